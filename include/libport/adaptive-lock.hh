@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/adaptive-lock.hh
+ ** \brief Definition of libport::AdaptiveLock and its variants.
+ */
+
+#ifndef LIBPORT_ADAPTIVE_LOCK_HH
+# define LIBPORT_ADAPTIVE_LOCK_HH
+
+# include <boost/noncopyable.hpp>
+
+# include <libport/detect-win32.h>
+# include <libport/export.hh>
+# include <libport/pthread.h>
+
+# if defined __linux__ && defined __GNUC__
+#  define LIBPORT_HAVE_FUTEX 1
+# endif
+
+namespace libport
+{
+
+  /*---------------.
+  | AdaptiveLock.  |
+  `---------------*/
+
+  /** A non-recursive mutex for short critical sections.
+   *
+   * Taking it when it is free costs a single compare-and-swap.  When it
+   * is held, the thread first spins for a while, adapting the duration
+   * to how long the previous waits lasted, and never on a single
+   * processor, then sleeps on a futex.  Without futexes, it relies on a
+   * plain, non-recursive, system mutex.
+   *
+   * Errors are not checked: relocking from the owner thread deadlocks.
+   */
+  class LIBPORT_API AdaptiveLock
+    : private boost::noncopyable
+  {
+  public:
+    AdaptiveLock();
+    ~AdaptiveLock();
+
+    void lock();
+    void unlock();
+    bool tryLock();
+
+    /// Number of times lock() had to wait, to spot hot locks.
+    size_t contentions() const;
+    void contentions_reset();
+
+  private:
+    /// Spin, then sleep until acquired.
+    void lock_slow_();
+# if defined LIBPORT_HAVE_FUTEX
+    /// Wake up a sleeper.
+    void unlock_slow_();
+    /// 0: free, 1: held, 2: held and maybe waited for.
+    volatile int state_;
+    /// Estimated number of spins before the lock is released.
+    int spins_;
+# elif defined WIN32
+    CRITICAL_SECTION lock_;
+# else
+    pthread_mutex_t lock_;
+# endif
+    long contentions_;
+  };
+
+
+  /*------------------------.
+  | RecursiveAdaptiveLock.  |
+  `------------------------*/
+
+  /// An AdaptiveLock which its owner may relock, for the locks held
+  /// while calling user callbacks.
+  class LIBPORT_API RecursiveAdaptiveLock
+    : private boost::noncopyable
+  {
+  public:
+    RecursiveAdaptiveLock();
+
+    void lock();
+    void unlock();
+    bool tryLock();
+
+    size_t contentions() const;
+    void contentions_reset();
+
+  private:
+    /// owner_, with acquire and release semantics.
+    pthread_t owner_get_() const;
+    void owner_set_(pthread_t owner);
+
+    AdaptiveLock lock_;
+    /// The thread holding lock_, pthread_t() if none.
+    volatile pthread_t owner_;
+    /// Number of times the owner locked us, only used by the owner.
+    unsigned depth_;
+  };
+
+
+  /*-----------------.
+  | AdaptiveRWLock.  |
+  `-----------------*/
+
+  /** A non-recursive reader-writer lock for short critical sections,
+   * spinning before sleeping like AdaptiveLock.
+   *
+   * It is not fair: a steady flow of readers starves the writers.
+   */
+  class LIBPORT_API AdaptiveRWLock
+    : private boost::noncopyable
+  {
+  public:
+    AdaptiveRWLock();
+    ~AdaptiveRWLock();
+
+    void readLock();
+    void readUnlock();
+    bool tryReadLock();
+
+    void writeLock();
+    void writeUnlock();
+    bool tryWriteLock();
+
+    /// Number of times readLock() or writeLock() had to wait.
+    size_t contentions() const;
+    void contentions_reset();
+
+  private:
+# if defined LIBPORT_HAVE_FUTEX
+    /// Wait until \a acquire succeeds.
+    void wait_(bool (AdaptiveRWLock::*acquire)());
+    /// Wake up the sleepers.
+    void wake_();
+    /// -1: held by a writer, otherwise the number of readers.
+    volatile int state_;
+    /// Number of sleeping threads.
+    volatile int sleepers_;
+    /// Bumped on each wake up, the sleepers wait on it.
+    volatile int sequence_;
+# elif defined WIN32
+    /// Readers are exclusive too.
+    AdaptiveLock lock_;
+# else
+    pthread_rwlock_t lock_;
+# endif
+    long contentions_;
+  };
+
+
+  /*---------------.
+  | Scoped locks.  |
+  `---------------*/
+
+  /// Hold a lock of type \a Lock during its lifetime.
+  template <typename Lock>
+  class ScopedLock
+    : private boost::noncopyable
+  {
+  public:
+    ScopedLock(Lock& l);
+    ~ScopedLock();
+
+  private:
+    Lock& lock_;
+  };
+
+  class ScopedReadLock
+    : private boost::noncopyable
+  {
+  public:
+    ScopedReadLock(AdaptiveRWLock& l);
+    ~ScopedReadLock();
+
+  private:
+    AdaptiveRWLock& lock_;
+  };
+
+  class ScopedWriteLock
+    : private boost::noncopyable
+  {
+  public:
+    ScopedWriteLock(AdaptiveRWLock& l);
+    ~ScopedWriteLock();
+
+  private:
+    AdaptiveRWLock& lock_;
+  };
+
+} // namespace libport
+
+# include <libport/adaptive-lock.hxx>
+
+#endif // !LIBPORT_ADAPTIVE_LOCK_HH
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef LIBPORT_ADAPTIVE_LOCK_HXX
+# define LIBPORT_ADAPTIVE_LOCK_HXX
+
+namespace libport
+{
+
+  /*---------------.
+  | AdaptiveLock.  |
+  `---------------*/
+
+  // Keep the uncontended paths inline, lock_slow_ does the rest.
+
+  inline
+  void
+  AdaptiveLock::lock()
+  {
+# if defined LIBPORT_HAVE_FUTEX
+    if (!__sync_bool_compare_and_swap(&state_, 0, 1))
+# elif defined WIN32
+    if (!TryEnterCriticalSection(&lock_))
+# else
+    if (pthread_mutex_trylock(&lock_))
+# endif
+      lock_slow_();
+  }
+
+  inline
+  void
+  AdaptiveLock::unlock()
+  {
+# if defined LIBPORT_HAVE_FUTEX
+    if (__sync_fetch_and_sub(&state_, 1) != 1)
+      unlock_slow_();
+# elif defined WIN32
+    LeaveCriticalSection(&lock_);
+# else
+    pthread_mutex_unlock(&lock_);
+# endif
+  }
+
+  inline
+  bool
+  AdaptiveLock::tryLock()
+  {
+# if defined LIBPORT_HAVE_FUTEX
+    return __sync_bool_compare_and_swap(&state_, 0, 1);
+# elif defined WIN32
+    return TryEnterCriticalSection(&lock_);
+# else
+    return !pthread_mutex_trylock(&lock_);
+# endif
+  }
+
+  inline
+  size_t
+  AdaptiveLock::contentions() const
+  {
+    return contentions_;
+  }
+
+  inline
+  void
+  AdaptiveLock::contentions_reset()
+  {
+    contentions_ = 0;
+  }
+
+
+  /*------------------------.
+  | RecursiveAdaptiveLock.  |
+  `------------------------*/
+
+  inline
+  RecursiveAdaptiveLock::RecursiveAdaptiveLock()
+    : owner_(pthread_t())
+    , depth_(0)
+  {}
+
+  // A thread sets owner_ to itself once it holds lock_, and resets it
+  // before releasing lock_, so owner_ is never a stale value of the
+  // reader: only the owner reads itself.  pthread_t() is neither a
+  // POSIX thread handle nor a Windows thread identifier.
+
+  inline
+  pthread_t
+  RecursiveAdaptiveLock::owner_get_() const
+  {
+# if defined __ATOMIC_ACQUIRE
+    return __atomic_load_n(&owner_, __ATOMIC_ACQUIRE);
+# else
+    // Volatile accesses are acquire and release with MSVC.
+    return owner_;
+# endif
+  }
+
+  inline
+  void
+  RecursiveAdaptiveLock::owner_set_(pthread_t owner)
+  {
+# if defined __ATOMIC_RELEASE
+    __atomic_store_n(&owner_, owner, __ATOMIC_RELEASE);
+# else
+    owner_ = owner;
+# endif
+  }
+
+  inline
+  void
+  RecursiveAdaptiveLock::lock()
+  {
+    pthread_t self = pthread_self();
+    if (pthread_equal(owner_get_(), self))
+    {
+      ++depth_;
+      return;
+    }
+    lock_.lock();
+    owner_set_(self);
+    depth_ = 1;
+  }
+
+  inline
+  void
+  RecursiveAdaptiveLock::unlock()
+  {
+    if (!--depth_)
+    {
+      owner_set_(pthread_t());
+      lock_.unlock();
+    }
+  }
+
+  inline
+  bool
+  RecursiveAdaptiveLock::tryLock()
+  {
+    pthread_t self = pthread_self();
+    if (pthread_equal(owner_get_(), self))
+    {
+      ++depth_;
+      return true;
+    }
+    if (!lock_.tryLock())
+      return false;
+    owner_set_(self);
+    depth_ = 1;
+    return true;
+  }
+
+  inline
+  size_t
+  RecursiveAdaptiveLock::contentions() const
+  {
+    return lock_.contentions();
+  }
+
+  inline
+  void
+  RecursiveAdaptiveLock::contentions_reset()
+  {
+    lock_.contentions_reset();
+  }
+
+
+  /*-----------------.
+  | AdaptiveRWLock.  |
+  `-----------------*/
+
+  inline
+  size_t
+  AdaptiveRWLock::contentions() const
+  {
+    return contentions_;
+  }
+
+  inline
+  void
+  AdaptiveRWLock::contentions_reset()
+  {
+    contentions_ = 0;
+  }
+
+
+  /*---------------.
+  | Scoped locks.  |
+  `---------------*/
+
+  template <typename Lock>
+  inline
+  ScopedLock<Lock>::ScopedLock(Lock& l)
+    : lock_(l)
+  {
+    lock_.lock();
+  }
+
+  template <typename Lock>
+  inline
+  ScopedLock<Lock>::~ScopedLock()
+  {
+    lock_.unlock();
+  }
+
+  inline
+  ScopedReadLock::ScopedReadLock(AdaptiveRWLock& l)
+    : lock_(l)
+  {
+    lock_.readLock();
+  }
+
+  inline
+  ScopedReadLock::~ScopedReadLock()
+  {
+    lock_.readUnlock();
+  }
+
+  inline
+  ScopedWriteLock::ScopedWriteLock(AdaptiveRWLock& l)
+    : lock_(l)
+  {
+    lock_.writeLock();
+  }
+
+  inline
+  ScopedWriteLock::~ScopedWriteLock()
+  {
+    lock_.writeUnlock();
+  }
+
+}
+
+#endif // !LIBPORT_ADAPTIVE_LOCK_HXX
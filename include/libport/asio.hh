@@ -38,13 +38,20 @@
 #  pragma GCC visibility pop
 # endif
 
+# include <deque>
+
 # include <boost/function.hpp>
+# include <boost/scoped_ptr.hpp>
+# include <boost/shared_ptr.hpp>
 
 # include <libport/system-warning-pop.hh>
 
+# include <libport/adaptive-lock.hh>
 # include <libport/destructible.hh>
 # include <libport/export.hh>
 # include <libport/finally.hh>
+# include <libport/ring-buffer.hh>
+# include <libport/socket-stats.hh>
 # include <libport/unistd.h>
 
 # include <boost/version.hpp>
@@ -60,6 +67,11 @@ namespace libport
   static const native_handle_type invalid_handle = -1;
 #endif
 
+  /// A buffer handed over to the write queue of a socket without a
+  /// copy.  The socket keeps a reference on it until it is written, so
+  /// it must not be modified once handed over.
+  typedef boost::shared_ptr<const std::string> SharedBuffer;
+
   //FIXME: extend to provide a way to ensure workerThread not started.
   /** Get the io_service handling all asynchronous operations.
    *
@@ -73,6 +85,26 @@ namespace libport
   /// Get the handle associated to io_service polling thread.
   LIBPORT_API pthread_t get_io_service_poll_thread();
 
+  /** Run at least \a size io_services, get_io_service() included, each
+   * in its own thread, 0 meaning one per processor.  Accepted sockets
+   * are given to them in turn.  The pool can only grow: call it at
+   * startup, before listening.
+   */
+  LIBPORT_API void set_io_service_pool_size(size_t size = 0);
+
+  /// Get the number of io_services of the pool, 1 if there is none.
+  LIBPORT_API size_t get_io_service_pool_size();
+
+  /** Get the next io_service of the pool, in turn, to spread sockets
+   * over the pool threads.  Return get_io_service() if there is no
+   * pool.
+   */
+  LIBPORT_API boost::asio::io_service& get_pooled_io_service();
+
+  /// Get the io_service number \a i of the pool, get_io_service() being
+  /// the first one.
+  LIBPORT_API boost::asio::io_service& get_pooled_io_service(size_t i);
+
 
   class LIBPORT_API AsioDestructible
     : public Destructible
@@ -94,6 +126,12 @@ namespace libport
    *
    * This class has a callback-based API: onReadFunc() and onErrorFunc().
    *
+   * Incompatible changes: received data is no longer copied, hence
+   * onReadFunc takes the receive buffer of the socket, a RingBuffer,
+   * instead of a boost::asio::streambuf; callbackLock is a
+   * RecursiveAdaptiveLock instead of a Lockable; and Socket no longer
+   * has a protected std::string buffer: use onReadv() instead.
+   *
    * Non-copyable (cannot derive from noncopyable again, done by
    * libport::Destructible).
    */
@@ -106,6 +144,9 @@ namespace libport
     libport::Finally deletor;
     /// Write data asynchronously to the socket.
     virtual void write(const void* data, size_t length) = 0;
+    /// Write \a data asynchronously, without copying it if possible.
+    /// By default, copy it.
+    virtual void write(const SharedBuffer& data);
     /// Alias on write() for API compatibility.
     void send(const void* addr, size_t len)
     {
@@ -134,18 +175,46 @@ namespace libport
     virtual std::string read(size_t length) = 0;
     // For internal use: start asynchronous reading task
     virtual void startReader() = 0;
+    /// For internal use: run the handlers in a strand instead of
+    /// locking, if supported.  Before startReader().
+    virtual void useStrand();
+    /// For internal use: close after \a timeout microseconds without
+    /// activity, 0 for never, if supported.
+    virtual void setIdleTimeout(useconds_t timeout);
 #if ! defined WIN32
     virtual native_handle_type stealFD() = 0;
 #endif
     virtual native_handle_type getFD() const = 0;
     virtual unsigned long bytesReceived() const = 0;
     virtual unsigned long bytesSent() const = 0;
-    /// Callback function called each time new data is available.
-    boost::function1<bool, boost::asio::streambuf&> onReadFunc;
+    /// The activity of this socket, empty if not measured.
+    virtual SocketStats getStats() const;
+    /// Called with the number of bytes of a file sent so far.
+    typedef boost::function1<void, size_t> onprogress_type;
+    /// Called once a file is sent, with the error if any and the
+    /// number of bytes sent.
+    typedef boost::function2<void, boost::system::error_code, size_t>
+      onsent_type;
+    /// For internal use: queue the transfer of \a fd, see
+    /// Socket::sendFile.  By default, not supported.
+    virtual boost::system::error_code
+    sendFile(native_handle_type fd, size_t offset, size_t length,
+             const onsent_type& onSent, const onprogress_type& onProgress);
+    /// Callback function called each time new data is available, in
+    /// place.  Consumed data must be consumed from the buffer.
+    boost::function1<bool, RingBuffer&> onReadFunc;
     /// Callback function called in case of error on the socket.
     boost::function1<void, boost::system::error_code> onErrorFunc;
+    /// Callback function called with true when the bytes waiting to be
+    /// written go above writeHighWater, and with false when they are
+    /// back to half of it.
+    boost::function1<void, bool> onWriteHighWaterFunc;
+    /// Number of bytes waiting to be written above which
+    /// onWriteHighWaterFunc is called, 0 for never.
+    size_t writeHighWater;
     /// Mutex to protect access to the above callbacks.
-    Lockable callbackLock;
+    /// Recursive: the callbacks may close the socket.
+    RecursiveAdaptiveLock callbackLock;
     /// If set, do not restart reader once callback returned.
     bool readOnce;
   };
@@ -195,6 +264,9 @@ namespace libport
     virtual void setBase(BaseSocket*);
 
     /** Called each time new data is received.
+     *   The data is not copied: it lies where it was received, and is
+     *   only valid during the call.  It is all the pending data,
+     *   followed by a NUL byte which is not part of it.
      *   \return the number of bytes used in buffer. The remaining data will
      *   be passed again to this function as soon as at least an extra byte
      *   is available.
@@ -204,6 +276,15 @@ namespace libport
       return length;
     }
 
+    /** Called each time new data is received, as at most two chunks
+     *  since the receive buffer is a ring.  Returning 0 while there are
+     *  two chunks makes the data contiguous, and calls again.
+     *
+     *  By default, call onRead() once the data is contiguous.
+     *   \return the number of bytes used, as onRead().
+     */
+    virtual size_t onReadv(const RingBuffer::const_buffers_type& data);
+
     /** Called in case of error on the socket. By default, do nothing.
      */
     virtual void onError(boost::system::error_code);
@@ -222,6 +303,12 @@ namespace libport
       CHECK;
       base_->write(data, length);
     }
+    /// Asynchronous write of a shared buffer, without copy.
+    void write(const SharedBuffer& data)
+    {
+      CHECK;
+      base_->write(data);
+    }
     /// Alias on write() for API compatibility.
     void send(const void* addr, size_t len)
     {
@@ -231,6 +318,51 @@ namespace libport
     {
       write(s.c_str(), s.length());
     }
+    void send(const SharedBuffer& data)
+    {
+      write(data);
+    }
+
+    typedef BaseSocket::onprogress_type onprogress_type;
+    typedef BaseSocket::onsent_type onsent_type;
+
+    /** Send \a length bytes of the file or pipe \a fd, 0 meaning up to
+     *  its end, after the data already written.  Regular files are
+     *  read from \a offset, without moving their file offset.
+     *
+     *  The data does not go through user space: sendfile and splice
+     *  are used on Linux.  \a onProgress is called with the number of
+     *  bytes sent so far as the transfer goes, and \a onSent once it
+     *  is over, from the io_service thread.  \a fd is not closed, and
+     *  must remain open until then.  Writes made meanwhile are sent
+     *  after the file.
+     *
+     *  Only supported on connected TCP sockets, without SSL.
+     *  \return operation_not_supported otherwise.
+     */
+    boost::system::error_code
+    sendFile(native_handle_type fd, size_t offset = 0, size_t length = 0,
+             const onsent_type& onSent = onsent_type(),
+             const onprogress_type& onProgress = onprogress_type());
+
+    /// Send the file \a path, and close it once done.
+    boost::system::error_code
+    sendFile(const std::string& path,
+             const onsent_type& onSent = onsent_type(),
+             const onprogress_type& onProgress = onprogress_type());
+
+    /** Throttle the writers: onWriteHighWater(true) is called when more
+     *  than \a bytes are waiting to be written, and
+     *  onWriteHighWater(false) when they are back to half of it.  0, the
+     *  default, disables it.
+     */
+    void setWriteHighWater(size_t bytes);
+
+    /** Called when the bytes waiting to be written cross the high-water
+     *  mark. By default, do nothing.
+     *  \param above  whether they went above it.
+     */
+    virtual void onWriteHighWater(bool above);
 
     void syncWrite(const void* data, size_t length);
     void syncWrite(const std::string& s);
@@ -258,6 +390,9 @@ namespace libport
     std::string getLocalHost() const     { CHECK;return base_->getLocalHost();}
     unsigned long bytesReceived() const  { CHECK;return base_->bytesReceived();}
     unsigned long bytesSent() const      { CHECK;return base_->bytesSent();}
+    /// Counters and histograms of the completions since the connection.
+    /// They are read without locking, so they may be slightly off.
+    SocketStats getStats() const         { CHECK;return base_->getStats();}
     bool isConnected() const             {return base_ && base_->isConnected();}
 
     /** Connect to a remote host.
@@ -349,6 +484,35 @@ namespace libport
               boost::system::error_code& erc,
               boost::asio::io_service& s = libport::get_io_service());
 
+    /// A datagram received by listenUDPBatch().
+    struct UDPDatagram
+    {
+      const void* data;
+      size_t length;
+      boost::shared_ptr<UDPLink> link;
+    };
+    typedef std::vector<UDPDatagram> udp_batch_type;
+
+    /// Type of onRead for listenUDPBatch().
+    typedef boost::function1<void, const udp_batch_type&> onreadbatch_type;
+
+    /** Listen using UDP, for high packet rates.
+     * Receive up to \a batchSize datagrams per system call (recvmmsg on
+     * Linux) in a preallocated buffer, and call onRead(batch) once for
+     * them.  Their data is valid during the call only, and datagrams
+     * larger than \a datagramSize are truncated.  The replies made
+     * during the call are sent together when it returns (sendmmsg on
+     * Linux).
+     * @return the local port that was bound.
+     */
+    static
+    unsigned short
+    listenUDPBatch(const std::string& host, const std::string& port,
+                   onreadbatch_type onRead,
+                   boost::system::error_code& erc,
+                   boost::asio::io_service& s = libport::get_io_service(),
+                   size_t batchSize = 64, size_t datagramSize = 2048);
+
     /// Close UDP socket listening on \b port.
     static bool closeUDP(unsigned short port);
 
@@ -403,8 +567,9 @@ namespace libport
     void setFD(native_handle_type fd, typename Sock::protocol_type proto);
     /// Set file descriptor from a native plain file descriptor
     void setNativeFD(native_handle_type fd);
-    /** Sleep for specified amount of time, polling if current thread is
-     * the asio worker thread
+    /** Sleep for specified amount of time, running the handlers if the
+     * current thread runs an io_service, until woken up by its
+     * TimerWheel.
      */
     static void sleep(useconds_t duration);
 
@@ -417,10 +582,48 @@ namespace libport
    /// Get current autoRead state.
    bool getAutoRead() const;
 
+   /** Set whether the handlers of this socket run in an asio strand.
+    * They are then serialized without locking callbackLock or the write
+    * queue, even if its io_service is run by several threads.  Writes
+    * from outside the handlers are posted to the strand, so writes of
+    * raw data are copied.  Default is off.  It can only be changed
+    * before connecting the Socket.
+    */
+   void setStrand(bool enable);
+   /// Get current strand state.
+   bool getStrand() const;
+
+   /** Close the connection, after calling onError(timed_out), when
+    * nothing was read nor written for \a timeout microseconds.  0, the
+    * default, disables it.  Sockets share the TimerWheel of their
+    * io_service, and the check may be late by an eighth of \a timeout.
+    */
+   void setIdleTimeout(useconds_t timeout);
+
+   /** Set the number of connections listen() accepts per readiness
+    * event.  Past the first one, the pending connections are accepted
+    * without waiting, so that a connection storm does not cost a
+    * completion per connection.  Default is 1.  It can only be changed
+    * before listening.
+    */
+   void setAcceptBatch(size_t size);
+   /// Get the number of connections accepted per readiness event.
+   size_t getAcceptBatch() const;
+
+   /** Set whether listen() opens one acceptor per io_service of the
+    * pool, bound to the same port with SO_REUSEPORT, so that the kernel
+    * spreads the connections over the pool threads and each connection
+    * stays on the thread which accepted it.  Default is off.  Ignored
+    * where SO_REUSEPORT is not available.  It can only be changed before
+    * listening.
+    */
+   void setReusePort(bool enable);
+   /// Get current SO_REUSEPORT state.
+   bool getReusePort() const;
+
   protected:
     virtual void doDestroy();
-    bool onRead_(boost::asio::streambuf&);
-    std::string buffer;
+    bool onRead_(RingBuffer&);
     BaseSocket* base_;
 
   private:
@@ -430,7 +633,14 @@ namespace libport
     template<typename Proto, typename BaseFactory> boost::system::error_code
     connectProto(const std::string& host, const std::string& port,
                  useconds_t timeout, bool async, BaseFactory bf);
+    /// Disconnect \a b from its Socket, in its strand if any.
+    static void resetCallbacks_(BaseSocket* b, DestructionLock l);
     bool autostart_reader_; //autoread state flag
+    bool strand_;
+    size_t writeHighWater_;
+    useconds_t idleTimeout_;
+    size_t acceptBatch_;
+    bool reusePort_;
   };
 #undef CHECK
   /** Wrapper of libport::Socket to be able to use Socket without inherit from
@@ -493,6 +703,8 @@ namespace libport
     onread_type onread_;
   };
 
+  /// Whether the current thread runs get_io_service() or an
+  /// io_service of the pool.
   LIBPORT_API bool
   isPollThread();
 
@@ -515,6 +727,19 @@ namespace libport
   asyncCall(boost::function0<void> callback, useconds_t usDelay,
             boost::asio::io_service& io = get_io_service());
 
+  /** Statistics of all the sockets, those destroyed included, since
+   *  the first one was created.
+   */
+  LIBPORT_API SocketStats get_socket_stats();
+
+  /** Measure, every \a period microseconds, how late \a io runs a
+   *  handler which is ready, in the backlog of get_socket_stats().
+   *  This keeps a timer pending on \a io for ever.
+   */
+  LIBPORT_API void
+  watch_io_service(boost::asio::io_service& io = get_io_service(),
+                   useconds_t period = 100000);
+
   /** Return a pair of connected sockets. First is read-only, second write-only.
    */
   LIBPORT_API void
@@ -36,22 +36,102 @@ namespace libport
       , protected libport::Lockable
     {
     public:
-      SocketImplBase(boost::asio::io_service& io)
-        : BaseSocket(io)
-        , current_(-1)
-        , pending_(false)
-      {}
-      /// Return ammount of data in write buffer
+      SocketImplBase(boost::asio::io_service& io);
+      ~SocketImplBase();
+      /// Return ammount of data waiting to be written, including the
+      /// write in progress.
       size_t getWriteBufferContentSize() const;
+      void useStrand();
+      void setIdleTimeout(useconds_t timeout);
+      SocketStats getStats() const;
+      /// A file being sent.
+      struct FileTransfer;
+      typedef boost::shared_ptr<FileTransfer> FileTransferPtr;
     protected:
-      /// Write double-buffer.
-      boost::asio::streambuf buffers_[2];
-      /// Read buffer.
-      boost::asio::streambuf readBuffer_;
-      /// Buffer id currently engaged in an async write, -1 for none
-      int current_;
-      /// Second buffer has data to write.
-      bool pending_;
+      typedef std::vector<SharedBuffer> buffers_type;
+
+      /// \name Write queue, under the lock of this.
+      /// \{
+      /// Queue a copy of \a data, appended to the last buffer if it is
+      /// ours.
+      /// \return  whether the queue went above the high-water mark.
+      bool enqueue_(const void* data, size_t length);
+      /// Queue \a data without copy.
+      /// \return  whether the queue went above the high-water mark.
+      bool enqueue_(const SharedBuffer& data);
+      /// If no write is in progress, make the queued buffers, up to the
+      /// next file if any, the one in progress, and add them to \a
+      /// buffers.
+      /// \return  whether there is something to write.
+      bool dequeue_(std::vector<boost::asio::const_buffer>& buffers);
+      /// The write in progress completed.
+      /// \return  whether the queue went back below the low-water mark.
+      bool written_();
+      /// The write in progress failed: drop its buffers.
+      /// \return  whether the queue went back below the low-water mark.
+      bool writeFailed_();
+      /// Account for a write completion of \a length bytes, queued at
+      /// \a since.
+      void wrote_(size_t length, utime_t since);
+      /// \}
+
+      /// \name File transfers, see Socket::sendFile.
+      /// \{
+      /// Queue the transfer \a f after the buffers, under the lock of
+      /// this.
+      void enqueue_(const FileTransferPtr& f);
+      /// Whether the next thing to write is a file, not yet started,
+      /// under the lock of this.
+      bool fileNext_() const;
+      /// The transfers waiting or in progress.  Each one has a null
+      /// buffer in queue_ to keep its place.
+      std::deque<FileTransferPtr> files_;
+      /// Whether files_.front() is being sent.
+      bool sendingFile_;
+      /// \}
+
+      /// \name Idle timeout.
+      /// \{
+      struct IdleTimer;
+      /// Check the activity in \a delay microseconds, under the lock
+      /// of this.
+      void armIdle_(useconds_t delay);
+      void checkIdle_(DestructionLock lock);
+      void cancelIdle_();
+      /// Under the lock of this.
+      boost::scoped_ptr<IdleTimer> idle_;
+      /// Date of the last read or write completion, under the lock of
+      /// this, even in a strand.
+      utime_t lastActivity_;
+      /// \}
+
+      /// Buffers waiting to be written.
+      buffers_type queue_;
+      /// Buffers of the write in progress, empty if none.
+      buffers_type writing_;
+      /// The last buffer of queue_ if we allocated it, 0 otherwise.
+      std::string* tail_;
+      /// Number of bytes in queue_ and writing_.
+      size_t queued_;
+      /// Whether the queue is above the high-water mark, and did not go
+      /// back below the low-water mark since.
+      bool aboveHighWater_;
+      /// The last value given to onWriteHighWaterFunc, under
+      /// callbackLock or in the strand.
+      bool notifiedHighWater_;
+      /// When the oldest buffer of queue_ was queued.
+      utime_t queuedSince_;
+      /// When the oldest buffer of writing_ was queued.
+      utime_t writingSince_;
+      /// Statistics, updated with the write queue and by the read
+      /// handler, under the lock of this, even in a strand.
+      SocketStats stats_;
+      utime_t created_;
+      /// Read buffer, filled in place.
+      RingBuffer readBuffer_;
+      /// Strand running the handlers if set, in which case neither
+      /// callbackLock nor this are locked.
+      boost::scoped_ptr<boost::asio::io_service::strand> strand_;
       friend class libport::Socket;
       template<class Stream> friend class SocketImpl;
     };
@@ -63,7 +143,13 @@ namespace libport
 
     inline size_t SocketImplBase::getWriteBufferContentSize() const
     {
-      return pending_ ? buffers_[1-current_].size() : 0;
+      return queued_;
+    }
+
+    inline void SocketImplBase::useStrand()
+    {
+      // On our own io_service, which may be one of the pool.
+      strand_.reset(new boost::asio::io_service::strand(io_));
     }
   }
 
@@ -123,6 +209,48 @@ namespace libport
     return autostart_reader_;
   }
 
+  inline void
+  Socket::setStrand(bool enable)
+  {
+    if (base_ && base_->isConnected())
+      throw std::runtime_error("Cannot change strand on a connected socket");
+    strand_ = enable;
+  }
+
+  inline bool
+  Socket::getStrand() const
+  {
+    return strand_;
+  }
+
+  inline void
+  Socket::setAcceptBatch(size_t size)
+  {
+    if (base_)
+      throw std::runtime_error("Cannot change accept batch once listening");
+    acceptBatch_ = std::max(size, size_t(1));
+  }
+
+  inline size_t
+  Socket::getAcceptBatch() const
+  {
+    return acceptBatch_;
+  }
+
+  inline void
+  Socket::setReusePort(bool enable)
+  {
+    if (base_)
+      throw std::runtime_error("Cannot change SO_REUSEPORT once listening");
+    reusePort_ = enable;
+  }
+
+  inline bool
+  Socket::getReusePort() const
+  {
+    return reusePort_;
+  }
+
   inline void
   Socket::readOnce()
   {
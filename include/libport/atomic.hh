@@ -8,6 +8,9 @@
  * See the LICENSE file for more information.
  */
 
+#ifndef LIBPORT_ATOMIC_HH
+# define LIBPORT_ATOMIC_HH
+
 #if defined(_MSC_VER)
 # include <Windows.h>
 # include <Winbase.h>
@@ -41,6 +44,7 @@ namespace libport
     }
 # endif
 #elif defined(__GNUC__)
+# define LIBPORT_HAVE_ATOMIC 1
     inline long increment_fetch(long* ptr)
     {
       return __sync_add_and_fetch(ptr, 1);
@@ -60,7 +64,21 @@ namespace libport
     {
       return __sync_fetch_and_sub(ptr, 1);
     }
+
+    /// Set *ptr to \a value if it is \a old, with a full barrier.
+    /// \return whether it was.
+    inline bool compare_and_swap(volatile long* ptr, long old, long value)
+    {
+      return __sync_bool_compare_and_swap(ptr, old, value);
+    }
+
+    /// Full memory barrier.
+    inline void barrier()
+    {
+      __sync_synchronize();
+    }
 #elif defined(_MSC_VER)
+# define LIBPORT_HAVE_ATOMIC 1
     inline long increment_fetch(long* ptr)
     {
       return InterlockedIncrement(ptr);
@@ -80,6 +98,18 @@ namespace libport
     {
       return decrement_fetch(ptr) + 1;
     }
+
+    inline bool compare_and_swap(volatile long* ptr, long old, long value)
+    {
+      return InterlockedCompareExchange(ptr, value, old) == old;
+    }
+
+    inline void barrier()
+    {
+      MemoryBarrier();
+    }
 #endif
   }
 }
+
+#endif // !LIBPORT_ATOMIC_HH
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/framed-socket.hh
+ ** \brief Definition of libport::FramedSocket and its framers.
+ */
+
+#ifndef LIBPORT_FRAMED_SOCKET_HH
+# define LIBPORT_FRAMED_SOCKET_HH
+
+# include <string>
+# include <vector>
+
+# include <boost/noncopyable.hpp>
+# include <boost/scoped_ptr.hpp>
+
+# include <libport/asio.hh>
+# include <libport/export.hh>
+
+namespace libport
+{
+
+  /// A frame received by a FramedSocket: a view on its payload, in
+  /// the receive buffer.
+  struct Frame
+  {
+    const char* data;
+    size_t length;
+  };
+
+  /// Cut a byte stream into frames, and wrap payloads into frames.
+  class LIBPORT_API Framer
+    : private boost::noncopyable
+  {
+  public:
+    virtual ~Framer();
+
+    /// Value of parse() for a malformed or oversized frame.
+    static const size_t invalid = size_t(-1);
+
+    /** Look for a frame at the beginning of \a data.
+     *  A framer belongs to a single socket, and may remember where it
+     *  stopped looking: \a data then starts with what was given to the
+     *  previous call, which returned 0.
+     *  \param frame  set to the payload, if the frame is complete.
+     *  \return the size of the whole frame, 0 if it is incomplete, or
+     *  invalid.
+     */
+    virtual size_t parse(const char* data, size_t length, Frame& frame) = 0;
+
+    /// Append to \a out a frame of payload \a data.
+    virtual void encode(const void* data, size_t length,
+                        std::string& out) const = 0;
+
+    /// Forget the state of parse(), if any.
+    virtual void reset();
+  };
+
+  /// Frames prefixed by their payload length, as a big-endian
+  /// integer of \a width bytes.
+  class LIBPORT_API LengthPrefixFramer: public Framer
+  {
+  public:
+    /// \param max  the largest payload accepted.
+    LengthPrefixFramer(size_t width = 4, size_t max = 16 << 20);
+
+    virtual size_t parse(const char* data, size_t length, Frame& frame);
+    virtual void encode(const void* data, size_t length,
+                        std::string& out) const;
+
+  private:
+    size_t width_;
+    size_t max_;
+  };
+
+  /// Frames ended by \a delimiter, which is not part of the payload.
+  class LIBPORT_API DelimiterFramer: public Framer
+  {
+  public:
+    /// \param max  the largest payload accepted.
+    DelimiterFramer(const std::string& delimiter = "\n",
+                    size_t max = 1 << 20);
+
+    virtual size_t parse(const char* data, size_t length, Frame& frame);
+    virtual void encode(const void* data, size_t length,
+                        std::string& out) const;
+    virtual void reset();
+
+  private:
+    std::string delimiter_;
+    size_t max_;
+    /// Bytes already searched for the delimiter.
+    size_t scanned_;
+  };
+
+  /// Frames of \a size bytes.
+  class LIBPORT_API FixedSizeFramer: public Framer
+  {
+  public:
+    FixedSizeFramer(size_t size);
+
+    virtual size_t parse(const char* data, size_t length, Frame& frame);
+    /// \a length must be the frame size.
+    virtual void encode(const void* data, size_t length,
+                        std::string& out) const;
+
+  private:
+    size_t size_;
+  };
+
+  /** A Socket which receives and sends frames rather than bytes.
+   *
+   *  Frames are parsed in place in the receive buffer, and all those
+   *  received at once are delivered together to onFrames().  A frame
+   *  that wraps around the end of the buffer is made contiguous first,
+   *  which is the only copy made.
+   *
+   *  An invalid frame calls onError(boost::asio::error::message_size)
+   *  and closes the socket.
+   */
+  class LIBPORT_API FramedSocket: public Socket
+  {
+  public:
+    typedef std::vector<Frame> frames_type;
+
+    /// Take the ownership of \a framer.
+    FramedSocket(Framer* framer,
+                 boost::asio::io_service& io = libport::get_io_service());
+
+    /** Called with the complete frames received, in order.  They are
+     *  only valid during the call.  By default, call onFrame() on each.
+     */
+    virtual void onFrames(const frames_type& frames);
+
+    /// Called for each frame received.  By default, do nothing.
+    virtual void onFrame(const Frame& frame);
+
+    /// Send \a data as one frame, with a single copy.  Frames sent
+    /// concurrently are not interleaved.
+    void sendFrame(const void* data, size_t length);
+    void sendFrame(const std::string& s);
+
+    Framer& framer_get();
+
+    virtual size_t onReadv(const RingBuffer::const_buffers_type& data);
+
+  private:
+    boost::scoped_ptr<Framer> framer_;
+    /// The frames being delivered, kept to reuse its storage.
+    frames_type frames_;
+  };
+
+} // namespace libport
+
+#endif // !LIBPORT_FRAMED_SOCKET_HH
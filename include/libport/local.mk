@@ -58,6 +58,8 @@ tr1_libport_include_HEADERS =                   \
 
 # C++ headers.
 libport_include_HEADERS +=                              \
+  include/libport/adaptive-lock.hh                      \
+  include/libport/adaptive-lock.hxx                     \
   include/libport/algorithm                             \
   include/libport/algorithm.hxx                         \
   include/libport/allocator-static.hh                   \
@@ -113,6 +115,7 @@ libport_include_HEADERS +=                              \
   include/libport/fnmatch.h                             \
   include/libport/fnmatch.hxx                           \
   include/libport/foreach.hh                            \
+  include/libport/framed-socket.hh                      \
   include/libport/fwd.hh                                \
   include/libport/hash.hh                               \
   include/libport/hierarchy.hh                          \
@@ -139,6 +142,8 @@ libport_include_HEADERS +=                              \
   include/libport/map.hxx                               \
   include/libport/markup-ostream.hh                     \
   include/libport/meta.hh                               \
+  include/libport/mpmc-queue.hh                         \
+  include/libport/mpmc-queue.hxx                        \
   include/libport/netdb.h                               \
   include/libport/network.h                             \
   include/libport/option-parser.hh                      \
@@ -146,6 +151,8 @@ libport_include_HEADERS +=                              \
   include/libport/package-info.hh                       \
   include/libport/pair.hh                               \
   include/libport/pair.hxx                              \
+  include/libport/parallel.hh                           \
+  include/libport/parallel.hxx                          \
   include/libport/path.hh                               \
   include/libport/path.hxx                              \
   include/libport/pid-file.hh                           \
@@ -161,6 +168,8 @@ libport_include_HEADERS +=                              \
   include/libport/ref-pt.hh                             \
   include/libport/reserved-vector.hh                    \
   include/libport/reserved-vector.hxx                   \
+  include/libport/ring-buffer.hh                        \
+  include/libport/ring-buffer.hxx                       \
   include/libport/safe-container.hh                     \
   include/libport/safe-container.hxx                    \
   include/libport/sched.hh                              \
@@ -173,6 +182,8 @@ libport_include_HEADERS +=                              \
   include/libport/separator.hh                          \
   include/libport/singleton-ptr.hh                      \
   include/libport/singleton-ptr.hxx                     \
+  include/libport/socket-stats.hh                       \
+  include/libport/socket-stats.hxx                      \
   include/libport/specific-ptr.hh                       \
   include/libport/specific-ptr.hxx                      \
   include/libport/sstream                               \
@@ -190,11 +201,13 @@ libport_include_HEADERS +=                              \
   include/libport/thread.hxx                            \
   include/libport/thread-data.hh                        \
   include/libport/thread-pool.hh                        \
+  include/libport/thread-pool.hxx                       \
   include/libport/throw-exception.hh                    \
   include/libport/time.hh                               \
   include/libport/time.hxx                              \
   include/libport/timer.hh                              \
   include/libport/timer.hxx                             \
+  include/libport/timer-wheel.hh                        \
   include/libport/tokenizer.hh                          \
   include/libport/traits.hh                             \
   include/libport/type-info.hh                          \
@@ -221,6 +234,8 @@ libport_include_HEADERS +=                              \
   include/libport/weak-ptr.hh                           \
   include/libport/weak-ptr.hxx                          \
   include/libport/windows.hh                            \
+  include/libport/work-deque.hh                         \
+  include/libport/work-deque.hxx                        \
   include/libport/xalloc.hh                             \
   include/libport/xalloc.hxx                            \
   include/libport/xlocale.hh                            \
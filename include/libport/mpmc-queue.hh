@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/mpmc-queue.hh
+ ** \brief Definition of libport::MPMCQueue.
+ */
+
+#ifndef LIBPORT_MPMC_QUEUE_HH
+# define LIBPORT_MPMC_QUEUE_HH
+
+# include <cstddef>
+
+# include <boost/noncopyable.hpp>
+
+# include <libport/atomic.hh>
+
+namespace libport
+{
+
+/*! A bounded lock-free FIFO of pointers, for many producers and many
+  consumers.
+
+  Each cell carries a sequence number telling whether it is free for
+  the producer of a given position, or full for its consumer, so that
+  producers and consumers only compete on their own index, with a
+  compare-and-swap.  Requires LIBPORT_HAVE_ATOMIC.
+*/
+  template <typename T>
+  class MPMCQueue
+    : private boost::noncopyable
+  {
+  public:
+    /// \a capacity must be a power of two.
+    MPMCQueue(size_t capacity = 4096);
+    ~MPMCQueue();
+
+    /// \return false if full.
+    bool push(T* t);
+    /// \return the oldest item, or 0 if empty.
+    T* pop();
+
+    /// Approximate number of items.
+    size_t size() const;
+
+  private:
+    struct Cell
+    {
+      volatile long sequence;
+      T* data;
+    };
+    Cell* cells_;
+    long mask_;
+    /// Keep producers and consumers on separate cache lines.
+    char pad0_[64];
+    volatile long push_;
+    char pad1_[64];
+    volatile long pop_;
+    char pad2_[64];
+  };
+
+} // namespace libport
+
+# include <libport/mpmc-queue.hxx>
+
+#endif // !LIBPORT_MPMC_QUEUE_HH
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/mpmc-queue.hxx
+ ** \brief Inline implementation of libport::MPMCQueue.
+ */
+
+#ifndef LIBPORT_MPMC_QUEUE_HXX
+# define LIBPORT_MPMC_QUEUE_HXX
+
+# include <libport/cassert>
+
+namespace libport
+{
+
+  template <typename T>
+  inline
+  MPMCQueue<T>::MPMCQueue(size_t capacity)
+    : cells_(new Cell[capacity])
+    , mask_(capacity - 1)
+    , push_(0)
+    , pop_(0)
+  {
+    aver(!(capacity & mask_));
+    for (size_t i = 0; i < capacity; ++i)
+      cells_[i].sequence = i;
+  }
+
+  template <typename T>
+  inline
+  MPMCQueue<T>::~MPMCQueue()
+  {
+    delete [] cells_;
+  }
+
+  template <typename T>
+  inline bool
+  MPMCQueue<T>::push(T* t)
+  {
+    long pos = push_;
+    Cell* c;
+    while (true)
+    {
+      c = &cells_[pos & mask_];
+      long dif = c->sequence - pos;
+      if (!dif)
+      {
+        if (atomic::compare_and_swap(&push_, pos, pos + 1))
+          break;
+        pos = push_;
+      }
+      else if (dif < 0)
+        // Not yet consumed since the previous round: full.
+        return false;
+      else
+        pos = push_;
+    }
+    c->data = t;
+    // Publish the data before the sequence.
+    atomic::barrier();
+    c->sequence = pos + 1;
+    return true;
+  }
+
+  template <typename T>
+  inline T*
+  MPMCQueue<T>::pop()
+  {
+    long pos = pop_;
+    Cell* c;
+    while (true)
+    {
+      c = &cells_[pos & mask_];
+      long dif = c->sequence - (pos + 1);
+      if (!dif)
+      {
+        if (atomic::compare_and_swap(&pop_, pos, pos + 1))
+          break;
+        pos = pop_;
+      }
+      else if (dif < 0)
+        // Not yet produced: empty.
+        return 0;
+      else
+        pos = pop_;
+    }
+    T* res = c->data;
+    // Read the data before freeing the cell.
+    atomic::barrier();
+    c->sequence = pos + mask_ + 1;
+    return res;
+  }
+
+  template <typename T>
+  inline size_t
+  MPMCQueue<T>::size() const
+  {
+    long res = push_ - pop_;
+    return res < 0 ? 0 : res;
+  }
+
+} // namespace libport
+
+#endif // !LIBPORT_MPMC_QUEUE_HXX
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/parallel.hh
+ ** \brief Parallel algorithms running on a libport::ThreadPool.
+ */
+
+#ifndef LIBPORT_PARALLEL_HH
+# define LIBPORT_PARALLEL_HH
+
+# include <functional>
+
+# include <boost/function.hpp>
+
+# include <libport/export.hh>
+# include <libport/thread-pool.hh>
+
+namespace libport
+{
+  /** Chunked parallel versions of some standard algorithms.
+   *
+   * The range is cut in chunks of \a grain items, which are run by
+   * the pool and by the calling thread: calling them from within a task
+   * of the same pool is fine, and they complete even if the pool is
+   * busy.  If \a grain is 0, it is chosen so that each thread of the
+   * pool gets a few chunks of at least min_grain items.  A range that
+   * fits in a single chunk is processed sequentially, by the caller.
+   *
+   * Iterators must be random access.  If some chunks throw, the others
+   * are skipped and one of the exceptions is rethrown.
+   */
+  namespace parallel
+  {
+    /// Minimum number of items per chunk when the grain is automatic.
+    static const size_t min_grain = 512;
+
+    /// Process [begin, end).
+    typedef boost::function2<void, size_t, size_t> Chunk;
+
+    /// The number of items per chunk to process \a n items.
+    /// \return \a grain if not 0.
+    LIBPORT_API
+    size_t grain_size(const ThreadPool& pool, size_t n, size_t grain);
+
+    /// Run \a chunk on [0, n), cut in chunks of \a grain items.
+    LIBPORT_API
+    void run(ThreadPool& pool, size_t n, size_t grain, const Chunk& chunk);
+
+    /// Apply \a f to each item of [first, last).
+    template <typename It, typename F>
+    void
+    for_each(ThreadPool& pool, It first, It last, F f, size_t grain = 0);
+
+    /// Store \a f of each item of [first, last) from \a out.
+    template <typename It, typename Out, typename F>
+    Out
+    transform(ThreadPool& pool, It first, It last, Out out, F f,
+              size_t grain = 0);
+
+    /// Fold [first, last) with \a op from \a init.
+    /// \a op must be associative, not necessarily commutative.
+    template <typename It, typename T, typename Op>
+    T
+    reduce(ThreadPool& pool, It first, It last, T init, Op op,
+           size_t grain = 0);
+
+    /// Sum of [first, last) and \a init.
+    template <typename It, typename T>
+    T
+    reduce(ThreadPool& pool, It first, It last, T init);
+
+    /// Sort [first, last) with \a comp: sort the chunks, then merge
+    /// them by pairs.  Not stable.
+    template <typename It, typename Comp>
+    void
+    sort(ThreadPool& pool, It first, It last, Comp comp, size_t grain = 0);
+
+    template <typename It>
+    void
+    sort(ThreadPool& pool, It first, It last);
+  }
+}
+
+# include <libport/parallel.hxx>
+
+#endif // !LIBPORT_PARALLEL_HH
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef LIBPORT_PARALLEL_HXX
+# define LIBPORT_PARALLEL_HXX
+
+# include <algorithm>
+# include <iterator>
+# include <vector>
+
+# include <boost/optional.hpp>
+
+# include <libport/foreach.hh>
+
+namespace libport
+{
+  namespace parallel
+  {
+    namespace detail
+    {
+      template <typename It, typename F>
+      struct ForEach
+      {
+        ForEach(It first, F f)
+          : first(first)
+          , f(f)
+        {}
+
+        void operator()(size_t begin, size_t end) const
+        {
+          std::for_each(first + begin, first + end, f);
+        }
+
+        It first;
+        F f;
+      };
+
+      template <typename It, typename Out, typename F>
+      struct Transform
+      {
+        Transform(It first, Out out, F f)
+          : first(first)
+          , out(out)
+          , f(f)
+        {}
+
+        void operator()(size_t begin, size_t end) const
+        {
+          std::transform(first + begin, first + end, out + begin, f);
+        }
+
+        It first;
+        Out out;
+        F f;
+      };
+
+      template <typename It, typename T, typename Op>
+      struct Reduce
+      {
+        Reduce(It first, Op op, size_t grain,
+               std::vector<boost::optional<T> >& partials)
+          : first(first)
+          , op(op)
+          , grain(grain)
+          , partials(partials)
+        {}
+
+        void operator()(size_t begin, size_t end) const
+        {
+          T res = first[begin];
+          for (size_t i = begin + 1; i < end; ++i)
+            res = op(res, first[i]);
+          partials[begin / grain] = res;
+        }
+
+        It first;
+        Op op;
+        size_t grain;
+        std::vector<boost::optional<T> >& partials;
+      };
+
+      template <typename It, typename Comp>
+      struct Sort
+      {
+        Sort(It first, Comp comp)
+          : first(first)
+          , comp(comp)
+        {}
+
+        void operator()(size_t begin, size_t end) const
+        {
+          std::sort(first + begin, first + end, comp);
+        }
+
+        It first;
+        Comp comp;
+      };
+
+      /// Merge the sorted halves of width \a width.
+      template <typename It, typename Comp>
+      struct Merge
+      {
+        Merge(It first, Comp comp, size_t width)
+          : first(first)
+          , comp(comp)
+          , width(width)
+        {}
+
+        void operator()(size_t begin, size_t end) const
+        {
+          size_t middle = std::min(begin + width, end);
+          if (middle < end)
+            std::inplace_merge(first + begin, first + middle, first + end,
+                               comp);
+        }
+
+        It first;
+        Comp comp;
+        size_t width;
+      };
+    }
+
+    template <typename It, typename F>
+    inline
+    void
+    for_each(ThreadPool& pool, It first, It last, F f, size_t grain)
+    {
+      run(pool, last - first, grain, detail::ForEach<It, F>(first, f));
+    }
+
+    template <typename It, typename Out, typename F>
+    inline
+    Out
+    transform(ThreadPool& pool, It first, It last, Out out, F f,
+              size_t grain)
+    {
+      run(pool, last - first, grain,
+          detail::Transform<It, Out, F>(first, out, f));
+      return out + (last - first);
+    }
+
+    template <typename It, typename T, typename Op>
+    inline
+    T
+    reduce(ThreadPool& pool, It first, It last, T init, Op op, size_t grain)
+    {
+      size_t n = last - first;
+      grain = grain_size(pool, n, grain);
+      std::vector<boost::optional<T> > partials((n + grain - 1) / grain);
+      run(pool, n, grain,
+          detail::Reduce<It, T, Op>(first, op, grain, partials));
+      // Combine in order, op needs not be commutative.
+      foreach (const boost::optional<T>& p, partials)
+        init = op(init, p.get());
+      return init;
+    }
+
+    template <typename It, typename T>
+    inline
+    T
+    reduce(ThreadPool& pool, It first, It last, T init)
+    {
+      return reduce(pool, first, last, init, std::plus<T>());
+    }
+
+    template <typename It, typename Comp>
+    inline
+    void
+    sort(ThreadPool& pool, It first, It last, Comp comp, size_t grain)
+    {
+      size_t n = last - first;
+      grain = grain_size(pool, n, grain);
+      run(pool, n, grain, detail::Sort<It, Comp>(first, comp));
+      for (size_t width = grain; width < n; width *= 2)
+        run(pool, n, 2 * width,
+            detail::Merge<It, Comp>(first, comp, width));
+    }
+
+    template <typename It>
+    inline
+    void
+    sort(ThreadPool& pool, It first, It last)
+    {
+      sort(pool, first, last,
+           std::less<typename std::iterator_traits<It>::value_type>());
+    }
+  }
+}
+
+#endif // !LIBPORT_PARALLEL_HXX
@@ -38,6 +38,8 @@ int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize);
 
 pthread_t pthread_self() throw ();
 
+int pthread_equal(pthread_t t1, pthread_t t2);
+
 int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
 		   void *(*start_routine) (void *), void *arg);
 
@@ -45,6 +45,12 @@ pthread_self() throw ()
   return GetCurrentThreadId();
 }
 
+inline int
+pthread_equal(pthread_t t1, pthread_t t2)
+{
+  return t1 == t2;
+}
+
 inline int
 pthread_create(pthread_t *thread, const pthread_attr_t *attr,
 	       void *(*start_routine) (void *), void *arg)
@@ -12,6 +12,16 @@
 # define LIBPORT_REF_COUNTED_HH
 
 # include <boost/noncopyable.hpp>
+// Not with MSVC, not to include Windows.h everywhere.  Whether
+// ThreadSafeRefCounted is atomic must not depend on whether the
+// translation unit included <libport/atomic.hh> before, hence
+// LIBPORT_REF_COUNTED_ATOMIC rather than LIBPORT_HAVE_ATOMIC.
+# if !defined _MSC_VER
+#  include <libport/atomic.hh>
+#  if defined LIBPORT_HAVE_ATOMIC
+#   define LIBPORT_REF_COUNTED_ATOMIC 1
+#  endif
+# endif
 # include <libport/lockable.hh>
 
 namespace libport
@@ -45,15 +55,26 @@ namespace libport
       mutable count_type count_;
   };
 
+  /// A RefCounted whose references may be taken and released from
+  /// several threads: its counter is atomic where supported, locked
+  /// otherwise.
   class ThreadSafeRefCounted: RefCounted
   {
   public:
+# if defined LIBPORT_REF_COUNTED_ATOMIC
+    ThreadSafeRefCounted();
+# endif
     void counter_inc () const;
     bool counter_dec () const;
     count_type counter_get() const;
   protected:
     void counter_reset() const;
+# if defined LIBPORT_REF_COUNTED_ATOMIC
+  private:
+    mutable long count_;
+# else
     mutable libport::Lockable lock_;
+# endif
   };
 }
 
@@ -87,6 +87,39 @@ namespace libport
     ref_counted_.count_--;
   }
 
+# if defined LIBPORT_REF_COUNTED_ATOMIC
+
+  inline
+  ThreadSafeRefCounted::ThreadSafeRefCounted()
+    : count_(0)
+  {}
+
+  inline void
+  ThreadSafeRefCounted::counter_inc() const
+  {
+    libport::atomic::increment_fetch(&count_);
+  }
+
+  inline bool
+  ThreadSafeRefCounted::counter_dec() const
+  {
+    return !libport::atomic::decrement_fetch(&count_);
+  }
+
+  inline RefCounted::count_type
+  ThreadSafeRefCounted::counter_get() const
+  {
+    return count_;
+  }
+
+  inline void
+  ThreadSafeRefCounted::counter_reset() const
+  {
+    count_ = 1;
+  }
+
+# else
+
   inline void
   ThreadSafeRefCounted::counter_inc() const
   {
@@ -111,6 +144,8 @@ namespace libport
     libport::BlockLock bl(lock_);
     RefCounted::counter_reset();
   }
+
+# endif
 }
 
 #endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/ring-buffer.hh
+ ** \brief Definition of libport::RingBuffer.
+ */
+
+#ifndef LIBPORT_RING_BUFFER_HH
+# define LIBPORT_RING_BUFFER_HH
+
+# include <string>
+# include <vector>
+
+# include <boost/array.hpp>
+# include <boost/asio/buffer.hpp>
+
+namespace libport
+{
+
+/*! RingBuffer is a byte queue filled in place, typically by the kernel.
+
+  +-------------------------------------------------+
+  | X X X X . . . . . . . . . . . . . X X X X X X X |
+  +---------^-----------------------^---------------+
+            |                       |
+            |                       +--- first byte
+            |
+            +--- next position to write
+
+  Free space is exposed through prepare() as at most two chunks, to be
+  filled with a scatter read (readv) and accounted with commit().  The
+  data is exposed through data() as at most two chunks too, and
+  consume() only moves the position of the first byte forward: data is
+  never moved, but when the buffer grows or when linearize() is asked
+  to make it contiguous.
+
+  When the buffer is emptied, positions are reset to the beginning, so
+  that data is less likely to wrap around.
+
+  Unless it wraps around, the data is followed by a NUL byte, which is
+  not part of it, for the parsers which rely on it.  The storage has an
+  extra byte for the case where the data ends with it.
+*/
+
+  class RingBuffer
+  {
+  public:
+    typedef boost::array<boost::asio::const_buffer, 2> const_buffers_type;
+    typedef boost::array<boost::asio::mutable_buffer, 2> mutable_buffers_type;
+
+    /// Create a buffer of \a capacity bytes.  It grows as needed.
+    RingBuffer(size_t capacity = 4096);
+
+    /// Number of bytes stored.
+    size_t size() const;
+    bool empty() const;
+    size_t capacity() const;
+
+    /// The data, as at most two chunks, the second one being empty
+    /// unless data wraps around.  Valid until the next non-const call.
+    const_buffers_type data() const;
+
+    /// Make room for at least \a n bytes, and return all the free
+    /// space as at most two chunks.
+    mutable_buffers_type prepare(size_t n);
+
+    /// Account for \a n bytes written at the beginning of prepare().
+    void commit(size_t n);
+
+    /// Forget the first \a n bytes.
+    void consume(size_t n);
+
+    /// Make the data contiguous, and return its first byte.
+    const char* linearize();
+
+    /// Copy \a length bytes at the end.
+    void write(const void* data, size_t length);
+
+    /// Copy out and consume at most \a length bytes.
+    /// \return  The number of bytes copied.
+    size_t read(void* data, size_t length);
+
+    /// Forget everything.
+    void clear();
+
+  private:
+    /// Reallocate to \a capacity bytes, with the data at the beginning.
+    void reallocate_(size_t capacity);
+    /// Put a NUL byte after the data, if it does not wrap around.
+    void terminate_();
+
+    /// The ring, and the final NUL byte.
+    std::vector<char> buffer_;
+    /// Position of the first byte.
+    size_t begin_;
+    /// Number of bytes stored.
+    size_t size_;
+  };
+
+} // namespace libport
+
+# include <libport/ring-buffer.hxx>
+
+#endif // !LIBPORT_RING_BUFFER_HH
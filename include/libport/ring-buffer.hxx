@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/ring-buffer.hxx
+ ** \brief Inline implementation of libport::RingBuffer.
+ */
+
+#ifndef LIBPORT_RING_BUFFER_HXX
+# define LIBPORT_RING_BUFFER_HXX
+
+# include <algorithm>
+
+# include <libport/cassert>
+# include <libport/cstring>
+
+namespace libport
+{
+
+  inline
+  RingBuffer::RingBuffer(size_t capacity)
+    : buffer_(std::max(capacity, size_t(1)) + 1)
+    , begin_(0)
+    , size_(0)
+  {
+  }
+
+  inline size_t
+  RingBuffer::size() const
+  {
+    return size_;
+  }
+
+  inline bool
+  RingBuffer::empty() const
+  {
+    return !size_;
+  }
+
+  inline size_t
+  RingBuffer::capacity() const
+  {
+    return buffer_.size() - 1;
+  }
+
+  inline RingBuffer::const_buffers_type
+  RingBuffer::data() const
+  {
+    const char* base = &buffer_[0];
+    size_t first = std::min(size_, capacity() - begin_);
+    const_buffers_type res =
+    {{
+      boost::asio::const_buffer(base + begin_, first),
+      boost::asio::const_buffer(base, size_ - first),
+    }};
+    return res;
+  }
+
+  inline RingBuffer::mutable_buffers_type
+  RingBuffer::prepare(size_t n)
+  {
+    if (capacity() - size_ < n)
+      reallocate_(std::max(2 * capacity(), size_ + n));
+    char* base = &buffer_[0];
+    size_t end = begin_ + size_;
+    if (end < capacity())
+    {
+      mutable_buffers_type res =
+      {{
+        boost::asio::mutable_buffer(base + end, capacity() - end),
+        boost::asio::mutable_buffer(base, begin_),
+      }};
+      return res;
+    }
+    else
+    {
+      end -= capacity();
+      mutable_buffers_type res =
+      {{
+        boost::asio::mutable_buffer(base + end, begin_ - end),
+        boost::asio::mutable_buffer(base, 0),
+      }};
+      return res;
+    }
+  }
+
+  inline void
+  RingBuffer::commit(size_t n)
+  {
+    aver(size_ + n <= capacity());
+    size_ += n;
+    terminate_();
+  }
+
+  inline void
+  RingBuffer::consume(size_t n)
+  {
+    aver(n <= size_);
+    size_ -= n;
+    if (size_)
+      begin_ = (begin_ + n) % capacity();
+    else
+      begin_ = 0;
+    terminate_();
+  }
+
+  inline const char*
+  RingBuffer::linearize()
+  {
+    if (capacity() < begin_ + size_)
+      reallocate_(capacity());
+    return &buffer_[begin_];
+  }
+
+  inline void
+  RingBuffer::write(const void* data, size_t length)
+  {
+    mutable_buffers_type free = prepare(length);
+    const char* p = static_cast<const char*>(data);
+    size_t first = std::min(length, boost::asio::buffer_size(free[0]));
+    memcpy(boost::asio::buffer_cast<char*>(free[0]), p, first);
+    memcpy(boost::asio::buffer_cast<char*>(free[1]), p + first,
+           length - first);
+    commit(length);
+  }
+
+  inline size_t
+  RingBuffer::read(void* data, size_t length)
+  {
+    length = std::min(length, size_);
+    const_buffers_type chunks = this->data();
+    char* p = static_cast<char*>(data);
+    size_t first = std::min(length, boost::asio::buffer_size(chunks[0]));
+    memcpy(p, boost::asio::buffer_cast<const char*>(chunks[0]), first);
+    memcpy(p + first, boost::asio::buffer_cast<const char*>(chunks[1]),
+           length - first);
+    consume(length);
+    return length;
+  }
+
+  inline void
+  RingBuffer::clear()
+  {
+    begin_ = size_ = 0;
+    terminate_();
+  }
+
+  inline void
+  RingBuffer::reallocate_(size_t capacity)
+  {
+    aver(size_ <= capacity);
+    std::vector<char> buffer(capacity + 1);
+    size_t size = read(&buffer[0], size_);
+    buffer_.swap(buffer);
+    begin_ = 0;
+    size_ = size;
+    terminate_();
+  }
+
+  inline void
+  RingBuffer::terminate_()
+  {
+    if (begin_ + size_ <= capacity())
+      buffer_[begin_ + size_] = 0;
+  }
+
+} // namespace libport
+
+#endif // !LIBPORT_RING_BUFFER_HXX
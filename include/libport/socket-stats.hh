@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/socket-stats.hh
+ ** \brief Definition of libport::Log2Histogram and libport::SocketStats.
+ */
+
+#ifndef LIBPORT_SOCKET_STATS_HH
+# define LIBPORT_SOCKET_STATS_HH
+
+# include <iosfwd>
+
+# include <libport/export.hh>
+# include <libport/utime.hh>
+
+namespace libport
+{
+
+  /// A histogram with power-of-two buckets: constant size, and
+  /// constant and cheap cost per sample.
+  class LIBPORT_API Log2Histogram
+  {
+  public:
+    typedef unsigned long long value_type;
+    /// Bucket 0 counts the 0s, and bucket i the values in
+    /// [2^(i-1), 2^i).  The last one counts the larger values too.
+    enum { buckets = 33 };
+
+    Log2Histogram();
+
+    void add(value_type value);
+    Log2Histogram& operator+=(const Log2Histogram& h);
+
+    /// Number of samples.
+    value_type count() const;
+    value_type sum() const;
+    value_type max() const;
+    double mean() const;
+    /// An upper bound of the \a q quantile, 0 <= q <= 1: the upper
+    /// bound of its bucket.
+    value_type quantile(double q) const;
+    /// Number of samples in bucket \a i.
+    value_type bucket(size_t i) const;
+
+  private:
+    static size_t index_(value_type value);
+
+    value_type buckets_[buckets];
+    value_type count_;
+    value_type sum_;
+    value_type max_;
+  };
+
+  /// Print the count, mean, median, 99th percentile and maximum.
+  LIBPORT_API std::ostream&
+  operator<<(std::ostream& o, const Log2Histogram& h);
+
+  /// Activity of a Socket, or of all of them (get_socket_stats()).
+  struct LIBPORT_API SocketStats
+  {
+    SocketStats();
+
+    /// Time covered, in microseconds.
+    utime_t duration;
+
+    /// Read completions.
+    Log2Histogram::value_type reads;
+    Log2Histogram::value_type readBytes;
+    /// Bytes per read completion.
+    Log2Histogram readSize;
+    /// Time spent in the read handler (onRead), in microseconds.
+    Log2Histogram handlerTime;
+
+    /// Write completions.
+    Log2Histogram::value_type writes;
+    Log2Histogram::value_type writeBytes;
+    /// Bytes per write completion.
+    Log2Histogram writeSize;
+    /// Bytes waiting to be written, after each write request.
+    Log2Histogram queueDepth;
+    /// For each write completion, the time its oldest data waited
+    /// since it was queued, in microseconds.
+    Log2Histogram queueTime;
+
+    /// Delay before the io_services run a ready handler, in
+    /// microseconds, if watched (watch_io_service()).  Only in the
+    /// global statistics.
+    Log2Histogram backlog;
+
+    /// Add the samples of \a s; the duration is the longest.
+    SocketStats& operator+=(const SocketStats& s);
+
+    /// Completions per second.
+    double readRate() const;
+    double writeRate() const;
+
+    /// Print as a table, one line per measure.
+    std::ostream& dump(std::ostream& o) const;
+  };
+
+  LIBPORT_API std::ostream&
+  operator<<(std::ostream& o, const SocketStats& s);
+
+} // namespace libport
+
+# include <libport/socket-stats.hxx>
+
+#endif // !LIBPORT_SOCKET_STATS_HH
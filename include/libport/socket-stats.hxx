@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/socket-stats.hxx
+ ** \brief Inline implementation of libport::Log2Histogram.
+ */
+
+#ifndef LIBPORT_SOCKET_STATS_HXX
+# define LIBPORT_SOCKET_STATS_HXX
+
+namespace libport
+{
+
+  inline size_t
+  Log2Histogram::index_(value_type value)
+  {
+# if defined __GNUC__
+    size_t res = value ? 64 - __builtin_clzll(value) : 0;
+# else
+    size_t res = 0;
+    for (; value; value >>= 1)
+      ++res;
+# endif
+    return res < size_t(buckets) ? res : buckets - 1;
+  }
+
+  inline void
+  Log2Histogram::add(value_type value)
+  {
+    ++buckets_[index_(value)];
+    ++count_;
+    sum_ += value;
+    if (max_ < value)
+      max_ = value;
+  }
+
+  inline Log2Histogram::value_type
+  Log2Histogram::count() const
+  {
+    return count_;
+  }
+
+  inline Log2Histogram::value_type
+  Log2Histogram::sum() const
+  {
+    return sum_;
+  }
+
+  inline Log2Histogram::value_type
+  Log2Histogram::max() const
+  {
+    return max_;
+  }
+
+  inline double
+  Log2Histogram::mean() const
+  {
+    return count_ ? double(sum_) / count_ : 0;
+  }
+
+  inline Log2Histogram::value_type
+  Log2Histogram::bucket(size_t i) const
+  {
+    return buckets_[i];
+  }
+
+} // namespace libport
+
+#endif // !LIBPORT_SOCKET_STATS_HXX
@@ -12,26 +12,44 @@
 # define LIBPORT_THREAD_POOL_HH
 
 # include <list>
+# include <vector>
 
+# include <boost/exception_ptr.hpp>
 # include <boost/function.hpp>
 
+# include <libport/adaptive-lock.hh>
+# include <libport/atomic.hh>
+# include <libport/condition.hh>
+# include <libport/exception.hh>
 # include <libport/export.hh>
+# include <libport/foreach.hh>
 # include <libport/intrusive-ptr.hh>
 # include <libport/lockable.hh>
 # include <libport/ref-counted.hh>
 # include <libport/semaphore.hh>
+# include <libport/utime.hh>
 
 namespace libport
 {
+  template <typename T> class MPMCQueue;
+  template <typename T> class UnmanagedThreadSpecificPtr;
+
   /** Simple ThreadPool implementation.
    * This is a shared-queue ThreadPool implementation with support for
    * 'locks' that prevents tasks sharing the same lock from executing in
    * parallel.
+   *
+   * In work-stealing mode, a fixed set of workers each own a deque:
+   * tasks queued from a worker go to its own deque, other tasks to a
+   * shared lock-free queue, and idle workers steal from the others.
+   * Tasks with a TaskLock are still serialized the same way.
    */
   class LIBPORT_API ThreadPool
   {
   public:
     typedef boost::function0<void> TaskFunc;
+    /// Called with the reason when a task is dropped instead of run.
+    typedef boost::function1<void, const char*> DropFunc;
     class TaskLock;
     class TaskHandle;
   private:
@@ -47,6 +65,8 @@ namespace libport
     public:
       TaskFunc taskFunc;
       rTaskLock taskLock;
+      /// Called if the task is dropped, may be empty.
+      DropFunc onDrop;
       // State is only modified by handler thread: not locked.
       enum State
       {
@@ -81,26 +101,85 @@ namespace libport
       unsigned int maxSize;
     };
 
-    /// Create a new thread pool that can grow up to \b maxThreads threads.
-    ThreadPool(size_t maxThreads = 0);
+    /** Create a new thread pool that can grow up to \b maxThreads threads.
+     *  @param workStealing start \b maxThreads workers at once, one per
+     *    processor if 0, and use the work-stealing mode.  Ignored without
+     *    LIBPORT_HAVE_ATOMIC.
+     */
+    ThreadPool(size_t maxThreads = 0, bool workStealing = false);
+
+    /// Stop the work-stealing workers, dropping the remaining tasks,
+    /// including those waiting for their TaskLock.  In the other mode,
+    /// neither the threads nor the queued tasks are waited for: the
+    /// pool must outlive them.
+    ~ThreadPool();
 
-    /// Set maximum number of threads in pool
+    /// Set maximum number of threads in pool.
+    /// No effect in work-stealing mode.
     void resize(size_t maxThreads);
 
     /** Queue a new task.
     *  @param func the function to execute when the task is scheduled.
     *  @param lock inter-task lock: no two tasks with the same lock will be
     *    allowed to run at the same time.
+    *  @param onDrop called, not under the lock of the pool, if the task
+    *    is dropped because of \b lock or, in work-stealing mode, because
+    *    the pool is destroyed.
     */
     rTaskHandle queueTask(TaskFunc func,
-                          rTaskLock lock = 0);
+                          rTaskLock lock = 0,
+                          DropFunc onDrop = DropFunc());
 
     /// Return number of tasks in queue.
+    /// Approximate in work-stealing mode.
     size_t queueSize();
 
+    /// Whether in work-stealing mode.
+    bool workStealing() const;
+
+    /// Number of tasks that may run in parallel: the number of workers,
+    /// or the maximum number of threads, or of processors if unbounded.
+    size_t concurrency() const;
+
+    /// Number of times the pool lock had to be waited for.
+    size_t contentions() const;
+
+    /*----------.
+    | Futures.  |
+    `----------*/
+
+    class FutureBase;
+    typedef libport::intrusive_ptr<FutureBase> rFutureBase;
+    template <typename T> class FutureState;
+    template <typename T> class Future;
+
+    /** Queue a new task, whose result or exception is available through
+    *  the returned future.  Call as queueTask<T>(func), T may be void.
+    *  If the task is dropped because of \b lock, or, in work-stealing
+    *  mode, because the pool is destroyed first, the future fails.  The
+    *  future may outlive the pool, but then() must not be called on it
+    *  afterwards, see FutureBase.
+    */
+    template <typename T>
+    Future<T> queueTask(boost::function0<T> func, rTaskLock lock = 0);
+
+    /// A future ready once all of \b fs are, whether they failed or not.
+    template <typename T>
+    static Future<void> when_all(const std::vector<Future<T> >& fs);
+
+    /// A future holding the index of the first of \b fs to be ready.
+    template <typename T>
+    static Future<size_t> when_any(const std::vector<Future<T> >& fs);
+
   private:
+    static Future<void> when_all_(const std::vector<rFutureBase>& fs);
+    static Future<size_t> when_any_(const std::vector<rFutureBase>& fs);
+
     void threadLoop(rThread thnead);
-    Lockable lock_;
+    /// Queue \a t, or mark it as DROPPED.
+    /// \return whether it was queued.
+    bool enqueue_(const rTaskHandle& t);
+    AdaptiveLock lock_;
     /// Main task queue (locked by lock_).
     std::list<rTaskHandle> queue_;
     /// Cached number of locked tasks.
@@ -122,7 +201,37 @@ namespace libport
     /// Idle threads (locked by lock_)
     std::vector<rThread> idleThreads_;
     size_t maxThreads_;
+
+    /*-----------------.
+    | Work stealing.  |
+    `-----------------*/
+
+    class Worker;
+    void workerLoop_(Worker* w);
+    /// Push a referenced task, in our deque if we are a worker.
+    void push_(TaskHandle* t);
+    /// Wake up a parked worker, if any.
+    void wake_();
+    /// \return a referenced task, or 0.
+    TaskHandle* findTask_(Worker* w);
+    /// Run \a t, then the tasks waiting on its lock.
+    void run_(rTaskHandle t);
+
+    bool workStealing_;
+    std::vector<Worker*> workers_;
+    /// The worker running the current thread, if any.
+    static UnmanagedThreadSpecificPtr<Worker> current_;
+    /// Tasks queued by non workers.
+    MPMCQueue<TaskHandle>* injector_;
+    /// Number of tasks that overflowed the injector into queue_.
+    long overflow_;
+    /// Number of parked workers not yet woken up.
+    long sleepers_;
+    Semaphore idle_;
+    volatile bool stopping_;
   };
 }
 
+# include <libport/thread-pool.hxx>
+
 #endif
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#ifndef LIBPORT_THREAD_POOL_HXX
+# define LIBPORT_THREAD_POOL_HXX
+
+# include <boost/bind.hpp>
+# include <boost/optional.hpp>
+
+namespace libport
+{
+
+  /*-------------.
+  | FutureBase.  |
+  `-------------*/
+
+  /// The part of a future shared state that does not depend on its type.
+  class LIBPORT_API ThreadPool::FutureBase: public ThreadSafeRefCounted
+  {
+  public:
+    typedef boost::function0<void> Callback;
+
+    /// \param pool where the continuations are queued, may be 0.  Not
+    ///   owned: it must outlive the calls to Future::then, when_all and
+    ///   when_any on this future, which queue tasks on it.
+    FutureBase(ThreadPool* pool);
+    virtual ~FutureBase();
+
+    bool ready() const;
+    /// Wait until ready.
+    void wait();
+    /// Wait at most \a useconds.
+    /// \return whether ready.
+    bool wait(utime_t useconds);
+
+    /// Call \a cb once ready, from the thread completing the future, or
+    /// right away if already ready.
+    void onReady(const Callback& cb);
+
+    /// Ready with an exception.
+    void fail(const boost::exception_ptr& e);
+    /// Rethrow the exception, if any.
+    void check() const;
+
+    ThreadPool* pool() const;
+
+  protected:
+    /// Mark ready, wake up the waiters, and run the callbacks.
+    void complete_();
+
+  private:
+    ThreadPool* pool_;
+    Condition cond_;
+    volatile bool ready_;
+    boost::exception_ptr exception_;
+    std::vector<Callback> callbacks_;
+  };
+
+
+  /*--------------.
+  | FutureState.  |
+  `--------------*/
+
+  template <typename T>
+  class ThreadPool::FutureState: public FutureBase
+  {
+  public:
+    FutureState(ThreadPool* pool)
+      : FutureBase(pool)
+    {}
+
+    /// Ready with \a v.
+    void set(const T& v)
+    {
+      value_ = v;
+      complete_();
+    }
+
+    /// Run \a f, ready with its result or exception.
+    /// Rethrow so that the task is marked as EXCEPTION.
+    void run(const boost::function0<T>& f)
+    {
+      try
+      {
+        set(f());
+      }
+      catch (...)
+      {
+        fail(boost::current_exception());
+        throw;
+      }
+    }
+
+    /// Wait, then return the value or rethrow the exception.
+    T get()
+    {
+      wait();
+      check();
+      return value_.get();
+    }
+
+  private:
+    boost::optional<T> value_;
+  };
+
+  template <>
+  class ThreadPool::FutureState<void>: public FutureBase
+  {
+  public:
+    FutureState(ThreadPool* pool)
+      : FutureBase(pool)
+    {}
+
+    void set()
+    {
+      complete_();
+    }
+
+    void run(const boost::function0<void>& f)
+    {
+      try
+      {
+        f();
+        set();
+      }
+      catch (...)
+      {
+        fail(boost::current_exception());
+        throw;
+      }
+    }
+
+    void get()
+    {
+      wait();
+      check();
+    }
+  };
+
+
+  /*---------------.
+  | Continuation.  |
+  `---------------*/
+
+  namespace thread_pool
+  {
+    /// The type of a continuation from T to U, and its binding to the
+    /// value of its antecedent.
+    template <typename T, typename U>
+    struct Continuation
+    {
+      typedef boost::function1<U, T> type;
+
+      static boost::function0<U>
+      bind(const type& f, ThreadPool::FutureState<T>& s)
+      {
+        return boost::bind(f, s.get());
+      }
+    };
+
+    template <typename U>
+    struct Continuation<void, U>
+    {
+      typedef boost::function0<U> type;
+
+      static boost::function0<U>
+      bind(const type& f, ThreadPool::FutureState<void>&)
+      {
+        return f;
+      }
+    };
+
+    template <typename T>
+    void
+    run(libport::intrusive_ptr<ThreadPool::FutureState<T> > s,
+        boost::function0<T> f)
+    {
+      s->run(f);
+    }
+
+    /// Fail \a s, whose task was dropped for \a reason.
+    inline void
+    drop(ThreadPool::rFutureBase s, const char* reason)
+    {
+      s->fail(boost::copy_exception(Exception(reason)));
+    }
+
+    /// Once \a s is ready, run \a f on its pool to complete \a res.
+    template <typename T, typename U>
+    void
+    then(libport::intrusive_ptr<ThreadPool::FutureState<T> > s,
+         libport::intrusive_ptr<ThreadPool::FutureState<U> > res,
+         typename Continuation<T, U>::type f)
+    {
+      try
+      {
+        s->check();
+      }
+      catch (...)
+      {
+        // Do not run the continuation of a failed future.
+        res->fail(boost::current_exception());
+        return;
+      }
+      boost::function0<U> g = Continuation<T, U>::bind(f, *s);
+      if (ThreadPool* pool = s->pool())
+        pool->queueTask(boost::bind(&run<U>, res, g),
+                        0,
+                        boost::bind(&drop, ThreadPool::rFutureBase(res), _1));
+      else
+        try
+        {
+          res->run(g);
+        }
+        catch (...)
+        {}
+    }
+  }
+
+
+  /*---------.
+  | Future.  |
+  `---------*/
+
+  template <typename T>
+  class ThreadPool::Future
+  {
+  public:
+    typedef FutureState<T> State;
+    typedef libport::intrusive_ptr<State> rState;
+
+    /// An invalid future.
+    Future()
+    {}
+
+    Future(rState s)
+      : state_(s)
+    {}
+
+    bool valid() const
+    {
+      return state_.get();
+    }
+
+    bool ready() const
+    {
+      return state_->ready();
+    }
+
+    void wait() const
+    {
+      state_->wait();
+    }
+
+    /// Wait at most \a useconds.
+    /// \return whether ready.
+    bool wait(utime_t useconds) const
+    {
+      return state_->wait(useconds);
+    }
+
+    /// Wait, then return the value or rethrow the exception of the task.
+    T get() const
+    {
+      return state_->get();
+    }
+
+    /** Once ready, queue \a f on the pool, called with the value.
+     *  If this future failed, \a f is not run and the result fails the
+     *  same way.  The pool must not be destroyed yet.
+     *  Call as then<U>(f), U may be void.
+     */
+    template <typename U>
+    Future<U> then(typename thread_pool::Continuation<T, U>::type f) const
+    {
+      typename Future<U>::rState res(new FutureState<U>(state_->pool()));
+      state_->onReady(boost::bind(&thread_pool::then<T, U>, state_, res, f));
+      return res;
+    }
+
+    const rState& state() const
+    {
+      return state_;
+    }
+
+  private:
+    rState state_;
+  };
+
+
+  /*-------------.
+  | ThreadPool.  |
+  `-------------*/
+
+  template <typename T>
+  ThreadPool::Future<T>
+  ThreadPool::queueTask(boost::function0<T> func, rTaskLock lock)
+  {
+    typename Future<T>::rState res(new FutureState<T>(this));
+    queueTask(boost::bind(&thread_pool::run<T>, res, func),
+              lock,
+              boost::bind(&thread_pool::drop, rFutureBase(res), _1));
+    return res;
+  }
+
+  template <typename T>
+  ThreadPool::Future<void>
+  ThreadPool::when_all(const std::vector<Future<T> >& fs)
+  {
+    std::vector<rFutureBase> states;
+    foreach (const Future<T>& f, fs)
+      states.push_back(f.state());
+    return when_all_(states);
+  }
+
+  template <typename T>
+  ThreadPool::Future<size_t>
+  ThreadPool::when_any(const std::vector<Future<T> >& fs)
+  {
+    std::vector<rFutureBase> states;
+    foreach (const Future<T>& f, fs)
+      states.push_back(f.state());
+    return when_any_(states);
+  }
+
+}
+
+#endif
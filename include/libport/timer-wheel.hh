@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/timer-wheel.hh
+ ** \brief Definition of libport::TimerWheel.
+ */
+
+#ifndef LIBPORT_TIMER_WHEEL_HH
+# define LIBPORT_TIMER_WHEEL_HH
+
+# include <vector>
+
+# include <boost/function.hpp>
+# include <boost/shared_ptr.hpp>
+
+# include <libport/asio.hh>
+# include <libport/export.hh>
+# include <libport/lockable.hh>
+# include <libport/utime.hh>
+
+namespace libport
+{
+
+/*! Many timers on an io_service, for the price of a single one.
+
+  Timers are hashed by expiry tick in a wheel of \a slots slots of \a
+  tick microseconds: adding and cancelling are O(1), and a single
+  deadline_timer is armed, for the next non-empty slot.
+
+  A timer fires at the beginning of a tick, at most \a slack after its
+  delay: its expiry is rounded up to the coarsest multiple of a power
+  of two ticks within its slack, so that timers with close deadlines
+  and loose slacks fire together.
+
+  Timers may be added and cancelled from any thread.  Callbacks run on
+  the io_service, without the wheel locked.  The wheel must not be
+  destroyed while its io_service runs.
+
+  It is a service of its io_service: see get_timer_wheel.  When the
+  io_service shuts down, pending timers are dropped without firing.
+*/
+
+  class LIBPORT_API TimerWheel
+    : public boost::asio::io_service::service
+  {
+  public:
+    typedef boost::function0<void> callback_type;
+    struct Entry;
+    /// A timer, to cancel it.
+    typedef boost::shared_ptr<Entry> Handle;
+
+    /// The service identifier.
+    static boost::asio::io_service::id id;
+
+    explicit TimerWheel(boost::asio::io_service& io,
+                        useconds_t tick = 1000, size_t slots = 512);
+    ~TimerWheel();
+
+    /// Call \a callback in \a delay microseconds, at most \a slack
+    /// later.
+    Handle add(useconds_t delay, const callback_type& callback,
+               useconds_t slack = 0);
+
+    /// Prevent the timer \a h from firing, and release its callback.
+    /// \return whether it was pending, false if it fired or is firing.
+    bool cancel(const Handle& h);
+
+    /// Number of timers pending.
+    size_t size() const;
+    /// Number of times the deadline_timer expired.
+    size_t wakeups() const;
+    useconds_t tick() const;
+
+  private:
+    /// Drop the pending timers, and their callbacks.
+    virtual void shutdown_service();
+
+    typedef long long tick_type;
+    typedef std::vector<Handle> slot_type;
+
+    /// Under the lock.
+    tick_type now_() const;
+    void arm_(tick_type tick);
+    /// Move the due callbacks of \a slot to \a due.
+    void expire_(slot_type& slot, tick_type now,
+                 std::vector<callback_type>& due);
+    void onTimer_(boost::system::error_code erc);
+
+    mutable Lockable lock_;
+    boost::asio::deadline_timer timer_;
+    useconds_t tick_;
+    std::vector<slot_type> slots_;
+    /// The last tick processed.
+    tick_type current_;
+    /// The tick the deadline_timer is armed for, 0 if none.
+    tick_type armed_;
+    size_t size_;
+    size_t wakeups_;
+  };
+
+  /// The TimerWheel of \a io, created on first use, destroyed with it.
+  LIBPORT_API TimerWheel&
+  get_timer_wheel(boost::asio::io_service& io = get_io_service());
+
+} // namespace libport
+
+#endif // !LIBPORT_TIMER_WHEEL_HH
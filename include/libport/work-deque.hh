@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/work-deque.hh
+ ** \brief Definition of libport::WorkDeque.
+ */
+
+#ifndef LIBPORT_WORK_DEQUE_HH
+# define LIBPORT_WORK_DEQUE_HH
+
+# include <vector>
+
+# include <boost/noncopyable.hpp>
+
+# include <libport/atomic.hh>
+
+namespace libport
+{
+
+/*! A Chase-Lev work-stealing deque of pointers.
+
+  Its owner thread pushes and pops at the bottom, like a stack, with
+  no atomic operation but for the last item.  Any other thread steals
+  the oldest items at the top, with a compare-and-swap.
+
+  It grows as needed.  The previous arrays are kept until destruction,
+  as late thieves may still read them.  Requires LIBPORT_HAVE_ATOMIC.
+*/
+  template <typename T>
+  class WorkDeque
+    : private boost::noncopyable
+  {
+  public:
+    /// \a capacity must be a power of two.
+    WorkDeque(size_t capacity = 256);
+    ~WorkDeque();
+
+    /// Owner only.
+    void push(T* t);
+    /// Owner only.
+    /// \return the last item pushed, or 0 if empty.
+    T* pop();
+    /// Any thread.
+    /// \return the oldest item, or 0 if empty or lost a race.
+    T* steal();
+
+    /// Number of items, approximate unless called by the owner.
+    size_t size() const;
+    bool empty() const;
+
+  private:
+    struct Array
+    {
+      Array(long size);
+      ~Array();
+      long mask;
+      T** items;
+    };
+    /// Double the capacity, copying the items in [top, bottom).
+    Array* grow_(Array* a, long bottom, long top);
+
+    /// Next item to steal.
+    volatile long top_;
+    /// Next slot to push to.
+    volatile long bottom_;
+    Array* volatile array_;
+    /// Owner only.
+    std::vector<Array*> old_;
+  };
+
+} // namespace libport
+
+# include <libport/work-deque.hxx>
+
+#endif // !LIBPORT_WORK_DEQUE_HH
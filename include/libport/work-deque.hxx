@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file libport/work-deque.hxx
+ ** \brief Inline implementation of libport::WorkDeque.
+ */
+
+#ifndef LIBPORT_WORK_DEQUE_HXX
+# define LIBPORT_WORK_DEQUE_HXX
+
+# include <libport/cassert>
+# include <libport/foreach.hh>
+
+namespace libport
+{
+
+  template <typename T>
+  inline
+  WorkDeque<T>::Array::Array(long size)
+    : mask(size - 1)
+    , items(new T*[size])
+  {
+    aver(!(size & mask));
+  }
+
+  template <typename T>
+  inline
+  WorkDeque<T>::Array::~Array()
+  {
+    delete [] items;
+  }
+
+  template <typename T>
+  inline
+  WorkDeque<T>::WorkDeque(size_t capacity)
+    : top_(0)
+    , bottom_(0)
+    , array_(new Array(capacity))
+  {
+  }
+
+  template <typename T>
+  inline
+  WorkDeque<T>::~WorkDeque()
+  {
+    delete array_;
+    foreach (Array* a, old_)
+      delete a;
+  }
+
+  template <typename T>
+  inline void
+  WorkDeque<T>::push(T* t)
+  {
+    long b = bottom_;
+    long top = top_;
+    Array* a = array_;
+    if (a->mask < b - top)
+      a = grow_(a, b, top);
+    a->items[b & a->mask] = t;
+    // Publish the item before the bottom.
+    atomic::barrier();
+    bottom_ = b + 1;
+  }
+
+  template <typename T>
+  inline T*
+  WorkDeque<T>::pop()
+  {
+    long b = bottom_ - 1;
+    Array* a = array_;
+    bottom_ = b;
+    // Reserve the item before looking at the thieves.
+    atomic::barrier();
+    long top = top_;
+    if (b < top)
+    {
+      bottom_ = top;
+      return 0;
+    }
+    T* res = a->items[b & a->mask];
+    if (top < b)
+      return res;
+    // The last item: race with the thieves.
+    if (!atomic::compare_and_swap(&top_, top, top + 1))
+      res = 0;
+    bottom_ = top + 1;
+    return res;
+  }
+
+  template <typename T>
+  inline T*
+  WorkDeque<T>::steal()
+  {
+    long top = top_;
+    atomic::barrier();
+    long b = bottom_;
+    if (b <= top)
+      return 0;
+    Array* a = array_;
+    T* res = a->items[top & a->mask];
+    if (!atomic::compare_and_swap(&top_, top, top + 1))
+      return 0;
+    return res;
+  }
+
+  template <typename T>
+  inline size_t
+  WorkDeque<T>::size() const
+  {
+    long res = bottom_ - top_;
+    return res < 0 ? 0 : res;
+  }
+
+  template <typename T>
+  inline bool
+  WorkDeque<T>::empty() const
+  {
+    return !size();
+  }
+
+  template <typename T>
+  inline typename WorkDeque<T>::Array*
+  WorkDeque<T>::grow_(Array* a, long bottom, long top)
+  {
+    Array* res = new Array(2 * (a->mask + 1));
+    for (long i = top; i < bottom; ++i)
+      res->items[i & res->mask] = a->items[i & a->mask];
+    old_.push_back(a);
+    // Publish the items before the array.
+    atomic::barrier();
+    array_ = res;
+    return res;
+  }
+
+} // namespace libport
+
+#endif // !LIBPORT_WORK_DEQUE_HXX
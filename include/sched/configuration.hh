@@ -21,6 +21,9 @@ namespace sched
     /// Default and minimum stack size for jobs (in bytes)
     size_t default_stack_size;
     size_t minimum_stack_size;
+    /// Stack space (in bytes) committed for new jobs, which grows on
+    /// demand up to their stack size.  If 0, it is committed whole.
+    size_t initial_stack_size;
   };
 
   /// Default configuration.
@@ -118,6 +118,11 @@ inline size_t coroutine_stack_size(Coro* self)
   return self->fc_stack.size;
 }
 
+inline size_t coroutine_stack_high_water_mark(Coro*)
+{
+  return 0;
+}
+
 
 inline void coroutine_initialize_main(Coro*) {}
 inline Coro* coroutine_main() { return new Coro;}
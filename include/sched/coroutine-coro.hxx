@@ -61,6 +61,7 @@ coroutine_new(size_t stack_size)
                      (stack_size > 16
                       ? stack_size - 16
                       : sched::configuration.default_stack_size - 16));
+  Coro_setStackCommitSize_(res, sched::configuration.initial_stack_size);
   if (coroutine_new_hook)
     coroutine_new_hook(res);
   return res;
@@ -94,6 +95,12 @@ coroutine_stack_size(Coro* self)
   return self->requestedStackSize;
 }
 
+inline size_t
+coroutine_stack_high_water_mark(Coro* self)
+{
+  return Coro_stackHighWaterMark(self);
+}
+
 inline void
 coroutine_initialize_main(Coro* coro)
 {
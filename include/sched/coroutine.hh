@@ -75,6 +75,10 @@ void* coroutine_current_stack_pointer(Coro* self);
 SCHED_CORO_API
 size_t coroutine_stack_size(Coro* self);
 
+/// The deepest the stack went, in bytes, or 0 if unknown.
+SCHED_CORO_API
+size_t coroutine_stack_high_water_mark(Coro* self);
+
 /// Check whether the stack space is sufficient or near exhaustion.
 /// \param coro The coroutine to check, can either be the current one
 ///        or any other coroutine.
@@ -18,17 +18,30 @@
 
 # include <list>
 
+# include <libport/config.h>
 # include <libport/intrusive-ptr.hh>
+# include <libport/ref-counted.hh>
 
 # include <sched/exception.hh>
 
 namespace sched
 {
 
+  /// The base of jobs and tags.  With several schedulers (see Workers),
+  /// their references are taken and released from several threads.
+# ifdef LIBPORT_SCHED_MULTITHREAD
+  typedef libport::ThreadSafeRefCounted ref_counted_type;
+# else
+  typedef libport::RefCounted ref_counted_type;
+# endif
+
   class Scheduler;
   class Job;
   typedef libport::intrusive_ptr<Job> rJob;
   typedef std::list<rJob> jobs_type;
+  class JobQueue;
+  class Notifier;
+  class Profiler;
   class Tag;
   typedef libport::intrusive_ptr<Tag> rTag;
 
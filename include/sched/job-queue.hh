@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/job-queue.hh
+ ** \brief Definition of sched::JobQueue.
+ */
+
+#ifndef SCHED_JOB_QUEUE_HH
+# define SCHED_JOB_QUEUE_HH
+
+# include <boost/intrusive/list.hpp>
+# include <boost/noncopyable.hpp>
+
+# include <sched/fwd.hh>
+
+namespace sched
+{
+
+  /// Hook embedded in every Job so that it can be linked into a
+  /// JobQueue without allocating.  A job belongs to at most one queue
+  /// at a time.
+  typedef boost::intrusive::list_base_hook<
+    boost::intrusive::link_mode<boost::intrusive::auto_unlink> >
+    JobQueueHook;
+
+  /// An intrusive FIFO of jobs, used by the scheduler as its run queues.
+  ///
+  /// The queue holds a reference on every job it contains.  Moving a
+  /// job from one queue to another, or exchanging two queues, never
+  /// allocates memory.
+  class JobQueue: boost::noncopyable
+  {
+  public:
+    JobQueue();
+    /// Release the jobs still queued.
+    ~JobQueue();
+
+    /// Whether there is no job in the queue.
+    bool empty() const;
+
+    /// Number of queued jobs.  Linear, reserved to debugging purpose.
+    size_t size() const;
+
+    /// The first job, or 0 if the queue is empty.
+    Job* front() const;
+
+    /// Append \a job, which must not belong to any queue.
+    void push_back(const rJob& job);
+
+    /// Remove and return the first job.  The queue must not be empty.
+    rJob pop_front();
+
+    /// Move all the jobs of \a other in front of ours, in constant time.
+    void splice_front(JobQueue& other);
+
+    /// Move all the jobs of \a other after ours, in constant time.
+    void splice_back(JobQueue& other);
+
+    /// Move our first job at the end of \a other, in constant time.  The
+    /// queue must not be empty.
+    void move_front_to(JobQueue& other);
+
+    /// Exchange the content of two queues, in constant time.
+    void swap(JobQueue& other);
+
+    /// Release all the jobs.
+    void clear();
+
+    /// Append the queued jobs to \a jobs.
+    void copy_to(jobs_type& jobs) const;
+
+    /// Whether \a job belongs to a queue.
+    static bool queued(const Job& job);
+
+    /// Remove \a job from the queue it belongs to, if any.
+    static void remove(Job& job);
+
+  private:
+    /// Drop the reference held on \a job by a queue.
+    static void release_(Job* job);
+
+    typedef boost::intrusive::list<
+      Job,
+      boost::intrusive::base_hook<JobQueueHook>,
+      boost::intrusive::constant_time_size<false> > list_type;
+    list_type jobs_;
+  };
+
+} // namespace sched
+
+// The inline implementation requires Job to be complete, it is
+// included by sched/job.hh.
+
+#endif // !SCHED_JOB_QUEUE_HH
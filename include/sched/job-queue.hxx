@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/job-queue.hxx
+ ** \brief Inline implementation of sched::JobQueue.
+ */
+
+#ifndef SCHED_JOB_QUEUE_HXX
+# define SCHED_JOB_QUEUE_HXX
+
+# include <libport/cassert>
+
+# include <sched/job-queue.hh>
+# include <sched/job.hh>
+
+namespace sched
+{
+
+  inline
+  JobQueue::JobQueue()
+  {
+  }
+
+  inline
+  JobQueue::~JobQueue()
+  {
+    clear();
+  }
+
+  inline bool
+  JobQueue::empty() const
+  {
+    return jobs_.empty();
+  }
+
+  inline size_t
+  JobQueue::size() const
+  {
+    return jobs_.size();
+  }
+
+  inline Job*
+  JobQueue::front() const
+  {
+    return jobs_.empty() ? 0 : const_cast<Job*>(&jobs_.front());
+  }
+
+  inline void
+  JobQueue::push_back(const rJob& job)
+  {
+    aver(job);
+    aver(!queued(*job));
+    job->counter_inc();
+    jobs_.push_back(*job);
+  }
+
+  inline rJob
+  JobQueue::pop_front()
+  {
+    aver(!jobs_.empty());
+    rJob res = &jobs_.front();
+    jobs_.pop_front();
+    // Hand our reference over to res, it cannot be the last one.
+    res->counter_dec();
+    return res;
+  }
+
+  inline void
+  JobQueue::splice_front(JobQueue& other)
+  {
+    jobs_.splice(jobs_.begin(), other.jobs_);
+  }
+
+  inline void
+  JobQueue::splice_back(JobQueue& other)
+  {
+    jobs_.splice(jobs_.end(), other.jobs_);
+  }
+
+  inline void
+  JobQueue::move_front_to(JobQueue& other)
+  {
+    aver(!jobs_.empty());
+    other.jobs_.splice(other.jobs_.end(), jobs_, jobs_.begin());
+  }
+
+  inline void
+  JobQueue::swap(JobQueue& other)
+  {
+    jobs_.swap(other.jobs_);
+  }
+
+  inline void
+  JobQueue::clear()
+  {
+    jobs_.clear_and_dispose(&JobQueue::release_);
+  }
+
+  inline void
+  JobQueue::copy_to(jobs_type& jobs) const
+  {
+    for (list_type::const_iterator i = jobs_.begin(); i != jobs_.end(); ++i)
+      jobs.push_back(const_cast<Job*>(&*i));
+  }
+
+  inline bool
+  JobQueue::queued(const Job& job)
+  {
+    return job.JobQueueHook::is_linked();
+  }
+
+  inline void
+  JobQueue::remove(Job& job)
+  {
+    if (queued(job))
+    {
+      job.JobQueueHook::unlink();
+      release_(&job);
+    }
+  }
+
+  inline void
+  JobQueue::release_(Job* job)
+  {
+    if (job->counter_dec())
+      delete job;
+  }
+
+} // namespace sched
+
+#endif // !SCHED_JOB_QUEUE_HXX
@@ -18,15 +18,20 @@
 
 # include <iosfwd>
 # include <list>
+# include <vector>
 
 # include <boost/any.hpp>
 
 # include <libport/symbol.hh>
+# include <libport/thread-pool.hh>
 # include <libport/utime.hh>
 
 # include <sched/coroutine.hh>
 # include <sched/export.hh>
 # include <sched/fwd.hh>
+# include <sched/job-queue.hh>
+# include <sched/notifier.hh>
+# include <sched/sleep-queue.hh>
 # include <sched/tag.hh>
 
 namespace sched
@@ -39,6 +44,7 @@ namespace sched
     sleeping,            ///< Job is sleeping until a specified deadline
     waiting,             ///< Job is waiting for changes to happen
     joining,             ///< Job is waiting for another job to terminate
+    offloaded,           ///< Job is waiting for a task run by another thread
     zombie,              ///< Job wants to be dead but isn't really yet
   };
 
@@ -86,8 +92,10 @@ namespace sched
   /// \li  2. Make sure the job is kept alive as long as there is at least one
   ///         reference onto it, and that it gets deleted from another
   ///         coroutine, or from the main one.
+  ///
+  /// The JobQueueHook base is reserved to the scheduler run queues.
 
-  class SCHED_API Job: public libport::RefCounted
+  class SCHED_API Job: public ref_counted_type, public JobQueueHook
   {
   public:
     /// Create a job from another one.
@@ -128,6 +136,9 @@ namespace sched
     /// \return The coroutine structure.
     Coro* coro_get() const;
 
+    /// The deepest our stack went so far, in bytes, or 0 if unknown.
+    size_t stack_high_water_mark() const;
+
     /// Has this job terminated?
     ///
     /// \return True if this job is in the \c zombie state.
@@ -182,6 +193,30 @@ namespace sched
     /// job in the collection.
     void yield_until_terminated(const jobs_type& jobs);
 
+    /// Wait until \a notifier is notified.  The job is not resumed by
+    /// the scheduler in the meantime, unless it is woken up explicitly
+    /// through state_set(), an exception is thrown to it, or the
+    /// scheduler polls waiting jobs.  The caller must check the
+    /// condition it is waiting for on return.
+    ///
+    /// \sa yield(), yield_for(), yield_until(), yield_until_terminated()
+    void yield_until_notified(Notifier& notifier);
+
+    /// The notifier this job is waiting for, if any.
+    const Notifier* notifier_get() const;
+
+    /// Run \a f in \a pool, and wait until it completes without blocking
+    /// the scheduler, in the \c offloaded state.  Meant for blocking
+    /// calls and heavy computations, which must not touch the state of
+    /// the scheduler or of its jobs.  If the job is interrupted by an
+    /// exception meanwhile, \a f still runs, but its result is lost.
+    ///
+    /// \return the result of \a f, or rethrow its exception.
+    ///
+    /// \sa yield(), yield_until_notified()
+    template <typename T>
+    T offload(libport::ThreadPool& pool, boost::function0<T> f);
+
     /// Wait for any other task to be scheduled.  This function is no longer
     /// a good way to wait for changes.  The current methods used is to
     /// create a tag which is added to the job and to freeze the tag.
@@ -223,6 +258,15 @@ namespace sched
     virtual size_t has_tag(const Tag& tag, size_t max_depth = (size_t)-1)
       const = 0;
 
+    /// Report that the job now holds \a tag, or no longer does.
+    ///
+    /// If Scheduler::indexed_tags_get(), the scheduler finds the jobs
+    /// affected by an action on a tag through these reports instead of
+    /// asking every job: every tag the job holds must be reported.
+    /// A tag acquired several times must be released as many times.
+    void tag_acquired(Tag& tag);
+    void tag_released(Tag& tag);
+
     /// Get the current job state.
     ///
     /// \return The current job state.
@@ -260,6 +304,21 @@ namespace sched
     bool ignore_pending_exceptions_get() const;
     void ignore_pending_exceptions_set(bool);
 
+    /// Whether the job must stay on its current scheduler.
+    ///
+    /// When several schedulers share the load (see Workers), unpinned
+    /// jobs may be handed over to another worker thread between two
+    /// rounds.  Jobs which touch non thread-safe or thread-local state,
+    /// or which may yield while handling an exception, must be pinned.
+    bool pinned_get() const;
+    void pinned_set(bool pinned);
+
+    /// Whether the job can be handed over to another scheduler now:
+    /// it is not pinned, it is runnable, and it shares no state known
+    /// to the scheduler (parent, children, waiters, notifier) with
+    /// other jobs.
+    bool migratable() const;
+
     /// Remember the time we have been frozen since if not remembered
     /// yet.
     ///
@@ -368,6 +427,7 @@ namespace sched
 
       typedef libport::Statistics<libport::utime_t, libport::ufloat>
         time_stat_type;
+      typedef libport::Statistics<size_t, libport::ufloat> size_stat_type;
 
       struct thread_stats_type
       {
@@ -377,6 +437,8 @@ namespace sched
         unsigned long nb_fork, nb_join;
         /// Number of exceptions raised.
         unsigned nb_exn;
+        /// Stack high-water marks of the terminated jobs, in bytes.
+        size_stat_type stack;
 
         void reset();
 
@@ -430,6 +492,9 @@ namespace sched
     virtual void scheduling_error(const std::string& msg = "") = 0;
 
   private:
+    /// Wait in the \c offloaded state until \a task is ready.
+    void offload_wait_(libport::ThreadPool::FutureBase& task);
+
     /// Current job state, to be manipulated only from the job and the
     /// scheduler.
     job_state state_;
@@ -447,7 +512,11 @@ namespace sched
     libport::utime_t time_shift_;
 
     /// Scheduler in charge of this job. Do not delete.
-    Scheduler& scheduler_;
+    friend class Scheduler;
+    Scheduler* scheduler_;
+
+    /// Must we stay on scheduler_?
+    bool pinned_;
 
     /// Other jobs to wake up when we terminate.
     jobs_type to_wake_up_;
@@ -487,8 +556,32 @@ namespace sched
     /// Ignore pending exceptions
     bool ignore_pending_exceptions_;
 
-    /// Number of jobs created and not yet destroyed.
-    static unsigned int alive_jobs_;
+    /// Number of jobs created and not yet destroyed.  Atomic, jobs may
+    /// be destroyed by several threads.
+    static long alive_jobs_;
+
+    /// Notifier we are waiting for, if any.
+    friend class Notifier;
+    Notifier* notifier_;
+
+    /// Position in the scheduler SleepQueue, if any.
+    friend class SleepQueue;
+    size_t sleep_index_;
+    static const size_t not_sleeping = size_t(-1);
+
+    /// Tags reported by tag_acquired(), in acquisition order.
+    friend class Tag;
+    std::vector<Tag*> indexed_tags_;
+
+    /// Report to the profiler of the scheduler, if any.
+    void profile_resumed_();
+    void profile_preempted_(job_state state);
+    void profile_woken_up_();
+
+    /// Our profile in the profiler of our scheduler.
+    friend class Profiler;
+    unsigned long profile_generation_;
+    size_t profile_index_;
   };
 
   SCHED_API
@@ -540,5 +633,7 @@ namespace sched
 } // namespace sched
 
 # include <sched/job.hxx>
+# include <sched/job-queue.hxx>
+# include <sched/sleep-queue.hxx>
 
 #endif // !SCHED_JOB_HH
@@ -16,9 +16,11 @@
 #ifndef SCHED_JOB_HXX
 # define SCHED_JOB_HXX
 
+# include <libport/atomic.hh>
 # include <libport/bind.hh>
 # include <libport/cassert>
 # include <libport/debug.hh>
+# include <libport/foreach.hh>
 
 # include <sched/scheduler.hh>
 # include <sched/coroutine.hh>
@@ -40,6 +42,7 @@ namespace sched
       CASE(sleeping)
       CASE(waiting)
       CASE(joining)
+      CASE(offloaded)
       CASE(zombie)
     }
 #undef CASE
@@ -68,13 +71,23 @@ namespace sched
     non_interruptible_ = false;
     check_stack_space_ = stack_size == 0;
     ignore_pending_exceptions_ = false;
+    pinned_ = false;
+    notifier_ = 0;
+    sleep_index_ = not_sleeping;
+    profile_generation_ = 0;
+    profile_index_ = 0;
+# ifdef LIBPORT_HAVE_ATOMIC
+    libport::atomic::increment_fetch(&alive_jobs_);
+# else
     alive_jobs_++;
+# endif
   }
 
   inline
   Job::Job(Scheduler& scheduler)
-    : RefCounted()
-    , scheduler_(scheduler)
+    : ref_counted_type()
+    , JobQueueHook()
+    , scheduler_(&scheduler)
     , stats_()
   {
     init_common();
@@ -82,7 +95,8 @@ namespace sched
 
   inline
   Job::Job(const Job& model, size_t stack_size)
-    : RefCounted()
+    : ref_counted_type()
+    , JobQueueHook()
     , scheduler_(model.scheduler_)
     , stats_()
   {
@@ -94,14 +108,23 @@ namespace sched
   Job::~Job()
   {
     aver(children_.empty(), children_);
+    foreach (Tag* tag, indexed_tags_)
+    {
+      libport::ScopedLock<libport::AdaptiveLock> bl(tag->holders_lock_);
+      tag->holders_.erase(this);
+    }
     coroutine_free(coro_);
+# ifdef LIBPORT_HAVE_ATOMIC
+    libport::atomic::decrement_fetch(&alive_jobs_);
+# else
     alive_jobs_--;
+# endif
   }
 
   inline Scheduler&
   Job::scheduler_get() const
   {
-    return scheduler_;
+    return *scheduler_;
   }
 
   inline bool
@@ -137,7 +160,13 @@ namespace sched
   inline void
   Job::yield_for(libport::utime_t delay)
   {
-    yield_until(scheduler_.get_time() + delay);
+    yield_until(scheduler_->get_time() + delay);
+  }
+
+  inline const Notifier*
+  Job::notifier_get() const
+  {
+    return notifier_;
   }
 
   inline Coro*
@@ -147,11 +176,17 @@ namespace sched
     return coro_;
   }
 
+  inline size_t
+  Job::stack_high_water_mark() const
+  {
+    return coroutine_stack_high_water_mark(coro_);
+  }
+
   inline void
   Job::start_job()
   {
     aver(state_ == to_start);
-    scheduler_.add_job(this);
+    scheduler_->add_job(this);
   }
 
   inline bool
@@ -181,6 +216,15 @@ namespace sched
     }
   }
 
+  template <typename T>
+  inline T
+  Job::offload(libport::ThreadPool& pool, boost::function0<T> f)
+  {
+    libport::ThreadPool::Future<T> res = pool.queueTask<T>(f);
+    offload_wait_(*res.state());
+    return res.get();
+  }
+
   inline job_state
   Job::state_get() const
   {
@@ -191,6 +235,9 @@ namespace sched
   Job::state_set(job_state state)
   {
     state_ = state;
+    scheduler_get().job_state_changed(*this);
+    if (scheduler_->profiler_get())
+      profile_woken_up_();
     if (state_ == running)
       scheduler_get().job_was_woken_up();
   }
@@ -284,15 +331,18 @@ namespace sched
     // between the beginning and the end.
     aver(!non_interruptible_);
 
+    if (scheduler_->profiler_get())
+      profile_preempted_(last_state);
+
     if (stats_.logging)
     {
-      libport::utime_t start_resume = scheduler_.get_time();
+      libport::utime_t start_resume = scheduler_->get_time();
       stats_.job.running.add_sample(
         start_resume - stats_.last_resume);
 
-      scheduler_.resume_scheduler(this);
+      scheduler_->resume_scheduler(this);
 
-      stats_.last_resume = scheduler_.get_time();
+      stats_.last_resume = scheduler_->get_time();
       switch (last_state)
       {
         case waiting:
@@ -306,7 +356,9 @@ namespace sched
       }
     }
     else
-      scheduler_.resume_scheduler(this);
+      scheduler_->resume_scheduler(this);
+    if (scheduler_->profiler_get())
+      profile_resumed_();
     hook_resumed();
   }
 
@@ -345,6 +397,7 @@ namespace sched
     nb_fork = 0;
     nb_join = 0;
     nb_exn = 0;
+    stack.resize(0);
   }
 
   inline void
@@ -359,7 +412,7 @@ namespace sched
   {
     stats_.logging = log;
     if (log)
-      stats_.last_resume = scheduler_.get_time();
+      stats_.last_resume = scheduler_->get_time();
   }
 
   inline bool
@@ -374,6 +427,31 @@ namespace sched
     ignore_pending_exceptions_ = v;
   }
 
+  inline bool
+  Job::pinned_get() const
+  {
+    return pinned_;
+  }
+
+  inline void
+  Job::pinned_set(bool pinned)
+  {
+    pinned_ = pinned;
+  }
+
+  inline bool
+  Job::migratable() const
+  {
+    return !pinned_
+      && (state_ == running || state_ == to_start)
+      && !frozen()
+      && !has_pending_exception()
+      && !parent_
+      && children_.empty()
+      && to_wake_up_.empty()
+      && !notifier_;
+  }
+
   inline rJob
   Job::parent_get() const
   {
@@ -9,6 +9,7 @@
         #define __x86_64__ 1
 #endif
 
+#include <libport/config.h>
 #include "Common.h"
 //#include "PortableUContext.h"
 #include "taskimpl.h"
@@ -39,10 +40,15 @@
 
 
 // Pick which coro implementation to use
-// The make file can set -DUSE_FIBERS, -DUSE_UCONTEXT or -DUSE_SETJMP to force this choice.
-#if !defined(USE_FIBERS) && !defined(USE_UCONTEXT) && !defined(USE_SETJMP)
-
-#if defined(WIN32) && defined(HAS_FIBERS)
+// The make file can set -DUSE_FIBERS, -DUSE_UCONTEXT, -DUSE_SETJMP or
+// -DUSE_AMD64_ASM to force this choice.  Configure selects USE_AMD64_ASM
+// with --enable-sched-asm-coro.
+#if !defined(USE_FIBERS) && !defined(USE_UCONTEXT) && !defined(USE_SETJMP) \
+  && !defined(USE_AMD64_ASM)
+
+#if defined(LIBPORT_SCHED_CORO_ASM) && defined(__x86_64__) && defined(__ELF__)
+#	define USE_AMD64_ASM
+#elif defined(WIN32) && defined(HAS_FIBERS)
 #	define USE_FIBERS
 #elif defined(HAS_UCONTEXT)
 //#elif defined(HAS_UCONTEXT) && !defined(__x86_64__)
@@ -67,6 +73,14 @@
 #elif defined(USE_SETJMP)
 	#include <setjmp.h>
 	#define CORO_IMPLEMENTATION "setjmp"
+#elif defined(USE_AMD64_ASM)
+	#define CORO_IMPLEMENTATION "amd64-asm"
+#endif
+
+// Stacks are mmap'd, with a guard page, and recycled through a pool.
+#if !defined(USE_FIBERS) && !defined(__SYMBIAN32__) \
+  && (defined(__unix__) || defined(__APPLE__))
+#	define CORO_USE_MMAP 1
 #endif
 
 #ifdef __cplusplus
@@ -79,7 +93,10 @@ struct Coro
 {
 	size_t requestedStackSize;
 	size_t allocatedStackSize;
+	size_t commitStackSize;
+	size_t committedStackSize;
 	void *stack;
+	void *context;
 
 #ifdef USE_VALGRIND
 	unsigned int valgrindStackId;
@@ -91,6 +108,9 @@ struct Coro
 	ucontext_t env;
 #elif defined(USE_SETJMP)
 	jmp_buf env;
+#elif defined(USE_AMD64_ASM)
+	// The stack pointer of the suspended coroutine, see amd64-switch.S.
+	void *env;
 #endif
 
 	unsigned char isMain;
@@ -111,6 +131,21 @@ CORO_API uint8_t *Coro_CurrentStackPointer(void)
 CORO_API void Coro_setStackSize_(Coro *self, size_t sizeInBytes);
 CORO_API size_t Coro_bytesLeftOnStack(Coro *self);
 CORO_API int Coro_stackSpaceAlmostGone(Coro *self);
+CORO_API int Coro_stackGuardContains(Coro *self, void *address);
+
+// growable stacks
+
+CORO_API void Coro_setStackCommitSize_(Coro *self, size_t sizeInBytes);
+CORO_API int Coro_growStack(Coro *self, void *address);
+CORO_API size_t Coro_stackHighWaterMark(Coro *self);
+
+// stack pool
+
+CORO_API size_t Coro_stackPoolSize(void);
+CORO_API void Coro_setStackPoolSize(size_t count);
+
+// The context given to Coro_startCoro_.
+CORO_API void *Coro_context(Coro *self);
 
 CORO_API void Coro_initializeMainCoro(Coro *self);
 
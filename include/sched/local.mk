@@ -21,10 +21,19 @@ sched_include_HEADERS =				\
   include/sched/fwd.hh				\
   include/sched/job.hh				\
   include/sched/job.hxx				\
+  include/sched/job-queue.hh			\
+  include/sched/job-queue.hxx			\
+  include/sched/notifier.hh			\
+  include/sched/notifier.hxx			\
+  include/sched/profiler.hh			\
+  include/sched/profiler.hxx			\
   include/sched/scheduler.hh			\
   include/sched/scheduler.hxx			\
+  include/sched/sleep-queue.hh			\
+  include/sched/sleep-queue.hxx			\
   include/sched/tag.hh				\
-  include/sched/tag.hxx
+  include/sched/tag.hxx				\
+  include/sched/workers.hh
 
 libcoroutine_includedir = $(sched_includedir)/libcoroutine
 libcoroutine_include_HEADERS =			\
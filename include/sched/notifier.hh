@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/notifier.hh
+ ** \brief Definition of sched::Notifier.
+ */
+
+#ifndef SCHED_NOTIFIER_HH
+# define SCHED_NOTIFIER_HH
+
+# include <boost/noncopyable.hpp>
+
+# include <sched/export.hh>
+# include <sched/fwd.hh>
+
+namespace sched
+{
+
+  /// Something jobs can wait for without being polled by the scheduler.
+  ///
+  /// A job calling Job::yield_until_notified() is parked by the scheduler
+  /// until the notifier is notified, the job state is changed explicitly,
+  /// or an exception is thrown to it. As with condition variables, the
+  /// waiting job must check the condition it is interested in when it is
+  /// resumed: in the polling compatibility mode of the scheduler, waiting
+  /// jobs are resumed at every round.
+  class SCHED_API Notifier: boost::noncopyable
+  {
+  public:
+    Notifier();
+    /// Wake up the waiting jobs.
+    ~Notifier();
+
+    /// Wake up all the waiting jobs.
+    void notify_all();
+
+    /// Wake up the job which has been waiting for the longest time.
+    void notify_one();
+
+    /// Whether some jobs are waiting.
+    bool has_waiters() const;
+
+  private:
+    friend class Job;
+
+    /// Wake up \a job which is waiting on us.
+    static void wake_up_(const rJob& job);
+
+    /// Stop \a job from waiting on its notifier, if any.
+    static void remove_(Job& job);
+
+    /// The waiting jobs, in arrival order.
+    jobs_type waiters_;
+  };
+
+} // namespace sched
+
+# include <sched/notifier.hxx>
+
+#endif // !SCHED_NOTIFIER_HH
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/notifier.hxx
+ ** \brief Inline implementation of sched::Notifier.
+ */
+
+#ifndef SCHED_NOTIFIER_HXX
+# define SCHED_NOTIFIER_HXX
+
+# include <sched/notifier.hh>
+
+namespace sched
+{
+
+  inline bool
+  Notifier::has_waiters() const
+  {
+    return !waiters_.empty();
+  }
+
+} // namespace sched
+
+#endif // !SCHED_NOTIFIER_HXX
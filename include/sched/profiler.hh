@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/profiler.hh
+ ** \brief Definition of sched::Profiler.
+ */
+
+#ifndef SCHED_PROFILER_HH
+# define SCHED_PROFILER_HH
+
+# include <deque>
+# include <iosfwd>
+# include <string>
+# include <vector>
+
+# include <boost/function.hpp>
+
+# include <libport/statistics.hh>
+# include <libport/ufloat.hh>
+# include <libport/utime.hh>
+
+# include <sched/export.hh>
+# include <sched/fwd.hh>
+# include <sched/job.hh>
+
+namespace sched
+{
+  /// Per-job profile of a scheduler: run time, resumes, scheduling
+  /// delay and stack usage.
+  ///
+  /// Install it with Scheduler::profiler_set(). Jobs report to it where
+  /// they call Job::hook_preempted() and Job::hook_resumed(), with the
+  /// monotonic libport::utime(), whatever the time of the scheduler.
+  /// The scheduling delay of a job is the time between the moment it
+  /// could run again (it yielded, its deadline passed, it was woken
+  /// up) and the moment it was resumed.
+  ///
+  /// A profiler is used by a single scheduler, hence by a single thread.
+  class SCHED_API Profiler
+  {
+  public:
+    Profiler();
+
+    typedef libport::Statistics<libport::utime_t, libport::ufloat>
+      time_stat_type;
+    typedef libport::Statistics<size_t, libport::ufloat> size_stat_type;
+
+    /// The profile of a job.
+    struct Profile
+    {
+      Profile(const std::string& name);
+
+      std::string name;
+      /// Duration of the slices the job ran.
+      time_stat_type run;
+      /// Scheduling delays.
+      time_stat_type delay;
+      /// Stack high-water mark, once terminated.
+      size_stat_type stack;
+      /// Whether the job terminated.
+      bool terminated;
+
+      // Current slice.
+      libport::utime_t resumed_at;
+      // When the job could run again, or 0 if unknown.
+      libport::utime_t ready_at;
+    };
+    typedef std::deque<Profile> profiles_type;
+
+    /// The profiles, in the order the jobs were first resumed.
+    const profiles_type& profiles_get() const;
+
+    /// Forget everything.
+    void clear();
+
+    /// How jobs are named, "Job(<address>)" by default.
+    typedef boost::function1<std::string, const Job&> namer_type;
+    void namer_set(const namer_type& namer);
+
+    /// Set the maximum number of slices kept for trace_dump(), 2^20 by
+    /// default. Further slices are only accounted in the profiles.
+    void max_slices_set(size_t max);
+
+    /// Print the profiles, the jobs which ran longer first.
+    std::ostream& dump(std::ostream& o) const;
+
+    /// Print the slices in the Chrome trace-event JSON format, to be
+    /// loaded by chrome://tracing.
+    std::ostream& trace_dump(std::ostream& o) const;
+
+    /// \name Reports from the jobs.
+    /// \{
+    void resumed(Job& job);
+    /// \param sleep  How long a sleeping job asked to sleep.
+    void preempted(Job& job, job_state state, libport::utime_t sleep = 0);
+    void woken_up(Job& job);
+    void terminated(Job& job);
+    /// \}
+
+  private:
+    /// The profile of \a job, created if needed.
+    Profile& profile_(Job& job);
+
+    /// A slice, for the trace.
+    struct Slice
+    {
+      size_t profile;
+      libport::utime_t start;
+      libport::utime_t duration;
+    };
+
+    /// Identifies the profiles of this profiler since its last clear()
+    /// in the jobs.
+    unsigned long generation_;
+    profiles_type profiles_;
+    std::vector<Slice> slices_;
+    size_t max_slices_;
+    namer_type namer_;
+  };
+
+  SCHED_API
+  std::ostream& operator<<(std::ostream& o, const Profiler& p);
+}
+
+# include <sched/profiler.hxx>
+
+#endif // !SCHED_PROFILER_HH
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/profiler.hxx
+ ** \brief Inline implementation of sched::Profiler.
+ */
+
+#ifndef SCHED_PROFILER_HXX
+# define SCHED_PROFILER_HXX
+
+# include <sched/profiler.hh>
+
+namespace sched
+{
+
+  inline
+  Profiler::Profile::Profile(const std::string& n)
+    : name(n)
+    , terminated(false)
+    , resumed_at(0)
+    , ready_at(0)
+  {
+  }
+
+  inline const Profiler::profiles_type&
+  Profiler::profiles_get() const
+  {
+    return profiles_;
+  }
+
+  inline void
+  Profiler::namer_set(const namer_type& namer)
+  {
+    namer_ = namer;
+  }
+
+  inline void
+  Profiler::max_slices_set(size_t max)
+  {
+    max_slices_ = max;
+  }
+
+  inline Profiler::Profile&
+  Profiler::profile_(Job& job)
+  {
+    if (job.profile_generation_ != generation_)
+    {
+      job.profile_generation_ = generation_;
+      job.profile_index_ = profiles_.size();
+      profiles_.push_back(Profile(namer_(job)));
+    }
+    return profiles_[job.profile_index_];
+  }
+
+  inline std::ostream&
+  operator<<(std::ostream& o, const Profiler& p)
+  {
+    return p.dump(o);
+  }
+
+} // namespace sched
+
+#endif // !SCHED_PROFILER_HXX
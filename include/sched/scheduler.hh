@@ -17,9 +17,13 @@
 # define SCHED_SCHEDULER_HH
 
 # include <iosfwd>
+# include <vector>
 
 # include <boost/any.hpp>
 # include <boost/function.hpp>
+# include <libport/intrusive-ptr.hh>
+# include <libport/lockable.hh>
+# include <libport/ref-counted.hh>
 # include <libport/ufloat.hh>
 # include <libport/statistics.hh>
 # include <boost/utility.hpp>
@@ -28,6 +32,8 @@
 # include <sched/coroutine.hh>
 # include <sched/export.hh>
 # include <sched/fwd.hh>
+# include <sched/job-queue.hh>
+# include <sched/sleep-queue.hh>
 
 namespace sched
 {
@@ -118,6 +124,16 @@ namespace sched
     /// action.
     void signal_stop(const Tag& tag, const boost::any& payload);
 
+    /// Signal that a tag has been frozen or unfrozen.
+    ///
+    /// \param tag The tag whose state changed.
+    ///
+    /// Parked jobs are not considered again until their deadline or
+    /// until they are woken up, but they must notice that they are
+    /// frozen or unfrozen: they will be reconsidered during the next
+    /// round, all of them unless indexed_tags_get().
+    void signal_freeze(const Tag& tag);
+
     /// Signal that an event implies that the scheduler should execute a new
     /// round after the current one.
     void signal_work_next_round();
@@ -134,7 +150,7 @@ namespace sched
 
     /// Get the current jobs list.
     ///
-    /// \return The currently non-terminated known jobs.
+    /// \return A snapshot of the currently non-terminated known jobs.
     jobs_type jobs_get() const;
 
     /// Get current mean and standard deviation (in libport::utime_t units) of
@@ -153,6 +169,33 @@ namespace sched
     /// Check whether we want real-time behavior or not.
     bool real_time_behavior_get() const;
 
+    /// Set whether waiting jobs are resumed at every round.
+    ///
+    /// This is the historical behavior, kept for compatibility. By
+    /// default, waiting jobs are parked until they are notified (see
+    /// Job::yield_until_notified()), unfrozen, or woken up explicitly.
+    void poll_waiting_jobs_set(bool poll);
+
+    /// Whether waiting jobs are resumed at every round.
+    bool poll_waiting_jobs_get() const;
+
+    /// Set whether the jobs of this scheduler report the tags they
+    /// hold (see Job::tag_acquired()).
+    ///
+    /// If so, stopping, blocking and freezing a tag only reach the jobs
+    /// holding it, instead of every job.
+    void indexed_tags_set(bool indexed);
+
+    /// Whether the jobs report the tags they hold.
+    bool indexed_tags_get() const;
+
+    /// Set the profiler the jobs report to, or 0 not to profile them.
+    /// It is not deleted by the scheduler.
+    void profiler_set(Profiler* profiler);
+
+    /// The profiler the jobs report to, if any.
+    Profiler* profiler_get() const;
+
     /// Sets whether to keep the list of jobs in the terminated state
     void keep_terminated_jobs_set(bool keep);
     /// Get the list of terminated jobs
@@ -169,40 +212,139 @@ namespace sched
     /// Notify the scheduler that one of its jobs was woken up.
     void job_was_woken_up();
 
+    /// Notify the scheduler that the state of \a job changed behind its
+    /// back.  If the job was sleeping, it is considered again during the
+    /// next round.
+    void job_state_changed(Job& job);
+
     /// Returns whether the scheduler is terminating.
     bool is_dying() const;
 
+    /// Number of jobs resumed during the last round.
+    size_t resumed_jobs_get() const;
+
+    /// Take charge of \a job, which comes from another scheduler.
+    ///
+    /// Must be called between two rounds, from the thread running this
+    /// scheduler.  The job is considered during the next round.
+    void adopt_job(rJob job);
+
+    /// Give away up to \a max runnable jobs which can be handed over to
+    /// another scheduler (see Job::migratable()) by appending them to
+    /// \a jobs, and return how many were released.
+    ///
+    /// Must be called between two rounds. The released jobs must be given
+    /// to another scheduler through adopt_job().
+    size_t release_jobs(jobs_type& jobs, size_t max);
+
+    class Mailbox;
+    typedef libport::intrusive_ptr<Mailbox> rMailbox;
+
+    /// A job of ours waiting, in the \c offloaded state, for a task run
+    /// by another thread (see Job::offload()).
+    class SCHED_API Offload: public libport::ThreadSafeRefCounted
+    {
+    public:
+      Offload(Job& job, rMailbox mailbox);
+      ~Offload();
+
+      /// Wake up the job during the next round.  May be called from any
+      /// thread, even once the scheduler is dead.
+      void complete();
+
+      /// The job, reset once it no longer waits.  Only manipulated from
+      /// the thread running the scheduler.
+      Job* job;
+
+    private:
+      rMailbox mailbox_;
+    };
+    typedef libport::intrusive_ptr<Offload> rOffload;
+
+    /// Register \a job, the current job, as waiting for a task.
+    rOffload offload(Job& job);
+
+    /// Set the function called, from any thread, when an offloaded task
+    /// completes, so that the thread running the scheduler calls work()
+    /// without waiting for the deadline.  Without it, rounds are run at
+    /// least every offload_poll while tasks are pending.  It is called
+    /// under a lock of the scheduler: it must be short, and must not
+    /// call the scheduler back.
+    void offload_hook_set(const boost::function0<void>& hook);
+
+    /// Maximum delay between two rounds while tasks are pending, if there
+    /// is no offload hook.
+    static const libport::utime_t offload_poll = 10000;
+
   private:
+    /// Wake up the jobs whose offloaded task completed.
+    ///
+    /// \return Whether some tasks are still pending.
+    bool offloads_completed_();
+
     /// Execute one round in the scheduler.
     ///
     /// \return See work().
     libport::utime_t execute_round();
 
     /// Compute and return next job to wake up.
-    void switch_to_next_(Coro* current, bool first_call = false);
+    void switch_to_next_(Coro* current);
+
+    /// Suspend \a job, the current job, until it is resumed.
+    ///
+    /// \return Whether the job must run, otherwise it must be suspended
+    ///         again by its scheduler, which may no longer be this one.
+    bool suspend_(rJob& job);
 
     /// Function to retrieve the current system time.
     boost::function0<libport::utime_t> get_time_;
 
-    /// List of jobs we are in charge of. During a cycle execution,
-    /// this is where jobs will accumulate themselves after they have
-    /// been executed.
-    jobs_type jobs_;
+    /// Run queue of the jobs we are in charge of. During a cycle
+    /// execution, this is where jobs will accumulate themselves after
+    /// they have been executed.
+    JobQueue jobs_;
+
+    /// Jobs still to be considered during the current round.
+    JobQueue pending_;
+
+    /// Jobs created during the current round, to be considered right
+    /// after the job that created them.
+    JobQueue created_;
 
-    /// List of jobs currently being scheduled during the current round.
-    jobs_type pending_;
+    /// Jobs which need not be considered before some date: sleeping
+    /// jobs, ordered by deadline, then jobs which can only be woken up
+    /// by an event (frozen jobs, jobs waiting for a notification or for
+    /// another job to terminate).
+    SleepQueue parked_;
+
+    /// Must every parked job be considered during the next round?
+    bool reconsider_parked_;
+
+    /// Are waiting jobs resumed at every round?
+    bool poll_waiting_jobs_;
+
+    /// Do jobs report the tags they hold?
+    bool indexed_tags_;
+
+    /// Profiler the jobs report to, if any. Do not delete.
+    Profiler* profiler_;
+
+    /// Jobs that terminated during the current round. They are released
+    /// at the beginning of the next one, once we no longer run on their
+    /// stack.
+    JobQueue zombies_;
 
     /// Current job.
     rJob current_job_;
 
     rJob idle_job_;
-    /// Iterator on the next job if iterating at the beginning of the
-    /// iteration.
-    jobs_type::iterator next_job_p_;
 
     /// Coroutine corresponding to the scheduler.
     Coro coro_;
 
+    /// Alternate stack on which stack overflows are reported.
+    void* signal_stack_;
+
     /// Has a new job been created?
     bool new_job_;
 
@@ -228,10 +370,13 @@ namespace sched
     /// Deadline for next round
     libport::utime_t deadline_;
 
+    /// Completed offloaded tasks, shared with the threads running them.
+    rMailbox mailbox_;
+
     // execute_round context
     libport::utime_t start_time_;
     bool at_least_one_started_;
-    jobs_type::iterator job_p_;
+    size_t resumed_jobs_;
   };
 
 } // namespace sched
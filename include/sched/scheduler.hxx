@@ -70,6 +70,49 @@ namespace sched
     return real_time_behavior_;
   }
 
+  inline size_t
+  Scheduler::resumed_jobs_get() const
+  {
+    return resumed_jobs_;
+  }
+
+  inline void
+  Scheduler::poll_waiting_jobs_set(bool poll)
+  {
+    poll_waiting_jobs_ = poll;
+    reconsider_parked_ = true;
+  }
+
+  inline bool
+  Scheduler::poll_waiting_jobs_get() const
+  {
+    return poll_waiting_jobs_;
+  }
+
+  inline void
+  Scheduler::indexed_tags_set(bool indexed)
+  {
+    indexed_tags_ = indexed;
+  }
+
+  inline bool
+  Scheduler::indexed_tags_get() const
+  {
+    return indexed_tags_;
+  }
+
+  inline void
+  Scheduler::profiler_set(Profiler* profiler)
+  {
+    profiler_ = profiler;
+  }
+
+  inline Profiler*
+  Scheduler::profiler_get() const
+  {
+    return profiler_;
+  }
+
   inline void
   Scheduler::keep_terminated_jobs_set(bool keep)
   {
@@ -100,6 +143,13 @@ namespace sched
     awoken_job_ = true;
   }
 
+  inline void
+  Scheduler::job_state_changed(Job& job)
+  {
+    if (SleepQueue::queued(job))
+      jobs_.push_back(parked_.remove(job));
+  }
+
   inline bool
   Scheduler::is_dying() const
   {
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/sleep-queue.hh
+ ** \brief Definition of sched::SleepQueue.
+ */
+
+#ifndef SCHED_SLEEP_QUEUE_HH
+# define SCHED_SLEEP_QUEUE_HH
+
+# include <vector>
+
+# include <boost/noncopyable.hpp>
+
+# include <libport/utime.hh>
+
+# include <sched/fwd.hh>
+
+namespace sched
+{
+
+  /// A binary min-heap of sleeping jobs, ordered by wake-up date.
+  ///
+  /// The queue holds a reference on every job it contains.  Each job
+  /// remembers its position in the heap, so that it can be removed in
+  /// logarithmic time when it is woken up before its deadline.
+  class SleepQueue: boost::noncopyable
+  {
+  public:
+    SleepQueue();
+    /// Release the jobs still queued.
+    ~SleepQueue();
+
+    /// Whether there is no job in the queue.
+    bool empty() const;
+
+    /// Number of queued jobs.
+    size_t size() const;
+
+    /// The earliest wake-up date. The queue must not be empty.
+    libport::utime_t deadline_get() const;
+
+    /// Insert \a job, to be woken up at \a deadline.  The job must not
+    /// belong to any queue.
+    void push(const rJob& job, libport::utime_t deadline);
+
+    /// Remove and return the job with the earliest wake-up date.  The
+    /// queue must not be empty.
+    rJob pop();
+
+    /// Remove \a job from the queue and return it.
+    rJob remove(Job& job);
+
+    /// Move all the jobs at the end of \a queue, in no particular order.
+    void flush(JobQueue& queue);
+
+    /// Release all the jobs.
+    void clear();
+
+    /// Append the queued jobs to \a jobs, in no particular order.
+    void copy_to(jobs_type& jobs) const;
+
+    /// Whether \a job belongs to a SleepQueue.
+    static bool queued(const Job& job);
+
+  private:
+    struct Entry
+    {
+      libport::utime_t deadline;
+      Job* job;
+    };
+
+    /// Put the entry \a e at position \a pos, and record it in the job.
+    void set_(size_t pos, const Entry& e);
+    /// Restore the heap property by moving \a e from \a pos.
+    void sift_up_(size_t pos, const Entry& e);
+    void sift_down_(size_t pos, const Entry& e);
+    /// Remove the entry at \a pos and return its job.
+    rJob erase_(size_t pos);
+
+    std::vector<Entry> heap_;
+  };
+
+} // namespace sched
+
+// The inline implementation requires Job to be complete, it is
+// included by sched/job.hh.
+
+#endif // !SCHED_SLEEP_QUEUE_HH
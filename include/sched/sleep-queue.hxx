@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/sleep-queue.hxx
+ ** \brief Inline implementation of sched::SleepQueue.
+ */
+
+#ifndef SCHED_SLEEP_QUEUE_HXX
+# define SCHED_SLEEP_QUEUE_HXX
+
+# include <libport/cassert>
+
+# include <sched/sleep-queue.hh>
+# include <sched/job.hh>
+
+namespace sched
+{
+
+  inline
+  SleepQueue::SleepQueue()
+  {
+  }
+
+  inline
+  SleepQueue::~SleepQueue()
+  {
+    clear();
+  }
+
+  inline bool
+  SleepQueue::empty() const
+  {
+    return heap_.empty();
+  }
+
+  inline size_t
+  SleepQueue::size() const
+  {
+    return heap_.size();
+  }
+
+  inline libport::utime_t
+  SleepQueue::deadline_get() const
+  {
+    aver(!heap_.empty());
+    return heap_.front().deadline;
+  }
+
+  inline void
+  SleepQueue::push(const rJob& job, libport::utime_t deadline)
+  {
+    aver(job);
+    aver(!queued(*job));
+    aver(!JobQueue::queued(*job));
+    job->counter_inc();
+    Entry e = { deadline, job.get() };
+    heap_.push_back(e);
+    sift_up_(heap_.size() - 1, e);
+  }
+
+  inline rJob
+  SleepQueue::pop()
+  {
+    aver(!heap_.empty());
+    return erase_(0);
+  }
+
+  inline rJob
+  SleepQueue::remove(Job& job)
+  {
+    aver(queued(job));
+    aver_eq(heap_[job.sleep_index_].job, &job);
+    return erase_(job.sleep_index_);
+  }
+
+  inline void
+  SleepQueue::flush(JobQueue& queue)
+  {
+    for (size_t i = 0; i < heap_.size(); ++i)
+    {
+      Job* job = heap_[i].job;
+      job->sleep_index_ = Job::not_sleeping;
+      queue.push_back(job);
+      // The reference is now held by queue.
+      job->counter_dec();
+    }
+    heap_.clear();
+  }
+
+  inline void
+  SleepQueue::clear()
+  {
+    // Clear heap_ before releasing, a destructor could reach us.
+    std::vector<Entry> heap;
+    heap.swap(heap_);
+    for (size_t i = 0; i < heap.size(); ++i)
+    {
+      heap[i].job->sleep_index_ = Job::not_sleeping;
+      if (heap[i].job->counter_dec())
+        delete heap[i].job;
+    }
+  }
+
+  inline void
+  SleepQueue::copy_to(jobs_type& jobs) const
+  {
+    for (size_t i = 0; i < heap_.size(); ++i)
+      jobs.push_back(heap_[i].job);
+  }
+
+  inline bool
+  SleepQueue::queued(const Job& job)
+  {
+    return job.sleep_index_ != Job::not_sleeping;
+  }
+
+  inline void
+  SleepQueue::set_(size_t pos, const Entry& e)
+  {
+    heap_[pos] = e;
+    e.job->sleep_index_ = pos;
+  }
+
+  inline void
+  SleepQueue::sift_up_(size_t pos, const Entry& e)
+  {
+    while (pos)
+    {
+      size_t parent = (pos - 1) / 2;
+      if (heap_[parent].deadline <= e.deadline)
+        break;
+      set_(pos, heap_[parent]);
+      pos = parent;
+    }
+    set_(pos, e);
+  }
+
+  inline void
+  SleepQueue::sift_down_(size_t pos, const Entry& e)
+  {
+    size_t size = heap_.size();
+    while (true)
+    {
+      size_t child = 2 * pos + 1;
+      if (size <= child)
+        break;
+      if (child + 1 < size
+          && heap_[child + 1].deadline < heap_[child].deadline)
+        ++child;
+      if (e.deadline <= heap_[child].deadline)
+        break;
+      set_(pos, heap_[child]);
+      pos = child;
+    }
+    set_(pos, e);
+  }
+
+  inline rJob
+  SleepQueue::erase_(size_t pos)
+  {
+    rJob res = heap_[pos].job;
+    // Hand our reference over to res, it cannot be the last one.
+    res->counter_dec();
+    res->sleep_index_ = Job::not_sleeping;
+    Entry last = heap_.back();
+    heap_.pop_back();
+    if (pos < heap_.size())
+    {
+      if (pos && last.deadline < heap_[(pos - 1) / 2].deadline)
+        sift_up_(pos, last);
+      else
+        sift_down_(pos, last);
+    }
+    return res;
+  }
+
+} // namespace sched
+
+#endif // !SCHED_SLEEP_QUEUE_HXX
@@ -13,13 +13,16 @@
 
 # include <boost/any.hpp>
 # include <boost/signals.hpp>
+# include <boost/unordered_map.hpp>
 
+# include <libport/adaptive-lock.hh>
 # include <libport/attributes.hh>
 # include <libport/finally.hh>
 # include <libport/symbol.hh>
 
 # include <sched/export.hh>
 # include <sched/fwd.hh>
+# include <sched/notifier.hh>
 
 namespace sched
 {
@@ -63,7 +66,7 @@ namespace sched
   // when they resume execution, if they get the same tag again, they will
   // not act as if they were blocked again.
 
-  class SCHED_API Tag: public libport::RefCounted
+  class SCHED_API Tag: public ref_counted_type
   {
   public:
     // Create a new tag.
@@ -98,12 +101,27 @@ namespace sched
     boost::signal0<void>& freeze_hook_get();
     boost::signal0<void>& unfreeze_hook_get();
 
+    // Notified when the tag is unfrozen. Jobs can wait for it through
+    // Job::yield_until_notified() instead of being polled.
+    Notifier& unfreeze_notifier_get();
+
     // Used to check the validity of cached results made on tag status.
     static unsigned long get_step_number();
 
+    // Append to \a jobs the jobs which reported holding this tag through
+    // Job::tag_acquired().
+    void holders_get(jobs_type& jobs) const;
+
   private:
     explicit Tag(const Tag&);
 
+    // The jobs holding this tag, and how many times they hold it, under
+    // holders_lock_: they may be run by different workers.
+    friend class Job;
+    typedef boost::unordered_map<Job*, unsigned> holders_type;
+    holders_type holders_;
+    mutable libport::AdaptiveLock holders_lock_;
+
     bool blocked_;
     bool frozen_;
     bool flow_control_;
@@ -112,6 +130,7 @@ namespace sched
     boost::any payload_;
     boost::signal0<void> freeze_hook_;
     boost::signal0<void> unfreeze_hook_;
+    Notifier unfreeze_notifier_;
     static unsigned long step_;
   };
 
@@ -27,11 +27,6 @@ namespace sched
   {
   }
 
-  inline
-  Tag::~Tag()
-  {
-  }
-
   inline bool
   Tag::frozen() const
   {
@@ -45,12 +40,13 @@ namespace sched
   }
 
   inline void
-  Tag::freeze(Scheduler&)
+  Tag::freeze(Scheduler& sched)
   {
     if (frozen_)
       return;
     frozen_ = true;
     step_++;
+    sched.signal_freeze(*this);
     freeze_hook_();
   }
 
@@ -61,8 +57,10 @@ namespace sched
       return;
     frozen_ = false;
     step_++;
+    sched.signal_freeze(*this);
     sched.signal_work_next_round();
     unfreeze_hook_();
+    unfreeze_notifier_.notify_all();
   }
 
   inline void
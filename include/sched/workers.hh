@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/workers.hh
+ ** \brief Definition of sched::Workers.
+ */
+
+#ifndef SCHED_WORKERS_HH
+# define SCHED_WORKERS_HH
+
+# include <vector>
+
+# include <boost/any.hpp>
+# include <boost/function.hpp>
+# include <boost/noncopyable.hpp>
+
+# include <libport/config.h>
+# include <libport/lockable.hh>
+# include <libport/semaphore.hh>
+# include <libport/utime.hh>
+
+# include <sched/export.hh>
+# include <sched/fwd.hh>
+
+// Without it, the current coroutine is shared by every thread.
+# if !defined LIBPORT_SCHED_MULTITHREAD && !defined BUILDING_LIBSCHED
+#  error "sched::Workers requires --enable-sched-multithread"
+# endif
+
+namespace sched
+{
+
+  /// A set of schedulers, each one run by its own worker thread.
+  ///
+  /// A worker which has nothing to run asks the busiest one for some of
+  /// its jobs, which are handed over between two rounds (see
+  /// Scheduler::release_jobs()).  Only migratable jobs move (see
+  /// Job::migratable()); pinned jobs stay on their worker.
+  ///
+  /// Schedulers and jobs are not thread-safe: a job must only be
+  /// manipulated by the worker running it, and must not share references
+  /// with jobs run by other workers.  Tags used by jobs of several workers
+  /// must be acted upon through freeze(), unfreeze(), block(), unblock()
+  /// and stop(), which apply to every worker at once.  Their holders
+  /// (see Scheduler::indexed_tags_set()) are locked, but such a tag must
+  /// not be destroyed while jobs of another worker hold it.
+  ///
+  /// Each thread must have its own current coroutine: libsched must be
+  /// configured with --enable-sched-multithread (SCHED_MULTITHREAD with
+  /// CMake), which also makes the job and tag counters atomic.  The
+  /// schedulers must not be given an idle job.
+  class SCHED_API Workers: boost::noncopyable
+  {
+  public:
+    /// Start the worker threads.
+    ///
+    /// \param get_time  A function returning the current system time.
+    /// \param size      The number of workers, one per processor if 0.
+    Workers(boost::function0<libport::utime_t> get_time, size_t size = 0);
+
+    /// Kill all the jobs and wait for the workers to terminate.
+    ~Workers();
+
+    /// The number of workers.
+    size_t size() const;
+
+    /// The scheduler run by the \a i-th worker.  Jobs must be created
+    /// with one of them, but must only be started through start_job().
+    Scheduler& scheduler_get(size_t i = 0) const;
+
+    /// The scheduler run by the calling thread, if it is a worker.
+    Scheduler* current_scheduler_get() const;
+
+    /// Start \a job on the least loaded worker.  May be called from any
+    /// thread.  The workers take the only reference to \a job.
+    void start_job(Job* job);
+
+    /// Run \a f while no worker is running a job, except the caller if
+    /// it is a worker.
+    ///
+    /// The workers are kicked afterward so that they take the changes
+    /// into account.
+    void synchronize(const boost::function0<void>& f);
+
+    /// Act on \a tag for the jobs of every worker.
+    /// \{
+    void freeze(Tag& tag);
+    void unfreeze(Tag& tag);
+    void block(Tag& tag, const boost::any& payload);
+    void unblock(Tag& tag);
+    void stop(const Tag& tag, const boost::any& payload);
+    /// \}
+
+  private:
+    class Worker;
+    friend class Worker;
+
+    /// The worker running in the calling thread, if any.
+    Worker* current_() const;
+
+    /// The scheduler which must apply tag operations first: the one of
+    /// the calling thread, so that it can be interrupted.
+    Scheduler& home_() const;
+
+    /// The most loaded worker other than \a thief, if it has jobs to
+    /// spare.
+    Worker* busiest_(const Worker& thief) const;
+
+    /// Wake up an idle worker, so that it can steal jobs.
+    void wake_idle_();
+
+    /// Ask every worker to kill its jobs and terminate.
+    void stopping_();
+
+    void freeze_(Tag& tag);
+    void unfreeze_(Tag& tag);
+    void block_(Tag& tag, const boost::any& payload);
+    void unblock_(Tag& tag);
+    void stop_(const Tag& tag, const boost::any& payload);
+    void stop_inboxes_(const Tag& tag, const boost::any& payload);
+
+    /// Function to retrieve the current system time.
+    boost::function0<libport::utime_t> get_time_;
+
+    /// The workers.
+    std::vector<Worker*> workers_;
+
+    /// Held by synchronize(), keeps workers from starting new rounds.
+    libport::Lockable turnstile_;
+
+    /// Released by workers once they are started.
+    libport::Semaphore ready_;
+
+    /// Number of workers waiting for something to do.
+    long idle_;
+  };
+
+} // namespace sched
+
+#endif // !SCHED_WORKERS_HH
@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <algorithm>
+#include <climits>
+
+#include <libport/adaptive-lock.hh>
+#include <libport/atomic.hh>
+#include <libport/cassert>
+#include <libport/unistd.h>
+
+#if defined LIBPORT_HAVE_FUTEX
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+
+namespace libport
+{
+  namespace
+  {
+    /// Spinning is useless on a single processor: the owner cannot
+    /// release the lock while we hold the processor.
+    int
+    spin_max()
+    {
+#if defined WIN32
+      SYSTEM_INFO si;
+      GetSystemInfo(&si);
+      return 1 < si.dwNumberOfProcessors ? 4000 : 0;
+#elif defined _SC_NPROCESSORS_ONLN
+      return 1 < sysconf(_SC_NPROCESSORS_ONLN) ? 100 : 0;
+#else
+      return 100;
+#endif
+    }
+
+    const int spins = spin_max();
+
+    inline
+    void
+    count(long& contentions)
+    {
+#ifdef LIBPORT_HAVE_ATOMIC
+      atomic::increment_fetch(&contentions);
+#else
+      ++contentions;
+#endif
+    }
+
+#if defined LIBPORT_HAVE_FUTEX
+    /// Let the other hyperthread run while spinning.
+    inline
+    void
+    relax()
+    {
+# if defined __i386__ || defined __x86_64__
+      __builtin_ia32_pause();
+# else
+      __sync_synchronize();
+# endif
+    }
+
+    /// Sleep if *addr is still \a value.
+    inline
+    void
+    futex_wait(volatile int* addr, int value)
+    {
+      syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, 0, 0, 0);
+    }
+
+    /// Wake up \a n threads sleeping on \a addr.
+    inline
+    void
+    futex_wake(volatile int* addr, int n)
+    {
+      syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+    }
+#endif
+  }
+
+
+  /*---------------.
+  | AdaptiveLock.  |
+  `---------------*/
+
+#if defined LIBPORT_HAVE_FUTEX
+
+  AdaptiveLock::AdaptiveLock()
+    : state_(0)
+    , spins_(0)
+    , contentions_(0)
+  {}
+
+  AdaptiveLock::~AdaptiveLock()
+  {}
+
+  void
+  AdaptiveLock::lock_slow_()
+  {
+    count(contentions_);
+    if (spins)
+    {
+      // Spin twice as long as the previous waits, and keep a running
+      // average of how long they actually were.  Locks that are held
+      // long stop spinning, short ones spin just enough.
+      int limit = std::min(spins, 2 * spins_ + 10);
+      int n = 0;
+      for (; n < limit; ++n)
+      {
+        relax();
+        if (!state_ && __sync_bool_compare_and_swap(&state_, 0, 1))
+          break;
+      }
+      spins_ += (n - spins_) / 8;
+      if (n < limit)
+        return;
+    }
+    // We do not know whether there are other sleepers: mark the lock as
+    // waited for, the unlock will wake someone up in vain at worst.
+    while (__sync_lock_test_and_set(&state_, 2))
+      futex_wait(&state_, 2);
+  }
+
+  void
+  AdaptiveLock::unlock_slow_()
+  {
+    __sync_lock_release(&state_);
+    futex_wake(&state_, 1);
+  }
+
+#elif defined WIN32
+
+  AdaptiveLock::AdaptiveLock()
+    : contentions_(0)
+  {
+    InitializeCriticalSectionAndSpinCount(&lock_, spins);
+  }
+
+  AdaptiveLock::~AdaptiveLock()
+  {
+    DeleteCriticalSection(&lock_);
+  }
+
+  void
+  AdaptiveLock::lock_slow_()
+  {
+    count(contentions_);
+    // Spins with the count given at construction, then sleeps.
+    EnterCriticalSection(&lock_);
+  }
+
+#else
+
+  AdaptiveLock::AdaptiveLock()
+    : contentions_(0)
+  {
+    // A default, hence non-recursive, mutex.
+    pthread_mutex_init(&lock_, 0);
+  }
+
+  AdaptiveLock::~AdaptiveLock()
+  {
+    pthread_mutex_destroy(&lock_);
+  }
+
+  void
+  AdaptiveLock::lock_slow_()
+  {
+    count(contentions_);
+    for (int n = 0; n < spins; ++n)
+      if (!pthread_mutex_trylock(&lock_))
+        return;
+    pthread_mutex_lock(&lock_);
+  }
+
+#endif
+
+
+  /*-----------------.
+  | AdaptiveRWLock.  |
+  `-----------------*/
+
+#if defined LIBPORT_HAVE_FUTEX
+
+  AdaptiveRWLock::AdaptiveRWLock()
+    : state_(0)
+    , sleepers_(0)
+    , sequence_(0)
+    , contentions_(0)
+  {}
+
+  AdaptiveRWLock::~AdaptiveRWLock()
+  {}
+
+  bool
+  AdaptiveRWLock::tryReadLock()
+  {
+    while (true)
+    {
+      int s = state_;
+      if (s < 0)
+        return false;
+      if (__sync_bool_compare_and_swap(&state_, s, s + 1))
+        return true;
+    }
+  }
+
+  bool
+  AdaptiveRWLock::tryWriteLock()
+  {
+    return __sync_bool_compare_and_swap(&state_, 0, -1);
+  }
+
+  void
+  AdaptiveRWLock::readLock()
+  {
+    if (!tryReadLock())
+      wait_(&AdaptiveRWLock::tryReadLock);
+  }
+
+  void
+  AdaptiveRWLock::writeLock()
+  {
+    if (!tryWriteLock())
+      wait_(&AdaptiveRWLock::tryWriteLock);
+  }
+
+  void
+  AdaptiveRWLock::readUnlock()
+  {
+    aver_gt(state_, 0);
+    // The atomic operation is a full barrier: sleepers_ is read after
+    // the release.
+    if (!__sync_sub_and_fetch(&state_, 1) && sleepers_)
+      wake_();
+  }
+
+  void
+  AdaptiveRWLock::writeUnlock()
+  {
+    aver_eq(state_, -1);
+    __sync_lock_release(&state_);
+    __sync_synchronize();
+    if (sleepers_)
+      wake_();
+  }
+
+  void
+  AdaptiveRWLock::wait_(bool (AdaptiveRWLock::*acquire)())
+  {
+    count(contentions_);
+    for (int n = 0; n < spins; ++n)
+    {
+      relax();
+      if ((this->*acquire)())
+        return;
+    }
+    while (true)
+    {
+      // Read the sequence before trying again: if the lock is released
+      // in between, the sequence changed and we do not sleep.
+      int seq = sequence_;
+      __sync_add_and_fetch(&sleepers_, 1);
+      bool acquired = (this->*acquire)();
+      if (!acquired)
+        futex_wait(&sequence_, seq);
+      __sync_sub_and_fetch(&sleepers_, 1);
+      if (acquired || (this->*acquire)())
+        return;
+    }
+  }
+
+  void
+  AdaptiveRWLock::wake_()
+  {
+    // Wake everybody: all the readers may enter, and the losers sleep
+    // again.
+    __sync_add_and_fetch(&sequence_, 1);
+    futex_wake(&sequence_, INT_MAX);
+  }
+
+#elif defined WIN32
+
+  AdaptiveRWLock::AdaptiveRWLock()
+    : contentions_(0)
+  {}
+
+  AdaptiveRWLock::~AdaptiveRWLock()
+  {}
+
+  void
+  AdaptiveRWLock::readUnlock()
+  {
+    lock_.unlock();
+  }
+
+  void
+  AdaptiveRWLock::writeUnlock()
+  {
+    lock_.unlock();
+  }
+
+  void
+  AdaptiveRWLock::readLock()
+  {
+    writeLock();
+  }
+
+  void
+  AdaptiveRWLock::writeLock()
+  {
+    if (!lock_.tryLock())
+    {
+      count(contentions_);
+      lock_.lock();
+    }
+  }
+
+  bool
+  AdaptiveRWLock::tryReadLock()
+  {
+    return lock_.tryLock();
+  }
+
+  bool
+  AdaptiveRWLock::tryWriteLock()
+  {
+    return lock_.tryLock();
+  }
+
+#else
+
+  AdaptiveRWLock::AdaptiveRWLock()
+    : contentions_(0)
+  {
+    pthread_rwlock_init(&lock_, 0);
+  }
+
+  AdaptiveRWLock::~AdaptiveRWLock()
+  {
+    pthread_rwlock_destroy(&lock_);
+  }
+
+  void
+  AdaptiveRWLock::readLock()
+  {
+    if (pthread_rwlock_tryrdlock(&lock_))
+    {
+      count(contentions_);
+      pthread_rwlock_rdlock(&lock_);
+    }
+  }
+
+  void
+  AdaptiveRWLock::writeLock()
+  {
+    if (pthread_rwlock_trywrlock(&lock_))
+    {
+      count(contentions_);
+      pthread_rwlock_wrlock(&lock_);
+    }
+  }
+
+  void
+  AdaptiveRWLock::readUnlock()
+  {
+    pthread_rwlock_unlock(&lock_);
+  }
+
+  void
+  AdaptiveRWLock::writeUnlock()
+  {
+    pthread_rwlock_unlock(&lock_);
+  }
+
+  bool
+  AdaptiveRWLock::tryReadLock()
+  {
+    return !pthread_rwlock_tryrdlock(&lock_);
+  }
+
+  bool
+  AdaptiveRWLock::tryWriteLock()
+  {
+    return !pthread_rwlock_trywrlock(&lock_);
+  }
+
+#endif
+}
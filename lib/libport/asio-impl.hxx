@@ -27,10 +27,12 @@
 #  include <boost/lambda/construct.hpp>
 #include <libport/system-warning-pop.hh>
 
+#include <libport/adaptive-lock.hh>
 #include <libport/lexical-cast.hh>
 #include <libport/lockable.hh>
 #include <libport/semaphore.hh>
 #include <libport/thread.hh>
+#include <libport/timer-wheel.hh>
 #include <libport/unistd.h>
 
 #if BOOST_VERSION >= 106800
@@ -57,16 +59,66 @@ namespace libport
                <boost::asio::ip::udp,
                 boost::asio::datagram_socket_service<boost::asio::ip::udp> >
             udpsock;
+    typedef boost::asio::ip::tcp::socket tcpsock;
 
     template<class Stream> class SocketImpl;
 
+    /// A file being sent, see Socket::sendFile.
+    struct SocketImplBase::FileTransfer
+    {
+      native_handle_type fd;
+      /// Whether \a fd is a pipe, spliced, rather than a file.
+      bool pipe;
+      off_t offset;
+      /// Bytes to send, 0 for up to the end.
+      size_t length;
+      size_t sent;
+      BaseSocket::onsent_type onSent;
+      BaseSocket::onprogress_type onProgress;
+# if ! defined WIN32
+      /// To wait for data on a pipe, on a duplicate of \a fd.
+      boost::scoped_ptr<boost::asio::posix::stream_descriptor> input;
+      /// Read but not sent yet, without splice.
+      std::string pending;
+# endif
+    };
+
+    /// Zero-copy transfers are only possible from the plain sockets.
+    template<class T>
+    boost::system::error_code
+    send_file(SocketImpl<T>*, native_handle_type, size_t, size_t,
+              const BaseSocket::onsent_type&,
+              const BaseSocket::onprogress_type&)
+    {
+      return errorcodes::make_error_code(errorcodes::operation_not_supported);
+    }
+
+    template<class T>
+    void
+    start_file(SocketImpl<T>*)
+    {
+      // Never queued.
+    }
+
+# if ! defined WIN32
+    boost::system::error_code
+    send_file(SocketImpl<tcpsock>* s, native_handle_type fd,
+              size_t offset, size_t length,
+              const BaseSocket::onsent_type& onSent,
+              const BaseSocket::onprogress_type& onProgress);
+    /// Wait until files_.front() can make progress.
+    void
+    start_file(SocketImpl<tcpsock>* s);
+# endif
+
     template<typename Stream, typename Lock>
     void
     read_or_recv(SocketImpl<Stream>* s, Lock lock);
 
     void
     onConnect(boost::system::error_code erc,
-              boost::asio::deadline_timer & timer,
+              TimerWheel& wheel,
+              const TimerWheel::Handle& timer,
               libport::Semaphore& sem,
               boost::system::error_code& caller_erc);
 
@@ -89,6 +141,7 @@ namespace libport
       }
 
       void write(const void* data, size_t length);
+      void write(const SharedBuffer& data);
       void close();
 
       unsigned short getRemotePort() const;
@@ -107,15 +160,26 @@ namespace libport
       {
         return bytesSent_;
       }
+      boost::system::error_code
+      sendFile(native_handle_type fd, size_t offset, size_t length,
+               const onsent_type& onSent, const onprogress_type& onProgress);
       template<typename Acceptor, typename BaseFactory>
       static void
       onAccept(io_service& io, boost::system::error_code erc, Stream* s,
-               SocketFactory fact, Acceptor *a, BaseFactory bf);
+               SocketFactory fact, Acceptor *a, BaseFactory bf,
+               size_t batch, bool pooled);
 
+      /// Wait for a connection on \a a, then accept up to \a batch
+      /// connections, on io_services of the pool if \a pooled.
       template<typename Acceptor, typename BaseFactory>
       static void
       acceptOne(io_service& io, SocketFactory fact, Acceptor *a,
-                BaseFactory bf);
+                BaseFactory bf, size_t batch = 1, bool pooled = true);
+
+      /// Bind the accepted stream \a s to a new socket.
+      template<typename BaseFactory>
+      static void
+      accepted(Stream* s, SocketFactory fact, BaseFactory bf);
 
       static BaseSocket* create(Stream* base);
       void startReader();
@@ -129,6 +193,10 @@ namespace libport
       virtual void doDestroy();
     private:
       Stream* base_;
+      /// Start writing the queued buffers if no write is in progress.
+      void startWrite();
+      /// Queue \a data, in the strand.
+      void strandWrite(DestructionLock lock, const SharedBuffer& data);
       void continueWrite(DestructionLock lock, boost::system::error_code erc,
 			 size_t sz);
       void onReadDemux(DestructionLock lock, boost::system::error_code erc,
@@ -141,11 +209,34 @@ namespace libport
 
       template<class T>
         friend void send_bounce(SocketImpl<T>*,const void*, size_t);
+      template<class T>
+        friend void send_bounce(SocketImpl<T>*, const SharedBuffer&);
+      template<class T>
+        friend void notify_high_water(SocketImpl<T>*);
+# if ! defined WIN32
+      friend boost::system::error_code
+      send_file(SocketImpl<tcpsock>* s, native_handle_type fd,
+                size_t offset, size_t length,
+                const BaseSocket::onsent_type& onSent,
+                const BaseSocket::onprogress_type& onProgress);
+      friend void start_file(SocketImpl<tcpsock>* s);
+      friend boost::function1<void, boost::system::error_code>
+      continue_handler(SocketImpl<tcpsock>* s);
+      friend void wait_file(SocketImpl<tcpsock>* s, FileTransfer& f,
+                            bool input);
+      friend void queue_file(SocketImpl<tcpsock>* s, DestructionLock,
+                             const FileTransferPtr& f);
+      friend void continue_file(SocketImpl<tcpsock>* s, DestructionLock,
+                                boost::system::error_code erc);
+# endif
 
       friend void
       recv_bounce(SocketImpl<udpsock>*s, AsioDestructible::DestructionLock lock,
 		  boost::system::error_code erc, size_t recv);
-      std::vector<char> udpBuffer_;
+      friend void
+      send_check(boost::system::error_code erc, SocketImpl<udpsock>*s,
+                 AsioDestructible::DestructionLock, SharedBuffer buffer,
+                 utime_t since);
       unsigned long bytesReceived_;
       unsigned long bytesSent_;
     };
@@ -158,6 +249,8 @@ namespace libport
     public:
       AcceptorImpl(boost::asio::io_service& io, Acceptor* base);
       ~AcceptorImpl();
+      /// Another acceptor, sharing the port of the first one.
+      void add(Acceptor* base);
       bool isConnected() const
       {
         return false;
@@ -186,7 +279,10 @@ namespace libport
       native_handle_type getFD() const;
 
     private:
+      /// The first one.
       Acceptor* base_;
+      /// The others, with SO_REUSEPORT.
+      std::vector<Acceptor*> others_;
     };
 
     template<class Acceptor>
@@ -205,6 +301,13 @@ namespace libport
       delete base_;
     }
 
+    template<class Acceptor>
+    void
+    AcceptorImpl<Acceptor>::add(Acceptor* base)
+    {
+      others_.push_back(base);
+    }
+
     template<class Acceptor>
     void
     AcceptorImpl<Acceptor>::close()
@@ -213,6 +316,9 @@ namespace libport
       if (base_)
         base_->close(erc);
       base_ = 0;
+      foreach (Acceptor* a, others_)
+        a->close(erc);
+      others_.clear();
     }
 
     template<class Acceptor>
@@ -267,6 +373,7 @@ namespace libport
     void
     SocketImpl<Stream>::close()
     {
+      cancelIdle_();
       if (base_->lowest_layer().is_open())
       {
         Destructible::DestructionLock l = getDestructionLock();
@@ -364,14 +471,11 @@ namespace libport
     std::string
     SocketImpl<Stream>::read_(size_t length)
     {
-      std::string buffer;
-      boost::asio::read(*base_, readBuffer_,
+      boost::asio::read(*base_, readBuffer_.prepare(length),
                         transfer_exactly(length));
-      std::istream is(&readBuffer_);
-      buffer.resize(length);
-      is.read(&buffer[0], length);
-      long len = is.gcount();
-      buffer.resize(len);
+      readBuffer_.commit(length);
+      std::string buffer(length, 0);
+      buffer.resize(readBuffer_.read(&buffer[0], length));
       bytesReceived_ += length;
       return buffer;
     }
@@ -420,22 +524,109 @@ namespace libport
     }
 
 
+    /// Lock \a l, unless the handlers are serialized by a strand.
+    template <typename Lock>
+    class BasicStrandLock
+    {
+    public:
+      BasicStrandLock(Lock& l, bool strand)
+        : lockable_(strand ? 0 : &l)
+      {
+        if (lockable_)
+          lockable_->lock();
+      }
+      ~BasicStrandLock()
+      {
+        if (lockable_)
+          lockable_->unlock();
+      }
+    private:
+      Lock* lockable_;
+    };
+
+    /// For the socket itself.
+    typedef BasicStrandLock<Lockable> StrandLock;
+    /// For its callbackLock.
+    typedef BasicStrandLock<RecursiveAdaptiveLock> CallbackStrandLock;
+
+    /// Tell the writers whether too much data is waiting, once the
+    /// queue crossed a water mark.  Both edges are delivered under
+    /// callbackLock, with the current state rather than the edge which
+    /// triggered the call, so that the last call is always right.
+    template<class T>
+    void
+    notify_high_water(SocketImpl<T>* s)
+    {
+      CallbackStrandLock bl(s->callbackLock, s->strand_.get());
+      bool above;
+      {
+        StrandLock bls(*s, s->strand_.get());
+        above = s->aboveHighWater_;
+      }
+      if (above == s->notifiedHighWater_)
+        return;
+      s->notifiedHighWater_ = above;
+      if (s->onWriteHighWaterFunc)
+        s->onWriteHighWaterFunc(above);
+    }
+
+    // Queue the data, and write it with the buffers queued meanwhile,
+    // with a single gather write, as soon as the write in progress
+    // completes.  In the strand, the queue is not locked.
+    template<class T>
+    void
+    send_bounce(SocketImpl<T>* s, const void* buffer, size_t length)
+    {
+      bool above;
+      if (!s->strand_)
+      {
+        libport::BlockLock bl(s);
+        above = s->enqueue_(buffer, length);
+        s->startWrite();
+      }
+      else if (s->strand_->running_in_this_thread())
+      {
+        above = s->enqueue_(buffer, length);
+        s->startWrite();
+      }
+      else
+      {
+        // Copy the data to queue it later, in the strand.
+        send_bounce(s, SharedBuffer(
+                      new std::string(static_cast<const char*>(buffer),
+                                      length)));
+        return;
+      }
+      if (above)
+        notify_high_water(s);
+    }
+
     template<class T>
     void
-    send_bounce(SocketImpl<T>* s,const void* buffer, size_t length)
+    send_bounce(SocketImpl<T>* s, const SharedBuffer& buffer)
     {
-      libport::BlockLock bl(s);
-      s->buffers_[s->current_==-1 ? 0:1-s->current_]
-         .sputn((const char*)buffer, length);
-      s->pending_ = true;
-      if (s->current_ == -1)
+      bool above;
+      if (!s->strand_)
       {
-        s->current_ = 1; // We wrote on 0, continueWrite will swap.
-        s->continueWrite(s->getDestructionLock(),
-                         boost::system::error_code(),
-                         0);
+        libport::BlockLock bl(s);
+        above = s->enqueue_(buffer);
+        s->startWrite();
       }
+      else if (s->strand_->running_in_this_thread())
+      {
+        above = s->enqueue_(buffer);
+        s->startWrite();
+      }
+      else
+      {
+        s->strand_->post(boost::bind(&SocketImpl<T>::strandWrite,
+                                     s, s->getDestructionLock(), buffer));
+        return;
+      }
+      if (above)
+        notify_high_water(s);
     }
+
     template<typename Stream>
     void
     SocketImpl<Stream>::write(const void* buffer, size_t length)
@@ -445,42 +636,94 @@ namespace libport
 
     template<typename Stream>
     void
-    SocketImpl<Stream>::continueWrite(DestructionLock lock,
-                                      boost::system::error_code erc,
-                                      size_t sz)
+    SocketImpl<Stream>::write(const SharedBuffer& buffer)
     {
-      BlockLock blc(callbackLock);
-      if (erc)
-      {
-        if (onErrorFunc)
-          onErrorFunc(erc);
-      }
-      else
+      send_bounce(this, buffer);
+    }
+
+    template<typename Stream>
+    boost::system::error_code
+    SocketImpl<Stream>::sendFile(native_handle_type fd,
+                                 size_t offset, size_t length,
+                                 const onsent_type& onSent,
+                                 const onprogress_type& onProgress)
+    {
+      return send_file(this, fd, offset, length, onSent, onProgress);
+    }
+
+    template<typename Stream>
+    void
+    SocketImpl<Stream>::strandWrite(DestructionLock,
+                                    const SharedBuffer& buffer)
+    {
+      send_bounce(this, buffer);
+    }
+
+    template<typename Stream>
+    void
+    SocketImpl<Stream>::startWrite()
+    {
+      // Under the lock of this, or in the strand.
+      std::vector<boost::asio::const_buffer> buffers;
+      if (dequeue_(buffers))
       {
-        bytesSent_ += sz;
-        libport::BlockLock bl(this);
-        current_ = 1 - current_;
-        if (pending_)
+        if (strand_)
           boost::asio::async_write(
-            *base_, buffers_[current_],
-            boost::bind(&SocketImpl<Stream>::continueWrite,
-                        this, lock,  _1, _2));
+            *base_, buffers,
+            strand_->wrap(boost::bind(&SocketImpl<Stream>::continueWrite,
+                                      this, getDestructionLock(),  _1, _2)));
         else
-          current_ = -1;
-        pending_ = false;
+          boost::asio::async_write(
+            *base_, buffers,
+            boost::bind(&SocketImpl<Stream>::continueWrite,
+                        this, getDestructionLock(),  _1, _2));
       }
+      else if (fileNext_())
+        start_file(this);
     }
 
+    template<typename Stream>
+    void
+    SocketImpl<Stream>::continueWrite(DestructionLock,
+                                      boost::system::error_code erc,
+                                      size_t sz)
+    {
+      CallbackStrandLock blc(callbackLock, strand_.get());
+      if (!erc)
+        bytesSent_ += sz;
+      bool below;
+      {
+        StrandLock bl(*this, strand_.get());
+        // On errors, drop the buffers so that the writes queued since
+        // are still attempted, and their errors reported.
+        below = erc ? writeFailed_() : written_();
+        startWrite();
+      }
+      if (erc && onErrorFunc)
+        onErrorFunc(erc);
+      if (below)
+        notify_high_water(this);
+    }
+
+
+    /// Free space to ask for in the read buffer before reading.
+    static const size_t read_size = 4096;
 
     template<typename Stream, typename Lock>
     void
     read_or_recv(SocketImpl<Stream>* s,
                  Lock lock)
     {
-      boost::asio::async_read(*s->base_, s->readBuffer_,
-                              boost::asio::transfer_at_least(1),
-                              boost::bind(&SocketImpl<Stream>::onReadDemux,
-                                          s, lock, _1, _2));
+      // Scatter read in the free space of the ring.
+      if (s->strand_)
+        s->base_->async_read_some(
+          s->readBuffer_.prepare(read_size),
+          s->strand_->wrap(boost::bind(&SocketImpl<Stream>::onReadDemux,
+                                       s, lock, _1, _2)));
+      else
+        s->base_->async_read_some(
+          s->readBuffer_.prepare(read_size),
+          boost::bind(&SocketImpl<Stream>::onReadDemux, s, lock, _1, _2));
     }
     template<typename Stream>
     void
@@ -488,7 +731,7 @@ namespace libport
                                     boost::system::error_code erc,
                                     size_t sz)
     {
-      BlockLock bl(callbackLock);
+      CallbackStrandLock bl(callbackLock, strand_.get());
       if (erc)
       {
         if (onErrorFunc)
@@ -496,9 +739,23 @@ namespace libport
       }
       else
       {
+        readBuffer_.commit(sz);
         bytesReceived_ += sz;
+        utime_t start = utime();
+        {
+          BlockLock bl(this);
+          ++stats_.reads;
+          stats_.readBytes += sz;
+          stats_.readSize.add(sz);
+          lastActivity_ = start;
+        }
         if (onReadFunc)
+        {
           onReadFunc(readBuffer_);
+          utime_t time = utime() - start;
+          BlockLock bl(this);
+          stats_.handlerTime.add(time);
+        }
         if (isConnected() && !readOnce)
           read_or_recv(this, lock);
       }
@@ -520,10 +777,36 @@ namespace libport
                                  Stream* s,
                                  SocketFactory fact,
                                  Acceptor *a,
-                                 BaseFactory bf)
+                                 BaseFactory bf,
+                                 size_t batch,
+                                 bool pooled)
     {
       if (erc)
         return;
+      accepted(s, fact, bf);
+      // Drain the pending connections, the acceptor being non-blocking.
+      for (size_t i = 1; i < batch; ++i)
+      {
+        s = new Stream(pooled ? get_pooled_io_service() : io);
+        a->accept(*s, erc);
+        if (erc)
+        {
+          // Most likely would_block.  Other errors will be reported
+          // to the next asynchronous accept.
+          delete s;
+          break;
+        }
+        accepted(s, fact, bf);
+      }
+      acceptOne(io, fact, a, bf, batch, pooled);
+    }
+
+    template<typename Stream>
+    template<typename BaseFactory>
+    void
+    SocketImpl<Stream>::accepted(Stream* s, SocketFactory fact,
+                                 BaseFactory bf)
+    {
       if (SocketImplBase* wrapper = dynamic_cast<SocketImplBase*>(bf(s)))
       {
         // This is now connected.
@@ -539,7 +822,6 @@ namespace libport
         // Failure.
         delete s;
       }
-      acceptOne(io, fact, a, bf);
     }
 
     template<typename Stream>
@@ -547,14 +829,51 @@ namespace libport
     void
     SocketImpl<Stream>::acceptOne(io_service& io, SocketFactory fact,
                                   Acceptor *a,
-                                  BaseFactory bf)
+                                  BaseFactory bf,
+                                  size_t batch,
+                                  bool pooled)
     {
-      Stream* s = new Stream(io);
+      // Spread the accepted sockets over the io_service pool, if any.
+      Stream* s = new Stream(pooled ? get_pooled_io_service() : io);
       a->async_accept(
         *s,
         boost::bind(&SocketImpl<Stream>::template
                     onAccept<Acceptor, BaseFactory>,
-                    boost::ref(io), _1, s, fact, a, bf));
+                    boost::ref(io), _1, s, fact, a, bf, batch, pooled));
+    }
+
+    /// An acceptor listening on \a ep, non-blocking if \a nonBlocking,
+    /// or 0 and \a erc set.
+    template<typename Proto>
+    typename Proto::acceptor*
+    open_acceptor(io_service& io, const typename Proto::endpoint& ep,
+                  bool reusePort, bool nonBlocking,
+                  boost::system::error_code& erc)
+    {
+      typedef typename Proto::acceptor acceptor_type;
+      acceptor_type* res = new acceptor_type(io);
+      res->open(ep.protocol(), erc);
+      if (!erc)
+        res->set_option(typename acceptor_type::reuse_address(true), erc);
+# if defined SO_REUSEPORT
+      if (!erc && reusePort)
+        res->set_option(boost::asio::detail::socket_option::boolean
+                        <SOL_SOCKET, SO_REUSEPORT>(true), erc);
+# else
+      LIBPORT_USE(reusePort);
+# endif
+      if (!erc)
+        res->bind(ep, erc);
+      if (!erc)
+        res->listen(acceptor_type::max_connections, erc);
+      if (!erc && nonBlocking)
+        res->non_blocking(true, erc);
+      if (erc)
+      {
+        delete res;
+        res = 0;
+      }
+      return res;
     }
 
 
@@ -567,28 +886,38 @@ namespace libport
       return bs;
     }
 
+    /// The connection timed out, interrupt.
     template<class Socket>
     inline void
-    onTimer(boost::system::error_code erc,
-            Socket& s,
+    onTimer(Socket& s,
             libport::Semaphore& sem,
             Destructible::DestructionLock)
     {
-      // If timer reached the end, connection timeout, interrupt.
-      if (!erc)
-        s.close();
-      // Else we got aborted, do nothing
+      s.close();
       sem++;
     }
 
+    /// The asynchronous connection timed out, interrupt.
+    template<class Socket>
+    inline void
+    onAsyncTimer(Socket* s)
+    {
+      boost::system::error_code erc;
+      s->close(erc);
+    }
+
     template<typename Proto, class BaseFactory>
     void
     async_connect(typename Proto::socket* bs,
                   Socket* s,
                   Destructible::DestructionLock,
                   BaseFactory bf,
-                  const boost::system::error_code& error)
+                  const TimerWheel::Handle& timer,
+                  boost::system::error_code error)
     {
+      if (timer && !get_timer_wheel(s->get_io_service()).cancel(timer)
+          && error == boost::asio::error::operation_aborted)
+        error = make_error_code(errorcodes::timed_out);
       if (error)
       {
         s->onError(error);
@@ -612,6 +941,7 @@ namespace libport
                   Socket* s,
                   Destructible::DestructionLock l,
                   BaseFactory bf,
+                  useconds_t timeout,
                   boost::system::error_code error,
                   const typename Proto::resolver::iterator i)
     {
@@ -622,9 +952,15 @@ namespace libport
         typename Proto::endpoint ep = *i;
         typename Proto::socket* bs =
           new typename Proto::socket(r->get_io_service());
+        TimerWheel::Handle timer;
+        if (timeout)
+          timer = get_timer_wheel(s->get_io_service()).add(
+            timeout,
+            boost::bind(&onAsyncTimer<typename Proto::socket>, bs),
+            timeout / 16);
         bs->async_connect(ep,
                           boost::bind(&async_connect<Proto, BaseFactory>,
-                                      bs, s, l, bf, _1));
+                                      bs, s, l, bf, timer, _1));
       }
       delete r;
     }
@@ -635,7 +971,7 @@ namespace libport
                           Destructible::DestructionLock l,
                           const std::string& host,
                           const std::string& port,
-                          int,
+                          useconds_t timeout,
                           BaseFactory bf)
     {
       typename Proto::resolver::query query(host, port);
@@ -643,7 +979,8 @@ namespace libport
         new typename Proto::resolver(s->get_io_service());
       resolver->async_resolve(query,
                               boost::bind(&async_resolve<Proto, BaseFactory>,
-                                          resolver, s, l, bf, _1, _2));
+                                          resolver, s, l, bf, timeout,
+                                          _1, _2));
     }
 
   }
@@ -705,15 +1042,19 @@ namespace libport
       newS = bind_or_delete(this, bf, s);
       if (!newS)
         return errorcodes::make_error_code(errorcodes::operation_canceled);
-      boost::asio::deadline_timer timer(get_io_service());
+      // Thousands of connections share the timer wheel, and a timeout
+      // may be a sixteenth late.
+      TimerWheel& wheel = get_timer_wheel(get_io_service());
       libport::Semaphore sem;
-      timer.expires_from_now(boost::posix_time::microseconds(timeout));
-      timer.async_wait(boost::bind(&netdetail::onTimer<typename Proto::socket>,
-                                   _1, boost::ref(*s),
-                                   boost::ref(sem),
-                                   newS->getDestructionLock()));
+      TimerWheel::Handle timer =
+        wheel.add(timeout,
+                  boost::bind(&netdetail::onTimer<typename Proto::socket>,
+                              boost::ref(*s),
+                              boost::ref(sem),
+                              newS->getDestructionLock()),
+                  timeout / 16);
       s->async_connect(ep, boost::bind(&netdetail::onConnect, _1,
-                                       boost::ref(timer),
+                                       boost::ref(wheel), timer,
                                        boost::ref(sem),
                                        boost::ref(erc)));
       sem--;
@@ -748,20 +1089,50 @@ namespace libport
                                                  get_io_service());
     if (erc)
       return erc;
-    typename Proto::acceptor* a;
-    try
+    typedef typename Proto::acceptor acceptor_type;
+    typedef netdetail::SocketImpl<typename Proto::socket> impl_type;
+    // One acceptor per io_service of the pool with SO_REUSEPORT, each
+    // keeping its connections.
+    size_t acceptors = 1;
+# if defined SO_REUSEPORT
+    if (reusePort_)
+      acceptors = get_io_service_pool_size();
+# endif
+    bool nonBlocking = 1 < acceptBatch_;
+    acceptor_type* a =
+      netdetail::open_acceptor<Proto>(get_io_service(), ep, reusePort_,
+                                      nonBlocking, erc);
+    if (!a)
+      return erc;
+    // The port actually bound, in case it was 0.
+    ep.port(a->local_endpoint().port());
+    std::vector<acceptor_type*> others;
+    for (size_t i = 1; i < acceptors; ++i)
     {
-      a = new typename Proto::acceptor(get_io_service(), ep);
+      acceptor_type* other =
+        netdetail::open_acceptor<Proto>(get_pooled_io_service(i), ep,
+                                        true, nonBlocking, erc);
+      if (!other)
+      {
+        foreach (acceptor_type* o, others)
+          delete o;
+        delete a;
+        return erc;
+      }
+      others.push_back(other);
     }
-    catch(const boost::system::system_error& se)
+
+    netdetail::AcceptorImpl<acceptor_type>* impl =
+      new netdetail::AcceptorImpl<acceptor_type>(get_io_service(), a);
+    setBase(impl);
+    impl_type::acceptOne(get_io_service(), f, a, bf, acceptBatch_,
+                         acceptors == 1);
+    for (size_t i = 1; i < acceptors; ++i)
     {
-      return se.code();
+      impl->add(others[i - 1]);
+      impl_type::acceptOne(get_pooled_io_service(i), f, others[i - 1], bf,
+                           acceptBatch_, false);
     }
-    BaseSocket* impl =
-      new netdetail::AcceptorImpl<typename Proto::acceptor>(get_io_service(), a);
-    setBase(impl);
-    netdetail::SocketImpl<typename Proto::socket>::acceptOne(
-      get_io_service(), f, a, bf);
     return erc;
   }
 }
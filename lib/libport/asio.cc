@@ -12,15 +12,32 @@
 // Said code goes in asio-ssl.cc
 #define LIBPORT_NO_SSL
 #define BOOST_ASIO_ENABLE_OLD_SERVICES
+#include <set>
+
 #include <libport/asio.hh>
+#include <libport/atomic.hh>
+#include <libport/config.h>
 #include <libport/debug.hh>
 #include <libport/containers.hh>
 #include <libport/detect-win32.h>
+#include <libport/foreach.hh>
 #include <libport/format.hh>
 #include <libport/thread.hh>
 
 #include "asio-impl.hxx"
 
+// Zero-copy file transfers, with the Linux sendfile.
+#if defined LIBPORT_HAVE_SPLICE && defined LIBPORT_HAVE_SENDFILE \
+  && defined LIBPORT_HAVE_SYS_SENDFILE_H
+# define LIBPORT_ASIO_SPLICE 1
+# include <sys/sendfile.h>
+#endif
+#if ! defined WIN32
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/stat.h>
+#endif
+
 GD_CATEGORY(Libport.Asio);
 
 #define FRAISE(...)                                             \
@@ -102,8 +119,7 @@ namespace libport
       }
       else
       {
-        std::ostream stream(&readBuffer_);
-        stream.write(buffer, r);
+        readBuffer_.write(buffer, r);
         if (onReadFunc)
           onReadFunc(readBuffer_);
       }
@@ -195,17 +211,81 @@ namespace libport
       typedef boost::function3<void, const void*, size_t,
                                boost::shared_ptr<UDPLink> > onread_type;
       onread_type onRead;
-      void start_receive();
+      virtual void start_receive();
       void handle_receive(const boost::system::error_code& error, size_t sz);
+      /// Bind to \a host:\a port, and start receiving.
+      /// \return the local port, or 0 on error.
+      unsigned short listen(const std::string& host, const std::string& port,
+                            boost::system::error_code& erc,
+                            boost::asio::io_service& io);
       unsigned short getLocalPort();
     private:
       std::vector<char> recv_buffer_;
       static const int default_size_ = 65535;
       boost::asio::ip::udp::endpoint remote_endpoint_;
+    protected:
       boost::asio::ip::udp::socket socket_;
       friend class libport::Socket;
     };
 
+    /// UDPSocket receiving and replying by batches of datagrams.
+    class UDPBatchSocket: public UDPSocket
+    {
+    public:
+      typedef boost::asio::ip::udp::endpoint endpoint_type;
+      UDPBatchSocket(boost::asio::io_service& io,
+                     size_t batchSize, size_t datagramSize);
+      Socket::onreadbatch_type onReadBatch;
+      virtual void start_receive();
+      void handle_ready(const boost::system::error_code& error);
+      /// Send \a data to \a to, with the replies to the current batch if
+      /// it is being delivered.
+      void reply(const endpoint_type& to, const void* data, size_t length);
+    private:
+      /// Receive the pending datagrams in batch_.
+      void receive_();
+      /// Send the replies to the current batch.
+      void flush_();
+      size_t batchSize_;
+      size_t datagramSize_;
+      /// Buffer for batchSize_ datagrams.
+      std::vector<char> slab_;
+      std::vector<endpoint_type> senders_;
+      Socket::udp_batch_type batch_;
+#if defined LIBPORT_HAVE_RECVMMSG
+      std::vector<mmsghdr> headers_;
+      std::vector<iovec> iovecs_;
+#endif
+      /// Protects the replies.
+      Lockable repliesLock_;
+      /// Whether a batch is being delivered.
+      bool delivering_;
+      /// Replies to the current batch, stored one after the other.
+      std::string replies_;
+      /// Their destination and the end of their data in replies_.
+      std::vector<std::pair<endpoint_type, size_t> > repliesTo_;
+    };
+
+    class UDPBatchLinkImpl: public UDPLink
+    {
+    public:
+      UDPBatchLinkImpl(UDPBatchSocket& socket,
+                       const boost::asio::ip::udp::endpoint& endpoint,
+                       Destructible::DestructionLock destructionLock)
+        : socket_(socket)
+        , endpoint_(endpoint)
+        , destructionLock_(destructionLock)
+      {}
+      virtual void reply(const void* data, size_t length)
+      {
+        socket_.reply(endpoint_, data, length);
+      }
+    private:
+      UDPBatchSocket& socket_;
+      boost::asio::ip::udp::endpoint endpoint_;
+      Destructible::DestructionLock destructionLock_;
+    };
+
     UDPSocket::UDPSocket(boost::asio::io_service& io)
       :socket_(io)
     {
@@ -235,6 +315,41 @@ namespace libport
       start_receive();
     }
 
+    unsigned short
+    UDPSocket::listen(const std::string& host, const std::string& port,
+                      boost::system::error_code& erc,
+                      boost::asio::io_service& io)
+    {
+      using namespace boost::asio::ip;
+      /* On some configurations, the resolver will resolve an ipv6 address
+       * even if this protocol is not supported by the system. So try to
+       * bind using all the endopints until one succeeds, and not just the
+       * first. */
+      udp::resolver::query query(host, port);
+      udp::resolver resolver(io);
+      udp::resolver::iterator iter = resolver.resolve(query, erc);
+      if (erc)
+        return 0;
+      // Careful to use the protocol reported by the endpoint.
+      while (iter != udp::resolver::iterator())
+      {
+        socket_.open(iter->endpoint().protocol(), erc);
+        if (!erc)
+          socket_.bind(iter->endpoint(), erc);
+        if (!erc)
+          goto ok;
+        iter++;
+      }
+      if (!erc)
+        erc =
+          netdetail::errorcodes::make_error_code(
+            netdetail::errorcodes::bad_address);
+      return 0;
+    ok:
+      start_receive();
+      return getLocalPort();
+    }
+
     unsigned short UDPSocket::getLocalPort()
     {
       return socket_.local_endpoint().port();
@@ -246,32 +361,207 @@ namespace libport
       socket_.send_to(boost::asio::buffer(data, length), endpoint_);
     }
 
+    UDPBatchSocket::UDPBatchSocket(boost::asio::io_service& io,
+                                   size_t batchSize, size_t datagramSize)
+      : UDPSocket(io)
+      , batchSize_(std::max(batchSize, size_t(1)))
+      , datagramSize_(datagramSize)
+      , slab_(batchSize_ * datagramSize_)
+      , senders_(batchSize_)
+      , delivering_(false)
+    {
+      batch_.reserve(batchSize_);
+#if defined LIBPORT_HAVE_RECVMMSG
+      headers_.resize(batchSize_);
+      iovecs_.resize(batchSize_);
+#endif
+    }
+
+    void
+    UDPBatchSocket::start_receive()
+    {
+      // Wait for the socket to be readable, and read ourselves.
+      socket_.async_receive(
+        boost::asio::null_buffers(),
+        boost::bind(&UDPBatchSocket::handle_ready, this,
+                    boost::asio::placeholders::error));
+    }
+
+    void
+    UDPBatchSocket::receive_()
+    {
+      Destructible::DestructionLock lock = getDestructionLock();
+      size_t n = 0;
+#if defined LIBPORT_HAVE_RECVMMSG
+      for (size_t i = 0; i < batchSize_; ++i)
+      {
+        iovecs_[i].iov_base = &slab_[i * datagramSize_];
+        iovecs_[i].iov_len = datagramSize_;
+        msghdr& h = headers_[i].msg_hdr;
+        memset(&h, 0, sizeof h);
+        h.msg_name = senders_[i].data();
+        h.msg_namelen = senders_[i].capacity();
+        h.msg_iov = &iovecs_[i];
+        h.msg_iovlen = 1;
+      }
+      int r = recvmmsg(socket_.LIBPORT_BOOST_NATIVE(), &headers_[0],
+                       batchSize_, MSG_DONTWAIT, 0);
+      if (r < 0)
+      {
+        GD_FINFO_TRACE("recvmmsg: %s", strerror(errno));
+        r = 0;
+      }
+      for (n = 0; n < size_t(r); ++n)
+      {
+        if (headers_[n].msg_hdr.msg_flags & MSG_TRUNC)
+          GD_FWARN("UDP datagram truncated to %s bytes", datagramSize_);
+        senders_[n].resize(headers_[n].msg_hdr.msg_namelen);
+        Socket::UDPDatagram d = {
+          &slab_[n * datagramSize_], headers_[n].msg_len,
+          boost::shared_ptr<UDPLink>(
+            new UDPBatchLinkImpl(*this, senders_[n], lock))
+        };
+        batch_.push_back(d);
+      }
+#else
+      boost::system::error_code erc;
+      for (; n < batchSize_ && (!n || socket_.available(erc)); ++n)
+      {
+        size_t sz = socket_.receive_from(
+          boost::asio::buffer(&slab_[n * datagramSize_], datagramSize_),
+          senders_[n], 0, erc);
+        if (erc)
+          break;
+        Socket::UDPDatagram d = {
+          &slab_[n * datagramSize_], sz,
+          boost::shared_ptr<UDPLink>(
+            new UDPBatchLinkImpl(*this, senders_[n], lock))
+        };
+        batch_.push_back(d);
+      }
+#endif
+    }
+
+    void
+    UDPBatchSocket::handle_ready(const boost::system::error_code& err)
+    {
+      if (err)
+        return;
+      receive_();
+      if (!batch_.empty())
+      {
+        {
+          BlockLock bl(repliesLock_);
+          delivering_ = true;
+        }
+        onReadBatch(batch_);
+        batch_.clear();
+        BlockLock bl(repliesLock_);
+        delivering_ = false;
+        flush_();
+      }
+      start_receive();
+    }
+
+    void
+    UDPBatchSocket::reply(const endpoint_type& to,
+                          const void* data, size_t length)
+    {
+      BlockLock bl(repliesLock_);
+      if (delivering_)
+      {
+        replies_.append(static_cast<const char*>(data), length);
+        repliesTo_.push_back(std::make_pair(to, replies_.size()));
+      }
+      else
+        socket_.send_to(boost::asio::buffer(data, length), to);
+    }
+
+    void
+    UDPBatchSocket::flush_()
+    {
+      // Under repliesLock_.
+      size_t sent = 0;
+#if defined LIBPORT_HAVE_SENDMMSG
+      std::vector<mmsghdr> headers(repliesTo_.size());
+      std::vector<iovec> iovecs(repliesTo_.size());
+      for (size_t i = 0, start = 0; i < repliesTo_.size(); ++i)
+      {
+        iovecs[i].iov_base = &replies_[start];
+        iovecs[i].iov_len = repliesTo_[i].second - start;
+        msghdr& h = headers[i].msg_hdr;
+        memset(&h, 0, sizeof h);
+        h.msg_name = repliesTo_[i].first.data();
+        h.msg_namelen = repliesTo_[i].first.size();
+        h.msg_iov = &iovecs[i];
+        h.msg_iovlen = 1;
+        start = repliesTo_[i].second;
+      }
+      while (sent < headers.size())
+      {
+        int r = sendmmsg(socket_.LIBPORT_BOOST_NATIVE(), &headers[sent],
+                         headers.size() - sent, MSG_DONTWAIT);
+        if (r <= 0)
+          break;
+        sent += r;
+      }
+#endif
+      // Send the rest one by one, waiting if needed.
+      for (; sent < repliesTo_.size(); ++sent)
+      {
+        size_t start = sent ? repliesTo_[sent - 1].second : 0;
+        boost::system::error_code erc;
+        socket_.send_to(boost::asio::buffer(&replies_[start],
+                                            repliesTo_[sent].second - start),
+                        repliesTo_[sent].first, 0, erc);
+        if (erc)
+          GD_FINFO_TRACE("UDP reply error: %s", erc.message());
+      }
+      replies_.clear();
+      repliesTo_.clear();
+    }
+
 
+    // The buffer is released once sent.
     void
-    delete_check(boost::system::error_code erc,
-                 SocketImpl<udpsock>*s,
-                 Destructible::DestructionLock,
-                 std::string* buf)
+    send_check(boost::system::error_code erc,
+               SocketImpl<udpsock>*s,
+               Destructible::DestructionLock,
+               SharedBuffer buffer,
+               utime_t since)
     {
       if (erc)
       {
         GD_FINFO_TRACE("Socket error: %s", erc.message());
-        BlockLock bl(s->callbackLock);
+        ScopedLock<RecursiveAdaptiveLock> bl(s->callbackLock);
         if (s->onErrorFunc)
           s->onErrorFunc(erc);
       }
-      delete buf;
+      else
+      {
+        BlockLock bl(s);
+        s->wrote_(buffer->size(), since);
+      }
     }
 
+    // Datagrams are neither queued nor merged: send them at once.
     template<>
     inline void
-    send_bounce(SocketImpl<udpsock>* s, const void* buffer, size_t length)
+    send_bounce(SocketImpl<udpsock>* s, const SharedBuffer& buffer)
     {
-      std::string* buf = new std::string(static_cast<const char*>(buffer),
-                                         length);
       s->base_->async_send(
-        boost::asio::buffer(*buf),
-        boost::bind(&delete_check, _1, s, s->getDestructionLock(), buf));
+        boost::asio::buffer(*buffer),
+        boost::bind(&send_check, _1, s, s->getDestructionLock(), buffer,
+                    utime()));
+    }
+
+    template<>
+    inline void
+    send_bounce(SocketImpl<udpsock>* s, const void* buffer, size_t length)
+    {
+      send_bounce(s, SharedBuffer(
+                    new std::string(static_cast<const char*>(buffer),
+                                    length)));
     }
 
 
@@ -281,8 +571,6 @@ namespace libport
                 SocketImpl<udpsock>::DestructionLock lock,
                 boost::system::error_code erc, size_t recv)
     {
-      std::ostream stream(&s->readBuffer_);
-      stream.write(&s->udpBuffer_[0], std::streamsize(recv));
       s->onReadDemux(lock, erc, recv);
     }
 
@@ -291,31 +579,383 @@ namespace libport
     read_or_recv(SocketImpl<udpsock>*s,
                  SocketImpl<udpsock>::DestructionLock lock)
     {
-      if (!s->udpBuffer_.size())
-        s->udpBuffer_.resize(65535);
-      s->base_->async_receive(boost::asio::buffer(s->udpBuffer_),
-                              boost::bind(&recv_bounce, s, lock, _1, _2));
+      // Room for the largest datagram, received in place.
+      if (s->strand_)
+        s->base_->async_receive(
+          s->readBuffer_.prepare(65535),
+          s->strand_->wrap(boost::bind(&recv_bounce, s, lock, _1, _2)));
+      else
+        s->base_->async_receive(s->readBuffer_.prepare(65535),
+                                boost::bind(&recv_bounce, s, lock, _1, _2));
     }
 
     void
     onConnect(boost::system::error_code erc,
-              boost::asio::deadline_timer & timer,
+              TimerWheel& wheel,
+              const TimerWheel::Handle& timer,
               libport::Semaphore& sem,
               boost::system::error_code& caller_erc)
     {
       caller_erc = erc;
-      // If timer was already canceled, cancel is a noop and does no harm.
-      timer.cancel();
+      // If the timer did not fire, it never will: signal for it.
+      if (wheel.cancel(timer))
+        sem++;
       sem++;
     }
   }
 
   BaseSocket::BaseSocket(boost::asio::io_service& io)
     : AsioDestructible(io)
+    , writeHighWater(0)
     , readOnce(false)
   {
   }
 
+  void
+  BaseSocket::write(const SharedBuffer& data)
+  {
+    write(data->data(), data->size());
+  }
+
+  void
+  BaseSocket::useStrand()
+  {
+  }
+
+  void
+  BaseSocket::setIdleTimeout(useconds_t)
+  {
+  }
+
+  SocketStats
+  BaseSocket::getStats() const
+  {
+    return SocketStats();
+  }
+
+  boost::system::error_code
+  BaseSocket::sendFile(native_handle_type, size_t, size_t,
+                       const onsent_type&, const onprogress_type&)
+  {
+    return netdetail::errorcodes::make_error_code(
+      netdetail::errorcodes::operation_not_supported);
+  }
+
+  /*--------------------.
+  | Socket statistics.  |
+  `--------------------*/
+
+  namespace
+  {
+    /// The sockets alive, and the statistics of those destroyed and
+    /// of the watched io_services.
+    struct SocketRegistry
+      : public Lockable
+    {
+      SocketRegistry()
+        : start(utime())
+      {}
+
+      std::set<const netdetail::SocketImplBase*> sockets;
+      SocketStats stats;
+      utime_t start;
+    };
+
+    /// Sample how late a timer expires on an io_service.
+    class IOServiceWatch
+    {
+    public:
+      IOServiceWatch(boost::asio::io_service& io, useconds_t period)
+        : timer_(io)
+        , period_(period)
+      {
+        wait();
+      }
+
+    private:
+      void wait()
+      {
+        expected_ = utime() + period_;
+        timer_.expires_from_now(boost::posix_time::microseconds(period_));
+        timer_.async_wait(boost::bind(&IOServiceWatch::onTimer, this, _1));
+      }
+
+      void onTimer(boost::system::error_code erc);
+
+      boost::asio::deadline_timer timer_;
+      useconds_t period_;
+      utime_t expected_;
+    };
+  }
+
+  /// Never destroyed, as sockets may outlive the static objects.
+  static SocketRegistry&
+  socket_registry()
+  {
+    static SocketRegistry* res = new SocketRegistry;
+    return *res;
+  }
+
+  void
+  IOServiceWatch::onTimer(boost::system::error_code erc)
+  {
+    if (erc)
+    {
+      delete this;
+      return;
+    }
+    utime_t late = utime() - expected_;
+    {
+      SocketRegistry& r = socket_registry();
+      BlockLock bl(r);
+      r.stats.backlog.add(0 < late ? late : 0);
+    }
+    wait();
+  }
+
+  SocketStats
+  get_socket_stats()
+  {
+    SocketRegistry& r = socket_registry();
+    BlockLock bl(r);
+    SocketStats res = r.stats;
+    // Each one copied under the lock of its socket: the registry is
+    // always locked first.
+    foreach (const netdetail::SocketImplBase* s, r.sockets)
+      res += s->getStats();
+    res.duration = utime() - r.start;
+    return res;
+  }
+
+  void
+  watch_io_service(boost::asio::io_service& io, useconds_t period)
+  {
+    new IOServiceWatch(io, period);
+  }
+
+  namespace netdetail
+  {
+    struct SocketImplBase::IdleTimer
+    {
+      useconds_t timeout;
+      TimerWheel::Handle timer;
+    };
+
+    SocketImplBase::SocketImplBase(boost::asio::io_service& io)
+      : BaseSocket(io)
+      , sendingFile_(false)
+      , tail_(0)
+      , queued_(0)
+      , aboveHighWater_(false)
+      , notifiedHighWater_(false)
+      , queuedSince_(0)
+      , writingSince_(0)
+      , created_(utime())
+    {
+      // Declared before created_.
+      lastActivity_ = created_;
+      SocketRegistry& r = socket_registry();
+      BlockLock bl(r);
+      r.sockets.insert(this);
+    }
+
+    SocketImplBase::~SocketImplBase()
+    {
+      SocketRegistry& r = socket_registry();
+      BlockLock bl(r);
+      r.sockets.erase(this);
+      r.stats += getStats();
+    }
+
+    SocketStats
+    SocketImplBase::getStats() const
+    {
+      BlockLock bl(const_cast<SocketImplBase*>(this));
+      SocketStats res = stats_;
+      res.duration = utime() - created_;
+      return res;
+    }
+
+    bool
+    SocketImplBase::enqueue_(const void* data, size_t length)
+    {
+      if (!tail_)
+      {
+        if (queue_.empty())
+          queuedSince_ = utime();
+        boost::shared_ptr<std::string> buffer(new std::string);
+        queue_.push_back(buffer);
+        tail_ = buffer.get();
+      }
+      tail_->append(static_cast<const char*>(data), length);
+      queued_ += length;
+      {
+        // Not locked in a strand.
+        BlockLock bl(this);
+        stats_.queueDepth.add(queued_);
+      }
+      return writeHighWater && !aboveHighWater_
+        && (aboveHighWater_ = writeHighWater < queued_);
+    }
+
+    bool
+    SocketImplBase::enqueue_(const SharedBuffer& data)
+    {
+      if (data->empty())
+        return false;
+      if (queue_.empty())
+        queuedSince_ = utime();
+      queue_.push_back(data);
+      tail_ = 0;
+      queued_ += data->size();
+      {
+        // Not locked in a strand.
+        BlockLock bl(this);
+        stats_.queueDepth.add(queued_);
+      }
+      return writeHighWater && !aboveHighWater_
+        && (aboveHighWater_ = writeHighWater < queued_);
+    }
+
+    void
+    SocketImplBase::enqueue_(const FileTransferPtr& f)
+    {
+      if (queue_.empty())
+        queuedSince_ = utime();
+      queue_.push_back(SharedBuffer());
+      tail_ = 0;
+      files_.push_back(f);
+    }
+
+    bool
+    SocketImplBase::fileNext_() const
+    {
+      return writing_.empty() && !sendingFile_
+        && !queue_.empty() && !queue_.front();
+    }
+
+    bool
+    SocketImplBase::dequeue_(std::vector<boost::asio::const_buffer>& buffers)
+    {
+      if (!writing_.empty() || queue_.empty() || !queue_.front())
+        return false;
+      buffers_type::iterator file =
+        std::find(queue_.begin(), queue_.end(), SharedBuffer());
+      if (file == queue_.end())
+      {
+        writing_.swap(queue_);
+        tail_ = 0;
+      }
+      else
+      {
+        writing_.assign(queue_.begin(), file);
+        queue_.erase(queue_.begin(), file);
+      }
+      writingSince_ = queuedSince_;
+      buffers.reserve(writing_.size());
+      foreach (const SharedBuffer& b, writing_)
+        buffers.push_back(boost::asio::buffer(*b));
+      return true;
+    }
+
+    bool
+    SocketImplBase::written_()
+    {
+      size_t length = 0;
+      foreach (const SharedBuffer& b, writing_)
+        length += b->size();
+      queued_ -= length;
+      writing_.clear();
+      wrote_(length, writingSince_);
+      return aboveHighWater_
+        && !(aboveHighWater_ = writeHighWater / 2 < queued_);
+    }
+
+    bool
+    SocketImplBase::writeFailed_()
+    {
+      foreach (const SharedBuffer& b, writing_)
+        queued_ -= b->size();
+      writing_.clear();
+      return aboveHighWater_
+        && !(aboveHighWater_ = writeHighWater / 2 < queued_);
+    }
+
+    void
+    SocketImplBase::wrote_(size_t length, utime_t since)
+    {
+      utime_t now = utime();
+      // Callers in a strand do not hold the lock.
+      BlockLock bl(this);
+      ++stats_.writes;
+      stats_.writeBytes += length;
+      stats_.writeSize.add(length);
+      stats_.queueTime.add(now - since);
+      lastActivity_ = now;
+    }
+
+    void
+    SocketImplBase::setIdleTimeout(useconds_t timeout)
+    {
+      BlockLock bl(this);
+      if (!idle_)
+        idle_.reset(new IdleTimer);
+      get_timer_wheel(get_io_service()).cancel(idle_->timer);
+      idle_->timeout = timeout;
+      lastActivity_ = utime();
+      if (timeout)
+        armIdle_(timeout);
+    }
+
+    void
+    SocketImplBase::armIdle_(useconds_t delay)
+    {
+      TimerWheel::callback_type check =
+        boost::bind(&SocketImplBase::checkIdle_, this, getDestructionLock());
+      if (strand_)
+        check = strand_->wrap(check);
+      idle_->timer =
+        get_timer_wheel(get_io_service()).add(delay, check,
+                                              idle_->timeout / 8);
+    }
+
+    void
+    SocketImplBase::checkIdle_(DestructionLock)
+    {
+      utime_t idle;
+      {
+        BlockLock bl(this);
+        if (!idle_->timeout || !isConnected())
+          return;
+        idle = utime() - lastActivity_;
+        if (idle < idle_->timeout)
+        {
+          armIdle_(idle_->timeout - idle);
+          return;
+        }
+      }
+      GD_FINFO_DEBUG("%p: idle for %sus, closing", this, idle);
+      {
+        CallbackStrandLock bl(callbackLock, strand_.get());
+        if (onErrorFunc)
+          onErrorFunc(errorcodes::make_error_code(errorcodes::timed_out));
+      }
+      close();
+    }
+
+    void
+    SocketImplBase::cancelIdle_()
+    {
+      BlockLock bl(this);
+      if (idle_)
+      {
+        // Release the destruction lock held by the callback.
+        get_timer_wheel(get_io_service()).cancel(idle_->timer);
+        idle_->timer.reset();
+      }
+    }
+  }
+
   boost::system::error_code
   Socket::connect(const std::string& host,
                   const std::string& port,
@@ -470,6 +1110,91 @@ namespace libport
     return *io;
   }
 
+  /*-------------------.
+  | io_service pool.  |
+  `-------------------*/
+
+  /// The io_services of the pool, get_io_service() first, and the
+  /// threads running them, under io_pool_lock.  io_pool[i] is pushed
+  /// before io_pool_threads[i].
+  static std::vector<boost::asio::io_service*> io_pool;
+  static std::vector<pthread_t> io_pool_threads;
+  static Lockable io_pool_lock;
+  /// Round-robin counter.
+  static long io_pool_next = 0;
+
+  static size_t
+  processors()
+  {
+#if defined WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long res = info.dwNumberOfProcessors;
+#else
+    long res = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return 0 < res ? res : 1;
+  }
+
+  void
+  set_io_service_pool_size(size_t size)
+  {
+    boost::asio::io_service& io = get_io_service();
+    if (!size)
+      size = processors();
+    BlockLock bl(io_pool_lock);
+    if (io_pool.empty())
+    {
+      io_pool.push_back(&io);
+      io_pool_threads.push_back(asio_worker_thread);
+    }
+    while (io_pool.size() < size)
+    {
+      boost::asio::io_service* pooled = new boost::asio::io_service;
+      io_pool.push_back(pooled);
+      io_pool_threads.push_back(
+        startThread(boost::bind<void>(&runIoService, pooled)));
+    }
+  }
+
+  size_t
+  get_io_service_pool_size()
+  {
+    BlockLock bl(io_pool_lock);
+    return std::max(io_pool.size(), size_t(1));
+  }
+
+  boost::asio::io_service&
+  get_pooled_io_service()
+  {
+    BlockLock bl(io_pool_lock);
+    if (io_pool.size() <= 1)
+      return get_io_service();
+    return *io_pool[atomic::fetch_increment(&io_pool_next) % io_pool.size()];
+  }
+
+  boost::asio::io_service&
+  get_pooled_io_service(size_t i)
+  {
+    BlockLock bl(io_pool_lock);
+    if (io_pool.size() <= 1)
+      return get_io_service();
+    return *io_pool[i % io_pool.size()];
+  }
+
+  /// The io_service run by the current thread, or 0.
+  static boost::asio::io_service*
+  poll_thread_io_service()
+  {
+    if (pthread_self() == asio_worker_thread)
+      return &get_io_service();
+    BlockLock bl(io_pool_lock);
+    for (size_t i = 1; i < io_pool_threads.size(); ++i)
+      if (pthread_self() == io_pool_threads[i])
+        return io_pool[i];
+    return 0;
+  }
+
   /*---------.
   | Socket.  |
   `---------*/
@@ -478,6 +1203,11 @@ namespace libport
     : AsioDestructible(io)
     , base_(0)
     , autostart_reader_(true)
+    , strand_(false)
+    , writeHighWater_(0)
+    , idleTimeout_(0)
+    , acceptBatch_(1)
+    , reusePort_(false)
   {
     GD_FINFO_TRACE("%p->Socket::Socket", this);
   }
@@ -555,36 +1285,28 @@ namespace libport
                     boost::system::error_code& erc,
                     boost::asio::io_service& io)
   {
-    using namespace boost::asio::ip;
     netdetail::UDPSocket* s = new netdetail::UDPSocket(io);
     s->onRead = onRead;
-    /* On some configurations, the resolver will resolve an ipv6 address even
-     * if this protocol is not supported by the system. So try to bind using all
-     * the endopints until one succeeds, and not just the first. */
-    udp::resolver::query query(host, port);
-    udp::resolver resolver(io);
-    udp::resolver::iterator iter = resolver.resolve(query, erc);
-    if (erc)
-      return 0;
-    // Careful to use the protocol reported by the endpoint.
-    while (iter != udp::resolver::iterator())
-    {
-      s->socket_.open(iter->endpoint().protocol(), erc);
-      if (!erc)
-        s->socket_.bind(iter->endpoint(), erc);
-      if (!erc)
-        goto ok;
-      iter++;
-    }
-    if (!erc)
-      erc =
-        netdetail::errorcodes::make_error_code(
-          netdetail::errorcodes::bad_address);
-    return 0;
-  ok:
-    s->start_receive();
-    unsigned short lp = s->getLocalPort();
-    udp_map[lp] = s;
+    unsigned short lp = s->listen(host, port, erc, io);
+    if (lp)
+      udp_map[lp] = s;
+    return lp;
+  }
+
+  unsigned short
+  Socket::listenUDPBatch(const std::string& host,
+                         const std::string& port,
+                         onreadbatch_type onRead,
+                         boost::system::error_code& erc,
+                         boost::asio::io_service& io,
+                         size_t batchSize, size_t datagramSize)
+  {
+    netdetail::UDPBatchSocket* s =
+      new netdetail::UDPBatchSocket(io, batchSize, datagramSize);
+    s->onReadBatch = onRead;
+    unsigned short lp = s->listen(host, port, erc, io);
+    if (lp)
+      udp_map[lp] = s;
     return lp;
   }
 
@@ -593,46 +1315,102 @@ namespace libport
   {
     base_ = b;
     GD_FINFO_TRACE("%p->Socket::setBase(%p)", this, base_);
-    BlockLock bl(base_->callbackLock);
+    ScopedLock<RecursiveAdaptiveLock> bl(base_->callbackLock);
     base_-> onReadFunc = boost::bind(&Socket::onRead_, this, _1);
     base_->onErrorFunc = boost::bind(&Socket::onError, this, _1);
+    base_->onWriteHighWaterFunc =
+      boost::bind(&Socket::onWriteHighWater, this, _1);
+    base_->writeHighWater = writeHighWater_;
+    if (strand_)
+      base_->useStrand();
+    if (idleTimeout_)
+      base_->setIdleTimeout(idleTimeout_);
+  }
+
+  void
+  Socket::setIdleTimeout(useconds_t timeout)
+  {
+    idleTimeout_ = timeout;
+    if (base_)
+      base_->setIdleTimeout(timeout);
+  }
+
+  void
+  Socket::setWriteHighWater(size_t bytes)
+  {
+    writeHighWater_ = bytes;
+    if (base_)
+      base_->writeHighWater = bytes;
+  }
+
+  void
+  Socket::onWriteHighWater(bool)
+  {
+    // Nothing
   }
 
   bool
-  Socket::onRead_(boost::asio::streambuf& buf)
+  Socket::onRead_(RingBuffer& buf)
   {
     DestructionLock lock = getDestructionLock();
-    // Dump the stream in our linear buffer
-    std::istream is(&buf);
-    static const int blockSize = 1024;
-    while (is.good())
-    {
-      size_t oldBufferLength = buffer.length();
-      buffer.resize(oldBufferLength + blockSize);
-      is.read(&buffer[0] + oldBufferLength, blockSize);
-      long len = is.gcount();
-      buffer.resize(oldBufferLength + len);
-    }
-    // Call onRead until it eats 0 characters.
-    size_t r;
-    do
-    {
-      r = onRead(buffer.c_str(), buffer.length());
-      if (r)
-        buffer = buffer.substr(r, buffer.npos);
-    }
-    while(r && !buffer.empty());
+    // Call onReadv until it eats 0 characters.  Data is not moved, but
+    // to make it contiguous for parsers which need more than the first
+    // chunk.
+    while (!buf.empty())
+    {
+      RingBuffer::const_buffers_type data = buf.data();
+      if (size_t r = onReadv(data))
+        buf.consume(r);
+      else if (boost::asio::buffer_size(data[1]))
+        buf.linearize();
+      else
+        break;
+    }
     return true;
   }
 
+  size_t
+  Socket::onReadv(const RingBuffer::const_buffers_type& data)
+  {
+    // Have onRead_ make the data contiguous, hence NUL-terminated.
+    if (boost::asio::buffer_size(data[1]))
+      return 0;
+    return onRead(boost::asio::buffer_cast<const void*>(data[0]),
+                  boost::asio::buffer_size(data[0]));
+  }
+
+  static void
+  wake_up(bool& awake)
+  {
+    awake = true;
+  }
+
   void
   Socket::sleep(useconds_t duration)
   {
-    //FIXME: implement for real
-    if (isPollThread())
-      pollFor(duration);
-    else
+    boost::asio::io_service* io = poll_thread_io_service();
+    if (!io)
+    {
       usleep(duration);
+      return;
+    }
+    // Run the handlers meanwhile, without stopping the io_service as
+    // pollFor() does.
+    utime_t end = utime() + duration;
+    bool awake = false;
+    TimerWheel& wheel = get_timer_wheel(*io);
+    TimerWheel::Handle timer =
+      wheel.add(duration, boost::bind(&wake_up, boost::ref(awake)));
+    while (!awake)
+      if (!io->run_one())
+      {
+        // Stopped.
+        wheel.cancel(timer);
+        utime_t left = end - utime();
+        if (0 < left)
+          usleep(left);
+        break;
+      }
   }
 
   static
@@ -666,7 +1444,7 @@ namespace libport
 
   bool isPollThread()
   {
-    return pthread_self() == asio_worker_thread;
+    return poll_thread_io_service();
   }
 
 # if 103600 <= BOOST_VERSION
@@ -767,6 +1545,323 @@ namespace libport
 
 # endif
 
+  /*-----------------.
+  | File transfers.  |
+  `-----------------*/
+
+#if ! defined WIN32
+  namespace netdetail
+  {
+    typedef SocketImplBase::FileTransfer FileTransfer;
+    typedef SocketImplBase::FileTransferPtr FileTransferPtr;
+
+    /// Bytes sent per handler, not to starve the other sockets.
+    static const size_t file_chunk = 1 << 20;
+
+    static boost::system::error_code
+    errno_error()
+    {
+      return boost::system::error_code(
+        errno, boost::asio::error::get_system_category());
+    }
+
+    /// Send up to \a length bytes of \a f to \a out.
+    /// \return the number of bytes sent, 0 at the end of \a f or on
+    /// errors.  On would_block, \a input is whether \a f is the one
+    /// to wait for.
+    static size_t
+    transfer_some(int out, FileTransfer& f, size_t length,
+                  boost::system::error_code& erc, bool& input)
+    {
+      input = false;
+#if defined LIBPORT_ASIO_SPLICE
+      ssize_t res =
+        f.pipe
+        ? splice(f.fd, 0, out, 0, length,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE)
+        : sendfile(out, f.fd, &f.offset, length);
+      if (res < 0)
+      {
+        erc = errno_error();
+        if (f.pipe && erc == boost::asio::error::would_block)
+        {
+          // Which side would block?
+          pollfd p = {f.fd, POLLIN, 0};
+          input = !poll(&p, 1, 0);
+        }
+        return 0;
+      }
+      return res;
+#else
+      // Through user space, keeping what the socket did not take for
+      // the next call.  The socket is non-blocking, see start_file.
+      // The pipe is left as is, it belongs to the caller: read it
+      // only when it is readable.
+      if (f.pending.empty())
+      {
+        if (f.pipe)
+        {
+          pollfd p = {f.fd, POLLIN, 0};
+          if (!poll(&p, 1, 0))
+          {
+            erc = boost::asio::error::would_block;
+            input = true;
+            return 0;
+          }
+        }
+        char buffer[1 << 14];
+        length = std::min(length, sizeof buffer);
+        ssize_t res =
+          f.pipe
+          ? ::read(f.fd, buffer, length)
+          : pread(f.fd, buffer, length, f.offset);
+        if (res <= 0)
+        {
+          if (res < 0)
+          {
+            erc = errno_error();
+            input = true;
+          }
+          return 0;
+        }
+        f.pending.assign(buffer, res);
+        if (!f.pipe)
+          f.offset += res;
+      }
+      ssize_t res = ::send(out, f.pending.data(), f.pending.size(), 0);
+      if (res < 0)
+      {
+        erc = errno_error();
+        return 0;
+      }
+      f.pending.erase(0, res);
+      return res;
+#endif
+    }
+
+    void continue_file(SocketImpl<tcpsock>* s,
+                       SocketImplBase::DestructionLock lock,
+                       boost::system::error_code erc);
+
+    /// The handler continuing the transfer of \a s.
+    boost::function1<void, boost::system::error_code>
+    continue_handler(SocketImpl<tcpsock>* s)
+    {
+      boost::function1<void, boost::system::error_code> res =
+        boost::bind(&continue_file, s, s->getDestructionLock(), _1);
+      if (s->strand_)
+        res = s->strand_->wrap(res);
+      return res;
+    }
+
+    /// Call continue_file when \a s can make progress, the socket
+    /// being writable, or its pipe readable if \a input.
+    void
+    wait_file(SocketImpl<tcpsock>* s, FileTransfer& f, bool input)
+    {
+      boost::function1<void, boost::system::error_code> h =
+        continue_handler(s);
+      if (input)
+        f.input->async_read_some(boost::asio::null_buffers(),
+                                 boost::bind(h, _1));
+      else
+        s->base_->async_write_some(boost::asio::null_buffers(),
+                                   boost::bind(h, _1));
+    }
+
+    /// Watch the pipe of \a f, on a duplicate of its descriptor.
+    static boost::system::error_code
+    open_input(SocketImpl<tcpsock>* s, FileTransfer& f)
+    {
+      int fd = dup(f.fd);
+      if (fd == -1)
+        return errno_error();
+      f.input.reset(new boost::asio::posix::stream_descriptor(
+                      s->get_io_service(), fd));
+      return boost::system::error_code();
+    }
+
+    void
+    start_file(SocketImpl<tcpsock>* s)
+    {
+      // Under the lock of s, or in the strand.
+      s->sendingFile_ = true;
+      FileTransfer& f = *s->files_.front();
+      boost::system::error_code erc;
+      // For sendfile and splice only: the synchronous operations of
+      // asio still block.
+      s->base_->native_non_blocking(true, erc);
+      if (!erc && f.pipe && !f.input)
+        erc = open_input(s, f);
+      if (erc)
+        // Let continue_file report it, not under our lock.
+        s->get_io_service().post(boost::bind(continue_handler(s), erc));
+      else
+        wait_file(s, f, false);
+    }
+
+    void
+    continue_file(SocketImpl<tcpsock>* s,
+                  SocketImplBase::DestructionLock,
+                  boost::system::error_code erc)
+    {
+      FileTransferPtr f;
+      {
+        StrandLock bl(*s, s->strand_.get());
+        f = s->files_.front();
+      }
+      utime_t start = utime();
+      size_t sent = 0;
+      bool done = false;
+      bool input = false;
+      while (!erc && sent < file_chunk)
+      {
+        size_t length = file_chunk - sent;
+        if (f->length)
+        {
+          if (f->length == f->sent)
+          {
+            done = true;
+            break;
+          }
+          length = std::min(length, f->length - f->sent);
+        }
+        size_t n = transfer_some(s->getFD(), *f, length, erc, input);
+        if (!n && !erc)
+          // End of file.
+          done = true;
+        f->sent += n;
+        sent += n;
+        if (done)
+          break;
+      }
+      if (erc == boost::asio::error::would_block)
+        erc.clear();
+      else if (erc)
+        done = true;
+
+      CallbackStrandLock blc(s->callbackLock, s->strand_.get());
+      if (sent)
+      {
+        {
+          StrandLock bl(*s, s->strand_.get());
+          s->bytesSent_ += sent;
+          s->wrote_(sent, start);
+        }
+        if (f->onProgress)
+          f->onProgress(f->sent);
+      }
+      if (!done)
+      {
+        StrandLock bl(*s, s->strand_.get());
+        wait_file(s, *f, input);
+        return;
+      }
+      GD_FINFO_DEBUG("%p: sent %s bytes of %s: %s",
+                     s, f->sent, f->fd, erc.message());
+      if (f->onSent)
+        f->onSent(erc, f->sent);
+      StrandLock bl(*s, s->strand_.get());
+      // Drop the transfer and its place in the queue.
+      s->files_.pop_front();
+      s->queue_.erase(s->queue_.begin());
+      s->queuedSince_ = utime();
+      s->sendingFile_ = false;
+      s->startWrite();
+    }
+
+    /// Queue \a f, in the strand if any.
+    void
+    queue_file(SocketImpl<tcpsock>* s, SocketImplBase::DestructionLock,
+               const FileTransferPtr& f)
+    {
+      if (!s->strand_)
+      {
+        BlockLock bl(s);
+        s->enqueue_(f);
+        s->startWrite();
+      }
+      else if (s->strand_->running_in_this_thread())
+      {
+        s->enqueue_(f);
+        s->startWrite();
+      }
+      else
+        s->strand_->post(boost::bind(&queue_file,
+                                     s, s->getDestructionLock(), f));
+    }
+
+    boost::system::error_code
+    send_file(SocketImpl<tcpsock>* s, native_handle_type fd,
+              size_t offset, size_t length,
+              const BaseSocket::onsent_type& onSent,
+              const BaseSocket::onprogress_type& onProgress)
+    {
+      if (!s->isConnected())
+        return errorcodes::make_error_code(errorcodes::not_connected);
+      struct stat st;
+      if (fstat(fd, &st))
+        return errno_error();
+      // sendfile needs a file it can map, splice needs a pipe.
+      if (!S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode))
+        return errorcodes::make_error_code(
+          errorcodes::operation_not_supported);
+      FileTransferPtr f(new FileTransfer);
+      f->fd = fd;
+      f->pipe = S_ISFIFO(st.st_mode);
+      f->offset = offset;
+      f->length = length;
+      f->sent = 0;
+      f->onSent = onSent;
+      f->onProgress = onProgress;
+      queue_file(s, s->getDestructionLock(), f);
+      return boost::system::error_code();
+    }
+  }
+#endif
+
+  boost::system::error_code
+  Socket::sendFile(native_handle_type fd, size_t offset, size_t length,
+                   const onsent_type& onSent, const onprogress_type& onProgress)
+  {
+    if (!base_)
+      return netdetail::errorcodes::make_error_code(
+        netdetail::errorcodes::not_connected);
+    return base_->sendFile(fd, offset, length, onSent, onProgress);
+  }
+
+#if ! defined WIN32
+  static void
+  close_sent_file(int fd, const Socket::onsent_type& onSent,
+                  boost::system::error_code erc, size_t sent)
+  {
+    ::close(fd);
+    if (onSent)
+      onSent(erc, sent);
+  }
+#endif
+
+  boost::system::error_code
+  Socket::sendFile(const std::string& path,
+                   const onsent_type& onSent, const onprogress_type& onProgress)
+  {
+#if defined WIN32
+    LIBPORT_USE(path, onSent, onProgress);
+    return netdetail::errorcodes::make_error_code(
+      netdetail::errorcodes::operation_not_supported);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+      return netdetail::errno_error();
+    boost::system::error_code erc =
+      sendFile(fd, 0, 0, boost::bind(&close_sent_file, fd, onSent, _1, _2),
+               onProgress);
+    if (erc)
+      ::close(fd);
+    return erc;
+#endif
+  }
+
   void
   makePipe(std::pair<Socket*, Socket*> s, boost::asio::io_service& io)
   {
@@ -826,6 +1921,23 @@ namespace libport
     GD_INFO_TRACE("connection_reset done");
   }
 
+  // The strand handlers do not lock callbackLock.
+  void
+  Socket::resetCallbacks_(BaseSocket* b, DestructionLock l)
+  {
+    netdetail::SocketImplBase* s =
+      dynamic_cast<netdetail::SocketImplBase*>(b);
+    if (s && s->strand_ && !s->strand_->running_in_this_thread())
+    {
+      s->strand_->post(boost::bind(&Socket::resetCallbacks_, b, l));
+      return;
+    }
+    ScopedLock<RecursiveAdaptiveLock> bl(b->callbackLock);
+    b->onReadFunc = 0;
+    b->onErrorFunc = 0;
+    b->unlinkAll();
+  }
+
   void
   Socket::close()
   {
@@ -841,10 +1953,7 @@ namespace libport
       }
       b->close();
       b->destroy();
-      BlockLock bl(b->callbackLock);
-      b->onReadFunc = 0;
-      b->onErrorFunc = 0;
-      b->unlinkAll();
+      resetCallbacks_(b, l);
     }
   }
 }
@@ -10,7 +10,7 @@
 
 #include <libport/format.hh>
 #include <libport/debug.hh>
-#include <libport/lockable.hh>
+#include <libport/adaptive-lock.hh>
 #include <boost/unordered_map.hpp>
 
 namespace libport
@@ -41,8 +41,8 @@ namespace libport
     static FormatMap map(map_ok);
     if (map_ok)
     {
-      static libport::Lockable lock;
-      libport::BlockLock bl(lock);
+      static libport::AdaptiveLock lock;
+      libport::ScopedLock<libport::AdaptiveLock> bl(lock);
       FormatMap::iterator i = map.find(s);
       if (i == map.end())
         return map[s].parse(s);
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#define LIBPORT_NO_SSL
+#include <libport/cassert>
+#include <libport/cstring>
+#include <libport/foreach.hh>
+#include <libport/framed-socket.hh>
+
+namespace libport
+{
+
+  /*---------.
+  | Framer.  |
+  `---------*/
+
+  Framer::~Framer()
+  {
+  }
+
+  void
+  Framer::reset()
+  {
+  }
+
+
+  /*---------------------.
+  | LengthPrefixFramer.  |
+  `---------------------*/
+
+  LengthPrefixFramer::LengthPrefixFramer(size_t width, size_t max)
+    : width_(width)
+    , max_(max)
+  {
+    aver(0 < width_ && width_ <= sizeof(size_t));
+  }
+
+  size_t
+  LengthPrefixFramer::parse(const char* data, size_t length, Frame& frame)
+  {
+    if (length < width_)
+      return 0;
+    size_t size = 0;
+    for (size_t i = 0; i < width_; ++i)
+      size = size << 8 | static_cast<unsigned char>(data[i]);
+    if (max_ < size)
+      return invalid;
+    if (length - width_ < size)
+      return 0;
+    frame.data = data + width_;
+    frame.length = size;
+    return width_ + size;
+  }
+
+  void
+  LengthPrefixFramer::encode(const void* data, size_t length,
+                             std::string& out) const
+  {
+    aver(length <= max_);
+    aver(width_ == sizeof(size_t) || !(length >> (8 * width_)));
+    out.reserve(out.size() + width_ + length);
+    for (size_t i = width_; i; --i)
+      out += char(length >> (8 * (i - 1)));
+    out.append(static_cast<const char*>(data), length);
+  }
+
+
+  /*------------------.
+  | DelimiterFramer.  |
+  `------------------*/
+
+  DelimiterFramer::DelimiterFramer(const std::string& delimiter, size_t max)
+    : delimiter_(delimiter)
+    , max_(max)
+    , scanned_(0)
+  {
+    aver(!delimiter_.empty());
+  }
+
+  size_t
+  DelimiterFramer::parse(const char* data, size_t length, Frame& frame)
+  {
+    size_t d = delimiter_.size();
+    const char* end = data + length;
+    // Resume where the previous search stopped, minus the beginning
+    // of a delimiter it may have seen.
+    const char* p = data + (scanned_ < d ? 0 : scanned_ - d + 1);
+    for (;
+         (p = static_cast<const char*>(memchr(p, delimiter_[0], end - p)))
+           && d <= size_t(end - p);
+         ++p)
+      if (!memcmp(p, delimiter_.data(), d))
+      {
+        scanned_ = 0;
+        size_t size = p - data;
+        if (max_ < size)
+          return invalid;
+        frame.data = data;
+        frame.length = size;
+        return size + d;
+      }
+    scanned_ = length;
+    return max_ + d <= length ? invalid : 0;
+  }
+
+  void
+  DelimiterFramer::encode(const void* data, size_t length,
+                          std::string& out) const
+  {
+    out.reserve(out.size() + length + delimiter_.size());
+    out.append(static_cast<const char*>(data), length);
+    out += delimiter_;
+  }
+
+  void
+  DelimiterFramer::reset()
+  {
+    scanned_ = 0;
+  }
+
+
+  /*------------------.
+  | FixedSizeFramer.  |
+  `------------------*/
+
+  FixedSizeFramer::FixedSizeFramer(size_t size)
+    : size_(size)
+  {
+    aver(size_);
+  }
+
+  size_t
+  FixedSizeFramer::parse(const char* data, size_t length, Frame& frame)
+  {
+    if (length < size_)
+      return 0;
+    frame.data = data;
+    frame.length = size_;
+    return size_;
+  }
+
+  void
+  FixedSizeFramer::encode(const void* data, size_t length,
+                          std::string& out) const
+  {
+    aver_eq(length, size_);
+    out.append(static_cast<const char*>(data), length);
+  }
+
+
+  /*---------------.
+  | FramedSocket.  |
+  `---------------*/
+
+  FramedSocket::FramedSocket(Framer* framer, boost::asio::io_service& io)
+    : Socket(io)
+    , framer_(framer)
+  {
+    aver(framer);
+  }
+
+  void
+  FramedSocket::onFrames(const frames_type& frames)
+  {
+    foreach (const Frame& f, frames)
+      onFrame(f);
+  }
+
+  void
+  FramedSocket::onFrame(const Frame&)
+  {
+    // Nothing
+  }
+
+  void
+  FramedSocket::sendFrame(const void* data, size_t length)
+  {
+    boost::shared_ptr<std::string> frame(new std::string);
+    framer_->encode(data, length, *frame);
+    write(frame);
+  }
+
+  void
+  FramedSocket::sendFrame(const std::string& s)
+  {
+    sendFrame(s.data(), s.size());
+  }
+
+  Framer&
+  FramedSocket::framer_get()
+  {
+    return *framer_;
+  }
+
+  size_t
+  FramedSocket::onReadv(const RingBuffer::const_buffers_type& buffers)
+  {
+    // Only the first chunk is parsed: a frame which does not fit in it
+    // is incomplete, and returning 0 for it makes the data contiguous.
+    const char* data = boost::asio::buffer_cast<const char*>(buffers[0]);
+    size_t length = boost::asio::buffer_size(buffers[0]);
+    size_t used = 0;
+    frames_.clear();
+    while (used < length)
+    {
+      Frame frame;
+      size_t size = framer_->parse(data + used, length - used, frame);
+      if (!size)
+        break;
+      if (size == Framer::invalid)
+      {
+        if (!frames_.empty())
+          onFrames(frames_);
+        frames_.clear();
+        framer_->reset();
+        onError(boost::asio::error::message_size);
+        close();
+        // Drop everything.
+        return length + boost::asio::buffer_size(buffers[1]);
+      }
+      frames_.push_back(frame);
+      used += size;
+    }
+    if (!frames_.empty())
+      onFrames(frames_);
+    return used;
+  }
+
+} // namespace libport
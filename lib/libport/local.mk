@@ -32,6 +32,7 @@ lib_libport_libport@LIBSFX@_la_CPPFLAGS =       \
 
 # Sources to compile to use libport.
 dist_lib_libport_libport@LIBSFX@_la_SOURCES =   \
+  lib/libport/adaptive-lock.cc                  \
   lib/libport/asio.cc                           \
   lib/libport/asio-impl.hxx                     \
   lib/libport/asio-ssl.cc                       \
@@ -55,6 +56,7 @@ dist_lib_libport_libport@LIBSFX@_la_SOURCES =   \
   lib/libport/file-system.cc                    \
   lib/libport/fnmatch.cc                        \
   lib/libport/format.cc                         \
+  lib/libport/framed-socket.cc                  \
   lib/libport/hmac-sha1.cc                      \
   lib/libport/indent.cc                         \
   lib/libport/input-arguments.cc                \
@@ -64,6 +66,7 @@ dist_lib_libport_libport@LIBSFX@_la_SOURCES =   \
   lib/libport/markup-ostream.cc                 \
   lib/libport/option-parser.cc                  \
   lib/libport/package-info.cc                   \
+  lib/libport/parallel.cc                       \
   lib/libport/path.cc                           \
   lib/libport/pid-file.cc                       \
   lib/libport/program-name.cc                   \
@@ -71,11 +74,13 @@ dist_lib_libport_libport@LIBSFX@_la_SOURCES =   \
   lib/libport/sched.cc                          \
   lib/libport/semaphore-rpl.cc                  \
   lib/libport/semaphore.cc                      \
+  lib/libport/socket-stats.cc                   \
   lib/libport/symbol.cc                         \
   lib/libport/synchronizer.cc                   \
   lib/libport/sys/utsname.cc                    \
   lib/libport/sysexits.cc                       \
   lib/libport/timer.cc                          \
+  lib/libport/timer-wheel.cc                    \
   lib/libport/thread-pool.cc                    \
   lib/libport/tokenizer.cc                      \
   lib/libport/ufloat.cc                         \
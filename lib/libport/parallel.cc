@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <algorithm>
+
+#include <boost/exception_ptr.hpp>
+
+#include <libport/bind.hh>
+#include <libport/condition.hh>
+#include <libport/parallel.hh>
+
+namespace libport
+{
+  namespace parallel
+  {
+    namespace
+    {
+      /// A range being processed, shared by the caller and the helpers.
+      class Job: public ThreadSafeRefCounted
+      {
+      public:
+        Job(size_t n, size_t grain, const Chunk& chunk)
+          : n_(n)
+          , grain_(grain)
+          , chunks_((n + grain - 1) / grain)
+          , next_(0)
+          , done_(0)
+          , failed_(false)
+          , chunk_(chunk)
+        {}
+
+        size_t chunks() const
+        {
+          return chunks_;
+        }
+
+        /// Process chunks until none is left.
+        void work()
+        {
+          while (true)
+          {
+            size_t i;
+            {
+              BlockLock bl(cond_);
+              if (next_ == chunks_)
+                return;
+              i = next_++;
+            }
+            if (!failed_)
+              try
+              {
+                chunk_(i * grain_, std::min(n_, (i + 1) * grain_));
+              }
+              catch (...)
+              {
+                BlockLock bl(cond_);
+                if (!failed_)
+                  exception_ = boost::current_exception();
+                failed_ = true;
+              }
+            BlockLock bl(cond_);
+            if (++done_ == chunks_)
+              cond_.broadcast();
+          }
+        }
+
+        /// Wait for all the chunks, and rethrow their exception.
+        void wait()
+        {
+          {
+            BlockLock bl(cond_);
+            while (done_ < chunks_)
+              cond_.wait();
+          }
+          if (failed_)
+            boost::rethrow_exception(exception_);
+        }
+
+      private:
+        size_t n_;
+        size_t grain_;
+        size_t chunks_;
+        /// Next chunk to process (locked by cond_).
+        size_t next_;
+        /// Number of chunks processed (locked by cond_).
+        size_t done_;
+        Condition cond_;
+        volatile bool failed_;
+        boost::exception_ptr exception_;
+        Chunk chunk_;
+      };
+    }
+
+    size_t
+    grain_size(const ThreadPool& pool, size_t n, size_t grain)
+    {
+      if (grain)
+        return grain;
+      // A few chunks per thread, to balance the load.
+      return std::max(n / (4 * pool.concurrency()), min_grain);
+    }
+
+    void
+    run(ThreadPool& pool, size_t n, size_t grain, const Chunk& chunk)
+    {
+      grain = grain_size(pool, n, grain);
+      if (n <= grain)
+      {
+        if (n)
+          chunk(0, n);
+        return;
+      }
+      libport::intrusive_ptr<Job> job(new Job(n, grain, chunk));
+      // The caller takes its share: helpers that start late find
+      // nothing left to do.
+      size_t helpers = std::min(job->chunks() - 1, pool.concurrency());
+      for (size_t i = 0; i < helpers; ++i)
+        pool.queueTask(boost::bind(&Job::work, job));
+      job->work();
+      job->wait();
+    }
+  }
+}
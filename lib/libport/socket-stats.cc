@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include <libport/socket-stats.hh>
+
+namespace libport
+{
+
+  /*----------------.
+  | Log2Histogram.  |
+  `----------------*/
+
+  Log2Histogram::Log2Histogram()
+    : count_(0)
+    , sum_(0)
+    , max_(0)
+  {
+    std::fill(buckets_, buckets_ + buckets, 0);
+  }
+
+  Log2Histogram&
+  Log2Histogram::operator+=(const Log2Histogram& h)
+  {
+    for (size_t i = 0; i < size_t(buckets); ++i)
+      buckets_[i] += h.buckets_[i];
+    count_ += h.count_;
+    sum_ += h.sum_;
+    max_ = std::max(max_, h.max_);
+    return *this;
+  }
+
+  Log2Histogram::value_type
+  Log2Histogram::quantile(double q) const
+  {
+    value_type rank = value_type(q * count_);
+    value_type seen = 0;
+    for (size_t i = 0; i < size_t(buckets) - 1; ++i)
+    {
+      seen += buckets_[i];
+      if (rank < seen)
+        return std::min(i ? (value_type(1) << i) - 1 : 0, max_);
+    }
+    return max_;
+  }
+
+  std::ostream&
+  operator<<(std::ostream& o, const Log2Histogram& h)
+  {
+    return o << std::setw(10) << h.count()
+             << std::setw(10) << std::fixed << std::setprecision(1)
+             << h.mean()
+             << std::setw(10) << h.quantile(0.5)
+             << std::setw(10) << h.quantile(0.99)
+             << std::setw(10) << h.max();
+  }
+
+
+  /*--------------.
+  | SocketStats.  |
+  `--------------*/
+
+  SocketStats::SocketStats()
+    : duration(0)
+    , reads(0)
+    , readBytes(0)
+    , writes(0)
+    , writeBytes(0)
+  {
+  }
+
+  SocketStats&
+  SocketStats::operator+=(const SocketStats& s)
+  {
+    duration = std::max(duration, s.duration);
+    reads += s.reads;
+    readBytes += s.readBytes;
+    readSize += s.readSize;
+    handlerTime += s.handlerTime;
+    writes += s.writes;
+    writeBytes += s.writeBytes;
+    writeSize += s.writeSize;
+    queueDepth += s.queueDepth;
+    queueTime += s.queueTime;
+    backlog += s.backlog;
+    return *this;
+  }
+
+  double
+  SocketStats::readRate() const
+  {
+    return duration ? reads * 1e6 / duration : 0;
+  }
+
+  double
+  SocketStats::writeRate() const
+  {
+    return duration ? writes * 1e6 / duration : 0;
+  }
+
+  std::ostream&
+  SocketStats::dump(std::ostream& o) const
+  {
+    o << std::fixed << std::setprecision(1)
+      << "duration: " << duration / 1e6 << "s" << std::endl
+      << "reads: " << reads << " (" << readRate() << "/s), "
+      << readBytes << " bytes" << std::endl
+      << "writes: " << writes << " (" << writeRate() << "/s), "
+      << writeBytes << " bytes" << std::endl
+      << std::setw(20) << ""
+      << std::setw(10) << "count"
+      << std::setw(10) << "mean"
+      << std::setw(10) << "p50 <="
+      << std::setw(10) << "p99 <="
+      << std::setw(10) << "max" << std::endl
+      << std::left << std::setw(20) << "read size (B)" << std::right
+      << readSize << std::endl
+      << std::left << std::setw(20) << "handler time (us)" << std::right
+      << handlerTime << std::endl
+      << std::left << std::setw(20) << "write size (B)" << std::right
+      << writeSize << std::endl
+      << std::left << std::setw(20) << "queue depth (B)" << std::right
+      << queueDepth << std::endl
+      << std::left << std::setw(20) << "queue time (us)" << std::right
+      << queueTime << std::endl;
+    if (backlog.count())
+      o << std::left << std::setw(20) << "backlog (us)" << std::right
+        << backlog << std::endl;
+    return o;
+  }
+
+  std::ostream&
+  operator<<(std::ostream& o, const SocketStats& s)
+  {
+    return s.dump(o);
+  }
+
+} // namespace libport
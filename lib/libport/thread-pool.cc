@@ -8,9 +8,19 @@
  * See the LICENSE file for more information.
  */
 
+#include <libport/bind.hh>
+#include <libport/cassert>
+#include <libport/foreach.hh>
 #include <libport/utime.hh>
 #include <libport/thread-pool.hh>
 #include <libport/thread.hh>
+#include <libport/thread-data.hh>
+#include <libport/unistd.h>
+
+#ifdef LIBPORT_HAVE_ATOMIC
+# include <libport/mpmc-queue.hh>
+# include <libport/work-deque.hh>
+#endif
 
 // Not using GD for debug, we need a 0-cost when disabled.
 #define debug(a)
@@ -18,16 +28,155 @@
 
 namespace libport
 {
-  ThreadPool::ThreadPool(size_t maxThreads)
-    : maxThreads_(maxThreads)
+#ifdef LIBPORT_HAVE_ATOMIC
+  class ThreadPool::Worker
+  {
+  public:
+    Worker(ThreadPool* p, size_t i)
+      : pool(p)
+      , index(i)
+    {}
+    ThreadPool* pool;
+    size_t index;
+    pthread_t handle;
+    WorkDeque<TaskHandle> deque;
+  };
+
+  UnmanagedThreadSpecificPtr<ThreadPool::Worker> ThreadPool::current_;
+#endif
+
+  static size_t
+  processors()
+  {
+#if defined WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long res = info.dwNumberOfProcessors;
+#else
+    long res = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return 0 < res ? res : 1;
+  }
+
+  ThreadPool::ThreadPool(size_t maxThreads, bool workStealing)
+    : nLockedTasks_(0)
+    , maxThreads_(maxThreads)
+    , workStealing_(false)
+    , injector_(0)
+    , overflow_(0)
+    , sleepers_(0)
+    , stopping_(false)
+  {
+#ifdef LIBPORT_HAVE_ATOMIC
+    if (!workStealing)
+      return;
+    workStealing_ = true;
+    injector_ = new MPMCQueue<TaskHandle>;
+    size_t n = maxThreads ? maxThreads : processors();
+    for (size_t i = 0; i < n; ++i)
+      workers_.push_back(new Worker(this, i));
+    // Start them once workers_ is complete, they steal from each other.
+    foreach (Worker* w, workers_)
+      w->handle = libport::startThread(boost::bind(&ThreadPool::workerLoop_,
+                                                   this, w));
+#else
+    (void) workStealing;
+#endif
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+#ifdef LIBPORT_HAVE_ATOMIC
+    if (!workStealing_)
+      return;
+    stopping_ = true;
+    atomic::barrier();
+    idle_ += workers_.size();
+    foreach (Worker* w, workers_)
+      PTHREAD_RUN(pthread_join, w->handle, 0);
+    // Drop the remaining tasks, so that their futures fail.  Their
+    // continuations may queue tasks again, dropped the same way.
+    std::vector<rTaskHandle> tasks;
+    do
+    {
+      tasks.clear();
+      foreach (Worker* w, workers_)
+        while (TaskHandle* t = w->deque.pop())
+        {
+          tasks.push_back(rTaskHandle(t));
+          t->counter_dec();
+        }
+      while (TaskHandle* t = injector_->pop())
+      {
+        tasks.push_back(rTaskHandle(t));
+        t->counter_dec();
+      }
+      {
+        ScopedLock<AdaptiveLock> bl(lock_);
+        tasks.insert(tasks.end(), queue_.begin(), queue_.end());
+        queue_.clear();
+        overflow_ = 0;
+        // The tasks waiting for the lock of a dropped one, appended
+        // to the tasks being visited.
+        for (size_t i = 0; i < tasks.size(); ++i)
+          if (TaskLock* lock = tasks[i]->taskLock.get())
+          {
+            tasks.insert(tasks.end(),
+                         lock->waitingTasks.begin(),
+                         lock->waitingTasks.end());
+            nLockedTasks_ -= lock->waitingTasks.size();
+            lock->waitingTasks.clear();
+            lock->registered = false;
+          }
+      }
+      foreach (const rTaskHandle& t, tasks)
+      {
+        t->state_ = TaskHandle::DROPPED;
+        if (t->onDrop)
+          t->onDrop("pool destroyed");
+      }
+    }
+    while (!tasks.empty());
+    foreach (Worker* w, workers_)
+      delete w;
+    delete injector_;
+#endif
+  }
+
+  bool
+  ThreadPool::workStealing() const
+  {
+    return workStealing_;
+  }
+
+  size_t
+  ThreadPool::concurrency() const
   {
+    if (workStealing_)
+      return workers_.size();
+    return maxThreads_ ? maxThreads_ : processors();
+  }
+
+  size_t
+  ThreadPool::contentions() const
+  {
+    return lock_.contentions();
   }
 
   size_t
   ThreadPool::queueSize()
   {
-    libport::BlockLock bl(lock_);
-    return queue_.size() + nLockedTasks_;
+    ScopedLock<AdaptiveLock> bl(lock_);
+    size_t res = queue_.size() + nLockedTasks_;
+#ifdef LIBPORT_HAVE_ATOMIC
+    if (workStealing_)
+    {
+      res += injector_->size();
+      foreach (Worker* w, workers_)
+        res += w->deque.size();
+    }
+#endif
+    return res;
   }
 
   void
@@ -48,7 +197,7 @@ namespace libport
       else if (thread->taskLock)
       {
         debug("handling taskLock task");
-        libport::BlockLock bl(lock_);
+        ScopedLock<AdaptiveLock> bl(lock_);
         if (thread->taskLock->waitingTasks.empty())
         { // No more tasks, deregister.
           debug("deregistering taskLock");
@@ -69,7 +218,7 @@ namespace libport
       {
         debug("thread fetching task to main queue");
         // Go fetch ourselve a task
-        libport::BlockLock bl(lock_);
+        ScopedLock<AdaptiveLock> bl(lock_);
         if (threads_.size() > maxThreads_ && maxThreads_)
         {
           debug("thread diing");
@@ -106,25 +255,64 @@ namespace libport
   }
 
   ThreadPool::rTaskHandle
-  ThreadPool::queueTask(TaskFunc func, rTaskLock lock)
+  ThreadPool::queueTask(TaskFunc func, rTaskLock lock, DropFunc onDrop)
   {
     rTaskHandle res(new TaskHandle);
     res->taskFunc = func;
     res->taskLock = lock;
+    res->onDrop = onDrop;
+    // Not under lock_: failing a future may queue its continuations.
+    if (!enqueue_(res) && onDrop)
+      onDrop("task dropped");
+    return res;
+  }
+
+  bool
+  ThreadPool::enqueue_(const rTaskHandle& res)
+  {
+    const rTaskLock& lock = res->taskLock;
+#ifdef LIBPORT_HAVE_ATOMIC
+    if (workStealing_)
+    {
+      if (lock)
+      {
+        ScopedLock<AdaptiveLock> bl(lock_);
+        if (lock->registered)
+        {
+          if (lock->maxSize && lock->waitingTasks.size() >= lock->maxSize -1)
+          {
+            debug("queuetask: dropping task");
+            res->state_ = TaskHandle::DROPPED;
+            return false;
+          }
+          // The worker running the lock will pick it up.
+          res->state_ = TaskHandle::QUEUED;
+          lock->waitingTasks.push_back(res);
+          nLockedTasks_++;
+          return true;
+        }
+        lock->registered = true;
+      }
+      res->state_ = TaskHandle::QUEUED;
+      res->counter_inc();
+      push_(res.get());
+      return true;
+    }
+#endif
     /* Three cases:
        - Task depends on another running task: add to this dependency queue.
        - We have IDLE threads: wake one up
        - Thread count is below limit: spawn a thread.
        - Else: queue
     */
-    libport::BlockLock bl(lock_);
+    ScopedLock<AdaptiveLock> bl(lock_);
     if (lock && lock->registered)
     {
       if (lock->maxSize && lock->waitingTasks.size() >= lock->maxSize -1)
       {
         debug("queuetask: dropping task");
         res->state_ = TaskHandle::DROPPED;
-        return res;
+        return false;
       }
       debug("queuetask: registered taskLock");
       lock->waitingTasks.push_back(res);
@@ -153,7 +341,7 @@ namespace libport
     if (lock)
       lock->registered = true;
     res->state_ = TaskHandle::QUEUED;
-    return res;
+    return true;
   }
 
   ThreadPool::Thread::~Thread()
@@ -183,4 +371,295 @@ namespace libport
   {
     maxThreads_ = maxThreads;
   }
+
+  /*----------.
+  | Futures.  |
+  `----------*/
+
+  ThreadPool::FutureBase::FutureBase(ThreadPool* pool)
+    : pool_(pool)
+    , ready_(false)
+  {
+  }
+
+  ThreadPool::FutureBase::~FutureBase()
+  {
+  }
+
+  bool
+  ThreadPool::FutureBase::ready() const
+  {
+    return ready_;
+  }
+
+  void
+  ThreadPool::FutureBase::wait()
+  {
+    BlockLock bl(cond_);
+    while (!ready_)
+      cond_.wait();
+  }
+
+  bool
+  ThreadPool::FutureBase::wait(utime_t useconds)
+  {
+    utime_t deadline = utime() + useconds;
+    BlockLock bl(cond_);
+    for (utime_t now = utime(); !ready_ && now < deadline; now = utime())
+      cond_.tryWait(deadline - now);
+    return ready_;
+  }
+
+  void
+  ThreadPool::FutureBase::onReady(const Callback& cb)
+  {
+    {
+      BlockLock bl(cond_);
+      if (!ready_)
+      {
+        callbacks_.push_back(cb);
+        return;
+      }
+    }
+    cb();
+  }
+
+  void
+  ThreadPool::FutureBase::fail(const boost::exception_ptr& e)
+  {
+    exception_ = e;
+    complete_();
+  }
+
+  void
+  ThreadPool::FutureBase::check() const
+  {
+    if (exception_)
+      boost::rethrow_exception(exception_);
+  }
+
+  ThreadPool*
+  ThreadPool::FutureBase::pool() const
+  {
+    return pool_;
+  }
+
+  void
+  ThreadPool::FutureBase::complete_()
+  {
+    std::vector<Callback> callbacks;
+    {
+      BlockLock bl(cond_);
+      aver(!ready_);
+      ready_ = true;
+      cond_.broadcast();
+      std::swap(callbacks, callbacks_);
+    }
+    foreach (const Callback& cb, callbacks)
+      cb();
+  }
+
+  namespace
+  {
+    /// Count down the inputs of when_all.
+    struct WhenAll: public ThreadSafeRefCounted
+    {
+      WhenAll(long n, ThreadPool::Future<void>::rState s)
+        : remaining(n)
+        , state(s)
+      {}
+
+      void done()
+      {
+        {
+          BlockLock bl(lock);
+          if (--remaining)
+            return;
+        }
+        state->set();
+      }
+
+      Lockable lock;
+      long remaining;
+      ThreadPool::Future<void>::rState state;
+    };
+
+    /// Complete when_any with the first input.
+    struct WhenAny: public ThreadSafeRefCounted
+    {
+      WhenAny(ThreadPool::Future<size_t>::rState s)
+        : first(true)
+        , state(s)
+      {}
+
+      void done(size_t i)
+      {
+        {
+          BlockLock bl(lock);
+          if (!first)
+            return;
+          first = false;
+        }
+        state->set(i);
+      }
+
+      Lockable lock;
+      bool first;
+      ThreadPool::Future<size_t>::rState state;
+    };
+  }
+
+  ThreadPool::Future<void>
+  ThreadPool::when_all_(const std::vector<rFutureBase>& fs)
+  {
+    Future<void>::rState res(
+      new FutureState<void>(fs.empty() ? 0 : fs.front()->pool()));
+    if (fs.empty())
+      res->set();
+    else
+    {
+      libport::intrusive_ptr<WhenAll> w(new WhenAll(fs.size(), res));
+      foreach (const rFutureBase& f, fs)
+        f->onReady(boost::bind(&WhenAll::done, w));
+    }
+    return res;
+  }
+
+  ThreadPool::Future<size_t>
+  ThreadPool::when_any_(const std::vector<rFutureBase>& fs)
+  {
+    aver(!fs.empty());
+    Future<size_t>::rState res(new FutureState<size_t>(fs.front()->pool()));
+    libport::intrusive_ptr<WhenAny> w(new WhenAny(res));
+    for (size_t i = 0; i < fs.size(); ++i)
+      fs[i]->onReady(boost::bind(&WhenAny::done, w, i));
+    return res;
+  }
+
+  /*-----------------.
+  | Work stealing.  |
+  `-----------------*/
+
+#ifdef LIBPORT_HAVE_ATOMIC
+  void
+  ThreadPool::push_(TaskHandle* t)
+  {
+    Worker* w = current_.get();
+    if (w && w->pool == this)
+      w->deque.push(t);
+    else if (!injector_->push(t))
+    {
+      debug("queuetask: injector full");
+      ScopedLock<AdaptiveLock> bl(lock_);
+      queue_.push_back(t);
+      t->counter_dec();
+      atomic::increment_fetch(&overflow_);
+    }
+    wake_();
+  }
+
+  void
+  ThreadPool::wake_()
+  {
+    // Publish the task before looking for sleepers.
+    atomic::barrier();
+    for (long s = sleepers_; 0 < s; s = sleepers_)
+      if (atomic::compare_and_swap(&sleepers_, s, s - 1))
+      {
+        idle_++;
+        return;
+      }
+  }
+
+  ThreadPool::TaskHandle*
+  ThreadPool::findTask_(Worker* w)
+  {
+    if (TaskHandle* res = w->deque.pop())
+      return res;
+    if (TaskHandle* res = injector_->pop())
+      return res;
+    size_t n = workers_.size();
+    for (size_t i = 1; i < n; ++i)
+      if (TaskHandle* res = workers_[(w->index + i) % n]->deque.steal())
+        return res;
+    if (overflow_)
+    {
+      ScopedLock<AdaptiveLock> bl(lock_);
+      if (!queue_.empty())
+      {
+        TaskHandle* res = queue_.front().get();
+        res->counter_inc();
+        queue_.pop_front();
+        atomic::decrement_fetch(&overflow_);
+        return res;
+      }
+    }
+    return 0;
+  }
+
+  void
+  ThreadPool::run_(rTaskHandle t)
+  {
+    rTaskLock lock = t->taskLock;
+    while (true)
+    {
+      t->state_ = TaskHandle::RUNNING;
+      try {
+        t->taskFunc();
+        t->state_ = TaskHandle::FINISHED;
+      }
+      catch(...)
+      {
+        t->state_ = TaskHandle::EXCEPTION;
+      }
+      if (!lock)
+        return;
+      ScopedLock<AdaptiveLock> bl(lock_);
+      if (lock->waitingTasks.empty())
+      {
+        debug("deregistering taskLock");
+        lock->registered = false;
+        return;
+      }
+      t = lock->waitingTasks.front();
+      lock->waitingTasks.pop_front();
+      nLockedTasks_--;
+    }
+  }
+
+  void
+  ThreadPool::workerLoop_(Worker* w)
+  {
+    current_.reset(w);
+    while (!stopping_)
+    {
+      TaskHandle* t = findTask_(w);
+      if (!t)
+      {
+        // Register as parked, then check again so that a task pushed
+        // meanwhile either is seen or wakes us up.
+        atomic::increment_fetch(&sleepers_);
+        t = findTask_(w);
+        if (!t && !stopping_)
+        {
+          idle_--;
+          continue;
+        }
+        // Unregister, or consume the wake up we were given.
+        long s = sleepers_;
+        while (0 < s && !atomic::compare_and_swap(&sleepers_, s, s - 1))
+          s = sleepers_;
+        if (!s)
+          idle_--;
+        if (!t)
+          continue;
+      }
+      // Adopt the reference taken by push_.
+      rTaskHandle task(t);
+      t->counter_dec();
+      run_(task);
+    }
+    current_.reset(0);
+  }
+#endif
 };
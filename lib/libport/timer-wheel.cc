@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#define LIBPORT_NO_SSL
+#include <algorithm>
+
+#include <libport/bind.hh>
+#include <libport/cassert>
+#include <libport/foreach.hh>
+#include <libport/timer-wheel.hh>
+
+namespace libport
+{
+
+  struct TimerWheel::Entry
+  {
+    /// The tick to fire at.
+    tick_type tick;
+    /// Empty once fired or cancelled.
+    callback_type callback;
+  };
+
+  boost::asio::io_service::id TimerWheel::id;
+
+  TimerWheel::TimerWheel(boost::asio::io_service& io,
+                         useconds_t tick, size_t slots)
+    : boost::asio::io_service::service(io)
+    , timer_(io)
+    , tick_(tick)
+    , slots_(slots)
+    , current_(0)
+    , armed_(0)
+    , size_(0)
+    , wakeups_(0)
+  {
+    aver(tick_);
+    aver(slots);
+    current_ = now_();
+  }
+
+  TimerWheel::~TimerWheel()
+  {
+    boost::system::error_code erc;
+    timer_.cancel(erc);
+  }
+
+  void
+  TimerWheel::shutdown_service()
+  {
+    // The callbacks may hold sockets: release them unlocked.
+    std::vector<callback_type> dropped;
+    {
+      BlockLock bl(lock_);
+      foreach (slot_type& s, slots_)
+      {
+        foreach (Handle& h, s)
+          if (h->callback)
+          {
+            dropped.push_back(callback_type());
+            dropped.back().swap(h->callback);
+          }
+        s.clear();
+      }
+      size_ = 0;
+      armed_ = 0;
+      boost::system::error_code erc;
+      timer_.cancel(erc);
+    }
+  }
+
+  TimerWheel::tick_type
+  TimerWheel::now_() const
+  {
+    return utime() / tick_;
+  }
+
+  TimerWheel::Handle
+  TimerWheel::add(useconds_t delay, const callback_type& callback,
+                  useconds_t slack)
+  {
+    Handle res(new Entry);
+    res->callback = callback;
+    utime_t due = utime() + delay;
+    // Fire at the earliest at the beginning of the tick after due, and
+    // at the latest in the tick of due + slack.
+    tick_type first = (due + tick_ - 1) / tick_;
+    tick_type last = (due + slack) / tick_;
+    res->tick = first;
+    for (tick_type step = 2; ; step *= 2)
+    {
+      tick_type t = (first + step - 1) / step * step;
+      if (last < t)
+        break;
+      res->tick = t;
+    }
+
+    BlockLock bl(lock_);
+    // Never in a slot already processed.
+    res->tick = std::max(res->tick, current_ + 1);
+    slots_[res->tick % slots_.size()].push_back(res);
+    ++size_;
+    if (!armed_ || res->tick < armed_)
+      arm_(res->tick);
+    return res;
+  }
+
+  bool
+  TimerWheel::cancel(const Handle& h)
+  {
+    BlockLock bl(lock_);
+    if (!h || !h->callback)
+      return false;
+    // Dropped from its slot when it is processed.
+    h->callback.clear();
+    --size_;
+    return true;
+  }
+
+  size_t
+  TimerWheel::size() const
+  {
+    BlockLock bl(lock_);
+    return size_;
+  }
+
+  size_t
+  TimerWheel::wakeups() const
+  {
+    BlockLock bl(lock_);
+    return wakeups_;
+  }
+
+  useconds_t
+  TimerWheel::tick() const
+  {
+    return tick_;
+  }
+
+  void
+  TimerWheel::arm_(tick_type tick)
+  {
+    armed_ = tick;
+    utime_t delay = std::max(tick * tick_ - utime(), utime_t(0));
+    // Cancels the previous wait, if any.
+    timer_.expires_from_now(boost::posix_time::microseconds(delay));
+    timer_.async_wait(boost::bind(&TimerWheel::onTimer_, this, _1));
+  }
+
+  void
+  TimerWheel::expire_(slot_type& slot, tick_type now,
+                      std::vector<callback_type>& due)
+  {
+    for (size_t i = 0; i < slot.size(); )
+    {
+      Entry& e = *slot[i];
+      if (e.callback && now < e.tick)
+        ++i;
+      else
+      {
+        if (e.callback)
+        {
+          due.push_back(callback_type());
+          due.back().swap(e.callback);
+          --size_;
+        }
+        slot[i].swap(slot.back());
+        slot.pop_back();
+      }
+    }
+  }
+
+  void
+  TimerWheel::onTimer_(boost::system::error_code erc)
+  {
+    if (erc)
+      // Rearmed or destroyed.
+      return;
+    std::vector<callback_type> due;
+    {
+      BlockLock bl(lock_);
+      ++wakeups_;
+      armed_ = 0;
+      tick_type now = now_();
+      tick_type n = slots_.size();
+      if (n <= now - current_)
+        foreach (slot_type& s, slots_)
+          expire_(s, now, due);
+      else
+        for (tick_type t = current_ + 1; t <= now; ++t)
+          expire_(slots_[t % n], now, due);
+      current_ = std::max(current_, now);
+      // Wake up for the next non-empty slot, even if its timers are for
+      // a later round.
+      if (size_)
+        for (tick_type t = now + 1; t <= now + n; ++t)
+          if (!slots_[t % n].empty())
+          {
+            arm_(t);
+            break;
+          }
+    }
+    foreach (callback_type& c, due)
+      c();
+  }
+
+  /*------------------.
+  | get_timer_wheel.  |
+  `------------------*/
+
+  TimerWheel&
+  get_timer_wheel(boost::asio::io_service& io)
+  {
+    return boost::asio::use_service<TimerWheel>(io);
+  }
+
+} // namespace libport
@@ -30,8 +30,8 @@ namespace sched
 
   Configuration configuration =
   {
-    // Default is large enough until we enable a mechanism to dynamically
-    // reallocate task space on demand.
+    // Default is large enough for the worst case.  Set initial_stack_size
+    // to commit only what jobs actually use.
     /* .default_stack_size = */   STACK_SIZE * 1024,
 #if defined(__x86_64__)
     // 64 bits pointers eat more stack. SEGV have been observed in the
@@ -40,5 +40,6 @@ namespace sched
 #else
     /* .minimum_stack_size = */   STACK_SIZE * 1024 / 8,
 #endif
+    /* .initial_stack_size = */   0,
   };
 }
@@ -9,6 +9,7 @@
  */
 
 #include <libport/cstdlib>
+#include <algorithm>
 #include <iostream>
 
 #include <libport/bind.hh>
@@ -22,6 +23,7 @@
 #include <libport/separate.hh>
 
 #include <sched/job.hh>
+#include <sched/profiler.hh>
 
 GD_CATEGORY(Sched);
 
@@ -78,7 +80,7 @@ namespace sched
   | Job.  |
   `------*/
 
-  unsigned int Job::alive_jobs_ = 0;
+  long Job::alive_jobs_ = 0;
 
   std::ostream&
   Job::dump(std::ostream& o) const
@@ -111,7 +113,9 @@ namespace sched
       // list.
       state_ = running;
       if (stats_.logging)
-        stats_.last_resume = scheduler_.get_time();
+        stats_.last_resume = scheduler_->get_time();
+      if (scheduler_->profiler_get())
+        profile_resumed_();
       try
       {
         if (has_pending_exception()
@@ -137,7 +141,7 @@ namespace sched
         {
           parent_->async_throw(ChildException(e.clone()));
           // Warn the scheduler that the world may have changed.
-          scheduler_.signal_work_next_round();
+          scheduler_->signal_work_next_round();
         }
       }
       catch (const std::exception& e)
@@ -154,11 +158,12 @@ namespace sched
     // Write stats for this last run
     if (stats_.logging)
     {
-      libport::utime_t start_resume = scheduler_.get_time();
+      libport::utime_t start_resume = scheduler_->get_time();
       stats_.job.running.add_sample(
         start_resume - stats_.last_resume);
       // Just a precaution in case we end up in resume_scheduler_.
       stats_.last_resume = start_resume;
+      stats_.job.stack.add_sample(stack_high_water_mark());
     }
     copy_stats_to_parent();
     terminate_cleanup();
@@ -182,7 +187,7 @@ namespace sched
     {
       if (stats_.logging)
       {
-        libport::utime_t start_resume = scheduler_.get_time();
+        libport::utime_t start_resume = scheduler_->get_time();
         stats_.job.running.add_sample(
           start_resume - stats_.last_resume);
         // Just a precaution in case we end up in resume_scheduler_.
@@ -225,6 +230,7 @@ namespace sched
     nb_fork += t.nb_fork;
     nb_join += t.nb_join;
     nb_exn += t.nb_exn;
+    stack.add_samples(t.stack);
   }
 
   void
@@ -299,6 +305,59 @@ namespace sched
       yield_until_terminated(*job);
   }
 
+  void
+  Job::yield_until_notified(Notifier& notifier)
+  {
+    if (non_interruptible_)
+      scheduling_error("attempt to wait for a notification"
+                       " in non-interruptible code");
+
+    aver(!notifier_);
+    notifier_ = &notifier;
+    notifier.waiters_.push_back(this);
+    state_ = waiting;
+    try
+    {
+      GD_FINFO_DEBUG("job %s: waiting for notifier %s", this, &notifier);
+      resume_scheduler_();
+    }
+    catch (...)
+    {
+      GD_FINFO_DEBUG("job %s: dequeued by exception", this);
+      Notifier::remove_(*this);
+      throw;
+    }
+    // We may have been woken up by something else than the notifier.
+    Notifier::remove_(*this);
+  }
+
+  void
+  Job::offload_wait_(libport::ThreadPool::FutureBase& task)
+  {
+    if (non_interruptible_)
+      scheduling_error("attempt to offload in non-interruptible code");
+
+    Scheduler::rOffload o = scheduler_->offload(*this);
+    task.onReady(boost::bind(&Scheduler::Offload::complete, o));
+    try
+    {
+      // We may be woken up by something else than the task.
+      while (!task.ready())
+      {
+        GD_FINFO_DEBUG("job %s: offloaded", this);
+        state_ = offloaded;
+        resume_scheduler_();
+      }
+    }
+    catch (...)
+    {
+      GD_FINFO_DEBUG("job %s: offload interrupted by exception", this);
+      o->job = 0;
+      throw;
+    }
+    o->job = 0;
+  }
+
   void
   Job::yield_until_things_changed()
   {
@@ -318,7 +377,7 @@ namespace sched
 
     // If this is the current job we are talking about, the exception
     // is synchronous.
-    if (!force_async && scheduler_.is_current_job(this))
+    if (!force_async && scheduler_->is_current_job(this))
       e.rethrow();
 
     // Store the exception for later use.
@@ -327,7 +386,34 @@ namespace sched
     // Now that we acquired an exception to raise, we are active again,
     // even if we were previously sleeping or waiting for something.
     if (state_ != to_start && state_ != zombie)
+    {
       state_ = running;
+      scheduler_->job_state_changed(*this);
+      if (scheduler_->profiler_get())
+        profile_woken_up_();
+    }
+  }
+
+  void
+  Job::tag_acquired(Tag& tag)
+  {
+    indexed_tags_.push_back(&tag);
+    libport::ScopedLock<libport::AdaptiveLock> bl(tag.holders_lock_);
+    ++tag.holders_[this];
+  }
+
+  void
+  Job::tag_released(Tag& tag)
+  {
+    // Tags are usually released in the reverse order.
+    std::vector<Tag*>::reverse_iterator i =
+      std::find(indexed_tags_.rbegin(), indexed_tags_.rend(), &tag);
+    aver(i != indexed_tags_.rend());
+    indexed_tags_.erase(--i.base());
+    libport::ScopedLock<libport::AdaptiveLock> bl(tag.holders_lock_);
+    Tag::holders_type::iterator h = tag.holders_.find(this);
+    if (!--h->second)
+      tag.holders_.erase(h);
   }
 
   void
@@ -372,6 +458,31 @@ namespace sched
     return alive_jobs_;
   }
 
+  void
+  Job::profile_resumed_()
+  {
+    scheduler_->profiler_get()->resumed(*this);
+  }
+
+  void
+  Job::profile_preempted_(job_state state)
+  {
+    Profiler* profiler = scheduler_->profiler_get();
+    // Leaving for good, from terminate_cleanup().
+    if (state_ == zombie)
+      profiler->terminated(*this);
+    else if (state == sleeping)
+      profiler->preempted(*this, state, deadline_ - scheduler_->get_time());
+    else
+      profiler->preempted(*this, state);
+  }
+
+  void
+  Job::profile_woken_up_()
+  {
+    scheduler_->profiler_get()->woken_up(*this);
+  }
+
   void
   Job::hook_preempted() const
   { /* nothing*/ }
@@ -41,6 +41,12 @@
 #include <stddef.h>
 #include "taskimpl.h"
 
+#ifdef CORO_USE_MMAP
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #ifdef USE_VALGRIND
 #include <valgrind/valgrind.h>
 #define STACK_REGISTER(coro)                                            \
@@ -48,7 +54,7 @@
   Coro *c = (coro);                                                     \
   c->valgrindStackId =                                                  \
     VALGRIND_STACK_REGISTER(c->stack,                                   \
-                            (char*) c->stack + c->requestedStackSize);  \
+                            (char*) c->stack + c->allocatedStackSize);  \
 }
 
 #define STACK_DEREGISTER(coro) \
@@ -72,6 +78,18 @@ typedef struct CallbackBlock
 static CallbackBlock globalCallbackBlock;
 #endif
 
+#ifdef USE_AMD64_ASM
+/* In amd64-switch.S. */
+#ifdef __cplusplus
+extern "C" {
+#endif
+void Coro_amd64Switch_(void **save, void *load);
+void Coro_amd64Start_(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
+
 Coro *Coro_new(void)
 {
 	Coro *self = (Coro *)io_calloc(1, sizeof(Coro));
@@ -83,10 +101,298 @@ Coro *Coro_new(void)
 #else
 	self->stack = NULL;
 #endif
+	self->context = NULL;
 	return self;
 }
 
-#ifndef USE_FIBERS
+#ifdef CORO_USE_MMAP
+
+/* Stacks are mapped with a PROT_NONE guard page below them, so that an
+   overflow faults deterministically instead of smashing the memory
+   nearby.  Released stacks are kept in a pool for the next coroutines,
+   after their pages were given back to the system: pooled stacks only
+   cost address space, and the pages of a recycled stack are committed
+   again lazily, as it grows.
+
+   If a commit size is set (Coro_setStackCommitSize_), only the top of
+   the stack is accessible at first, the rest of it is merely reserved.
+   Coro_growStack, called by the SIGSEGV handler of the client, makes
+   more of it accessible when the coroutine faults there.  */
+
+#ifndef MAP_ANONYMOUS
+#	define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#	define MAP_NORESERVE 0
+#endif
+
+#if defined(__linux__)
+typedef unsigned char mincore_vec_t;
+#else
+typedef char mincore_vec_t;
+#endif
+
+typedef struct CoroStack
+{
+	void *stack;
+	size_t size;
+	size_t committed;
+} CoroStack;
+
+#define CORO_STACK_POOL_MAX 1024
+
+static CoroStack stackPool[CORO_STACK_POOL_MAX];
+static size_t stackPoolCount = 0;
+static size_t stackPoolSize = 64;
+static pthread_mutex_t stackPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t Coro_pageSize(void)
+{
+	static size_t pageSize = 0;
+	if (!pageSize)
+		pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	return pageSize;
+}
+
+static size_t Coro_roundToPage_(size_t size)
+{
+	size_t page = Coro_pageSize();
+	return (size + page - 1) & ~(page - 1);
+}
+
+static void Coro_unmapStack_(void *stack, size_t size)
+{
+	size_t page = Coro_pageSize();
+	munmap((uint8_t *)stack - page, size + page);
+}
+
+/* Make only the top \a committed bytes of \a stack accessible, instead
+   of \a was.  */
+static int Coro_commitStack_(void *stack, size_t size,
+			     size_t was, size_t committed)
+{
+	uint8_t *top = (uint8_t *)stack + size;
+	if (committed < was)
+		return !mprotect(top - was, was - committed, PROT_NONE);
+	return committed == was
+		|| !mprotect(top - committed, committed - was,
+			     PROT_READ | PROT_WRITE);
+}
+
+static void *Coro_mapStack_(size_t size, size_t committed)
+{
+	size_t page = Coro_pageSize();
+	uint8_t *base = (uint8_t *)mmap(NULL, size + page, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS
+					| MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	if (!Coro_commitStack_(base + page, size, 0, committed))
+	{
+		munmap(base, size + page);
+		return NULL;
+	}
+	return base + page;
+}
+
+/* A pooled stack of \a size bytes, or NULL.  The most recently released
+   ones are preferred, their top pages are more likely to be cached. */
+static void *Coro_pooledStack_(size_t size, size_t *committed)
+{
+	void *res = NULL;
+	size_t i;
+	pthread_mutex_lock(&stackPoolLock);
+	for (i = stackPoolCount; i; --i)
+		if (stackPool[i - 1].size == size)
+		{
+			res = stackPool[i - 1].stack;
+			*committed = stackPool[i - 1].committed;
+			stackPool[i - 1] = stackPool[--stackPoolCount];
+			break;
+		}
+	pthread_mutex_unlock(&stackPoolLock);
+	return res;
+}
+
+static void Coro_releaseStack_(void *stack, size_t size, size_t committed)
+{
+	size_t page = Coro_pageSize();
+	int pooled = 0;
+	/* Keep the top page, which is the first one used. */
+	madvise((uint8_t *)stack + size - committed, committed - page,
+		MADV_DONTNEED);
+	pthread_mutex_lock(&stackPoolLock);
+	if (stackPoolCount < stackPoolSize)
+	{
+		stackPool[stackPoolCount].stack = stack;
+		stackPool[stackPoolCount].size = size;
+		stackPool[stackPoolCount].committed = committed;
+		++stackPoolCount;
+		pooled = 1;
+	}
+	pthread_mutex_unlock(&stackPoolLock);
+	if (!pooled)
+		Coro_unmapStack_(stack, size);
+}
+
+size_t Coro_stackPoolSize(void)
+{
+	return stackPoolSize;
+}
+
+void Coro_setStackPoolSize(size_t count)
+{
+	if (CORO_STACK_POOL_MAX < count)
+		count = CORO_STACK_POOL_MAX;
+	pthread_mutex_lock(&stackPoolLock);
+	stackPoolSize = count;
+	while (count < stackPoolCount)
+	{
+		--stackPoolCount;
+		Coro_unmapStack_(stackPool[stackPoolCount].stack,
+				 stackPool[stackPoolCount].size);
+	}
+	pthread_mutex_unlock(&stackPoolLock);
+}
+
+int Coro_stackGuardContains(Coro *self, void *address)
+{
+	uint8_t *stack = (uint8_t *)self->stack;
+	uint8_t *p = (uint8_t *)address;
+	return stack && stack - Coro_pageSize() <= p && p < stack;
+}
+
+void Coro_setStackCommitSize_(Coro *self, size_t sizeInBytes)
+{
+	self->commitStackSize = sizeInBytes;
+}
+
+int Coro_growStack(Coro *self, void *address)
+{
+	uint8_t *stack = (uint8_t *)self->stack;
+	uint8_t *p = (uint8_t *)address;
+	size_t size = self->allocatedStackSize;
+	size_t committed;
+	if (!stack || p < stack || stack + size - self->committedStackSize <= p)
+		return 0;
+	/* Double the accessible part, at least up to the faulting page. */
+	committed = 2 * self->committedStackSize;
+	if (committed < (size_t)(stack + size - p))
+		committed = Coro_roundToPage_(stack + size - p);
+	if (size < committed)
+		committed = size;
+	if (!Coro_commitStack_(stack, size, self->committedStackSize, committed))
+		return 0;
+	self->committedStackSize = committed;
+	return 1;
+}
+
+size_t Coro_stackHighWaterMark(Coro *self)
+{
+	size_t page = Coro_pageSize();
+	mincore_vec_t vec[64];
+	uint8_t *end, *top, *low;
+	if (!self->stack)
+		return 0;
+	/* The stack is used downward from its end, and its pages were all
+	   discarded when it was last released: the first page, from the
+	   end, which is not resident is beyond the deepest use. */
+	end = (uint8_t *)self->stack + self->allocatedStackSize;
+	low = end - self->committedStackSize;
+	for (top = end; low < top; top -= 64 * page)
+	{
+		size_t n = (size_t)(top - low) / page;
+		size_t i;
+		if (64 < n)
+			n = 64;
+		if (mincore(top - n * page, n * page, vec))
+			return 0;
+		for (i = n; i; --i)
+			if (!(vec[i - 1] & 1))
+				return (size_t)(end - (top - (n - i) * page));
+	}
+	return self->committedStackSize;
+}
+
+void Coro_allocStackIfNeeded(Coro *self)
+{
+	size_t size = Coro_roundToPage_(self->requestedStackSize + 16);
+	size_t committed = size;
+	if (self->commitStackSize && self->commitStackSize < size)
+		committed = Coro_roundToPage_(self->commitStackSize);
+
+	if (self->stack && size != self->allocatedStackSize)
+	{
+		STACK_DEREGISTER(self);
+		Coro_releaseStack_(self->stack, self->allocatedStackSize,
+				   self->committedStackSize);
+		self->stack = NULL;
+	}
+
+	if (!self->stack)
+	{
+		size_t pooled = 0;
+		self->stack = Coro_pooledStack_(size, &pooled);
+		if (self->stack
+		    && !Coro_commitStack_(self->stack, size, pooled, committed))
+		{
+			Coro_unmapStack_(self->stack, size);
+			self->stack = NULL;
+		}
+		if (!self->stack)
+			self->stack = Coro_mapStack_(size, committed);
+		if (!self->stack)
+		{
+			perror("mmap");
+			abort();
+		}
+		self->allocatedStackSize = size;
+		self->committedStackSize = committed;
+		STACK_REGISTER(self);
+	}
+}
+
+#else // !CORO_USE_MMAP
+
+size_t Coro_stackPoolSize(void)
+{
+	return 0;
+}
+
+void Coro_setStackPoolSize(size_t count)
+{
+	(void)count;
+}
+
+int Coro_stackGuardContains(Coro *self, void *address)
+{
+	(void)self;
+	(void)address;
+	return 0;
+}
+
+void Coro_setStackCommitSize_(Coro *self, size_t sizeInBytes)
+{
+	(void)self;
+	(void)sizeInBytes;
+}
+
+int Coro_growStack(Coro *self, void *address)
+{
+	(void)self;
+	(void)address;
+	return 0;
+}
+
+size_t Coro_stackHighWaterMark(Coro *self)
+{
+	(void)self;
+	return 0;
+}
+
+#endif
+
+#if !defined(USE_FIBERS) && !defined(CORO_USE_MMAP)
 void Coro_allocStackIfNeeded(Coro *self)
 {
 	if (self->stack && self->requestedStackSize < self->allocatedStackSize)
@@ -124,7 +430,12 @@ void Coro_free(Coro *self)
 	STACK_DEREGISTER(self);
 	if (self->stack)
 	{
+#ifdef CORO_USE_MMAP
+		Coro_releaseStack_(self->stack, self->allocatedStackSize,
+				   self->committedStackSize);
+#else
 		io_free(self->stack);
+#endif
 	}
 #endif
 
@@ -140,6 +451,11 @@ void *Coro_stack(Coro *self)
 	return self->stack;
 }
 
+void *Coro_context(Coro *self)
+{
+	return self->context;
+}
+
 size_t Coro_stackSize(Coro *self)
 {
 	return self->requestedStackSize;
@@ -206,6 +522,7 @@ void Coro_startCoro_(Coro *self, Coro *other, void *context, CoroStartCallback *
 	//CallbackBlock *block = malloc(sizeof(CallbackBlock)); // memory leak
 	block->context = context;
 	block->func    = callback;
+	other->context = context;
 
 #ifdef USE_FIBERS
 	block->associatedCoro = other;
@@ -298,6 +615,8 @@ void Coro_switchTo_(Coro *self, Coro *next)
 	SwitchToFiber(next->fiber);
 #elif defined(USE_UCONTEXT)
 	swapcontext(&self->env, &next->env);
+#elif defined(USE_AMD64_ASM)
+	Coro_amd64Switch_(&self->env, next->env);
 #elif defined(USE_SETJMP)
 	if (setjmp(self->env) == 0)
 	{
@@ -308,7 +627,39 @@ void Coro_switchTo_(Coro *self, Coro *next)
 
 // ---- setup ------------------------------------------
 
-#if defined(USE_SETJMP) && defined(__x86_64__)
+/* The size of the stack the first frame is built in.  A mapped stack
+   may be more than a page larger than requested, and only its top is
+   committed at first: use the whole of it.  */
+static size_t Coro_setupStackSize_(Coro *self)
+{
+#ifdef CORO_USE_MMAP
+	return self->allocatedStackSize;
+#else
+	return Coro_stackSize(self);
+#endif
+}
+
+#if defined(USE_AMD64_ASM)
+
+void Coro_setup(Coro *self, void *arg)
+{
+	/* A frame as saved by Coro_amd64Switch_, returning to
+	   Coro_amd64Start_ with a 16-byte aligned stack. */
+	uintptr_t top =
+		((uintptr_t)Coro_stack(self) + Coro_setupStackSize_(self)) & ~15;
+	uint64_t *sp = (uint64_t *)top - 8;
+	sp[0] = 0x037f | ((uint64_t)0x1f80 << 32); /* x87 CW, MXCSR: defaults */
+	sp[1] = 0;                                 /* %r15 */
+	sp[2] = 0;                                 /* %r14 */
+	sp[3] = (uint64_t)arg;                     /* %r13 */
+	sp[4] = (uint64_t)Coro_StartWithArg;       /* %r12 */
+	sp[5] = 0;                                 /* %rbx */
+	sp[6] = 0;                                 /* %rbp */
+	sp[7] = (uint64_t)Coro_amd64Start_;        /* return address */
+	self->env = sp;
+}
+
+#elif defined(USE_SETJMP) && defined(__x86_64__)
 
 void Coro_setup(Coro *self, void *arg)
 {
@@ -348,8 +699,8 @@ void Coro_setup(Coro *self, void *arg)
 
 	getcontext(ucp);
 
-	ucp->uc_stack.ss_sp    = Coro_stack(self) + Coro_stackSize(self) - 8;
-	ucp->uc_stack.ss_size  = Coro_stackSize(self);
+	ucp->uc_stack.ss_sp    = Coro_stack(self) + Coro_setupStackSize_(self) - 8;
+	ucp->uc_stack.ss_size  = Coro_setupStackSize_(self);
 	ucp->uc_stack.ss_flags = 0;
 	ucp->uc_link = NULL;
 
@@ -367,7 +718,7 @@ void Coro_setup(Coro *self, void *arg)
 	getcontext(ucp);
 
 	ucp->uc_stack.ss_sp    = Coro_stack(self);
-	ucp->uc_stack.ss_size  = Coro_stackSize(self);
+	ucp->uc_stack.ss_size  = Coro_setupStackSize_(self);
 #if !defined(__APPLE__)
 	ucp->uc_stack.ss_flags = 0;
 	ucp->uc_link = NULL;
@@ -394,7 +745,7 @@ void Coro_setup(Coro *self, void *arg)
 		DeleteFiber(self->fiber);
 	}
 
-	self->fiber = CreateFiber(Coro_stackSize(self),
+	self->fiber = CreateFiber(Coro_setupStackSize_(self),
 							  (LPFIBER_START_ROUTINE)Coro_StartWithArg,
 							 (LPVOID)arg);
 	if (!self->fiber) {
@@ -410,7 +761,7 @@ void Coro_setup(Coro *self, void *arg)
 void Coro_setup(Coro *self, void *arg)
 {
 	setjmp(buf);
-	buf[7] = (long)(Coro_stack(self) + Coro_stackSize(self) - 16);
+	buf[7] = (long)(Coro_stack(self) + Coro_setupStackSize_(self) - 16);
 	buf[8] = (long)Coro_Start;
 	globalCallbackBlock.context=((CallbackBlock*)arg)->context;
 	globalCallbackBlock.func=((CallbackBlock*)arg)->func;
@@ -431,7 +782,7 @@ void Coro_setup(Coro *self, void *arg)
 	self->env[1] = 0;
 	self->env[2] = 0;
 	self->env[3] = (unsigned long)(Coro_stack(self))
-		+ Coro_stackSize(self) - 64;
+		+ Coro_setupStackSize_(self) - 64;
 	self->env[9] = (long)Coro_Start;
 	self->env[8] =  self->env[3] + 32;
 }
@@ -445,7 +796,7 @@ void Coro_setup(Coro *self, void *arg)
 void Coro_setup(Coro *self, void *arg)
 {
 	size_t *sp = (size_t *)(((intptr_t)Coro_stack(self)
-						+ Coro_stackSize(self) - 64 + 15) & ~15);
+						+ Coro_setupStackSize_(self) - 64 + 15) & ~15);
 
 	setjmp(buf);
 
@@ -466,7 +817,7 @@ void Coro_setup(Coro *self, void *arg)
 void Coro_setup(Coro *self, void *arg)
 {
 	size_t *sp = (size_t *)(((intptr_t)Coro_stack(self)
-						+ Coro_stackSize(self) - 64 + 15) & ~15);
+						+ Coro_setupStackSize_(self) - 64 + 15) & ~15);
 
 	setjmp(buf);
 
@@ -489,7 +840,7 @@ void Coro_setup(Coro *self, void *arg)
 void Coro_setup(Coro *self, void *arg)
 {
 	void *stack = Coro_stack(self);
-	size_t stacksize = Coro_stackSize(self);
+	size_t stacksize = Coro_setupStackSize_(self);
 	void *func = (void *)Coro_Start;
 
 	setjmp(buf);
@@ -507,7 +858,7 @@ void Coro_setup(Coro *self, void *arg)
 void Coro_setup(Coro *self, void *arg)
 {
 	setjmp(buf);
-	buf[8] = (int)Coro_stack(self) + (int)Coro_stackSize(self) - 16;
+	buf[8] = (int)Coro_stack(self) + (int)Coro_setupStackSize_(self) - 16;
 	buf[9] = (int)Coro_Start;
 }
 
@@ -530,7 +881,7 @@ void Coro_setup(Coro *self, void *arg)
 
  void Coro_setup(Coro *self, void *arg)
  {
-	 size_t *sp = (size_t *)(((intptr_t)Coro_stack(self) + Coro_stackSize(self) - 64 + 15) & ~15);
+	 size_t *sp = (size_t *)(((intptr_t)Coro_stack(self) + Coro_setupStackSize_(self) - 64 + 15) & ~15);
 
 	 setjmp(buf);
 
@@ -551,7 +902,7 @@ void Coro_setup(Coro *self, void *arg)
 
  void Coro_setup(Coro *self, void *arg)
  {
-	 size_t *sp = (size_t *)((intptr_t)Coro_stack(self) + Coro_stackSize(self));
+	 size_t *sp = (size_t *)((intptr_t)Coro_stack(self) + Coro_setupStackSize_(self));
 
 	 setjmp(buf);
 
@@ -1,6 +1,7 @@
 dist_lib_sched_libsched@LIBSFX@_la_SOURCES +=	\
   lib/sched/libcoroutine/Base.h			\
   lib/sched/libcoroutine/Coro.cc		\
+  lib/sched/libcoroutine/amd64-switch.S	\
   lib/sched/libcoroutine/context.cc		\
   lib/sched/libcoroutine/asm.S
 
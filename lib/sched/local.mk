@@ -25,12 +25,17 @@ dist_lib_sched_libsched@LIBSFX@_la_SOURCES =	\
   lib/sched/configuration.cc			\
   lib/sched/coroutine-hooks.cc			\
   lib/sched/job.cc				\
+  lib/sched/notifier.cc			\
+  lib/sched/profiler.cc			\
   lib/sched/pthread-coro.cc			\
   lib/sched/pthread-coro.hh			\
   lib/sched/pthread-coro.hxx			\
   lib/sched/scheduler.cc			\
+  lib/sched/stack-guard.cc			\
+  lib/sched/stack-guard.hh			\
   lib/sched/tag.cc				\
-  lib/sched/uclibc-workaround.cc
+  lib/sched/uclibc-workaround.cc		\
+  lib/sched/workers.cc
 
 lib_sched_libsched@LIBSFX@_la_CPPFLAGS +=	\
   -I$(top_srcdir)/include/sched/libcoroutine
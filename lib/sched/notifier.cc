@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <libport/bind.hh>
+#include <libport/containers.hh>
+#include <libport/foreach.hh>
+
+#include <sched/job.hh>
+#include <sched/notifier.hh>
+
+namespace sched
+{
+
+  Notifier::Notifier()
+  {
+  }
+
+  Notifier::~Notifier()
+  {
+    notify_all();
+  }
+
+  void
+  Notifier::wake_up_(const rJob& job)
+  {
+    job->notifier_ = 0;
+    job->state_set(running);
+  }
+
+  static bool
+  is_job(const Job* job, const rJob& other)
+  {
+    return job == other.get();
+  }
+
+  void
+  Notifier::remove_(Job& job)
+  {
+    if (Notifier* n = job.notifier_)
+    {
+      job.notifier_ = 0;
+      libport::erase_if(n->waiters_, boost::bind(is_job, &job, _1));
+    }
+  }
+
+  void
+  Notifier::notify_all()
+  {
+    // Waking up a job may make it wait again on this notifier.
+    jobs_type waiters;
+    waiters.swap(waiters_);
+    foreach (const rJob& job, waiters)
+      wake_up_(job);
+  }
+
+  void
+  Notifier::notify_one()
+  {
+    if (waiters_.empty())
+      return;
+    rJob job = waiters_.front();
+    waiters_.pop_front();
+    wake_up_(job);
+  }
+
+} // namespace sched
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/profiler.cc
+ ** \brief Implementation of sched::Profiler.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#include <boost/io/ios_state.hpp>
+
+#include <libport/atomic.hh>
+#include <libport/foreach.hh>
+
+#include <sched/profiler.hh>
+
+namespace sched
+{
+
+  /// Source of the profiler generations, shared by the workers.
+  static long generations = 0;
+
+  static std::string
+  default_name(const Job& job)
+  {
+    std::ostringstream o;
+    o << "Job(" << &job << ")";
+    return o.str();
+  }
+
+  Profiler::Profiler()
+    : generation_(libport::atomic::increment_fetch(&generations))
+    , max_slices_(1 << 20)
+    , namer_(default_name)
+  {
+  }
+
+  void
+  Profiler::clear()
+  {
+    generation_ = libport::atomic::increment_fetch(&generations);
+    profiles_.clear();
+    slices_.clear();
+  }
+
+  /*--------------------------.
+  | Reports from the jobs.    |
+  `--------------------------*/
+
+  void
+  Profiler::resumed(Job& job)
+  {
+    libport::utime_t now = libport::utime();
+    Profile& p = profile_(job);
+    // Jobs woken up early by an exception did not wait.
+    if (p.ready_at)
+      p.delay.add_sample(std::max(now - p.ready_at, libport::utime_t(0)));
+    p.resumed_at = now;
+  }
+
+  void
+  Profiler::preempted(Job& job, job_state state, libport::utime_t sleep)
+  {
+    libport::utime_t end = libport::utime();
+    Profile& p = profile_(job);
+    libport::utime_t duration = end - p.resumed_at;
+    p.run.add_sample(duration);
+    if (slices_.size() < max_slices_)
+    {
+      Slice s = { job.profile_index_, p.resumed_at, duration };
+      slices_.push_back(s);
+    }
+    switch (state)
+    {
+    case running:
+      p.ready_at = end;
+      break;
+    case sleeping:
+      p.ready_at = end + std::max(sleep, libport::utime_t(0));
+      break;
+    default:
+      // Until woken up.
+      p.ready_at = 0;
+      break;
+    }
+  }
+
+  void
+  Profiler::woken_up(Job& job)
+  {
+    if (job.profile_generation_ != generation_)
+      return;
+    Profile& p = profiles_[job.profile_index_];
+    libport::utime_t now = libport::utime();
+    if (!p.ready_at || now < p.ready_at)
+      p.ready_at = now;
+  }
+
+  void
+  Profiler::terminated(Job& job)
+  {
+    preempted(job, zombie);
+    Profile& p = profiles_[job.profile_index_];
+    p.stack.add_sample(job.stack_high_water_mark());
+    p.terminated = true;
+  }
+
+  /*----------.
+  | Dumping.  |
+  `----------*/
+
+  static libport::ufloat
+  total(const Profiler::time_stat_type& s)
+  {
+    return s.n_samples() ? s.mean() * s.n_samples() : 0;
+  }
+
+  static bool
+  ran_longer(const Profiler::Profile* a, const Profiler::Profile* b)
+  {
+    return total(b->run) < total(a->run);
+  }
+
+  std::ostream&
+  Profiler::dump(std::ostream& o) const
+  {
+    // Leave the format of the caller's stream as it was.
+    boost::io::ios_all_saver saver(o);
+    std::vector<const Profile*> sorted;
+    libport::ufloat sum = 0;
+    foreach (const Profile& p, profiles_)
+    {
+      sorted.push_back(&p);
+      sum += total(p.run);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), ran_longer);
+
+    o << std::setw(12) << "run (us)"
+      << std::setw(8) << "%"
+      << std::setw(10) << "resumes"
+      << std::setw(12) << "slice (us)"
+      << std::setw(12) << "delay (us)"
+      << std::setw(12) << "max delay"
+      << std::setw(10) << "stack"
+      << "  job" << std::endl;
+    foreach (const Profile* p, sorted)
+    {
+      libport::ufloat run = total(p->run);
+      o << std::fixed << std::setprecision(0)
+        << std::setw(12) << run
+        << std::setprecision(1)
+        << std::setw(8) << (sum ? 100 * run / sum : 0)
+        << std::setw(10) << p->run.n_samples()
+        << std::setprecision(0)
+        << std::setw(12) << (p->run.n_samples() ? p->run.mean() : 0)
+        << std::setw(12) << (p->delay.n_samples() ? p->delay.mean() : 0)
+        << std::setw(12) << (p->delay.n_samples() ? p->delay.max() : 0)
+        << std::setw(10) << (p->stack.n_samples() ? p->stack.max() : 0)
+        << "  " << p->name
+        << (p->terminated ? "" : " (running)")
+        << std::endl;
+    }
+    return o;
+  }
+
+  /// Print \a s as a JSON string.
+  static std::ostream&
+  json_string(std::ostream& o, const std::string& s)
+  {
+    o << '"';
+    foreach (char c, s)
+      switch (c)
+      {
+      case '"':  o << "\\\""; break;
+      case '\\': o << "\\\\"; break;
+      default:
+        if (0 <= c && c < 0x20)
+        {
+          char buf[8];
+          snprintf(buf, sizeof buf, "\\u%04x", c);
+          o << buf;
+        }
+        else
+          o << c;
+      }
+    return o << '"';
+  }
+
+  std::ostream&
+  Profiler::trace_dump(std::ostream& o) const
+  {
+    // One thread per job, named after it.
+    o << "{\"traceEvents\":[";
+    const char* sep = "\n";
+    for (size_t i = 0; i < profiles_.size(); ++i)
+    {
+      o << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+        << i + 1 << ",\"args\":{\"name\":";
+      json_string(o, profiles_[i].name) << "}}";
+      sep = ",\n";
+    }
+    foreach (const Slice& s, slices_)
+    {
+      o << sep << "{\"name\":\"run\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+        << s.profile + 1
+        << ",\"ts\":" << s.start
+        << ",\"dur\":" << s.duration << "}";
+      sep = ",\n";
+    }
+    return o << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  }
+
+} // namespace sched
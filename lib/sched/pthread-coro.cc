@@ -150,6 +150,12 @@ coroutine_stack_size(Coro*)
 #endif
 }
 
+size_t
+coroutine_stack_high_water_mark(Coro*)
+{
+  return 0;
+}
+
 void
 coroutine_initialize_main(Coro* c)
 {
@@ -14,6 +14,7 @@
  */
 
 #include <algorithm>
+#include <limits>
 #include <libport/cassert>
 #include <libport/cstdlib>
 
@@ -23,6 +24,7 @@
 
 #include <sched/scheduler.hh>
 #include <sched/job.hh>
+#include "stack-guard.hh"
 
 Coro* coroutine_main_;
 LocalCoroPtr coroutine_current_;
@@ -34,8 +36,73 @@ GD_CATEGORY(Sched);
 namespace sched
 {
 
+  /*----------.
+  | Mailbox.  |
+  `----------*/
+
+  /// Where the threads running offloaded tasks post their completion.
+  class Scheduler::Mailbox: public libport::ThreadSafeRefCounted
+  {
+  public:
+    Mailbox()
+      : pending(0)
+      , closed(false)
+    {}
+
+    /// Protects the following members.
+    libport::Lockable lock;
+    /// Completed tasks.
+    std::vector<rOffload> completed;
+    /// Number of tasks not completed yet.
+    size_t pending;
+    /// Called when a task completes.
+    boost::function0<void> hook;
+    /// Whether the scheduler is dead.
+    bool closed;
+  };
+
+
+  /*----------.
+  | Offload.  |
+  `----------*/
+
+  Scheduler::Offload::Offload(Job& job, rMailbox mailbox)
+    : job(&job)
+    , mailbox_(mailbox)
+  {
+  }
+
+  Scheduler::Offload::~Offload()
+  {
+  }
+
+  void
+  Scheduler::Offload::complete()
+  {
+    // Call the hook under the lock, so that the scheduler, and
+    // whatever the hook refers to, are not destroyed meanwhile.
+    libport::BlockLock bl(mailbox_->lock);
+    if (mailbox_->closed)
+      return;
+    --mailbox_->pending;
+    mailbox_->completed.push_back(this);
+    if (mailbox_->hook)
+      mailbox_->hook();
+  }
+
+
+  /*------------.
+  | Scheduler.  |
+  `------------*/
+
+  const libport::utime_t Scheduler::offload_poll;
+
   Scheduler::Scheduler(boost::function0<libport::utime_t> get_time)
     : get_time_(get_time)
+    , reconsider_parked_(false)
+    , poll_waiting_jobs_(false)
+    , indexed_tags_(false)
+    , profiler_(0)
     , current_job_(0)
     , new_job_(false)
     , awoken_job_(false)
@@ -43,9 +110,12 @@ namespace sched
     , ready_to_die_(false)
     , real_time_behavior_(false)
     , keep_terminated_jobs_(false)
+    , mailbox_(new Mailbox)
+    , resumed_jobs_(0)
   {
     GD_INFO_DUMP("Initializing main coroutine");
     coroutine_initialize_main(&coro_);
+    signal_stack_ = stack_guard_install();
   }
 
   Scheduler::~Scheduler()
@@ -56,7 +126,16 @@ namespace sched
     if (!pending_.empty())
       GD_FWARN("%s pending jobs remaining", pending_.size());
     if (!jobs_.empty())
-      GD_FWARN("s jobs remaining", jobs_.size());
+      GD_FWARN("%s jobs remaining", jobs_.size());
+    if (!parked_.empty())
+      GD_FWARN("%s parked jobs remaining", parked_.size());
+    {
+      libport::BlockLock bl(mailbox_->lock);
+      mailbox_->closed = true;
+      mailbox_->completed.clear();
+      mailbox_->hook = 0;
+    }
+    stack_guard_uninstall(signal_stack_);
   }
 
   // This function is required to start a new job using the libcoroutine.
@@ -72,19 +151,18 @@ namespace sched
   Scheduler::add_job(rJob job)
   {
     aver(job);
-    aver(!libport::has(jobs_, job));
-    aver(!libport::has(pending_, job));
+    aver(!JobQueue::queued(*job));
     if (ready_to_die_)
       GD_WARN("add_job called on a ready to die scheduler");
-    // If we are currently in a job, add it to the pending_ queue so that
+    // If we are currently in a job, add it to the created_ queue so that
     // the job is started in the course of the current round. To make sure
     // that it is not started too late even if the creator is located after
     // the job that is causing the creation (think "at job handler" for
-    // example), insert it right before the job which was right after the
-    // current one. This way, jobs inserted successively will get queued
-    // in the right order.
+    // example), created_ is moved in front of pending_ before the job
+    // which was right after the current one is considered. This way, jobs
+    // inserted successively will get queued in the right order.
     if (current_job_ && current_job_ != idle_job_)
-      pending_.insert(next_job_p_, job);
+      created_.push_back(job);
     else
       jobs_.push_back(job);
     new_job_ = true;
@@ -111,9 +189,62 @@ namespace sched
     current_job_ = 0;
   }
 
-  static bool prio_gt(const rJob& j1, const rJob& j2)
+  // Order \a jobs by decreasing priority, keeping the order of the jobs
+  // of equal priority.  Priorities are few: distribute the jobs in
+  // per-priority FIFOs, and concatenate the non-empty ones.
+  static void
+  sort_by_prio(JobQueue& jobs)
+  {
+    JobQueue buckets[UPRIO_MAX + 1];
+    // Bit N is set if buckets[N] is not empty.
+    unsigned used = 0;
+    while (Job* job = jobs.front())
+    {
+      prio_type prio = std::min(job->prio_get(), prio_type(UPRIO_MAX));
+      jobs.move_front_to(buckets[prio]);
+      used |= 1u << prio;
+    }
+    for (prio_type prio = UPRIO_MAX + 1; used; )
+      if (used & (1u << --prio))
+      {
+        jobs.splice_back(buckets[prio]);
+        used &= ~(1u << prio);
+      }
+  }
+
+  Scheduler::rOffload
+  Scheduler::offload(Job& job)
   {
-    return j2->prio_get() < j1->prio_get();
+    libport::BlockLock bl(mailbox_->lock);
+    ++mailbox_->pending;
+    return new Offload(job, mailbox_);
+  }
+
+  void
+  Scheduler::offload_hook_set(const boost::function0<void>& hook)
+  {
+    libport::BlockLock bl(mailbox_->lock);
+    mailbox_->hook = hook;
+  }
+
+  bool
+  Scheduler::offloads_completed_()
+  {
+    std::vector<rOffload> completed;
+    bool res;
+    {
+      libport::BlockLock bl(mailbox_->lock);
+      std::swap(completed, mailbox_->completed);
+      res = mailbox_->pending && !mailbox_->hook;
+    }
+    // Jobs interrupted by an exception no longer wait.
+    foreach (const rOffload& o, completed)
+      if (o->job && o->job->state_get() == offloaded)
+      {
+        GD_FINFO_DEBUG("job %s: offloaded task completed", *o->job);
+        o->job->state_set(running);
+      }
+    return res;
   }
 
   libport::utime_t
@@ -123,49 +254,62 @@ namespace sched
     // Just initialize our loop variables here, all the per-job logic is in
     // switch_to_next_.
 
+    // We are back in the scheduler coroutine, release the jobs which
+    // terminated during the previous round.
+    zombies_.clear();
+
+    // Wake up the jobs whose task completed, before they are considered.
+    bool polling = offloads_completed_();
+
     // Run all the jobs in the run queue once.
-    pending_.clear();
-    std::swap(pending_, jobs_);
+    aver(pending_.empty());
+    aver(created_.empty());
+    pending_.swap(jobs_);
 
-    // Sort all the jobs according to their priority.
-    if (real_time_behavior_)
+    // If a tag has been frozen or unfrozen, every parked job must be
+    // considered to notice it. Otherwise, only wake up the ones whose
+    // deadline is reached.
+    start_time_ = get_time_();
+    if (reconsider_parked_)
     {
-      static std::vector<rJob> tmp;
-      tmp.reserve(pending_.size());
-      tmp.clear();
-      foreach(rJob job, pending_)
-	tmp.push_back(job);
-      std::stable_sort(tmp.begin(), tmp.end(), prio_gt);
-      pending_.clear();
-      foreach(rJob job, tmp)
-	pending_.push_back(job);
+      reconsider_parked_ = false;
+      parked_.flush(pending_);
     }
+    else
+      while (!parked_.empty() && parked_.deadline_get() <= start_time_)
+        pending_.push_back(parked_.pop());
+
+    // Sort all the jobs according to their priority.
+    if (real_time_behavior_)
+      sort_by_prio(pending_);
 
     // By default, wake us up after one hour and consider that we have no
     // new job to start. Also, run waiting jobs only if the previous round
     // may have add a side effect and reset this indication for the current
     // job.
-    start_time_ = get_time_();
     deadline_ = start_time_ +  3600000000LL;
     at_least_one_started_ = false;
+    resumed_jobs_ = 0;
 
     GD_FINFO_DUMP("%s jobs in the queue for this round", pending_.size());
 
-    job_p_ = pending_.begin();
-    switch_to_next_(&coro_, true);
+    switch_to_next_(&coro_);
     // When we reach here, IDLE job has already been executed.
     GD_FINFO_DUMP("Back to execute_round, nj=%s, aj=%s, die=%s, returning %d",
                   new_job_, awoken_job_, ready_to_die_, deadline_);
     new_job_ = false;
     awoken_job_ = false;
+    // Nobody will tell us when the pending tasks complete.
+    if (polling)
+      deadline_ = std::min(deadline_, start_time_ + offload_poll);
     // If we are ready to die and there are no jobs left, then die.
-    if (ready_to_die_ && jobs_.empty())
+    if (ready_to_die_ && jobs_.empty() && parked_.empty())
       deadline_ = SCHED_EXIT;
     return deadline_;
   }
 
   void
-  Scheduler::switch_to_next_(Coro* current_coro, bool first)
+  Scheduler::switch_to_next_(Coro* current_coro)
   {
     /* We are using a direct coro-to-coro switch now. Which means code after
      * the coro_switch_to line is not executed immediately when the coro
@@ -175,25 +319,20 @@ namespace sched
      * Care must be taken to not hold any job ref when switching, we may never
      * come back if the current job was terminated.
      */
-    GD_FINFO_DUMP("switch_to_next from %s (%s)", current_coro, first);
+    GD_FINFO_DUMP("switch_to_next from %s", current_coro);
     // To simplify, idle_job_ is also yielding through this function.
     if (idle_job_ && current_coro == idle_job_->coro_get())
     {
       coroutine_switch_to(current_coro, &coro_);
       return;
     }
-    while (true)
+    // Jobs created by the previous job are considered before the ones
+    // which were following it.
+    pending_.splice_front(created_);
+    // Once we are done, return to scheduler main coro.
+    while (!pending_.empty())
     {
-      if (!first)
-        ++job_p_;
-      first = false;
-      // If we are done, return to scheduler main coro
-      if (job_p_ == pending_.end())
-        break;
-      rJob job = *job_p_;
-      // Store the next job so that insertions happen before it.
-      next_job_p_ = job_p_;
-      ++next_job_p_;
+      rJob job = pending_.pop_front();
       // If the job has terminated during the previous round, remove the
       // references we have on it by just skipping it.
       if (job->terminated())
@@ -229,6 +368,7 @@ namespace sched
 	job = 0;
         signal_work_next_round();
 	at_least_one_started_ = true;
+        ++resumed_jobs_;
 	coroutine_start(current_coro,
                         current_job_->coro_get(), run_job, current_job_.get());
         GD_INFO_DUMP("Back at #2, returning from switch_to_next_");
@@ -258,14 +398,19 @@ namespace sched
 	}
 	break;
       case waiting:
-	// Since jobs keep their orders in the queue, start waiting jobs if
-	// previous jobs in the run have had a possible side effect or if
-	// the previous run may have had some. Without it, we may miss some
-	// changes if the watching job is after the modifying job in the queue
-	// and the watched condition gets true for only one cycle.
-	start =  !job->frozen() || job->has_pending_exception();
+	// In polling mode, since jobs keep their orders in the queue, start
+	// waiting jobs if previous jobs in the run have had a possible side
+	// effect or if the previous run may have had some. Without it, we
+	// may miss some changes if the watching job is after the modifying
+	// job in the queue and the watched condition gets true for only one
+	// cycle. Otherwise, jobs waiting for a notification are parked
+	// until they get it. Jobs waiting for things to change still have
+	// to be polled.
+	start = !job->frozen()
+          && (poll_waiting_jobs_ || !job->notifier_get());
 	break;
       case joining:
+      case offloaded:
 	break;
       }
 
@@ -280,6 +425,7 @@ namespace sched
       if (start || job->has_pending_exception())
       {
 	at_least_one_started_ = true;
+        ++resumed_jobs_;
 	GD_FINFO_DUMP("will resume job %s", *job);
         current_job_ = job;
         job = 0;
@@ -287,13 +433,27 @@ namespace sched
         GD_INFO_DUMP("Back at #3, returning from switch_to_next_");
         return;
       }
+      // Job not started. Sleeping jobs are not considered again before
+      // their deadline, which frozen ones cannot reach.
+      else if (job->state_get() == sleeping)
+	parked_.push(job,
+                     job->frozen()
+                     ? std::numeric_limits<libport::utime_t>::max()
+                     : job->deadline_get());
+      // Unless we are polling, other jobs are not considered again until
+      // an event wakes them up.
+      else if (!poll_waiting_jobs_)
+	parked_.push(job, std::numeric_limits<libport::utime_t>::max());
       else
-	jobs_.push_back(job);   // Job not started, keep it in queue
+	jobs_.push_back(job);   // Keep it in queue
     }
     GD_FINFO_DUMP("Round finished, back to main coro (switch = %s)",
                   current_coro != &coro_);
     current_job_ = 0;
 
+    // The earliest parked job sets the deadline.
+    if (!parked_.empty())
+      deadline_ = std::min(deadline_, parked_.deadline_get());
 
     // If during this cycle a new job has been created by an existing job,
     // start it.
@@ -330,69 +490,113 @@ namespace sched
 
     // We may have to suspend the job several time in case it makes no sense
     // to start it back. Let's do it in a loop and we'll break when we want
-    // to resume the job.
+    // to resume the job. The job may have been handed over to another
+    // scheduler in the meantime, which is then in charge of suspending
+    // it again.
+    while (!job->scheduler_get().suspend_(job))
+      continue;
 
-    while (true)
+    // Check that we are not near exhausting the stack space.
+    job->check_stack_space();
+
+    // Resume job execution
+  }
+
+  bool
+  Scheduler::suspend_(rJob& job)
+  {
+    // Add the job at the end of the scheduler queue unless the job has
+    // already terminated.
+    if (job != idle_job_)
     {
-      // Add the job at the end of the scheduler queue unless the job has
-      // already terminated.
-      if (job != idle_job_)
+      if (!job->terminated())
+        jobs_.push_back(job);
+      else
       {
-        if (!job->terminated())
-	  jobs_.push_back(job);
-        else if (keep_terminated_jobs_)
+        if (keep_terminated_jobs_)
           terminated_jobs_.push_back(job);
+        // We are still running on the stack of the job: make sure
+        // it is not destroyed before we are back in the scheduler.
+        zombies_.push_back(job);
       }
+    }
 
+    // Switch back to the scheduler. But in the case this job has been
+    // destroyed, erase the local variable first so that it doesn't keep
+    // a reference on it which will never be destroyed.
+    aver(current_job_ == job);
+    GD_FINFO_DUMP("%s has %sterminated (state: %s)",
+                  *job, job->terminated() ? "" : "not ", job->state_get());
+    Coro* current_coro = job->coro_get();
+    if (job->terminated())
+      job = 0;
+    else
+      switch (job->state_get())
+      {
+      case running:
+        signal_work_next_round();
+        break;
+      case sleeping:
+        deadline_ = std::min(deadline_, job->deadline_get());
+        break;
+      default:
+        break;
+      }
+    // Calling switch_to_next_ from IDLE job is ok
+    switch_to_next_(current_coro);
 
-      // Switch back to the scheduler. But in the case this job has been
-      // destroyed, erase the local variable first so that it doesn't keep
-      // a reference on it which will never be destroyed.
-      aver(current_job_ == job);
-      GD_FINFO_DUMP("%s has %sterminated (state: %s)",
-                    *job, job->terminated() ? "" : "not ", job->state_get());
-      Coro* current_coro = job->coro_get();
-      if (job->terminated())
-	job = 0;
-      else
-        switch (job->state_get())
-	{
-	case running:
-	  signal_work_next_round();
-	  break;
-	case sleeping:
-	  deadline_ = std::min(deadline_, job->deadline_get());
-	  break;
-	default:
-	  break;
-	}
-      // Calling switch_to_next_ from IDLE job is ok
-        switch_to_next_(current_coro);
-
-      // If we regain control, we are not dead.
-      aver(job);
+    // If we regain control, we are not dead.
+    aver(job);
 
-      // We regained control, we are again in the context of the job.
-      current_job_ = job;
-      GD_FINFO_DUMP("job %s resumed", *job);
+    // We regained control, we are again in the context of the job. Do
+    // not use this from now on: the job may have been resumed by
+    // another scheduler.
+    Scheduler& self = job->scheduler_get();
+    self.current_job_ = job;
+    GD_FINFO_DUMP("job %s resumed", *job);
 
-      // Execute a deferred exception if any; this may break out of this loop
-      job->check_for_pending_exception();
+    // Execute a deferred exception if any; this may break out of this loop
+    job->check_for_pending_exception();
 
-      // If we are not frozen, it is time to resume regular execution
-      if (!job->frozen())
-	break;
+    // If we are not frozen, it is time to resume regular execution
+    if (!job->frozen())
+      return true;
 
-      // Ok, we are frozen. Let's requeue ourselves,
-      // we will be in waiting mode.
-
-      job->state_set(waiting);
-    }
+    // Ok, we are frozen. Let's requeue ourselves,
+    // we will be in waiting mode.
+    job->state_set(waiting);
+    return false;
+  }
 
-    // Check that we are not near exhausting the stack space.
-    job->check_stack_space();
+  void
+  Scheduler::adopt_job(rJob job)
+  {
+    aver(job);
+    aver(!current_job_ || current_job_ == idle_job_);
+    aver(!JobQueue::queued(*job));
+    aver(!SleepQueue::queued(*job));
+    job->scheduler_ = this;
+    jobs_.push_back(job);
+    new_job_ = true;
+  }
 
-    // Resume job execution
+  size_t
+  Scheduler::release_jobs(jobs_type& jobs, size_t max)
+  {
+    aver(!current_job_ || current_job_ == idle_job_);
+    // Give away the jobs which would run last.
+    jobs_type candidates;
+    jobs_.copy_to(candidates);
+    size_t res = 0;
+    for (jobs_type::reverse_iterator i = candidates.rbegin();
+         res < max && i != candidates.rend(); ++i)
+      if ((*i)->migratable())
+      {
+        JobQueue::remove(**i);
+        jobs.push_back(*i);
+        ++res;
+      }
+    return res;
   }
 
   void
@@ -448,12 +652,21 @@ namespace sched
   void
   Scheduler::signal_stop(const Tag& tag, const boost::any& payload)
   {
+    // Only the jobs holding the tag are concerned. Keep them alive,
+    // some may be removed.
+    jobs_type jobs;
+    if (indexed_tags_)
+      tag.holders_get(jobs);
+    else
+      jobs = jobs_get();
+
     // Tell the jobs that a tag has been stopped, ending with
     // the current job to avoid interrupting this method early.
-    foreach (const rJob& job, jobs_get())
+    foreach (const rJob& job, jobs)
     {
-      // The current job will be handled last.
-      if (job == current_job_)
+      // The current job will be handled last, the jobs of other
+      // schedulers by their own.
+      if (job == current_job_ || job->scheduler_ != this)
 	continue;
       // Job to be started during this cycle.
       if (job->state_get() == to_start)
@@ -461,7 +674,7 @@ namespace sched
 	// Check if this job deserves to be removed.
 	if (job->has_tag(tag))
 	{
-	  pending_.remove(job);
+	  JobQueue::remove(*job);
 	  continue;
 	}
       }
@@ -474,13 +687,37 @@ namespace sched
       current_job_->register_stopped_tag(tag, payload);
   }
 
+  void
+  Scheduler::signal_freeze(const Tag& tag)
+  {
+    if (!indexed_tags_)
+    {
+      reconsider_parked_ = true;
+      return;
+    }
+    // Only the parked jobs holding the tag need to notice it.
+    jobs_type jobs;
+    tag.holders_get(jobs);
+    foreach (const rJob& job, jobs)
+      if (job->scheduler_ == this && SleepQueue::queued(*job))
+        jobs_.push_back(parked_.remove(*job));
+  }
+
   jobs_type
   Scheduler::jobs_get() const
   {
-    // If this method is called from within a job, return the currently
-    // executing jobs (pending_), otherwise return the jobs_ content which
-    // is complete.
-    return current_job_ ? pending_ : jobs_;
+    // Outside of a round, jobs_ is complete. During a round, it holds
+    // the jobs already considered, the current job is in no queue, and
+    // the others are still waiting in created_ and pending_.
+    jobs_type res;
+    jobs_.copy_to(res);
+    if (current_job_ && current_job_ != idle_job_
+        && !JobQueue::queued(*current_job_))
+      res.push_back(current_job_);
+    created_.copy_to(res);
+    pending_.copy_to(res);
+    parked_.copy_to(res);
+    return res;
   }
 
   const scheduler_stats_type&
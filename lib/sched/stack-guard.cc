@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/stack-guard.cc
+ ** \brief Growth and overflows of job stacks.
+ */
+
+#include <libport/config.h>
+
+#include <sched/coroutine.hh>
+#include "stack-guard.hh"
+
+#if !defined LIBPORT_SCHED_CORO_OSTHREAD && !defined SCHED_USE_BOOST_CORO \
+  && defined CORO_USE_MMAP
+# define SCHED_STACK_GUARD 1
+#endif
+
+#ifdef SCHED_STACK_GUARD
+
+# include <algorithm>
+# include <csignal>
+# include <cstdlib>
+# include <cstring>
+
+# include <pthread.h>
+# include <unistd.h>
+
+namespace sched
+{
+
+  /// The SIGSEGV handler before ours.
+  static struct sigaction previous_handler;
+
+  /// A fixed-size message: the handler may run on a corrupt heap.
+  struct Message
+  {
+    Message()
+      : size(0)
+    {}
+
+    Message& operator<<(const char* s)
+    {
+      while (*s && size < sizeof buffer)
+        buffer[size++] = *s++;
+      return *this;
+    }
+
+    /// Append an address.
+    Message& operator<<(unsigned long n)
+    {
+      return number(n, 16);
+    }
+
+    /// Append \a n in \a base, with a 0x prefix in hexadecimal.
+    Message& number(unsigned long n, unsigned base = 10)
+    {
+      char digits[3 * sizeof n + 1];
+      char* p = digits + sizeof digits;
+      *--p = 0;
+      do
+        *--p = "0123456789abcdef"[n % base];
+      while (n /= base);
+      if (base == 16)
+        *this << "0x";
+      return *this << p;
+    }
+
+    void flush() const
+    {
+      if (write(STDERR_FILENO, buffer, size) < 0)
+        std::abort();
+    }
+
+    char buffer[256];
+    size_t size;
+  };
+
+  /// Hand the signal to the handler installed before ours, without
+  /// uninstalling ours.
+  static void
+  chain(int sig, siginfo_t* info, void* context)
+  {
+    if (previous_handler.sa_flags & SA_SIGINFO)
+      previous_handler.sa_sigaction(sig, info, context);
+    else if (previous_handler.sa_handler != SIG_DFL
+             && previous_handler.sa_handler != SIG_IGN)
+      previous_handler.sa_handler(sig);
+    else
+      // A real fault cannot be ignored: retry the faulting instruction,
+      // and die.
+      signal(SIGSEGV, SIG_DFL);
+  }
+
+  static void
+  on_segv(int sig, siginfo_t* info, void* context)
+  {
+    Coro* coro = coroutine_current();
+    if (coro && Coro_growStack(coro, info->si_addr))
+      // Retry the faulting instruction, on a larger stack.
+      return;
+    if (coro && Coro_stackGuardContains(coro, info->si_addr))
+    {
+      // Like Job::dump, which allocates.
+      Message m;
+      m << "sched: stack overflow in ";
+      if (void* job = Coro_context(coro))
+        m << "Job(" << reinterpret_cast<unsigned long>(job) << ")";
+      else
+        m << "coroutine " << reinterpret_cast<unsigned long>(coro);
+      m << " (stack size: ";
+      m.number(Coro_stackSize(coro)) << ")\n";
+      m.flush();
+      // Retry the faulting instruction, and die.
+      signal(SIGSEGV, SIG_DFL);
+    }
+    else
+      chain(sig, info, context);
+  }
+
+  void*
+  stack_guard_install()
+  {
+    // Someone, say Boost.Test, may have replaced our handler since it
+    // was installed by another scheduler.
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&mutex);
+    struct sigaction action;
+    sigaction(SIGSEGV, 0, &action);
+    if (!(action.sa_flags & SA_SIGINFO) || action.sa_sigaction != on_segv)
+    {
+      memset(&action, 0, sizeof action);
+      action.sa_sigaction = on_segv;
+      action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGSEGV, &action, &previous_handler);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    // The handler cannot run on the stack which overflowed.
+    stack_t stack;
+    if (sigaltstack(0, &stack) || !(stack.ss_flags & SS_DISABLE))
+      return 0;
+    stack.ss_size = std::max(size_t(SIGSTKSZ), size_t(64 * 1024));
+    stack.ss_sp = malloc(stack.ss_size);
+    stack.ss_flags = 0;
+    if (stack.ss_sp && sigaltstack(&stack, 0))
+    {
+      free(stack.ss_sp);
+      return 0;
+    }
+    return stack.ss_sp;
+  }
+
+  void
+  stack_guard_uninstall(void* signal_stack)
+  {
+    // Leave the alternate stack if it is not the one of this thread.
+    stack_t stack;
+    if (!signal_stack
+        || sigaltstack(0, &stack)
+        || stack.ss_sp != signal_stack)
+      return;
+    stack.ss_flags = SS_DISABLE;
+    if (!sigaltstack(&stack, 0))
+      free(signal_stack);
+  }
+
+} // namespace sched
+
+#else // !SCHED_STACK_GUARD
+
+namespace sched
+{
+
+  void*
+  stack_guard_install()
+  {
+    return 0;
+  }
+
+  void
+  stack_guard_uninstall(void*)
+  {
+  }
+
+} // namespace sched
+
+#endif
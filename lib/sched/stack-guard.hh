@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** \file sched/stack-guard.hh
+ ** \brief Growth and overflows of job stacks.
+ */
+
+#ifndef SCHED_STACK_GUARD_HH
+# define SCHED_STACK_GUARD_HH
+
+namespace sched
+{
+  /// Grow the job stacks of the calling thread, and report their
+  /// overflows.
+  ///
+  /// libcoroutine stacks are bounded by a guard page: an overflow
+  /// faults there.  The SIGSEGV handler, run on an alternate stack,
+  /// reports the job which overflowed and lets the fault kill the
+  /// program.  Faults on the part of a stack which is not committed yet
+  /// (see Configuration::initial_stack_size) grow it.  Other faults are
+  /// handed to the previous handler.
+  ///
+  /// \return  The alternate signal stack allocated for the calling
+  ///          thread, if it did not have one, to pass to
+  ///          stack_guard_uninstall().
+  void* stack_guard_install();
+
+  /// Release the alternate signal stack returned by
+  /// stack_guard_install().
+  void stack_guard_uninstall(void* signal_stack);
+}
+
+#endif // !SCHED_STACK_GUARD_HH
@@ -8,13 +8,37 @@
  * See the LICENSE file for more information.
  */
 
+#include <algorithm>
+#include <vector>
+
 #include <libport/cstdlib>
+#include <libport/foreach.hh>
 
+#include <sched/job.hh>
 #include <sched/scheduler.hh>
 #include <sched/tag.hh>
 
 namespace sched
 {
+  Tag::~Tag()
+  {
+    // Jobs may outlive the tags they did not release.
+    libport::ScopedLock<libport::AdaptiveLock> bl(holders_lock_);
+    foreach (const holders_type::value_type& h, holders_)
+    {
+      std::vector<Tag*>& tags = h.first->indexed_tags_;
+      tags.erase(std::remove(tags.begin(), tags.end(), this), tags.end());
+    }
+  }
+
+  void
+  Tag::holders_get(jobs_type& jobs) const
+  {
+    libport::ScopedLock<libport::AdaptiveLock> bl(holders_lock_);
+    foreach (const holders_type::value_type& h, holders_)
+      jobs.push_back(h.first);
+  }
+
   void
   Tag::stop(Scheduler& sched, const boost::any& payload) const
   {
@@ -48,6 +72,12 @@ namespace sched
     return unfreeze_hook_;
   }
 
+  Notifier&
+  Tag::unfreeze_notifier_get()
+  {
+    return unfreeze_notifier_;
+  }
+
   unsigned long Tag::step_ = 0;
 
 } // namespace sched
@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <algorithm>
+
+#include <libport/atomic.hh>
+#include <libport/bind.hh>
+#include <libport/cassert>
+#include <libport/condition.hh>
+#include <libport/debug.hh>
+#include <libport/detect-win32.h>
+#include <libport/foreach.hh>
+#include <libport/thread.hh>
+#include <libport/unistd.h>
+
+#include <sched/job.hh>
+#include <sched/scheduler.hh>
+#include <sched/tag.hh>
+#include <sched/workers.hh>
+
+// Workers need a current coroutine per thread (see workers.hh).
+#ifdef LIBPORT_SCHED_MULTITHREAD
+
+GD_CATEGORY(Sched.Workers);
+
+namespace sched
+{
+
+  /*-----------------.
+  | Workers::Worker.  |
+  `-----------------*/
+
+  class Workers::Worker
+  {
+  public:
+    Worker(Workers& owner, size_t index);
+
+    /// Body of the worker thread.
+    void run();
+
+    /// Take charge of \a jobs, released by another worker, and clear it.
+    void receive(jobs_type& jobs);
+
+    /// Make the worker run a new round as soon as possible.
+    void kick();
+
+    Workers& owner_;
+    size_t index_;
+    pthread_t thread_;
+    /// Our scheduler, living in the stack of our thread.
+    Scheduler* scheduler_;
+
+    /// Held while running a round. Other workers may act on our
+    /// scheduler when they hold it.
+    libport::Lockable lock_;
+
+    /// Protects the following members, and signals their changes.
+    libport::Condition cond_;
+    /// Jobs given to us, to adopt before the next round.
+    JobQueue inbox_;
+    /// A worker which would like some of our jobs.
+    Worker* thief_;
+    /// Number of jobs we resumed during the last round.
+    size_t load_;
+    /// Are we waiting for something to do?
+    bool idle_;
+    /// Must we run a round right now?
+    bool kicked_;
+    /// Must we kill our jobs and terminate?
+    bool stopping_;
+
+  private:
+    /// Wait until \a deadline or until we are given something to do,
+    /// asking for some jobs to the busiest worker first.
+    void wait_(libport::utime_t deadline);
+  };
+
+  Workers::Worker::Worker(Workers& owner, size_t index)
+    : owner_(owner)
+    , index_(index)
+    , scheduler_(0)
+    , thief_(0)
+    , load_(0)
+    , idle_(false)
+    , kicked_(false)
+    , stopping_(false)
+  {
+  }
+
+  void
+  Workers::Worker::run()
+  {
+    Scheduler scheduler(owner_.get_time_);
+    // Run a round as soon as an offloaded task completes.
+    scheduler.offload_hook_set(boost::bind(&Worker::kick, this));
+    {
+      libport::BlockLock bl(cond_);
+      thread_ = pthread_self();
+      scheduler_ = &scheduler;
+    }
+    GD_FINFO_TRACE("worker %s: started", index_);
+    owner_.ready_++;
+
+    bool dying = false;
+    while (true)
+    {
+      // Let synchronize() go first.
+      {
+        libport::BlockLock pass(owner_.turnstile_);
+      }
+      libport::utime_t deadline;
+      size_t load;
+      {
+        libport::BlockLock round(lock_);
+        bool stopping;
+        {
+          libport::BlockLock bl(cond_);
+          while (!inbox_.empty())
+            scheduler.adopt_job(inbox_.pop_front());
+          kicked_ = false;
+          stopping = stopping_;
+        }
+        if (stopping && !dying)
+        {
+          GD_FINFO_TRACE("worker %s: killing jobs", index_);
+          dying = true;
+          scheduler.killall_jobs();
+        }
+
+        deadline = scheduler.work();
+
+        Worker* thief;
+        {
+          libport::BlockLock bl(cond_);
+          load = load_ = scheduler.resumed_jobs_get();
+          thief = thief_;
+          thief_ = 0;
+        }
+        // Hand half of our jobs over to a worker which asked for some.
+        if (thief && !dying)
+        {
+          jobs_type jobs;
+          if (scheduler.release_jobs(jobs, load / 2))
+          {
+            GD_FINFO_DEBUG("worker %s: giving %s jobs to worker %s",
+                           index_, jobs.size(), thief->index_);
+            thief->receive(jobs);
+          }
+        }
+      }
+
+      if (deadline == SCHED_EXIT)
+        break;
+      if (deadline == SCHED_IMMEDIATE)
+      {
+        if (1 < load && !dying && owner_.idle_)
+          owner_.wake_idle_();
+      }
+      else
+        wait_(deadline);
+    }
+
+    {
+      libport::BlockLock bl(cond_);
+      scheduler_ = 0;
+    }
+    GD_FINFO_TRACE("worker %s: terminated", index_);
+  }
+
+  void
+  Workers::Worker::wait_(libport::utime_t deadline)
+  {
+    bool stopping;
+    {
+      libport::BlockLock bl(cond_);
+      stopping = stopping_;
+    }
+    if (!stopping)
+      if (Worker* victim = owner_.busiest_(*this))
+      {
+        libport::BlockLock bl(victim->cond_);
+        if (!victim->thief_)
+          victim->thief_ = this;
+      }
+
+    libport::BlockLock bl(cond_);
+    idle_ = true;
+    libport::atomic::increment_fetch(&owner_.idle_);
+    while (inbox_.empty() && !kicked_ && !stopping_)
+    {
+      libport::utime_t now = owner_.get_time_();
+      if (deadline <= now)
+        break;
+      // Do not overflow useconds_t.
+      cond_.tryWait(std::min(deadline - now, libport::utime_t(1000000)));
+    }
+    libport::atomic::decrement_fetch(&owner_.idle_);
+    idle_ = false;
+  }
+
+  void
+  Workers::Worker::receive(jobs_type& jobs)
+  {
+    // Release the references of the giver while holding the lock, we
+    // may start manipulating the jobs as soon as it is released.
+    libport::BlockLock bl(cond_);
+    foreach (const rJob& job, jobs)
+      inbox_.push_back(job);
+    jobs.clear();
+    kicked_ = true;
+    cond_.signal();
+  }
+
+  void
+  Workers::Worker::kick()
+  {
+    libport::BlockLock bl(cond_);
+    kicked_ = true;
+    cond_.signal();
+  }
+
+
+  /*----------.
+  | Workers.  |
+  `----------*/
+
+  static size_t
+  processors()
+  {
+#if defined WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long res = info.dwNumberOfProcessors;
+#else
+    long res = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return 0 < res ? res : 1;
+  }
+
+  Workers::Workers(boost::function0<libport::utime_t> get_time, size_t size)
+    : get_time_(get_time)
+    , ready_(0)
+    , idle_(0)
+  {
+    if (!size)
+      size = processors();
+    GD_FINFO_TRACE("starting %s workers", size);
+    for (size_t i = 0; i < size; ++i)
+      workers_.push_back(new Worker(*this, i));
+    foreach (Worker* w, workers_)
+      libport::startThread(w, &Worker::run);
+    ready_ -= size;
+  }
+
+  Workers::~Workers()
+  {
+    GD_INFO_TRACE("stopping workers");
+    // Make sure no job is in transit to a worker which already killed
+    // its jobs.
+    synchronize(boost::bind(&Workers::stopping_, this));
+    foreach (Worker* w, workers_)
+    {
+      PTHREAD_RUN(pthread_join, w->thread_, 0);
+      delete w;
+    }
+  }
+
+  size_t
+  Workers::size() const
+  {
+    return workers_.size();
+  }
+
+  Scheduler&
+  Workers::scheduler_get(size_t i) const
+  {
+    aver(i < workers_.size());
+    return *workers_[i]->scheduler_;
+  }
+
+  Scheduler*
+  Workers::current_scheduler_get() const
+  {
+    Worker* w = current_();
+    return w ? w->scheduler_ : 0;
+  }
+
+  Workers::Worker*
+  Workers::current_() const
+  {
+    pthread_t self = pthread_self();
+    foreach (Worker* w, workers_)
+      if (pthread_equal(w->thread_, self))
+        return w;
+    return 0;
+  }
+
+  void
+  Workers::start_job(Job* job)
+  {
+    aver(job);
+    aver_eq(job->state_get(), to_start);
+    Worker* target = 0;
+    size_t min = 0;
+    foreach (Worker* w, workers_)
+    {
+      libport::BlockLock bl(w->cond_);
+      size_t load = w->load_ + (w->inbox_.empty() ? 0 : 1);
+      if (!target || load < min)
+      {
+        target = w;
+        min = load;
+      }
+    }
+    libport::BlockLock bl(target->cond_);
+    target->inbox_.push_back(job);
+    target->kicked_ = true;
+    target->cond_.signal();
+  }
+
+  Workers::Worker*
+  Workers::busiest_(const Worker& thief) const
+  {
+    Worker* res = 0;
+    size_t max = 1;
+    foreach (Worker* w, workers_)
+      if (w != &thief)
+      {
+        libport::BlockLock bl(w->cond_);
+        if (max < w->load_ && !w->stopping_)
+        {
+          res = w;
+          max = w->load_;
+        }
+      }
+    return res;
+  }
+
+  void
+  Workers::wake_idle_()
+  {
+    foreach (Worker* w, workers_)
+    {
+      libport::BlockLock bl(w->cond_);
+      if (w->idle_)
+      {
+        w->kicked_ = true;
+        w->cond_.signal();
+        return;
+      }
+    }
+  }
+
+  void
+  Workers::synchronize(const boost::function0<void>& f)
+  {
+    // If we are a worker, we are in the middle of a round: let the
+    // others act on our scheduler while we wait.
+    Worker* self = current_();
+    if (self)
+      self->lock_.unlock();
+    turnstile_.lock();
+    foreach (Worker* w, workers_)
+      w->lock_.lock();
+    try
+    {
+      f();
+    }
+    catch (...)
+    {
+      foreach (Worker* w, workers_)
+        w->lock_.unlock();
+      turnstile_.unlock();
+      if (self)
+        self->lock_.lock();
+      throw;
+    }
+    foreach (Worker* w, workers_)
+      w->lock_.unlock();
+    turnstile_.unlock();
+    if (self)
+      self->lock_.lock();
+    foreach (Worker* w, workers_)
+      if (w != self)
+        w->kick();
+  }
+
+  void
+  Workers::stopping_()
+  {
+    foreach (Worker* w, workers_)
+    {
+      libport::BlockLock bl(w->cond_);
+      w->stopping_ = true;
+    }
+  }
+
+  Scheduler&
+  Workers::home_() const
+  {
+    Worker* w = current_();
+    return *(w ? w : workers_.front())->scheduler_;
+  }
+
+  void
+  Workers::freeze(Tag& tag)
+  {
+    synchronize(boost::bind(&Workers::freeze_, this, boost::ref(tag)));
+  }
+
+  void
+  Workers::unfreeze(Tag& tag)
+  {
+    synchronize(boost::bind(&Workers::unfreeze_, this, boost::ref(tag)));
+  }
+
+  void
+  Workers::block(Tag& tag, const boost::any& payload)
+  {
+    synchronize(boost::bind(&Workers::block_, this,
+                            boost::ref(tag), boost::cref(payload)));
+  }
+
+  void
+  Workers::unblock(Tag& tag)
+  {
+    synchronize(boost::bind(&Workers::unblock_, this, boost::ref(tag)));
+  }
+
+  void
+  Workers::stop(const Tag& tag, const boost::any& payload)
+  {
+    synchronize(boost::bind(&Workers::stop_, this,
+                            boost::cref(tag), boost::cref(payload)));
+  }
+
+  // In the following functions, the tag is acted upon through the
+  // scheduler of the caller, last since it may interrupt the caller.
+  // The other schedulers are just signaled.
+
+  void
+  Workers::freeze_(Tag& tag)
+  {
+    Scheduler& home = home_();
+    foreach (Worker* w, workers_)
+      if (w->scheduler_ != &home)
+        w->scheduler_->signal_freeze(tag);
+    tag.freeze(home);
+  }
+
+  void
+  Workers::unfreeze_(Tag& tag)
+  {
+    Scheduler& home = home_();
+    foreach (Worker* w, workers_)
+      if (w->scheduler_ != &home)
+      {
+        w->scheduler_->signal_freeze(tag);
+        w->scheduler_->signal_work_next_round();
+      }
+    tag.unfreeze(home);
+  }
+
+  void
+  Workers::block_(Tag& tag, const boost::any& payload)
+  {
+    Scheduler& home = home_();
+    stop_inboxes_(tag, payload);
+    foreach (Worker* w, workers_)
+      if (w->scheduler_ != &home)
+        w->scheduler_->signal_stop(tag, payload);
+    tag.block(home, payload);
+  }
+
+  void
+  Workers::unblock_(Tag& tag)
+  {
+    Scheduler& home = home_();
+    foreach (Worker* w, workers_)
+      if (w->scheduler_ != &home)
+        w->scheduler_->signal_work_next_round();
+    tag.unblock(home);
+  }
+
+  void
+  Workers::stop_(const Tag& tag, const boost::any& payload)
+  {
+    Scheduler& home = home_();
+    stop_inboxes_(tag, payload);
+    foreach (Worker* w, workers_)
+      if (w->scheduler_ != &home)
+        w->scheduler_->signal_stop(tag, payload);
+    tag.stop(home, payload);
+  }
+
+  void
+  Workers::stop_inboxes_(const Tag& tag, const boost::any& payload)
+  {
+    // Jobs in transit are not known to any scheduler, handle them as
+    // Scheduler::signal_stop() does.
+    foreach (Worker* w, workers_)
+    {
+      libport::BlockLock bl(w->cond_);
+      jobs_type jobs;
+      w->inbox_.copy_to(jobs);
+      foreach (const rJob& job, jobs)
+        if (job->state_get() != to_start)
+          job->register_stopped_tag(tag, payload);
+        else if (job->has_tag(tag))
+          JobQueue::remove(*job);
+    }
+  }
+
+} // namespace sched
+
+#endif // LIBPORT_SCHED_MULTITHREAD
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <vector>
+
+#include <libport/adaptive-lock.hh>
+#include <libport/bind.hh>
+#include <libport/foreach.hh>
+#include <libport/lockable.hh>
+#include <libport/thread.hh>
+#include <libport/unistd.h>
+#include <libport/unit-test.hh>
+#include <libport/utime.hh>
+
+using libport::test_suite;
+using libport::AdaptiveLock;
+using libport::AdaptiveRWLock;
+using libport::RecursiveAdaptiveLock;
+
+static const int nthreads = 4;
+static const int iterations = 100000;
+
+// Not atomic: only correct if the lock is.
+static volatile long counter;
+
+template <typename Lock>
+static void
+increment(Lock* l)
+{
+  for (int i = 0; i < iterations; ++i)
+  {
+    libport::ScopedLock<Lock> bl(*l);
+    ++counter;
+  }
+}
+
+// Check the recursion along the way.
+static void
+increment_twice(RecursiveAdaptiveLock* l)
+{
+  for (int i = 0; i < iterations; ++i)
+  {
+    libport::ScopedLock<RecursiveAdaptiveLock> bl(*l);
+    ++counter;
+    libport::ScopedLock<RecursiveAdaptiveLock> bl2(*l);
+    ++counter;
+  }
+}
+
+template <typename Lock>
+static void
+lock_unlock(Lock* l)
+{
+  l->lock();
+  l->unlock();
+}
+
+static void
+run_threads(const boost::function0<void>& f)
+{
+  std::vector<pthread_t> threads;
+  for (int i = 0; i < nthreads; ++i)
+    threads.push_back(libport::startThread(f));
+  foreach (pthread_t t, threads)
+    pthread_join(t, 0);
+}
+
+static void
+test_exclusion()
+{
+  AdaptiveLock l;
+  counter = 0;
+  run_threads(boost::bind(&increment<AdaptiveLock>, &l));
+  BOOST_CHECK_EQUAL(counter, nthreads * iterations);
+
+  RecursiveAdaptiveLock r;
+  counter = 0;
+  run_threads(boost::bind(&increment_twice, &r));
+  BOOST_CHECK_EQUAL(counter, 2 * nthreads * iterations);
+}
+
+static void
+test_try()
+{
+  AdaptiveLock l;
+  BOOST_CHECK(l.tryLock());
+  BOOST_CHECK(!l.tryLock());
+  l.unlock();
+
+  RecursiveAdaptiveLock r;
+  r.lock();
+  BOOST_CHECK(r.tryLock());
+  r.unlock();
+  // Still held by us.
+  pthread_t t = libport::startThread(
+    boost::bind(&lock_unlock<RecursiveAdaptiveLock>, &r));
+  usleep(100000);
+  BOOST_CHECK_EQUAL(r.contentions(), 1u);
+  r.unlock();
+  pthread_join(t, 0);
+  BOOST_CHECK(r.tryLock());
+  r.unlock();
+}
+
+static void
+test_contentions()
+{
+  AdaptiveLock l;
+  lock_unlock(&l);
+  BOOST_CHECK_EQUAL(l.contentions(), 0u);
+
+  l.lock();
+  pthread_t t =
+    libport::startThread(boost::bind(&lock_unlock<AdaptiveLock>, &l));
+  usleep(100000);
+  BOOST_CHECK_EQUAL(l.contentions(), 1u);
+  l.unlock();
+  pthread_join(t, 0);
+  BOOST_CHECK_EQUAL(l.contentions(), 1u);
+  l.contentions_reset();
+  BOOST_CHECK_EQUAL(l.contentions(), 0u);
+}
+
+/*-----------------.
+| AdaptiveRWLock.  |
+`-----------------*/
+
+// Always equal outside of the write lock.
+static volatile long first;
+static volatile long second;
+static volatile bool broken;
+
+static void
+writer(AdaptiveRWLock* l)
+{
+  for (int i = 0; i < iterations; ++i)
+  {
+    libport::ScopedWriteLock bl(*l);
+    ++first;
+    ++second;
+  }
+}
+
+static void
+reader(AdaptiveRWLock* l)
+{
+  for (int i = 0; i < iterations; ++i)
+  {
+    libport::ScopedReadLock bl(*l);
+    if (first != second)
+      broken = true;
+  }
+}
+
+static void
+reader_writer(AdaptiveRWLock* l)
+{
+  reader(l);
+  writer(l);
+}
+
+static bool
+try_read(AdaptiveRWLock* l)
+{
+  if (!l->tryReadLock())
+    return false;
+  l->readUnlock();
+  return true;
+}
+
+static bool
+try_write(AdaptiveRWLock* l)
+{
+  if (!l->tryWriteLock())
+    return false;
+  l->writeUnlock();
+  return true;
+}
+
+static void
+read_unlock(AdaptiveRWLock* l)
+{
+  l->readLock();
+  l->readUnlock();
+}
+
+static void
+test_rw()
+{
+  AdaptiveRWLock l;
+  first = second = 0;
+  broken = false;
+  run_threads(boost::bind(&reader_writer, &l));
+  BOOST_CHECK(!broken);
+  BOOST_CHECK_EQUAL(first, nthreads * iterations);
+  BOOST_CHECK_EQUAL(second, nthreads * iterations);
+
+  // Readers share.
+  l.readLock();
+  BOOST_CHECK(try_read(&l));
+  BOOST_CHECK(!try_write(&l));
+  l.readUnlock();
+  BOOST_CHECK(try_write(&l));
+
+  // Writers do not.
+  l.contentions_reset();
+  l.writeLock();
+  BOOST_CHECK(!try_read(&l));
+  pthread_t t = libport::startThread(boost::bind(&read_unlock, &l));
+  usleep(100000);
+  BOOST_CHECK_EQUAL(l.contentions(), 1u);
+  l.writeUnlock();
+  pthread_join(t, 0);
+  BOOST_CHECK(try_write(&l));
+}
+
+// Uncontended lock and unlock, compared to the recursive Lockable.
+static void
+test_bench()
+{
+  static const int n = 1000000;
+  libport::Lockable lockable;
+  libport::utime_t start = libport::utime();
+  for (int i = 0; i < n; ++i)
+    libport::BlockLock bl(lockable);
+  libport::utime_t recursive = libport::utime() - start;
+
+  AdaptiveLock adaptive;
+  start = libport::utime();
+  for (int i = 0; i < n; ++i)
+    libport::ScopedLock<AdaptiveLock> bl(adaptive);
+  libport::utime_t plain = libport::utime() - start;
+
+  BOOST_TEST_MESSAGE(n << " lock/unlock: Lockable " << recursive
+                     << "us, AdaptiveLock " << plain << "us");
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("libport::AdaptiveLock");
+  suite->add(BOOST_TEST_CASE(test_exclusion));
+  suite->add(BOOST_TEST_CASE(test_try));
+  suite->add(BOOST_TEST_CASE(test_contentions));
+  suite->add(BOOST_TEST_CASE(test_rw));
+  suite->add(BOOST_TEST_CASE(test_bench));
+  return suite;
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+// Throughput of connections and messages as the io_service pool grows.
+
+#include <set>
+
+#include "test.hh"
+
+using libport::test_suite;
+
+#include <libport/asio.hh>
+#include <libport/atomic.hh>
+#include <libport/format.hh>
+#include <libport/lexical-cast.hh>
+#include <libport/unistd.h>
+#include <libport/utime.hh>
+
+using boost::system::error_code;
+
+static const int port = 7891;
+static const size_t clients = 50;
+static const size_t messages = 200;
+static const std::string message(100, 'x');
+
+/// Number of clients which received all their echoes.
+static long done = 0;
+/// Number of server sockets alive.
+static long servers = 0;
+/// Whether sockets run their handlers in a strand.
+static bool strand = false;
+/// The threads which accepted the server sockets.
+static libport::Lockable acceptors_lock;
+static std::set<pthread_t> acceptors;
+/// The threads which ran the client read handlers.
+static libport::Lockable readers_lock;
+static std::set<pthread_t> readers;
+
+class EchoSocket: public libport::Socket
+{
+public:
+  EchoSocket()
+  {
+    setStrand(strand);
+    libport::atomic::increment_fetch(&servers);
+  }
+
+  void onConnect()
+  {
+    libport::BlockLock bl(acceptors_lock);
+    acceptors.insert(pthread_self());
+  }
+
+  ~EchoSocket()
+  {
+    libport::atomic::decrement_fetch(&servers);
+  }
+
+  size_t onRead(const void* data, size_t size)
+  {
+    write(data, size);
+    return size;
+  }
+
+  void onError(error_code)
+  {
+    destroy();
+  }
+
+  static Socket* factory()
+  {
+    return new EchoSocket;
+  }
+};
+
+/// Send \a messages, one at a time, waiting for their echo.
+class PingSocket: public libport::Socket
+{
+public:
+  PingSocket()
+    : Socket(libport::get_pooled_io_service())
+    , received_(0)
+    , sent_(0)
+  {
+    setStrand(strand);
+  }
+
+  void start()
+  {
+    ++sent_;
+    send(message);
+  }
+
+  size_t onRead(const void*, size_t size)
+  {
+    {
+      libport::BlockLock bl(readers_lock);
+      readers.insert(pthread_self());
+    }
+    received_ += size;
+    if (received_ < sent_ * message.size())
+      ;
+    else if (sent_ < messages)
+      start();
+    else
+      libport::atomic::increment_fetch(&done);
+    return size;
+  }
+
+private:
+  size_t received_;
+  size_t sent_;
+};
+
+/// Run the clients with a pool of \a threads io_services, with
+/// strands if \a strands.
+static void
+bench(size_t threads, bool strands = false)
+{
+  strand = strands;
+  libport::set_io_service_pool_size(threads);
+  BOOST_REQUIRE_EQUAL(libport::get_io_service_pool_size(), threads);
+  done = 0;
+  readers.clear();
+
+  libport::utime_t start = libport::utime();
+  std::vector<PingSocket*> sockets;
+  for (size_t i = 0; i < clients; ++i)
+  {
+    PingSocket* s = new PingSocket;
+    error_code err = s->connect("127.0.0.1", port);
+    BOOST_REQUIRE_MESSAGE(!err, err.message());
+    sockets.push_back(s);
+  }
+  libport::utime_t connected = libport::utime();
+
+  foreach (PingSocket* s, sockets)
+    s->start();
+  for (int i = 0; i < 3000 && done < long(clients); ++i)
+    usleep(10000);
+  libport::utime_t end = libport::utime();
+  BOOST_CHECK_EQUAL(done, long(clients));
+  // The handlers run in the threads of the pool, strands or not.
+  if (1 < threads)
+    BOOST_CHECK_LT(1u, readers.size());
+
+  BOOST_TEST_MESSAGE(
+    libport::format("%s threads%s: %.0f connections/s, %.0f messages/s",
+                    threads, strands ? " with strands" : "",
+                    clients * 1e6 / (connected - start),
+                    clients * messages * 1e6 / (end - connected)));
+
+  foreach (PingSocket* s, sockets)
+    s->destroy();
+  for (int i = 0; i < 300 && servers; ++i)
+    usleep(10000);
+  BOOST_CHECK_EQUAL(servers, 0);
+}
+
+static void
+test()
+{
+  libport::Socket* server = new libport::Socket;
+  error_code err = server->listen(&EchoSocket::factory, "127.0.0.1", port);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+
+  // The pool can only grow.
+  bench(1);
+  bench(2);
+  bench(4);
+  bench(4, true);
+
+  server->destroy();
+}
+
+/// Connect \a clients at once to listeners accepting \a batch
+/// connections per wakeup, with one acceptor per thread if \a
+/// reusePort.
+static void
+storm(size_t batch, bool reusePort, int port)
+{
+  const size_t clients = 400;
+  acceptors.clear();
+  libport::Socket* server = new libport::Socket;
+  server->setAcceptBatch(batch);
+  server->setReusePort(reusePort);
+  BOOST_CHECK_EQUAL(server->getAcceptBatch(), batch);
+  error_code err = server->listen(&EchoSocket::factory, "127.0.0.1", port);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+
+  libport::utime_t start = libport::utime();
+  std::vector<libport::Socket*> sockets;
+  for (size_t i = 0; i < clients; ++i)
+  {
+    libport::Socket* s = new libport::Socket(libport::get_pooled_io_service());
+    err = s->connect("127.0.0.1", port, false, 0, true);
+    BOOST_REQUIRE_MESSAGE(!err, err.message());
+    sockets.push_back(s);
+  }
+  for (int i = 0; i < 3000 && servers < long(clients); ++i)
+    usleep(1000);
+  libport::utime_t end = libport::utime();
+  BOOST_CHECK_EQUAL(servers, long(clients));
+  BOOST_TEST_MESSAGE(
+    libport::format("batch %s%s: %.0f connections/s, accepted by %s threads",
+                    batch, reusePort ? " with SO_REUSEPORT" : "",
+                    clients * 1e6 / (end - start), acceptors.size()));
+  BOOST_CHECK_EQUAL(acceptors.size(),
+                    reusePort ? libport::get_io_service_pool_size() : 1);
+
+  // Do not destroy sockets still connecting.
+  foreach (libport::Socket* s, sockets)
+    for (int i = 0; i < 300 && !s->isConnected(); ++i)
+      usleep(1000);
+  foreach (libport::Socket* s, sockets)
+    s->destroy();
+  server->destroy();
+  for (int i = 0; i < 300 && servers; ++i)
+    usleep(10000);
+  BOOST_CHECK_EQUAL(servers, 0);
+}
+
+static void
+test_storm()
+{
+  libport::set_io_service_pool_size(4);
+  storm(1, false, port + 1);
+  storm(64, false, port + 2);
+  storm(64, true, port + 3);
+}
+
+test_suite*
+init_test_suite()
+{
+  skip_if("windows");
+  test_suite* suite = BOOST_TEST_SUITE("Libport.Asio io_service pool");
+  suite->add(BOOST_TEST_CASE(test));
+  suite->add(BOOST_TEST_CASE(test_storm));
+  return suite;
+}
@@ -26,12 +26,16 @@
 //        buckets_.resize(num_buckets, bucket);
 //
 
+#include <fstream>
+
 #include "test.hh"
+#include <libport/fcntl.h>
 #include <libport/sysexits.hh>
 
 using libport::test_suite;
 
 #include <libport/asio.hh>
+#include <libport/format.hh>
 #include <libport/lexical-cast.hh>
 #include <libport/thread.hh>
 #include <libport/utime.hh>
@@ -137,6 +141,8 @@ public:
   {
     nRead++;
     //BOOST_TEST_MESSAGE(this << " read " << size);
+    // As guaranteed to the parsers.
+    BOOST_CHECK(!static_cast<const char*>(data)[size]);
     if (echo)
       write(data, size);
     if (dump)
@@ -144,11 +150,18 @@ public:
     return size;
   }
 
+  void onWriteHighWater(bool above)
+  {
+    highWater.push_back(above);
+  }
+
   void onError(error_code erc)
   {
     BOOST_TEST_MESSAGE(this << "->TestSocket::onError(" << erc
                        << ": " << erc.message() << ")");
     lastError = erc;
+    if (!firstError)
+      firstError = erc;
     if (destroyOnError)
       destroy();
   }
@@ -162,7 +175,11 @@ public:
   // Destroy socket onError.
   bool destroyOnError;
   std::string received;
+  // Calls to onWriteHighWater.
+  std::vector<bool> highWater;
   error_code lastError;
+  // Errors following the first one may be due to the closing.
+  error_code firstError;
   static TestSocket* factory()
   {
     lastInstance = new TestSocket();
@@ -413,6 +430,316 @@ test_udp()
 }
 
 
+void
+test_shared_write()
+{
+  size_t instances = TestSocket::nInstance;
+  libport::Socket* h = new libport::Socket();
+  error_code err = h->listen(boost::bind(&TestSocket::factoryEx, false, true),
+                             listen_host, S_AVAIL_PORT, false);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+
+  TestSocket* client = new TestSocket(false, false);
+  client->setWriteHighWater(1024);
+  err = client->connect(connect_host, S_AVAIL_PORT, false);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  libport::SharedBuffer chunk(new std::string(10000, 'x'));
+  for (int i = 0; i < 100; ++i)
+  {
+    client->send(chunk);
+    client->send(msg);
+  }
+  usleep(delay*3);
+  BOOST_CHECK_EQUAL(TestSocket::lastInstance->received.size(),
+                    100 * (chunk->size() + strlen(msg)));
+  BOOST_CHECK_EQUAL(TestSocket::lastInstance->received.substr(10000, 9),
+                    msg);
+  BOOST_CHECK_EQUAL(client->bytesSent(), 100 * (chunk->size() + strlen(msg)));
+  // Above the high-water mark, then back to low water.
+  BOOST_REQUIRE_LE(2u, client->highWater.size());
+  BOOST_CHECK(client->highWater.front());
+  BOOST_CHECK(!client->highWater.back());
+  // The edges alternate.
+  for (size_t i = 1; i < client->highWater.size(); ++i)
+    BOOST_CHECK_NE(client->highWater[i], client->highWater[i - 1]);
+  // The buffer was not copied, and is released.
+  BOOST_CHECK(chunk.unique());
+
+  client->close();
+  h->close();
+  h->destroy();
+  usleep(delay);
+  BOOST_CHECK_EQUAL(TestSocket::nInstance, instances);
+}
+
+
+static size_t udp_batches = 0;
+static size_t udp_datagrams = 0;
+void echo_batch(const libport::Socket::udp_batch_type& batch)
+{
+  ++udp_batches;
+  udp_datagrams += batch.size();
+  foreach (const libport::Socket::UDPDatagram& d, batch)
+    d.link->reply(d.data, d.length);
+}
+
+void
+test_udp_batch()
+{
+  error_code err;
+  unsigned short port =
+    libport::Socket::listenUDPBatch(listen_host, "0", &echo_batch, err,
+                                    libport::get_io_service(), 16, 64);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+
+  TestSocket* client = new TestSocket(false, true);
+  err = client->connect(connect_host, string_cast(port), true);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  // One write, one datagram, one echo.
+  std::string expected;
+  for (int i = 0; i < 100; ++i)
+  {
+    std::string d = string_cast(i) + ";";
+    client->send(d);
+    expected += d;
+  }
+  usleep(delay*2);
+  BOOST_CHECK_EQUAL(udp_datagrams, 100u);
+  BOOST_CHECK_LE(udp_batches, udp_datagrams);
+  BOOST_TEST_MESSAGE(udp_datagrams << " datagrams in "
+                     << udp_batches << " batches");
+  BOOST_CHECK_EQUAL(client->received.size(), expected.size());
+  BOOST_CHECK_EQUAL(client->nRead, 100u);
+
+  client->destroy();
+  BOOST_CHECK(libport::Socket::closeUDP(port));
+  usleep(delay);
+}
+
+
+void
+test_strand()
+{
+  size_t instances = TestSocket::nInstance;
+  libport::Socket* h = new libport::Socket();
+  error_code err = h->listen(boost::bind(&TestSocket::factoryEx, true, true),
+                             listen_host, S_AVAIL_PORT, false);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+
+  TestSocket* client = new TestSocket(false, true);
+  client->setStrand(true);
+  err = client->connect(connect_host, S_AVAIL_PORT, false);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  BOOST_CHECK_THROW(client->setStrand(false), std::runtime_error);
+  // Written from outside the strand: copied and posted.
+  client->send(msg);
+  client->send(libport::SharedBuffer(new std::string(msg)));
+  usleep(delay);
+  BOOST_CHECK_EQUAL(client->received, std::string(msg) + msg);
+
+  client->close();
+  h->close();
+  h->destroy();
+  usleep(delay);
+  BOOST_CHECK_EQUAL(TestSocket::nInstance, instances);
+}
+
+
+void
+test_stats()
+{
+  libport::watch_io_service(libport::get_io_service(), 10000);
+  libport::SocketStats before = libport::get_socket_stats();
+  libport::Socket* h = new libport::Socket();
+  error_code err = h->listen(boost::bind(&TestSocket::factoryEx, true, true),
+                             listen_host, S_AVAIL_PORT, false);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+
+  TestSocket* client = new TestSocket(false, true);
+  err = client->connect(connect_host, S_AVAIL_PORT, false);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  for (int i = 0; i < 10; ++i)
+    client->send(msg);
+  usleep(delay);
+  BOOST_CHECK_EQUAL(client->received.size(), 10 * strlen(msg));
+
+  libport::SocketStats s = client->getStats();
+  BOOST_TEST_MESSAGE(s);
+  BOOST_CHECK_LE(1u, s.reads);
+  BOOST_CHECK_EQUAL(s.readBytes, 10 * strlen(msg));
+  BOOST_CHECK_EQUAL(s.readSize.count(), s.reads);
+  BOOST_CHECK_EQUAL(s.handlerTime.count(), s.reads);
+  BOOST_CHECK_LE(1u, s.writes);
+  BOOST_CHECK_EQUAL(s.writeBytes, 10 * strlen(msg));
+  BOOST_CHECK_EQUAL(s.queueDepth.count(), 10u);
+  BOOST_CHECK_EQUAL(s.queueTime.count(), s.writes);
+  BOOST_CHECK_LT(0, s.duration);
+
+  // The server side counts too, and remains counted once destroyed.
+  client->close();
+  h->close();
+  h->destroy();
+  usleep(delay);
+  libport::SocketStats all = libport::get_socket_stats();
+  BOOST_TEST_MESSAGE(all);
+  BOOST_CHECK_LE(before.reads + 2 * s.reads, all.reads);
+  BOOST_CHECK_EQUAL(all.readBytes - before.readBytes,
+                    2 * 10 * strlen(msg));
+  BOOST_CHECK_LT(before.backlog.count(), all.backlog.count());
+}
+
+void
+test_idle_timeout()
+{
+  libport::Socket* h = new libport::Socket();
+  error_code err = h->listen(boost::bind(&TestSocket::factoryEx, true, false),
+                             listen_host, S_AVAIL_PORT, false);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+
+  TestSocket* client = new TestSocket(false, true);
+  client->destroyOnError = false;
+  err = client->connect(connect_host, S_AVAIL_PORT, false);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  client->setIdleTimeout(delay);
+  // Traffic keeps it alive.
+  for (int i = 0; i < 6; ++i)
+  {
+    client->send(msg);
+    usleep(delay / 2);
+  }
+  BOOST_CHECK(client->isConnected());
+  BOOST_CHECK(!client->firstError);
+  usleep(delay * 2);
+  BOOST_CHECK(!client->isConnected());
+  BOOST_CHECK_MESSAGE(client->firstError == boost::system::errc::timed_out,
+                      client->firstError.message());
+  BOOST_CHECK_EQUAL(client->received.size(), 6 * strlen(msg));
+
+  client->destroy();
+  h->close();
+  h->destroy();
+  usleep(delay);
+}
+
+static size_t sent_bytes;
+static error_code sent_error;
+static std::vector<size_t> progress;
+
+static void
+on_sent(error_code erc, size_t sent)
+{
+  sent_error = erc;
+  sent_bytes = sent;
+}
+
+static void
+on_progress(size_t sent)
+{
+  progress.push_back(sent);
+}
+
+static void
+write_pipe(int fd, const std::string& data)
+{
+  // More than the pipe holds, in several writes.
+  for (size_t i = 0; i < data.size(); i += 10000)
+  {
+    size_t n = std::min(data.size() - i, size_t(10000));
+    BOOST_CHECK_EQUAL(write(fd, data.c_str() + i, n), ssize_t(n));
+    usleep(1000);
+  }
+  close(fd);
+}
+
+void
+test_send_file()
+{
+  // Several times the 1MB sent per handler.
+  std::string content;
+  for (size_t i = 0; content.size() < 3000000; ++i)
+    content += libport::format("%s\n", i);
+  const char* path = "asio-send-file.tmp";
+  std::ofstream(path, std::ios::binary) << content;
+
+  libport::Socket* h = new libport::Socket();
+  error_code err = h->listen(boost::bind(&TestSocket::factoryEx, false, true),
+                             listen_host, S_AVAIL_PORT, false);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+  TestSocket* client = new TestSocket(false, false);
+  BOOST_CHECK(client->sendFile(path) == boost::system::errc::not_connected);
+  err = client->connect(connect_host, S_AVAIL_PORT, false);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  usleep(delay);
+  TestSocket* server = TestSocket::lastInstance;
+
+  // A range of a file, in order with the writes.
+  int fd = open(path, O_RDONLY);
+  BOOST_REQUIRE_NE(fd, -1);
+  client->send("head");
+  sent_bytes = 0;
+  progress.clear();
+  err = client->sendFile(fd, 10, 2500000, &on_sent, &on_progress);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+  client->send("tail");
+  for (int i = 0; i < 100 && !sent_bytes; ++i)
+    usleep(delay / 10);
+  usleep(delay);
+  BOOST_CHECK_EQUAL(sent_bytes, 2500000u);
+  BOOST_CHECK(!sent_error);
+  BOOST_REQUIRE(!progress.empty());
+  BOOST_CHECK_EQUAL(progress.back(), 2500000u);
+  BOOST_CHECK_EQUAL(server->received.size(), 2500008u);
+  BOOST_CHECK(server->received == "head" + content.substr(10, 2500000) + "tail");
+  // The file offset did not move.
+  BOOST_CHECK_EQUAL(lseek(fd, 0, SEEK_CUR), 0);
+  close(fd);
+
+  // A whole file, by name.
+  server->received.clear();
+  sent_bytes = 0;
+  err = client->sendFile(path, &on_sent);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+  for (int i = 0; i < 100 && !sent_bytes; ++i)
+    usleep(delay / 10);
+  usleep(delay);
+  BOOST_CHECK_EQUAL(sent_bytes, content.size());
+  BOOST_CHECK(server->received == content);
+
+  // The synchronous operations still block: more than the socket
+  // buffers hold.
+  server->received.clear();
+  std::string big = content + content + content;
+  BOOST_CHECK_NO_THROW(client->syncWrite(big));
+  for (int i = 0; i < 100 && server->received.size() < big.size(); ++i)
+    usleep(delay / 10);
+  BOOST_CHECK(server->received == big);
+
+  // A pipe, filled slowly, up to its end.
+  int p[2];
+  BOOST_REQUIRE_NE(pipe(p), -1);
+  std::string data = content.substr(0, 200000);
+  libport::startThread(boost::bind(&write_pipe, p[1], data));
+  server->received.clear();
+  sent_bytes = 0;
+  progress.clear();
+  err = client->sendFile(p[0], 0, 0, &on_sent, &on_progress);
+  BOOST_CHECK_MESSAGE(!err, err.message());
+  for (int i = 0; i < 100 && !sent_bytes; ++i)
+    usleep(delay / 10);
+  usleep(delay);
+  BOOST_CHECK(!sent_error);
+  BOOST_CHECK_EQUAL(sent_bytes, data.size());
+  BOOST_CHECK_LT(1u, progress.size());
+  BOOST_CHECK(server->received == data);
+  close(p[0]);
+
+  client->destroy();
+  h->close();
+  h->destroy();
+  unlink(path);
+  usleep(delay);
+}
+
 void test_pipe()
 {
   TestSocket* s1 = new TestSocket(false, true);
@@ -446,6 +773,12 @@ init_test_suite()
   suite->add(BOOST_TEST_CASE(test_invalid_ip));
   suite->add(BOOST_TEST_CASE(test));
   suite->add(BOOST_TEST_CASE(test_udp));
+  suite->add(BOOST_TEST_CASE(test_shared_write));
+  suite->add(BOOST_TEST_CASE(test_udp_batch));
+  suite->add(BOOST_TEST_CASE(test_strand));
+  suite->add(BOOST_TEST_CASE(test_stats));
+  suite->add(BOOST_TEST_CASE(test_idle_timeout));
+  suite->add(BOOST_TEST_CASE(test_send_file));
   suite->add(BOOST_TEST_CASE(test_pipe));
   return suite;
 }
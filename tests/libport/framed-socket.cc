@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "test.hh"
+
+using libport::test_suite;
+
+#include <libport/format.hh>
+#include <libport/framed-socket.hh>
+#include <libport/lexical-cast.hh>
+#include <libport/unistd.h>
+#include <libport/utime.hh>
+
+using boost::system::error_code;
+using libport::Frame;
+
+static const int port = 7893;
+static const libport::utime_t delay = 200000;
+
+static std::string
+str(const Frame& f)
+{
+  return std::string(f.data, f.length);
+}
+
+// Parse \a s with \a framer, returning the payloads separated by '|'
+// and the unparsed tail after a '#'.
+static std::string
+parse(libport::Framer& framer, const std::string& s)
+{
+  std::string res;
+  size_t used = 0;
+  while (used < s.size())
+  {
+    Frame f;
+    size_t size = framer.parse(s.data() + used, s.size() - used, f);
+    if (size == libport::Framer::invalid)
+      return res + "!";
+    if (!size)
+      break;
+    res += str(f) + "|";
+    used += size;
+  }
+  return res + "#" + s.substr(used);
+}
+
+static void
+test_framers()
+{
+  {
+    libport::LengthPrefixFramer f(2, 10);
+    std::string frames;
+    f.encode("abc", 3, frames);
+    f.encode("", 0, frames);
+    f.encode("0123456789", 10, frames);
+    BOOST_CHECK_EQUAL(frames.size(), 19u);
+    BOOST_CHECK_EQUAL(frames.substr(0, 5), std::string("\0\3abc", 5));
+    BOOST_CHECK_EQUAL(parse(f, frames), "abc||0123456789|#");
+    BOOST_CHECK_EQUAL(parse(f, frames.substr(0, 4)),
+                      "#" + frames.substr(0, 4));
+    BOOST_CHECK_EQUAL(parse(f, std::string("\0\13", 2)), "!");
+  }
+
+  {
+    libport::DelimiterFramer f("\r\n", 5);
+    BOOST_CHECK_EQUAL(parse(f, "ab\r\n\r\ncd"), "ab||#cd");
+    f.reset();
+    // The search resumes where it stopped, even within a delimiter.
+    BOOST_CHECK_EQUAL(parse(f, "ab\r"), "#ab\r");
+    BOOST_CHECK_EQUAL(parse(f, "ab\r\nc"), "ab|#c");
+    BOOST_CHECK_EQUAL(parse(f, "abcdef\r\n"), "!");
+    f.reset();
+    BOOST_CHECK_EQUAL(parse(f, "abcdefg"), "!");
+    f.reset();
+    std::string frame;
+    f.encode("xy", 2, frame);
+    BOOST_CHECK_EQUAL(frame, "xy\r\n");
+  }
+
+  {
+    libport::FixedSizeFramer f(3);
+    BOOST_CHECK_EQUAL(parse(f, "abcdefgh"), "abc|def|#gh");
+  }
+}
+
+/// Frames and batches received, and first error, by the servers.
+static size_t frames = 0;
+static size_t batches = 0;
+static std::string received;
+static error_code error;
+
+/// Echo the frames.
+class EchoSocket: public libport::FramedSocket
+{
+public:
+  EchoSocket()
+    : libport::FramedSocket(new libport::LengthPrefixFramer(4, 1000))
+  {
+  }
+
+  virtual void onFrames(const frames_type& fs)
+  {
+    ++batches;
+    libport::FramedSocket::onFrames(fs);
+  }
+
+  virtual void onFrame(const Frame& f)
+  {
+    ++frames;
+    received.append(f.data, f.length);
+    sendFrame(f.data, f.length);
+  }
+
+  virtual void onError(error_code erc)
+  {
+    if (!error)
+      error = erc;
+    destroy();
+  }
+
+  static libport::Socket* factory()
+  {
+    return new EchoSocket;
+  }
+};
+
+class ClientSocket: public libport::FramedSocket
+{
+public:
+  ClientSocket()
+    : libport::FramedSocket(new libport::LengthPrefixFramer)
+  {
+  }
+
+  virtual void onFrame(const Frame& f)
+  {
+    echoes.push_back(str(f));
+  }
+
+  std::vector<std::string> echoes;
+};
+
+static void
+test_socket()
+{
+  libport::Socket* server = new libport::Socket;
+  error_code err = server->listen(&EchoSocket::factory, "127.0.0.1", port);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+
+  ClientSocket* client = new ClientSocket;
+  err = client->connect("127.0.0.1", port);
+  BOOST_REQUIRE_MESSAGE(!err, err.message());
+  // Frames of all sizes, which end up wrapping around the end of the
+  // receive buffer.
+  std::string sent;
+  for (size_t i = 0; i < 1000; ++i)
+  {
+    std::string frame(i % 300, 'a' + i % 26);
+    client->sendFrame(frame);
+    sent += frame;
+  }
+  usleep(delay * 2);
+  BOOST_CHECK_EQUAL(frames, 1000u);
+  BOOST_CHECK(received == sent);
+  BOOST_CHECK_LT(batches, frames);
+  BOOST_TEST_MESSAGE(libport::format("%s frames in %s batches",
+                                     frames, batches));
+  BOOST_REQUIRE_EQUAL(client->echoes.size(), 1000u);
+  BOOST_CHECK_EQUAL(client->echoes[299], std::string(299, 'a' + 299 % 26));
+  BOOST_CHECK(error == error_code());
+
+  // An oversized frame is an error.
+  client->sendFrame(std::string(1001, 'x'));
+  usleep(delay);
+  BOOST_CHECK_MESSAGE(error == boost::asio::error::message_size, error.message());
+  BOOST_CHECK_EQUAL(frames, 1000u);
+
+  client->destroy();
+  server->destroy();
+  usleep(delay);
+}
+
+test_suite*
+init_test_suite()
+{
+  skip_if("windows");
+  test_suite* suite = BOOST_TEST_SUITE("Libport.FramedSocket");
+  suite->add(BOOST_TEST_CASE(test_framers));
+  suite->add(BOOST_TEST_CASE(test_socket));
+  return suite;
+}
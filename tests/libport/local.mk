@@ -18,8 +18,10 @@ TESTSFLAGS = --log_level=$(LOG_LEVEL)
 
 # Program to check:
 TESTS_BINARIES =                                \
+  tests/libport/adaptive-lock.cc                \
   tests/libport/allocator-static.cc             \
   tests/libport/asio.cc                         \
+  tests/libport/asio-pool.cc                    \
   tests/libport/assert.cc                       \
   tests/libport/atomic.cc                       \
   tests/libport/attributes.cc                   \
@@ -45,6 +47,7 @@ TESTS_BINARIES =                                \
   tests/libport/fnmatch.cc                      \
   tests/libport/foreach.cc                      \
   tests/libport/format.cc                       \
+  tests/libport/framed-socket.cc                \
   tests/libport/has-if.cc                       \
   tests/libport/hash.cc                         \
   tests/libport/hmac-sha1.cc                    \
@@ -54,16 +57,19 @@ TESTS_BINARIES =                                \
   tests/libport/io-stream.cc                    \
   tests/libport/markup-ostream.cc               \
   tests/libport/option-parser.cc                \
+  tests/libport/parallel.cc                     \
   tests/libport/path.cc                         \
   tests/libport/pid-file.cc                     \
   tests/libport/preproc.cc                      \
   tests/libport/pthread.cc                      \
   tests/libport/read-stdin.cc                   \
   tests/libport/reserved-vector.cc              \
+  tests/libport/ring-buffer.cc                  \
   tests/libport/safe-container.cc               \
   tests/libport/semaphore.cc                    \
   tests/libport/separate.cc                     \
   tests/libport/singleton-ptr.cc                \
+  tests/libport/socket-stats.cc                 \
   tests/libport/statistics.cc                   \
   tests/libport/sstream.cc                      \
   tests/libport/symbol.cc                       \
@@ -71,6 +77,7 @@ TESTS_BINARIES =                                \
   tests/libport/thread-pool.cc                  \
   tests/libport/time.cc                         \
   tests/libport/timer.cc                        \
+  tests/libport/timer-wheel.cc                  \
   tests/libport/tokenizer.cc                    \
   tests/libport/traits.cc                       \
   tests/libport/ufloat-double.cc                \
@@ -110,6 +117,15 @@ LDADD +=                                        \
 tests_libport_asio_LDADD = $(BOOST_SYSTEM_LIBS)  $(LDADD)
 tests_libport_asio_LDFLAGS = $(BOOST_SYSTEM_LDFLAGS) $(AM_LDFLAGS)
 tests_libport_asio_CXXFLAGS = $(PTHREAD_CFLAGS) $(AM_CXXFLAGS)
+tests_libport_asio_pool_LDADD = $(tests_libport_asio_LDADD)
+tests_libport_asio_pool_LDFLAGS = $(tests_libport_asio_LDFLAGS)
+tests_libport_asio_pool_CXXFLAGS = $(tests_libport_asio_CXXFLAGS)
+tests_libport_framed_socket_LDADD = $(tests_libport_asio_LDADD)
+tests_libport_framed_socket_LDFLAGS = $(tests_libport_asio_LDFLAGS)
+tests_libport_framed_socket_CXXFLAGS = $(tests_libport_asio_CXXFLAGS)
+tests_libport_timer_wheel_LDADD = $(tests_libport_asio_LDADD)
+tests_libport_timer_wheel_LDFLAGS = $(tests_libport_asio_LDFLAGS)
+tests_libport_timer_wheel_CXXFLAGS = $(tests_libport_asio_CXXFLAGS)
 
 tests_libport_xltdl_LDADD = $(LDADD) $(LTDL_LIBS)
 
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <libport/bind.hh>
+#include <libport/lexical-cast.hh>
+#include <libport/parallel.hh>
+#include <libport/unistd.h>
+#include <libport/unit-test.hh>
+#include <libport/utime.hh>
+
+using libport::test_suite;
+using libport::ThreadPool;
+namespace parallel = libport::parallel;
+
+static std::vector<int>
+random_ints(size_t n)
+{
+  std::vector<int> res(n);
+  for (size_t i = 0; i < n; ++i)
+    res[i] = rand() % 100000;
+  return res;
+}
+
+static void
+twice(int& i)
+{
+  i *= 2;
+}
+
+static std::string
+show(int i)
+{
+  return string_cast(i);
+}
+
+static void
+throw_on(int i, int bad)
+{
+  if (i == bad)
+    throw std::runtime_error("bad");
+}
+
+static void
+check_algorithms(ThreadPool& tp, size_t n, size_t grain)
+{
+  BOOST_TEST_MESSAGE("n = " << n << ", grain = " << grain);
+  std::vector<int> v = random_ints(n);
+
+  std::vector<int> w = v;
+  parallel::for_each(tp, w.begin(), w.end(), &twice, grain);
+  std::vector<int> expected = v;
+  std::for_each(expected.begin(), expected.end(), &twice);
+  BOOST_CHECK(w == expected);
+
+  std::vector<std::string> s(n);
+  BOOST_CHECK(parallel::transform(tp, v.begin(), v.end(), s.begin(), &show,
+                                  grain)
+              == s.end());
+  BOOST_CHECK(n == 0 || s.back() == show(v.back()));
+  BOOST_CHECK(n < 2 || s[n / 2] == show(v[n / 2]));
+
+  BOOST_CHECK_EQUAL(parallel::reduce(tp, v.begin(), v.end(), 0LL,
+                                     std::plus<long long>(), grain),
+                    std::accumulate(v.begin(), v.end(), 0LL));
+  // Not commutative: the order of the chunks is kept.
+  BOOST_CHECK(parallel::reduce(tp, s.begin(), s.end(), std::string(">"),
+                               std::plus<std::string>(), grain)
+              == std::accumulate(s.begin(), s.end(), std::string(">")));
+
+  w = v;
+  parallel::sort(tp, w.begin(), w.end(), std::greater<int>(), grain);
+  expected = v;
+  std::sort(expected.begin(), expected.end(), std::greater<int>());
+  BOOST_CHECK(w == expected);
+}
+
+static void
+test_algorithms(bool stealing)
+{
+  ThreadPool tp(4, stealing);
+  check_algorithms(tp, 0, 0);
+  check_algorithms(tp, 1, 0);
+  check_algorithms(tp, 100, 0);
+  check_algorithms(tp, 100, 1);
+  check_algorithms(tp, 1000, 7);
+  check_algorithms(tp, 100000, 0);
+  check_algorithms(tp, 100001, 1000);
+
+  std::vector<int> v(100000);
+  parallel::sort(tp, v.begin(), v.end());
+  BOOST_CHECK_EQUAL(parallel::reduce(tp, v.begin(), v.end(), 0), 0);
+}
+
+static void
+test_shared()
+{
+  test_algorithms(false);
+}
+
+static void
+test_stealing()
+{
+  test_algorithms(true);
+}
+
+static void
+test_exception()
+{
+  ThreadPool tp(4, true);
+  std::vector<int> v(10000);
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = i;
+  BOOST_CHECK_THROW(parallel::for_each(tp, v.begin(), v.end(),
+                                       boost::bind(&throw_on, _1, 5000), 100),
+                    std::runtime_error);
+  // Sequential.
+  BOOST_CHECK_THROW(parallel::for_each(tp, v.begin(), v.end(),
+                                       boost::bind(&throw_on, _1, 5000)),
+                    std::runtime_error);
+}
+
+// The caller runs chunks too: it completes while the pool is busy.
+static void
+test_busy()
+{
+  ThreadPool tp(1);
+  tp.queueTask(boost::bind(&usleep, 1000000));
+  usleep(10000);
+  std::vector<int> v = random_ints(10000);
+  libport::utime_t start = libport::utime();
+  parallel::sort(tp, v.begin(), v.end(), std::less<int>(), 100);
+  BOOST_CHECK_LT(libport::utime() - start, 500000);
+  BOOST_CHECK(std::is_sorted(v.begin(), v.end()));
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("libport::parallel");
+  suite->add(BOOST_TEST_CASE(test_shared));
+  suite->add(BOOST_TEST_CASE(test_stealing));
+  suite->add(BOOST_TEST_CASE(test_exception));
+  suite->add(BOOST_TEST_CASE(test_busy));
+  return suite;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <string>
+
+#include <libport/ring-buffer.hh>
+#include <libport/unit-test.hh>
+
+using libport::test_suite;
+using libport::RingBuffer;
+using boost::asio::buffer_cast;
+using boost::asio::buffer_size;
+
+// The content of \a b, chunk by chunk, separated by '|'.
+static std::string
+chunks(const RingBuffer& b)
+{
+  RingBuffer::const_buffers_type data = b.data();
+  std::string res(buffer_cast<const char*>(data[0]), buffer_size(data[0]));
+  if (buffer_size(data[1]))
+    res += "|" + std::string(buffer_cast<const char*>(data[1]),
+                             buffer_size(data[1]));
+  return res;
+}
+
+// Fill the free space in place, as a scatter read would.
+static void
+fill(RingBuffer& b, const std::string& s)
+{
+  RingBuffer::mutable_buffers_type free = b.prepare(s.size());
+  size_t first = std::min(s.size(), buffer_size(free[0]));
+  s.copy(buffer_cast<char*>(free[0]), first);
+  s.copy(buffer_cast<char*>(free[1]), s.size() - first, first);
+  b.commit(s.size());
+}
+
+static void
+wrap_around()
+{
+  RingBuffer b(8);
+  fill(b, "Hello");
+  BOOST_CHECK_EQUAL(chunks(b), "Hello");
+  b.consume(3);
+  BOOST_CHECK_EQUAL(chunks(b), "lo");
+
+  // Consuming does not move data, writing wraps around.
+  fill(b, "World");
+  BOOST_CHECK_EQUAL(b.capacity(), 8u);
+  BOOST_CHECK_EQUAL(chunks(b), "loWor|ld");
+  BOOST_CHECK_EQUAL(std::string(b.linearize(), b.size()), "loWorld");
+  BOOST_CHECK_EQUAL(chunks(b), "loWorld");
+
+  // Emptied buffers start over at the beginning.
+  b.consume(b.size());
+  fill(b, "12345678");
+  BOOST_CHECK_EQUAL(chunks(b), "12345678");
+}
+
+static void
+growth()
+{
+  RingBuffer b(8);
+  fill(b, "abcdef");
+  b.consume(4);
+  fill(b, "ghij");
+  BOOST_CHECK_EQUAL(chunks(b), "efgh|ij");
+  // Growing keeps the data, contiguous.
+  fill(b, "klmnopqrst");
+  BOOST_CHECK_EQUAL(b.capacity(), 16u);
+  BOOST_CHECK_EQUAL(chunks(b), "efghijklmnopqrst");
+}
+
+static void
+copies()
+{
+  RingBuffer b(4);
+  b.write("abc", 3);
+  char buf[8];
+  BOOST_CHECK_EQUAL(b.read(buf, 2), 2u);
+  BOOST_CHECK_EQUAL(std::string(buf, 2), "ab");
+  b.write("defg", 4);
+  BOOST_CHECK_EQUAL(chunks(b), "cdefg");
+  BOOST_CHECK_EQUAL(b.read(buf, sizeof buf), 5u);
+  BOOST_CHECK_EQUAL(std::string(buf, 5), "cdefg");
+  BOOST_CHECK(b.empty());
+}
+
+// The data is followed by a NUL byte, unless it wraps around.
+static void
+terminated()
+{
+  RingBuffer b(8);
+  fill(b, "abcdefgh");
+  BOOST_CHECK_EQUAL(b.linearize()[b.size()], 0);
+  b.consume(6);
+  fill(b, "ijk");
+  BOOST_CHECK_EQUAL(chunks(b), "gh|ijk");
+  b.consume(2);
+  BOOST_CHECK_EQUAL(std::string(b.linearize()), "ijk");
+  fill(b, "lmnopqrstu");
+  BOOST_CHECK_EQUAL(std::string(b.linearize()), "ijklmnopqrstu");
+  b.clear();
+  b.write("vw", 2);
+  BOOST_CHECK_EQUAL(std::string(b.linearize()), "vw");
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("libport::RingBuffer");
+  suite->add(BOOST_TEST_CASE(wrap_around));
+  suite->add(BOOST_TEST_CASE(growth));
+  suite->add(BOOST_TEST_CASE(copies));
+  suite->add(BOOST_TEST_CASE(terminated));
+  return suite;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <sstream>
+
+#include <libport/socket-stats.hh>
+#include <libport/unit-test.hh>
+
+using libport::test_suite;
+using libport::Log2Histogram;
+
+static void
+histogram()
+{
+  Log2Histogram h;
+  BOOST_CHECK_EQUAL(h.count(), 0u);
+  BOOST_CHECK_EQUAL(h.quantile(0.5), 0u);
+
+  h.add(0);
+  h.add(1);
+  h.add(5);
+  h.add(6);
+  h.add(1000);
+  BOOST_CHECK_EQUAL(h.count(), 5u);
+  BOOST_CHECK_EQUAL(h.sum(), 1012u);
+  BOOST_CHECK_EQUAL(h.max(), 1000u);
+  BOOST_CHECK_CLOSE(h.mean(), 202.4, 0.001);
+  BOOST_CHECK_EQUAL(h.bucket(0), 1u);
+  BOOST_CHECK_EQUAL(h.bucket(1), 1u);
+  // [4, 8).
+  BOOST_CHECK_EQUAL(h.bucket(3), 2u);
+  // [512, 1024).
+  BOOST_CHECK_EQUAL(h.bucket(10), 1u);
+  // Upper bounds of the buckets, bounded by the maximum.
+  BOOST_CHECK_EQUAL(h.quantile(0.5), 7u);
+  BOOST_CHECK_EQUAL(h.quantile(0.99), 1000u);
+  BOOST_CHECK_EQUAL(h.quantile(1), 1000u);
+
+  // Huge values end in the last bucket.
+  h.add(Log2Histogram::value_type(1) << 40);
+  BOOST_CHECK_EQUAL(h.bucket(Log2Histogram::buckets - 1), 1u);
+
+  Log2Histogram g;
+  g.add(3);
+  g += h;
+  BOOST_CHECK_EQUAL(g.count(), 7u);
+  BOOST_CHECK_EQUAL(g.bucket(2), 1u);
+  BOOST_CHECK_EQUAL(g.max(), h.max());
+}
+
+static void
+stats()
+{
+  libport::SocketStats s;
+  s.duration = 2000000;
+  s.reads = 10;
+  s.readSize.add(100);
+  libport::SocketStats t;
+  t.duration = 1000000;
+  t.reads = 30;
+  t.writes = 4;
+  t.readSize.add(200);
+  s += t;
+  BOOST_CHECK_EQUAL(s.duration, 2000000);
+  BOOST_CHECK_EQUAL(s.reads, 40u);
+  BOOST_CHECK_EQUAL(s.readSize.count(), 2u);
+  BOOST_CHECK_EQUAL(s.readRate(), 20);
+  BOOST_CHECK_EQUAL(s.writeRate(), 2);
+
+  std::ostringstream o;
+  o << s;
+  BOOST_TEST_MESSAGE(o.str());
+  BOOST_CHECK_NE(o.str().find("reads: 40 (20.0/s)"), std::string::npos);
+  BOOST_CHECK_NE(o.str().find("read size (B)"), std::string::npos);
+  // No backlog was measured.
+  BOOST_CHECK_EQUAL(o.str().find("backlog"), std::string::npos);
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("libport::SocketStats");
+  suite->add(BOOST_TEST_CASE(histogram));
+  suite->add(BOOST_TEST_CASE(stats));
+  return suite;
+}
@@ -9,11 +9,13 @@
  */
 
 #include <libport/bind.hh>
+#include <libport/foreach.hh>
 #include <libport/lexical-cast.hh>
 #include "test.hh"
 
 #include <libport/unistd.h>
 #include <libport/thread-pool.hh>
+#include <libport/utime.hh>
 
 // For atomic increment
 #include <boost/interprocess/detail/atomic.hpp>
@@ -49,9 +51,9 @@ static void task_sleep_inc(int delay)
 
 // Just start a bunch of tasks and ensure they are all executed.
 // In slowInject, inject slower to trigger the IDLE thread code more often.
-static void test_many(bool slowInject)
+static void test_many(bool slowInject, bool stealing)
 {
-  ThreadPool tp(10);
+  ThreadPool tp(10, stealing);
   counter = 0;
   std::vector<ThreadPool::rTaskLock> v;
   for(int i=0; i<10; ++i)
@@ -81,12 +83,22 @@ static void test_many(bool slowInject)
 
 static void test_many_slow()
 {
-  test_many(true);
+  test_many(true, false);
 }
 
 static void test_many_fast()
 {
-  test_many(false);
+  test_many(false, false);
+}
+
+static void test_many_slow_stealing()
+{
+  test_many(true, true);
+}
+
+static void test_many_fast_stealing()
+{
+  test_many(false, true);
 }
 
 std::vector<unsigned> lockCheck;
@@ -107,10 +119,11 @@ static void task_sleep_check_lock(int delay, unsigned lockid, unsigned lockval)
 }
 
 // Test that no two tasks with same lock are executed in parallel.
-static void test_lock()
+static void test_lock(bool stealing)
 {
-  ThreadPool tp(10);
+  ThreadPool tp(10, stealing);
   counter = 0;
+  errors = 0;
   std::vector<ThreadPool::rTaskLock> v;
   for(int i=0; i<10; ++i)
     v.push_back(new ThreadPool::TaskLock);
@@ -135,10 +148,20 @@ static void test_lock()
   BOOST_CHECK_EQUAL(errors, 0U);
 }
 
+static void test_lock_shared()
+{
+  test_lock(false);
+}
+
+static void test_lock_stealing()
+{
+  test_lock(true);
+}
+
 // Test the dropping feature
-static void test_drop()
+static void test_drop(bool stealing)
 {
-  ThreadPool& tp = *new ThreadPool(10);
+  ThreadPool& tp = *new ThreadPool(10, stealing);
   ThreadPool::rTaskLock l(new ThreadPool::TaskLock(1));
   ThreadPool::rTaskHandle h1 = tp.queueTask(boost::bind(&usleep, 200000), l);
   ThreadPool::rTaskHandle h2 = tp.queueTask(boost::bind(&usleep, 200000), l);
@@ -150,6 +173,207 @@ static void test_drop()
   BOOST_CHECK_EQUAL(h3->getState(), ThreadPool::TaskHandle::DROPPED);
 }
 
+static void test_drop_shared()
+{
+  test_drop(false);
+}
+
+static void test_drop_stealing()
+{
+  test_drop(true);
+}
+
+static void task_inc()
+{
+  atomic_inc32(&counter);
+}
+
+// Queue two subtasks from within the pool, down to depth 0.
+static void task_fork(ThreadPool* tp, unsigned depth)
+{
+  if (depth)
+  {
+    tp->queueTask(boost::bind(&task_fork, tp, depth - 1));
+    tp->queueTask(boost::bind(&task_fork, tp, depth - 1));
+  }
+  else
+    atomic_inc32(&counter);
+}
+
+static bool wait_counter(boost::uint32_t n)
+{
+  for (int i = 0; i < 2000 && atomic_read32(&counter) != n; ++i)
+    usleep(10000);
+  return atomic_read32(&counter) == n;
+}
+
+// Tasks queued from within a worker go to its deque, and are stolen.
+static void test_fork_join()
+{
+  ThreadPool tp(4, true);
+  BOOST_CHECK(tp.workStealing());
+  counter = 0;
+  tp.queueTask(boost::bind(&task_fork, &tp, 12));
+  BOOST_CHECK(wait_counter(1 << 12));
+  BOOST_CHECK_EQUAL(tp.queueSize(), 0U);
+}
+
+// Throughput of tiny tasks, queued from outside, then from within.
+static void bench(bool stealing)
+{
+  const char* mode = stealing ? "stealing" : "shared";
+  ThreadPool tp(4, stealing);
+  static const boost::uint32_t nTasks = 200000 / dfactor;
+  counter = 0;
+  libport::utime_t start = libport::utime();
+  for (unsigned i = 0; i < nTasks; ++i)
+    tp.queueTask(&task_inc);
+  BOOST_CHECK(wait_counter(nTasks));
+  libport::utime_t d = libport::utime() - start;
+  BOOST_TEST_MESSAGE(mode << ": " << nTasks * 1000000LL / (d ? d : 1)
+                     << " external tasks/s");
+
+  static const unsigned depth = 16 - (dfactor != 1) * 4;
+  counter = 0;
+  start = libport::utime();
+  tp.queueTask(boost::bind(&task_fork, &tp, depth));
+  BOOST_CHECK(wait_counter(1 << depth));
+  d = libport::utime() - start;
+  BOOST_TEST_MESSAGE(mode << ": " << (2LL << depth) * 1000000LL / (d ? d : 1)
+                     << " fork-join tasks/s");
+}
+
+static void test_bench()
+{
+  bench(false);
+  bench(true);
+}
+
+static int square(int i)
+{
+  return i * i;
+}
+
+static int sleep_square(int delay, int i)
+{
+  usleep(delay);
+  return i * i;
+}
+
+static int fail(int)
+{
+  throw std::runtime_error("fail");
+}
+
+static int sum(const std::vector<ThreadPool::Future<int> >* fs)
+{
+  int res = 0;
+  foreach (const ThreadPool::Future<int>& f, *fs)
+    res += f.get();
+  return res;
+}
+
+static void test_future(bool stealing)
+{
+  ThreadPool tp(4, stealing);
+
+  // Value, exception.
+  BOOST_CHECK_EQUAL(tp.queueTask<int>(boost::bind(&square, 7)).get(), 49);
+  ThreadPool::Future<int> f = tp.queueTask<int>(boost::bind(&fail, 0));
+  BOOST_CHECK_THROW(f.get(), std::runtime_error);
+  counter = 0;
+  tp.queueTask<void>(&task_inc).get();
+  BOOST_CHECK_EQUAL(atomic_read32(&counter), 1U);
+
+  // Timed wait.
+  f = tp.queueTask<int>(boost::bind(&sleep_square, 300000, 2));
+  BOOST_CHECK(!f.wait(10000));
+  BOOST_CHECK(!f.ready());
+  BOOST_CHECK(f.wait(5000000));
+  BOOST_CHECK(f.ready());
+  BOOST_CHECK_EQUAL(f.get(), 4);
+
+  // Continuations, and propagation of failures.
+  ThreadPool::Future<int> g =
+    tp.queueTask<int>(boost::bind(&sleep_square, 10000, 2))
+    .then<int>(&square)
+    .then<int>(boost::bind(&sleep_square, 1000, _1));
+  BOOST_CHECK_EQUAL(g.get(), 256);
+  counter = 0;
+  ThreadPool::Future<void> h = f.then<void>(boost::bind(&task_inc));
+  h.get();
+  BOOST_CHECK_EQUAL(atomic_read32(&counter), 1U);
+  g = tp.queueTask<int>(boost::bind(&fail, 0)).then<int>(&square);
+  BOOST_CHECK_THROW(g.get(), std::runtime_error);
+  g = tp.queueTask<int>(boost::bind(&square, 3)).then<int>(&fail);
+  BOOST_CHECK_THROW(g.get(), std::runtime_error);
+
+  // Fan-out, fan-in.
+  std::vector<ThreadPool::Future<int> > fs;
+  for (int i = 0; i < 100; ++i)
+    fs.push_back(tp.queueTask<int>(boost::bind(&sleep_square,
+                                               rand() % 1000, i)));
+  g = ThreadPool::when_all(fs).then<int>(boost::bind(&sum, &fs));
+  BOOST_CHECK_EQUAL(g.get(), 328350);
+  BOOST_CHECK(ThreadPool::when_all(std::vector<ThreadPool::Future<int> >())
+              .ready());
+
+  fs.clear();
+  fs.push_back(tp.queueTask<int>(boost::bind(&sleep_square, 500000, 1)));
+  fs.push_back(tp.queueTask<int>(boost::bind(&sleep_square, 1000, 2)));
+  BOOST_CHECK_EQUAL(ThreadPool::when_any(fs).get(), 1U);
+
+  // Dropped tasks fail their future.
+  ThreadPool::rTaskLock l(new ThreadPool::TaskLock(1));
+  f = tp.queueTask<int>(boost::bind(&sleep_square, 100000, 1), l);
+  g = tp.queueTask<int>(boost::bind(&sleep_square, 100000, 1), l);
+  BOOST_CHECK(g.ready());
+  BOOST_CHECK_THROW(g.get(), libport::Exception);
+  BOOST_CHECK_EQUAL(f.get(), 1);
+  BOOST_CHECK(ThreadPool::when_all(fs).wait(5000000));
+}
+
+static void test_future_shared()
+{
+  test_future(false);
+}
+
+static void test_future_stealing()
+{
+  test_future(true);
+}
+
+// The futures of the tasks dropped by the destruction of the pool fail.
+static void test_future_destroyed()
+{
+  ThreadPool::Future<int> f;
+  ThreadPool::Future<int> g;
+  ThreadPool::Future<int> h;
+  ThreadPool::Future<int> k;
+  {
+    ThreadPool tp(1, true);
+    if (!tp.workStealing())
+      return;
+    // Keeps the only worker busy until the pool is destroyed, then
+    // queues its continuation, dropped too.
+    k = tp.queueTask<int>(boost::bind(&sleep_square, 300000, 1))
+      .then<int>(&square);
+    usleep(100000);
+    f = tp.queueTask<int>(boost::bind(&square, 2));
+    ThreadPool::rTaskLock l(new ThreadPool::TaskLock);
+    g = tp.queueTask<int>(boost::bind(&square, 3), l);
+    h = tp.queueTask<int>(boost::bind(&square, 4), l);
+  }
+  BOOST_CHECK(f.ready());
+  BOOST_CHECK_THROW(f.get(), libport::Exception);
+  BOOST_CHECK(g.ready());
+  BOOST_CHECK_THROW(g.get(), libport::Exception);
+  BOOST_CHECK(h.ready());
+  BOOST_CHECK_THROW(h.get(), libport::Exception);
+  BOOST_CHECK(k.ready());
+  BOOST_CHECK_THROW(k.get(), libport::Exception);
+}
+
 test_suite*
 init_test_suite()
 {
@@ -163,7 +387,16 @@ init_test_suite()
   srand(seed);
   suite->add(BOOST_TEST_CASE(test_many_slow));
   suite->add(BOOST_TEST_CASE(test_many_fast));
-  suite->add(BOOST_TEST_CASE(test_lock));
-  suite->add(BOOST_TEST_CASE(test_drop));
+  suite->add(BOOST_TEST_CASE(test_many_slow_stealing));
+  suite->add(BOOST_TEST_CASE(test_many_fast_stealing));
+  suite->add(BOOST_TEST_CASE(test_lock_shared));
+  suite->add(BOOST_TEST_CASE(test_lock_stealing));
+  suite->add(BOOST_TEST_CASE(test_drop_shared));
+  suite->add(BOOST_TEST_CASE(test_drop_stealing));
+  suite->add(BOOST_TEST_CASE(test_fork_join));
+  suite->add(BOOST_TEST_CASE(test_bench));
+  suite->add(BOOST_TEST_CASE(test_future_shared));
+  suite->add(BOOST_TEST_CASE(test_future_stealing));
+  suite->add(BOOST_TEST_CASE(test_future_destroyed));
   return suite;
 }
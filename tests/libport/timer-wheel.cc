@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <algorithm>
+
+#include "test.hh"
+
+using libport::test_suite;
+
+#include <libport/format.hh>
+#include <libport/timer-wheel.hh>
+#include <libport/unistd.h>
+#include <libport/utime.hh>
+
+using libport::TimerWheel;
+using libport::utime_t;
+
+static std::vector<utime_t> fired;
+
+static void
+fire(size_t i)
+{
+  fired[i] = libport::utime();
+}
+
+// Timers fire in time, never early.
+static void
+deadlines()
+{
+  TimerWheel& w = libport::get_timer_wheel();
+  const size_t n = 20;
+  fired.assign(n, 0);
+  utime_t start = libport::utime();
+  for (size_t i = 0; i < n; ++i)
+    w.add(i * 5000, boost::bind(&fire, i));
+  usleep(200000);
+  BOOST_CHECK_EQUAL(w.size(), 0u);
+  for (size_t i = 0; i < n; ++i)
+  {
+    BOOST_CHECK_LE(start + utime_t(i * 5000), fired[i]);
+    // A tick late at most, and the scheduler.
+    BOOST_CHECK_LT(fired[i], start + utime_t(i * 5000) + 50000);
+  }
+}
+
+static void
+cancel()
+{
+  TimerWheel& w = libport::get_timer_wheel();
+  fired.assign(2, 0);
+  TimerWheel::Handle h0 = w.add(10000, boost::bind(&fire, 0));
+  TimerWheel::Handle h1 = w.add(10000, boost::bind(&fire, 1));
+  BOOST_CHECK_EQUAL(w.size(), 2u);
+  BOOST_CHECK(w.cancel(h0));
+  BOOST_CHECK(!w.cancel(h0));
+  BOOST_CHECK_EQUAL(w.size(), 1u);
+  usleep(100000);
+  BOOST_CHECK_EQUAL(fired[0], 0);
+  BOOST_CHECK_NE(fired[1], 0);
+  // Too late.
+  BOOST_CHECK(!w.cancel(h1));
+}
+
+/// Number of wakeups to run \a n timers spread over 200ms, with \a
+/// slack.
+static size_t
+wakeups(size_t n, useconds_t slack)
+{
+  TimerWheel& w = libport::get_timer_wheel();
+  fired.assign(n, 0);
+  size_t before = w.wakeups();
+  for (size_t i = 0; i < n; ++i)
+    w.add(10000 + i * 200000 / n, boost::bind(&fire, i), slack);
+  usleep(400000);
+  BOOST_CHECK_EQUAL(w.size(), 0u);
+  BOOST_CHECK(std::find(fired.begin(), fired.end(), 0) == fired.end());
+  return w.wakeups() - before;
+}
+
+// Timers share wakeups, the more so as their slack is large.
+static void
+coalescing()
+{
+  size_t strict = wakeups(1000, 0);
+  size_t loose = wakeups(1000, 20000);
+  BOOST_TEST_MESSAGE(libport::format("1000 timers over 200ms: %s wakeups, "
+                                     "%s with 20ms slack", strict, loose));
+  // At most one per 1ms tick, and a few for scheduling hiccups.
+  BOOST_CHECK_LE(strict, 220u);
+  BOOST_CHECK_LT(loose, strict / 4);
+}
+
+static void
+hold(boost::shared_ptr<int>)
+{
+}
+
+// The wheel is a service of its io_service, and drops its timers with
+// it.
+static void
+destroyed()
+{
+  boost::shared_ptr<int> p(new int(0));
+  {
+    boost::asio::io_service io;
+    TimerWheel& w = libport::get_timer_wheel(io);
+    BOOST_CHECK_EQUAL(&w, &libport::get_timer_wheel(io));
+    BOOST_CHECK_NE(&w, &libport::get_timer_wheel());
+    TimerWheel::Handle h = w.add(1000000, boost::bind(&hold, p));
+    BOOST_CHECK_EQUAL(p.use_count(), 2);
+  }
+  BOOST_CHECK_EQUAL(p.use_count(), 1);
+}
+
+test_suite*
+init_test_suite()
+{
+  skip_if("windows");
+  test_suite* suite = BOOST_TEST_SUITE("libport::TimerWheel");
+  suite->add(BOOST_TEST_CASE(deadlines));
+  suite->add(BOOST_TEST_CASE(cancel));
+  suite->add(BOOST_TEST_CASE(coalescing));
+  suite->add(BOOST_TEST_CASE(destroyed));
+  return suite;
+}
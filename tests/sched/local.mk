@@ -11,19 +11,50 @@ if ! SCHED_CORO_OSTHREAD
 ## the sched interface.
 TESTS_BINARIES +=				\
   tests/sched/debug.cc				\
+  tests/sched/offload.cc			\
+  tests/sched/profiler.cc			\
   tests/sched/sched-except.cc			\
   tests/sched/sched.cc				\
+  tests/sched/scheduler.cc			\
+  tests/sched/sleepers.cc			\
+  tests/sched/stacks.cc				\
+  tests/sched/switch.cc				\
   tests/sched/thread-coro.cc
+if SCHED_MULTITHREAD
+## Workers need a current coroutine per thread.
+TESTS_BINARIES += tests/sched/workers.cc
+endif
 endif
 
 tests_sched_debug_SOURCES = tests/sched/debug.cc
 tests_sched_debug_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
 
+tests_sched_offload_SOURCES = tests/sched/offload.cc
+tests_sched_offload_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
+tests_sched_profiler_SOURCES = tests/sched/profiler.cc
+tests_sched_profiler_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
 tests_sched_sched_SOURCES = tests/sched/sched.cc
 tests_sched_sched_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
 
+tests_sched_scheduler_SOURCES = tests/sched/scheduler.cc
+tests_sched_scheduler_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
+tests_sched_sleepers_SOURCES = tests/sched/sleepers.cc
+tests_sched_sleepers_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
+tests_sched_stacks_SOURCES = tests/sched/stacks.cc
+tests_sched_stacks_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
+tests_sched_switch_SOURCES = tests/sched/switch.cc
+tests_sched_switch_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
 tests_sched_sched_except_SOURCES = tests/sched/sched-except.cc
 tests_sched_sched_except_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
 
 tests_sched_thread_coro_SOURCES = tests/sched/thread-coro.cc
 tests_sched_thread_coro_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
+
+tests_sched_workers_SOURCES = tests/sched/workers.cc
+tests_sched_workers_LDFLAGS = $(SCHED_LIBS) $(AM_LDFLAGS)
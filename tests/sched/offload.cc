@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** Check that jobs offloading work to a thread pool do not block the
+ ** scheduler.
+ */
+
+#include <stdexcept>
+
+#include <libport/bind.hh>
+#include <libport/semaphore.hh>
+#include <libport/thread-pool.hh>
+#include <libport/unistd.h>
+#include <libport/utime.hh>
+
+#include <sched/job.hh>
+#include <sched/scheduler.hh>
+#include <tests/libport/test.hh>
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+static libport::utime_t
+get_time()
+{
+  return libport::utime();
+}
+
+static int
+blocking_square(int i)
+{
+  usleep(200000);
+  return i * i;
+}
+
+static int
+blocking_fail()
+{
+  usleep(50000);
+  throw std::runtime_error("fail");
+}
+
+/// A job running \a f on \a pool, or yielding forever if \a f is empty.
+class OffloadJob: public sched::Job
+{
+public:
+  OffloadJob(sched::Scheduler& s, libport::ThreadPool& pool,
+             boost::function0<int> f = 0)
+    : sched::Job(s)
+    , pool_(pool)
+    , f_(f)
+    , result(-1)
+    , failed(false)
+    , done(false)
+    , rounds(0)
+  {}
+
+  virtual bool frozen() const
+  {
+    return false;
+  }
+
+  virtual size_t has_tag(const sched::Tag&, size_t) const
+  {
+    return 0;
+  }
+
+  virtual sched::prio_type prio_get() const
+  {
+    return sched::UPRIO_DEFAULT;
+  }
+
+  libport::ThreadPool& pool_;
+  boost::function0<int> f_;
+  int result;
+  bool failed;
+  bool done;
+  unsigned rounds;
+
+protected:
+  virtual void work()
+  {
+    if (f_)
+    {
+      try
+      {
+        result = offload(pool_, f_);
+      }
+      catch (const std::runtime_error&)
+      {
+        failed = true;
+      }
+      done = true;
+    }
+    else
+      while (true)
+      {
+        ++rounds;
+        yield();
+      }
+  }
+
+  virtual void scheduling_error(const std::string& msg)
+  {
+    BOOST_ERROR("scheduling error: " << msg);
+  }
+};
+
+/// Run \a s until \a job is done, at most 5s, waiting for the
+/// deadlines on \a wake.
+static void
+run_until_done(sched::Scheduler& s, OffloadJob& job, libport::Semaphore* wake)
+{
+  libport::utime_t end = libport::utime() + 5000000;
+  while (!job.done && libport::utime() < end)
+  {
+    libport::utime_t deadline = s.work();
+    libport::utime_t now = libport::utime();
+    if (deadline <= now)
+      continue;
+    if (wake)
+      wake->uget(deadline - now);
+    else
+      usleep(deadline - now);
+  }
+  BOOST_CHECK(job.done);
+}
+
+// The scheduler keeps running the other jobs meanwhile.
+static void
+test_result()
+{
+  libport::ThreadPool pool(2);
+  sched::Scheduler s(get_time);
+  sched::rJob busy(new OffloadJob(s, pool));
+  busy->start_job();
+  OffloadJob* off = new OffloadJob(s, pool, boost::bind(&blocking_square, 7));
+  sched::rJob job(off);
+  job->start_job();
+  s.work();
+  s.work();
+  BOOST_CHECK_EQUAL(job->state_get(), sched::offloaded);
+  BOOST_CHECK_EQUAL(sched::name(sched::offloaded),
+                    std::string("offloaded"));
+  unsigned rounds = static_cast<OffloadJob*>(busy.get())->rounds;
+  run_until_done(s, *off, 0);
+  BOOST_CHECK_EQUAL(off->result, 49);
+  BOOST_CHECK_LT(rounds + 100,
+                 static_cast<OffloadJob*>(busy.get())->rounds);
+  s.killall_jobs();
+  while (s.work() != sched::SCHED_EXIT)
+    continue;
+}
+
+static void
+test_exception()
+{
+  libport::ThreadPool pool(2, true);
+  sched::Scheduler s(get_time);
+  OffloadJob* off = new OffloadJob(s, pool, &blocking_fail);
+  sched::rJob job(off);
+  job->start_job();
+  run_until_done(s, *off, 0);
+  BOOST_CHECK(off->failed);
+  s.killall_jobs();
+  while (s.work() != sched::SCHED_EXIT)
+    continue;
+}
+
+// With a hook, the completion wakes the host loop up right away.
+static void
+test_hook()
+{
+  libport::ThreadPool pool(2);
+  // Outlives the scheduler, which drops the hook.
+  libport::Semaphore wake;
+  sched::Scheduler s(get_time);
+  s.offload_hook_set(boost::bind(&libport::Semaphore::operator++, &wake));
+  OffloadJob* off = new OffloadJob(s, pool, boost::bind(&blocking_square, 3));
+  sched::rJob job(off);
+  job->start_job();
+  s.work();
+  s.work();
+  // Nothing else to do: the scheduler does not ask to be polled.
+  BOOST_CHECK_LT(libport::utime() + 1000000, s.work());
+  libport::utime_t start = libport::utime();
+  run_until_done(s, *off, &wake);
+  BOOST_CHECK_LT(libport::utime() - start, 1000000);
+  BOOST_CHECK_EQUAL(off->result, 9);
+  s.killall_jobs();
+  while (s.work() != sched::SCHED_EXIT)
+    continue;
+}
+
+// Jobs killed, and schedulers destroyed, before the task completes.
+static void
+test_interrupted()
+{
+  libport::ThreadPool pool(2);
+  {
+    sched::Scheduler s(get_time);
+    OffloadJob* off =
+      new OffloadJob(s, pool, boost::bind(&blocking_square, 2));
+    sched::rJob job(off);
+    job->start_job();
+    s.work();
+    s.work();
+    BOOST_CHECK_EQUAL(job->state_get(), sched::offloaded);
+    s.killall_jobs();
+    while (s.work() != sched::SCHED_EXIT)
+      continue;
+    BOOST_CHECK(job->terminated());
+    BOOST_CHECK(!off->done);
+  }
+  // Let the task complete.
+  usleep(300000);
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched::Job::offload");
+  suite->add(BOOST_TEST_CASE(test_result));
+  suite->add(BOOST_TEST_CASE(test_exception));
+  suite->add(BOOST_TEST_CASE(test_hook));
+  suite->add(BOOST_TEST_CASE(test_interrupted));
+  return suite;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <sstream>
+#include <string>
+
+#include <libport/format.hh>
+#include <libport/utime.hh>
+
+#include <sched/job.hh>
+#include <sched/profiler.hh>
+#include <sched/scheduler.hh>
+#include <tests/libport/test.hh>
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+static libport::utime_t
+get_time()
+{
+  return libport::utime();
+}
+
+/// A job which yields \a rounds times, spending about \a busy
+/// microseconds each time.
+class BusyJob: public sched::Job
+{
+public:
+  BusyJob(sched::Scheduler& s, const std::string& name,
+          unsigned rounds, libport::utime_t busy)
+    : sched::Job(s)
+    , name_(name)
+    , rounds_(rounds)
+    , busy_(busy)
+  {
+  }
+
+  const std::string& name_get() const
+  {
+    return name_;
+  }
+
+  virtual bool frozen() const
+  {
+    return false;
+  }
+
+  virtual size_t has_tag(const sched::Tag&, size_t) const
+  {
+    return false;
+  }
+
+  virtual sched::prio_type prio_get() const
+  {
+    return sched::UPRIO_DEFAULT;
+  }
+
+protected:
+  virtual void work()
+  {
+    for (unsigned i = 0; i < rounds_; ++i)
+    {
+      libport::utime_t end = libport::utime() + busy_;
+      while (libport::utime() < end)
+        continue;
+      yield();
+    }
+  }
+
+  virtual void scheduling_error(const std::string& msg)
+  {
+    BOOST_ERROR("scheduling error: " << msg);
+  }
+
+private:
+  std::string name_;
+  unsigned rounds_;
+  libport::utime_t busy_;
+};
+
+static std::string
+job_name(const sched::Job& job)
+{
+  return static_cast<const BusyJob&>(job).name_get();
+}
+
+static void
+run(sched::Scheduler& s)
+{
+  while (!s.jobs_get().empty())
+    s.work();
+  // Release the terminated jobs.
+  s.work();
+}
+
+// Jobs report how long they run and wait.
+static void
+profiles()
+{
+  sched::Profiler p;
+  p.namer_set(job_name);
+  sched::Scheduler s(get_time);
+  s.profiler_set(&p);
+  (new BusyJob(s, "idle", 10, 0))->start_job();
+  (new BusyJob(s, "busy", 10, 1000))->start_job();
+  run(s);
+
+  const sched::Profiler::profiles_type& profiles = p.profiles_get();
+  BOOST_REQUIRE_EQUAL(profiles.size(), 2u);
+  const sched::Profiler::Profile& idle = profiles[0];
+  const sched::Profiler::Profile& busy = profiles[1];
+  BOOST_CHECK_EQUAL(idle.name, "idle");
+  BOOST_CHECK(idle.terminated);
+  BOOST_CHECK(busy.terminated);
+  // The first run, then one per yield.
+  BOOST_CHECK_EQUAL(idle.run.n_samples(), 11u);
+  BOOST_CHECK_EQUAL(idle.delay.n_samples(), 10u);
+  BOOST_CHECK_LE(10000, busy.run.mean() * busy.run.n_samples());
+  // The idle job waits for the busy one.
+  BOOST_CHECK_LE(busy.run.mean(), idle.delay.mean() + 100);
+
+  // The busy job comes first.
+  std::ostringstream table;
+  p.dump(table);
+  BOOST_TEST_MESSAGE(table.str());
+  BOOST_CHECK_LT(table.str().find("busy"), table.str().find("idle"));
+  // The format of the stream is left as is.
+  table << 0.25;
+  BOOST_CHECK_EQUAL(table.str().substr(table.str().size() - 4), "0.25");
+
+  std::ostringstream trace;
+  p.trace_dump(trace);
+  BOOST_CHECK_EQUAL(trace.str().find("{\"traceEvents\":["), 0u);
+  BOOST_CHECK_NE(trace.str().find("\"args\":{\"name\":\"busy\"}"),
+                 std::string::npos);
+  BOOST_CHECK_NE(trace.str().find("\"ph\":\"X\""), std::string::npos);
+
+  p.clear();
+  BOOST_CHECK(p.profiles_get().empty());
+}
+
+/// Time to run jobs yielding every \a busy microseconds.
+static libport::utime_t
+yielders(sched::Profiler* p, libport::utime_t busy, unsigned rounds)
+{
+  sched::Scheduler s(get_time);
+  s.profiler_set(p);
+  for (unsigned i = 0; i < 10; ++i)
+    (new BusyJob(s, "yielder", rounds, busy))->start_job();
+  libport::utime_t start = libport::utime();
+  run(s);
+  return libport::utime() - start;
+}
+
+// Cost of the profiler on jobs which do nothing but switching, and on
+// jobs which run 10us between switches.
+static void
+overhead()
+{
+  sched::Profiler p;
+  p.max_slices_set(0);
+  const unsigned rounds = 20000;
+  libport::utime_t without = yielders(0, 0, rounds);
+  libport::utime_t with = yielders(&p, 0, rounds);
+  BOOST_TEST_MESSAGE(libport::format("profiler cost per switch: %sns",
+                                     (with - without) * 1000
+                                     / (10 * rounds)));
+  p.clear();
+  without = yielders(0, 10, rounds / 10);
+  with = yielders(&p, 10, rounds / 10);
+  BOOST_TEST_MESSAGE(libport::format("profiler overhead for 10us slices:"
+                                     " %.1f%%",
+                                     100.0 * (with - without) / without));
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched profiler");
+  suite->add(BOOST_TEST_CASE(profiles));
+  suite->add(BOOST_TEST_CASE(overhead));
+  return suite;
+}
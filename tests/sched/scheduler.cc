@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <string>
+
+#include <libport/bind.hh>
+#include <libport/utime.hh>
+
+#include <sched/job.hh>
+#include <sched/scheduler.hh>
+#include <sched/tag.hh>
+#include <tests/libport/test.hh>
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+static libport::utime_t now = 0;
+
+static libport::utime_t
+get_time()
+{
+  return now;
+}
+
+// The trace of the executed jobs.
+static std::string trace;
+
+class TestJob: public sched::Job
+{
+public:
+  TestJob(sched::Scheduler& s, char name, unsigned rounds)
+    : sched::Job(s)
+    , name_(name)
+    , rounds_(rounds)
+    , spawn_(0)
+    , delay_(0)
+    , notifier_(0)
+    , prio_(sched::UPRIO_DEFAULT)
+  {
+    ++alive;
+  }
+
+  TestJob(const TestJob& model, char name, unsigned rounds)
+    : sched::Job(model)
+    , name_(name)
+    , rounds_(rounds)
+    , spawn_(0)
+    , delay_(0)
+    , notifier_(0)
+    , prio_(sched::UPRIO_DEFAULT)
+  {
+    ++alive;
+  }
+
+  ~TestJob()
+  {
+    --alive;
+  }
+
+  /// Spawn two children named \a name and \a name + 1 on first run.
+  void spawn_set(char name)
+  {
+    spawn_ = name;
+  }
+
+  /// Sleep for \a delay instead of yielding.
+  void delay_set(libport::utime_t delay)
+  {
+    delay_ = delay;
+  }
+
+  /// Wait for \a notifier instead of yielding.
+  void notifier_set(sched::Notifier& notifier)
+  {
+    notifier_ = &notifier;
+  }
+
+  void tag_set(sched::rTag tag)
+  {
+    if (tag_)
+      tag_released(*tag_);
+    tag_ = tag;
+    if (tag_)
+      tag_acquired(*tag_);
+  }
+
+  void prio_set(sched::prio_type prio)
+  {
+    prio_ = prio;
+  }
+
+  virtual bool frozen() const
+  {
+    return tag_ && tag_->frozen();
+  }
+
+  virtual size_t has_tag(const sched::Tag& tag, size_t) const
+  {
+    return tag_ == &tag;
+  }
+
+  virtual sched::prio_type prio_get() const
+  {
+    return prio_;
+  }
+
+  static unsigned alive;
+
+protected:
+  virtual void work()
+  {
+    for (unsigned i = 0; i < rounds_; ++i)
+    {
+      trace += name_;
+      if (!i && spawn_)
+        for (char c = spawn_; c < spawn_ + 2; ++c)
+          (new TestJob(*this, c, 1))->start_job();
+      if (delay_)
+        yield_for(delay_);
+      else if (notifier_)
+        yield_until_notified(*notifier_);
+      else
+        yield();
+    }
+  }
+
+  virtual void scheduling_error(const std::string& msg)
+  {
+    BOOST_ERROR("scheduling error: " << msg);
+  }
+
+private:
+  char name_;
+  unsigned rounds_;
+  char spawn_;
+  libport::utime_t delay_;
+  sched::Notifier* notifier_;
+  sched::rTag tag_;
+  sched::prio_type prio_;
+};
+
+unsigned TestJob::alive = 0;
+
+// Run rounds until there is nothing left to do.
+static void
+run(sched::Scheduler& s, unsigned max_rounds = 100)
+{
+  for (unsigned i = 0; i < max_rounds && !s.jobs_get().empty(); ++i)
+    s.work();
+}
+
+static void
+round_robin()
+{
+  trace.clear();
+  {
+    sched::Scheduler s(get_time);
+    (new TestJob(s, 'a', 3))->start_job();
+    (new TestJob(s, 'b', 2))->start_job();
+    (new TestJob(s, 'c', 1))->start_job();
+    BOOST_CHECK_EQUAL(s.jobs_get().size(), 3u);
+    run(s);
+    BOOST_CHECK_EQUAL(trace, "abcaba");
+    BOOST_CHECK(s.jobs_get().empty());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// With real-time behavior, jobs run by decreasing priority, and in
+// order for a given priority.  Real-time jobs do not yield.
+static void
+priorities()
+{
+  trace.clear();
+  {
+    sched::Scheduler s(get_time);
+    s.real_time_behavior_set();
+    const char names[] = "abcd";
+    const sched::prio_type prios[] =
+      { sched::UPRIO_DEFAULT, sched::UPRIO_NONE, sched::UPRIO_DEFAULT,
+        sched::UPRIO_RT_MIN };
+    for (unsigned i = 0; i < 4; ++i)
+    {
+      TestJob* job = new TestJob(s, names[i], 2);
+      job->prio_set(prios[i]);
+      job->start_job();
+    }
+    run(s);
+    BOOST_CHECK_EQUAL(trace, "ddacbacb");
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// Jobs created during a round run right after their creator, in
+// creation order.
+static void
+created_jobs()
+{
+  trace.clear();
+  {
+    sched::Scheduler s(get_time);
+    sched::rJob a = new TestJob(s, 'a', 2);
+    static_cast<TestJob*>(a.get())->spawn_set('x');
+    a->start_job();
+    (new TestJob(s, 'b', 2))->start_job();
+    run(s);
+    BOOST_CHECK_EQUAL(trace, "axybab");
+    BOOST_CHECK(a->terminated());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// Sleeping jobs are not considered before their deadline.
+static void
+sleepers()
+{
+  trace.clear();
+  now = 0;
+  {
+    sched::Scheduler s(get_time);
+    TestJob* a = new TestJob(s, 'a', 2);
+    a->delay_set(100);
+    a->start_job();
+    (new TestJob(s, 'b', 2))->start_job();
+    BOOST_CHECK_EQUAL(s.work(), sched::SCHED_IMMEDIATE);
+    BOOST_CHECK_EQUAL(s.work(), sched::SCHED_IMMEDIATE);
+    BOOST_CHECK_EQUAL(s.work(), 100);
+    BOOST_CHECK_EQUAL(trace, "abb");
+    now = 99;
+    BOOST_CHECK_EQUAL(s.work(), 100);
+    BOOST_CHECK_EQUAL(trace, "abb");
+    now = 100;
+    BOOST_CHECK_EQUAL(s.work(), 200);
+    BOOST_CHECK_EQUAL(trace, "abba");
+    BOOST_CHECK_EQUAL(s.jobs_get().size(), 1u);
+
+    // An exception wakes the job up before its deadline.
+    s.jobs_get().front()->terminate_now();
+    run(s);
+    BOOST_CHECK(s.jobs_get().empty());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// The time spent frozen is not taken into account.
+static void
+frozen_sleepers()
+{
+  trace.clear();
+  now = 0;
+  {
+    sched::Scheduler s(get_time);
+    sched::rTag tag = new sched::Tag;
+    TestJob* a = new TestJob(s, 'a', 1);
+    a->delay_set(100);
+    a->tag_set(tag);
+    a->start_job();
+    BOOST_CHECK_EQUAL(s.work(), sched::SCHED_IMMEDIATE);
+    BOOST_CHECK_EQUAL(s.work(), 100);
+    now = 50;
+    tag->freeze(s);
+    s.work();
+    now = 80;
+    tag->unfreeze(s);
+    BOOST_CHECK_EQUAL(s.work(), 130);
+    now = 100;
+    BOOST_CHECK_EQUAL(s.work(), 130);
+    BOOST_CHECK_EQUAL(s.jobs_get().size(), 1u);
+    now = 130;
+    run(s);
+    BOOST_CHECK(s.jobs_get().empty());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// Waiting jobs are not resumed until they are notified.
+static void
+notified_waiters()
+{
+  trace.clear();
+  {
+    sched::Scheduler s(get_time);
+    sched::Notifier n;
+    TestJob* a = new TestJob(s, 'a', 2);
+    a->notifier_set(n);
+    a->start_job();
+    (new TestJob(s, 'b', 3))->start_job();
+    s.work();
+    s.work();
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "abbb");
+    BOOST_CHECK(n.has_waiters());
+    n.notify_one();
+    BOOST_CHECK(!n.has_waiters());
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "abbba");
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "abbba");
+    BOOST_CHECK_EQUAL(s.jobs_get().size(), 1u);
+    n.notify_all();
+    run(s);
+    BOOST_CHECK(s.jobs_get().empty());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// In compatibility mode, waiting jobs are resumed at every round.
+static void
+polled_waiters()
+{
+  trace.clear();
+  {
+    sched::Scheduler s(get_time);
+    s.poll_waiting_jobs_set(true);
+    sched::Notifier n;
+    TestJob* a = new TestJob(s, 'a', 3);
+    a->notifier_set(n);
+    a->start_job();
+    (new TestJob(s, 'b', 3))->start_job();
+    run(s);
+    BOOST_CHECK_EQUAL(trace, "ababab");
+    BOOST_CHECK(!n.has_waiters());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// Jobs can wait for a tag to be unfrozen.
+static void
+unfreeze_waiters()
+{
+  trace.clear();
+  {
+    sched::Scheduler s(get_time);
+    sched::rTag tag = new sched::Tag;
+    tag->freeze(s);
+    TestJob* a = new TestJob(s, 'a', 2);
+    a->notifier_set(tag->unfreeze_notifier_get());
+    a->start_job();
+    s.work();
+    s.work();
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "a");
+    tag->unfreeze(s);
+    run(s);
+    BOOST_CHECK_EQUAL(trace, "aa");
+    BOOST_CHECK_EQUAL(s.jobs_get().size(), 1u);
+    tag->freeze(s);
+    tag->unfreeze(s);
+    run(s);
+    BOOST_CHECK(s.jobs_get().empty());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+// Tag actions only reach the jobs which reported holding the tag.
+static void
+indexed_tags()
+{
+  trace.clear();
+  now = 0;
+  {
+    sched::Scheduler s(get_time);
+    s.indexed_tags_set(true);
+    sched::rTag tag = new sched::Tag;
+    TestJob* a = new TestJob(s, 'a', 3);
+    a->delay_set(100);
+    a->tag_set(tag);
+    a->start_job();
+    TestJob* b = new TestJob(s, 'b', 3);
+    b->delay_set(100);
+    b->start_job();
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "ab");
+
+    // Only a notices the freeze, and its deadline is postponed.
+    sched::jobs_type holders;
+    tag->holders_get(holders);
+    BOOST_CHECK_EQUAL(holders.size(), 1u);
+    now = 50;
+    tag->freeze(s);
+    s.work();
+    now = 80;
+    tag->unfreeze(s);
+    BOOST_CHECK_EQUAL(s.work(), 100);
+    now = 100;
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "abb");
+
+    // Only a is stopped.
+    tag->stop(s, boost::any());
+    s.work();
+    BOOST_CHECK_EQUAL(s.jobs_get().size(), 1u);
+    now = 200;
+    s.work();
+    BOOST_CHECK_EQUAL(trace, "abbb");
+    now = 300;
+    run(s);
+    BOOST_CHECK(s.jobs_get().empty());
+
+    // Terminated jobs are no longer indexed.
+    holders.clear();
+    tag->holders_get(holders);
+    BOOST_CHECK(holders.empty());
+  }
+  BOOST_CHECK_EQUAL(TestJob::alive, 0u);
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched::Scheduler");
+  suite->add(BOOST_TEST_CASE(round_robin));
+  suite->add(BOOST_TEST_CASE(priorities));
+  suite->add(BOOST_TEST_CASE(created_jobs));
+  suite->add(BOOST_TEST_CASE(sleepers));
+  suite->add(BOOST_TEST_CASE(frozen_sleepers));
+  suite->add(BOOST_TEST_CASE(notified_waiters));
+  suite->add(BOOST_TEST_CASE(polled_waiters));
+  suite->add(BOOST_TEST_CASE(unfreeze_waiters));
+  suite->add(BOOST_TEST_CASE(indexed_tags));
+  return suite;
+}
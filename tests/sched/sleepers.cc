@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/**
+ ** Bench the cost of a scheduler round against the number of sleeping
+ ** jobs.
+ */
+
+#include <libport/foreach.hh>
+#include <libport/statistics.hh>
+#include <libport/utime.hh>
+
+#include <sched/job.hh>
+#include <sched/scheduler.hh>
+#include <tests/libport/test.hh>
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+/// A job which either yields or sleeps for \a delay forever.
+class LoopJob: public sched::Job
+{
+public:
+  LoopJob(sched::Scheduler& s, libport::utime_t delay)
+    : sched::Job(s)
+    , delay_(delay)
+  {
+    ++alive;
+  }
+
+  ~LoopJob()
+  {
+    --alive;
+  }
+
+  virtual bool frozen() const
+  {
+    return false;
+  }
+
+  virtual size_t has_tag(const sched::Tag&, size_t) const
+  {
+    return 0;
+  }
+
+  virtual sched::prio_type prio_get() const
+  {
+    return sched::UPRIO_DEFAULT;
+  }
+
+  static unsigned alive;
+  static unsigned long resumed;
+
+protected:
+  virtual void work()
+  {
+    while (true)
+    {
+      ++resumed;
+      if (delay_)
+        yield_for(delay_);
+      else
+        yield();
+    }
+  }
+
+  virtual void scheduling_error(const std::string& msg)
+  {
+    BOOST_ERROR("scheduling error: " << msg);
+  }
+
+private:
+  libport::utime_t delay_;
+};
+
+unsigned LoopJob::alive = 0;
+unsigned long LoopJob::resumed = 0;
+
+static libport::utime_t
+get_time()
+{
+  return libport::utime();
+}
+
+static const unsigned runnable = 10;
+static const unsigned rounds = 1000;
+
+/// Return the mean duration of a round, in microseconds.
+static libport::ufloat
+bench(unsigned sleepers)
+{
+  sched::Scheduler s(get_time);
+  for (unsigned i = 0; i < sleepers; ++i)
+    (new LoopJob(s, 3600000000LL))->start_job();
+  for (unsigned i = 0; i < runnable; ++i)
+    (new LoopJob(s, 0))->start_job();
+
+  // Start everybody.
+  s.work();
+  s.work();
+
+  libport::Statistics<libport::utime_t, libport::ufloat> stats;
+  LoopJob::resumed = 0;
+  for (unsigned i = 0; i < rounds; ++i)
+  {
+    libport::utime_t start = libport::utime();
+    s.work();
+    stats.add_sample(libport::utime() - start);
+  }
+  // Only the runnable jobs were resumed.
+  BOOST_CHECK_EQUAL(LoopJob::resumed, runnable * rounds);
+
+  foreach (const sched::rJob& job, s.jobs_get())
+    job->terminate_now();
+  while (!s.jobs_get().empty())
+    s.work();
+  return stats.mean();
+}
+
+static void
+round_cost()
+{
+  static const unsigned sleepers[] = { 0, 100, 1000, 10000 };
+  foreach (unsigned n, sleepers)
+  {
+    BOOST_TEST_MESSAGE(libport::format("%6s sleepers, %s runnable: "
+                                       "%sus per round",
+                                       n, runnable, bench(n)));
+    BOOST_CHECK_EQUAL(LoopJob::alive, 0u);
+  }
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched::Scheduler sleepers");
+  suite->add(BOOST_TEST_CASE(round_cost));
+  return suite;
+}
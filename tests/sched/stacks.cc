@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <csignal>
+#include <cstring>
+#include <string>
+
+#include <sys/mman.h>
+
+#include <libport/sys/wait.h>
+#include <libport/unistd.h>
+
+#include <sched/job.hh>
+#include <sched/scheduler.hh>
+#include <tests/libport/test.hh>
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+#ifdef CORO_USE_MMAP
+
+static libport::utime_t
+get_time()
+{
+  return 0;
+}
+
+// The stack of the last job run.
+static void* stack = 0;
+
+/// A job which records its stack, and uses \a depth bytes of it.
+class StackJob: public sched::Job
+{
+public:
+  StackJob(sched::Scheduler& s, size_t depth = 0)
+    : sched::Job(s)
+    , depth_(depth)
+  {
+  }
+
+  static const size_t overflow = size_t(-1);
+
+  virtual bool frozen() const
+  {
+    return false;
+  }
+
+  virtual size_t has_tag(const sched::Tag&, size_t) const
+  {
+    return false;
+  }
+
+  virtual sched::prio_type prio_get() const
+  {
+    return sched::UPRIO_DEFAULT;
+  }
+
+protected:
+  virtual void work()
+  {
+    stack = Coro_stack(coro_get());
+    if (depth_)
+    {
+      volatile char c = 0;
+      use(&c, depth_);
+    }
+  }
+
+  virtual void scheduling_error(const std::string& msg)
+  {
+    BOOST_ERROR("scheduling error: " << msg);
+  }
+
+private:
+  static unsigned use(volatile char* p, size_t depth)
+  {
+    volatile char buf[1024];
+    buf[0] = *p;
+    if (depth <= sizeof buf)
+      return buf[0];
+    return use(buf, depth - sizeof buf) + buf[0];
+  }
+
+  size_t depth_;
+};
+
+// The stack of a terminated job is given to the next one.
+static void
+recycled_stacks()
+{
+  BOOST_CHECK_LT(0u, Coro_stackPoolSize());
+  sched::Scheduler s(get_time);
+  (new StackJob(s))->start_job();
+  s.work();
+  void* first = stack;
+  BOOST_CHECK(first);
+  // Release the terminated job.
+  s.work();
+  (new StackJob(s))->start_job();
+  s.work();
+  BOOST_CHECK_EQUAL(stack, first);
+  s.work();
+
+  // Without a pool, a new stack is mapped.
+  size_t size = Coro_stackPoolSize();
+  Coro_setStackPoolSize(0);
+  (new StackJob(s))->start_job();
+  s.work();
+  s.work();
+  Coro_setStackPoolSize(size);
+}
+
+// A stack overflow faults, and is reported.
+static void
+overflow()
+{
+  int fds[2];
+  BOOST_REQUIRE(!pipe(fds));
+  pid_t pid = fork();
+  BOOST_REQUIRE_LE(0, pid);
+  if (!pid)
+  {
+    dup2(fds[1], STDERR_FILENO);
+    sched::Scheduler s(get_time);
+    (new StackJob(s, StackJob::overflow))->start_job();
+    s.work();
+    _exit(0);
+  }
+  close(fds[1]);
+  std::string err;
+  char buf[1024];
+  for (ssize_t n; 0 < (n = read(fds[0], buf, sizeof buf)); )
+    err.append(buf, n);
+  close(fds[0]);
+  int status;
+  BOOST_REQUIRE_EQUAL(waitpid(pid, &status, 0), pid);
+  BOOST_CHECK(WIFSIGNALED(status));
+  BOOST_CHECK_EQUAL(WTERMSIG(status), SIGSEGV);
+  BOOST_CHECK_MESSAGE(err.find("sched: stack overflow in Job(")
+                      != std::string::npos,
+                      err);
+}
+
+// Faults elsewhere go to the previous handler, which stays chained.
+static char* page = 0;
+static int faults = 0;
+
+static void
+unprotect(int, siginfo_t* info, void*)
+{
+  if (info->si_addr == page)
+  {
+    ++faults;
+    mprotect(page, getpagesize(), PROT_READ | PROT_WRITE);
+  }
+}
+
+static void
+chained_handler()
+{
+  pid_t pid = fork();
+  BOOST_REQUIRE_LE(0, pid);
+  if (!pid)
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_sigaction = unprotect;
+    action.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &action, 0);
+    page = static_cast<char*>(mmap(0, getpagesize(), PROT_NONE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    sched::Scheduler s(get_time);
+    for (int i = 0; i < 2; ++i)
+    {
+      mprotect(page, getpagesize(), PROT_NONE);
+      *(volatile char*)page = 1;
+    }
+    // Ours is still installed.
+    sigaction(SIGSEGV, 0, &action);
+    _exit(action.sa_sigaction == unprotect ? 0 : faults);
+  }
+  int status;
+  BOOST_REQUIRE_EQUAL(waitpid(pid, &status, 0), pid);
+  BOOST_REQUIRE(WIFEXITED(status));
+  BOOST_CHECK_EQUAL(WEXITSTATUS(status), 2);
+}
+
+// Jobs report how deep their stack went.
+static void
+high_water_mark()
+{
+  sched::Scheduler s(get_time);
+  sched::rJob job = new StackJob(s, 64 * 1024);
+  job->start_job();
+  s.work();
+  BOOST_CHECK(job->terminated());
+  const sched::Job::stats_type::size_stat_type& stack =
+    job->stats_get().job.stack;
+  BOOST_CHECK_EQUAL(stack.n_samples(), 1u);
+  BOOST_CHECK_LE(64u * 1024, stack.max());
+  BOOST_CHECK_LT(stack.max(), 96u * 1024);
+  job = 0;
+  s.work();
+}
+
+// Stacks committed partially grow on demand.
+static void
+growable_stacks()
+{
+  size_t initial = sched::configuration.initial_stack_size;
+  sched::configuration.initial_stack_size = 16 * 1024;
+  sched::Scheduler s(get_time);
+
+  // Shallow jobs only commit the top of their stack.
+  sched::rJob job = new StackJob(s, 32 * 1024);
+  job->start_job();
+  s.work();
+  BOOST_CHECK(job->terminated());
+  Coro* coro = job->coro_get();
+  BOOST_CHECK_LE(32u * 1024, coro->committedStackSize);
+  BOOST_CHECK_LT(coro->committedStackSize, coro->allocatedStackSize);
+
+  // Deep ones grow up to the whole stack.
+  size_t size = coroutine_stack_size(coro);
+  job = new StackJob(s, size - 64 * 1024);
+  job->start_job();
+  s.work();
+  BOOST_CHECK(job->terminated());
+  BOOST_CHECK_LE(size - 64 * 1024, job->stats_get().job.stack.max());
+  job = 0;
+  s.work();
+  sched::configuration.initial_stack_size = initial;
+}
+
+// The coroutines of one_page_stacks.
+static Coro* main_coro;
+static Coro* one_page_coro;
+
+static void
+back_to_main(void*)
+{
+  Coro_switchTo_(one_page_coro, main_coro);
+}
+
+// Committing a single page, while the mapping is more than a page
+// larger than the requested size: the first frame must be built in the
+// committed part, not by a fault that nobody would handle here.
+static void
+one_page_stacks()
+{
+  size_t page = getpagesize();
+  main_coro = Coro_new();
+  Coro_initializeMainCoro(main_coro);
+  one_page_coro = Coro_new();
+  Coro_setStackSize_(one_page_coro, 16 * page);
+  Coro_setStackCommitSize_(one_page_coro, page);
+  Coro_startCoro_(main_coro, one_page_coro, 0, &back_to_main);
+  BOOST_CHECK_LT(16 * page, one_page_coro->allocatedStackSize);
+  BOOST_CHECK_EQUAL(one_page_coro->committedStackSize, page);
+  Coro_free(one_page_coro);
+  Coro_free(main_coro);
+}
+
+#endif
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched job stacks");
+#ifdef CORO_USE_MMAP
+  suite->add(BOOST_TEST_CASE(recycled_stacks));
+  suite->add(BOOST_TEST_CASE(overflow));
+  suite->add(BOOST_TEST_CASE(chained_handler));
+  suite->add(BOOST_TEST_CASE(high_water_mark));
+  suite->add(BOOST_TEST_CASE(growable_stacks));
+  suite->add(BOOST_TEST_CASE(one_page_stacks));
+#endif
+  return suite;
+}
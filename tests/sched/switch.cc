@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+/// Cost of a context switch, with the coroutine backend libsched was
+/// configured with, and with the mechanisms of the other backends
+/// available here.  Configure libsched with each backend to compare
+/// them all.
+
+#include <libport/format.hh>
+#include <libport/pthread.h>
+#include <libport/semaphore.hh>
+#include <libport/utime.hh>
+
+#include <sched/coroutine.hh>
+#include <tests/libport/test.hh>
+
+#if defined __linux__ && !defined LIBPORT_SCHED_CORO_OSTHREAD
+# include <ucontext.h>
+# define HAVE_UCONTEXT 1
+#endif
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+/// Round trips per measure.
+static const unsigned rounds = 100000;
+
+static void
+report(const char* backend, libport::utime_t duration)
+{
+  BOOST_TEST_MESSAGE(libport::format("%-20s %10.0f switches/s",
+                                     backend,
+                                     2 * rounds * 1e6 / (duration + 1)));
+}
+
+/*------------------.
+| sched coroutines. |
+`------------------*/
+
+static Coro* main_coro;
+static Coro* peer_coro;
+static unsigned peer_switches;
+
+static void
+peer(void*)
+{
+  while (true)
+  {
+    ++peer_switches;
+    coroutine_switch_to(peer_coro, main_coro);
+  }
+}
+
+static void
+coroutines()
+{
+#if defined LIBPORT_SCHED_CORO_OSTHREAD
+  const char* backend = "pthread-coro";
+#elif defined SCHED_USE_BOOST_CORO
+  const char* backend = "boost fcontext";
+#else
+  const char* backend = "libcoroutine " CORO_IMPLEMENTATION;
+#endif
+  main_coro = coroutine_new();
+  coroutine_initialize_main(main_coro);
+  peer_coro = coroutine_new();
+  coroutine_start(main_coro, peer_coro, peer, (void*)0);
+
+  peer_switches = 0;
+  libport::utime_t start = libport::utime();
+  for (unsigned i = 0; i < rounds; ++i)
+    coroutine_switch_to(main_coro, peer_coro);
+  report(backend, libport::utime() - start);
+  BOOST_CHECK_EQUAL(peer_switches, rounds);
+  coroutine_free(peer_coro);
+}
+
+/*-----------.
+| ucontext.  |
+`-----------*/
+
+#ifdef HAVE_UCONTEXT
+static ucontext_t main_context;
+static ucontext_t peer_context;
+
+static void
+peer_ucontext()
+{
+  while (true)
+  {
+    ++peer_switches;
+    swapcontext(&peer_context, &main_context);
+  }
+}
+
+static void
+ucontexts()
+{
+  static char stack[64 * 1024];
+  getcontext(&peer_context);
+  peer_context.uc_stack.ss_sp = stack;
+  peer_context.uc_stack.ss_size = sizeof stack;
+  peer_context.uc_link = 0;
+  makecontext(&peer_context, peer_ucontext, 0);
+
+  peer_switches = 0;
+  libport::utime_t start = libport::utime();
+  for (unsigned i = 0; i < rounds; ++i)
+    swapcontext(&main_context, &peer_context);
+  report("ucontext", libport::utime() - start);
+  BOOST_CHECK_EQUAL(peer_switches, rounds);
+}
+#endif
+
+/*-----------------------------------------------.
+| Threads handing over, as pthread-coro does.    |
+`-----------------------------------------------*/
+
+static libport::Semaphore to_main;
+static libport::Semaphore to_peer;
+
+static void*
+peer_thread(void*)
+{
+  for (unsigned i = 0; i < rounds; ++i)
+  {
+    --to_peer;
+    ++peer_switches;
+    ++to_main;
+  }
+  return 0;
+}
+
+static void
+threads()
+{
+  peer_switches = 0;
+  pthread_t thread;
+  PTHREAD_RUN(pthread_create, &thread, 0, peer_thread, (void*)0);
+  libport::utime_t start = libport::utime();
+  for (unsigned i = 0; i < rounds; ++i)
+  {
+    ++to_peer;
+    --to_main;
+  }
+  report("threads", libport::utime() - start);
+  PTHREAD_RUN(pthread_join, thread, 0);
+  BOOST_CHECK_EQUAL(peer_switches, rounds);
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched context switches");
+  suite->add(BOOST_TEST_CASE(coroutines));
+#ifdef HAVE_UCONTEXT
+  suite->add(BOOST_TEST_CASE(ucontexts));
+#endif
+  suite->add(BOOST_TEST_CASE(threads));
+  return suite;
+}
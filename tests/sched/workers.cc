@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2012, Gostai S.A.S.
+ *
+ * This software is provided "as is" without warranty of any kind,
+ * either expressed or implied, including but not limited to the
+ * implied warranties of fitness for a particular purpose.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include <libport/unistd.h>
+#include <libport/utime.hh>
+
+#include <sched/job.hh>
+#include <sched/scheduler.hh>
+#include <sched/tag.hh>
+#include <sched/workers.hh>
+#include <tests/libport/test.hh>
+
+// For atomic increment
+#include <boost/interprocess/detail/atomic.hpp>
+
+#include <boost/version.hpp>
+namespace ipcdetail =
+#if BOOST_VERSION < 104800
+   boost::interprocess::detail;
+#else
+   boost::interprocess::ipcdetail;
+#endif
+
+using ipcdetail::atomic_dec32;
+using ipcdetail::atomic_inc32;
+using ipcdetail::atomic_read32;
+
+// Do not test coroutine with valgrind if it is not enabled.
+# include <libport/instrument.hh>
+INSTRUMENTFLAGS(--mode=none);
+
+using libport::test_suite;
+
+static libport::utime_t
+get_time()
+{
+  return libport::utime();
+}
+
+static volatile boost::uint32_t alive = 0;
+static volatile boost::uint32_t finished = 0;
+static volatile boost::uint32_t migrated = 0;
+static volatile boost::uint32_t iterations = 0;
+static volatile boost::uint32_t stopped = 0;
+
+/// A job which burns some CPU between yields, \a rounds times, or
+/// forever if 0.  It spawns \a spawn copies of itself on first run.
+class BusyJob: public sched::Job
+{
+public:
+  BusyJob(sched::Scheduler& s, unsigned rounds)
+    : sched::Job(s)
+    , rounds_(rounds)
+    , spawn_(0)
+    , tag_(0)
+  {
+    atomic_inc32(&alive);
+  }
+
+  BusyJob(const BusyJob& model)
+    : sched::Job(model)
+    , rounds_(model.rounds_)
+    , spawn_(0)
+    , tag_(model.tag_)
+  {
+    pinned_set(model.pinned_get());
+    atomic_inc32(&alive);
+  }
+
+  ~BusyJob()
+  {
+    atomic_dec32(&alive);
+  }
+
+  void spawn_set(unsigned spawn)
+  {
+    spawn_ = spawn;
+  }
+
+  void tag_set(const sched::Tag* tag)
+  {
+    tag_ = tag;
+  }
+
+  virtual bool frozen() const
+  {
+    return tag_ && tag_->frozen();
+  }
+
+  virtual size_t has_tag(const sched::Tag& tag, size_t) const
+  {
+    return tag_ == &tag;
+  }
+
+  virtual sched::prio_type prio_get() const
+  {
+    return sched::UPRIO_DEFAULT;
+  }
+
+protected:
+  virtual void work()
+  {
+    for (unsigned i = 0; i < spawn_; ++i)
+      (new BusyJob(*this))->start_job();
+    const sched::Scheduler* scheduler = &scheduler_get();
+    bool moved = false;
+    try
+    {
+      for (unsigned i = 0; !rounds_ || i < rounds_; ++i)
+      {
+        libport::utime_t end = libport::utime() + 20;
+        while (libport::utime() < end)
+          continue;
+        atomic_inc32(&iterations);
+        yield();
+        moved = moved || &scheduler_get() != scheduler;
+      }
+    }
+    catch (const sched::StopException&)
+    {
+      atomic_inc32(&stopped);
+      throw;
+    }
+    if (moved)
+      atomic_inc32(&migrated);
+    atomic_inc32(&finished);
+  }
+
+  virtual void scheduling_error(const std::string& msg)
+  {
+    BOOST_ERROR("scheduling error: " << msg);
+  }
+
+private:
+  unsigned rounds_;
+  unsigned spawn_;
+  const sched::Tag* tag_;
+};
+
+static void
+reset()
+{
+  alive = finished = migrated = iterations = stopped = 0;
+}
+
+// Wait up to 10s for \a n jobs to finish.
+static void
+wait_finished(boost::uint32_t n)
+{
+  for (unsigned i = 0; i < 1000 && atomic_read32(&finished) < n; ++i)
+    usleep(10000);
+  BOOST_CHECK_EQUAL(atomic_read32(&finished), n);
+}
+
+static void
+steal(bool pinned)
+{
+  reset();
+  {
+    sched::Workers w(get_time, 4);
+    BOOST_CHECK_EQUAL(w.size(), 4u);
+    BusyJob* spawner = new BusyJob(w.scheduler_get(), 200);
+    spawner->spawn_set(31);
+    spawner->pinned_set(pinned);
+    w.start_job(spawner);
+    wait_finished(32);
+    if (pinned)
+      BOOST_CHECK_EQUAL(atomic_read32(&migrated), 0u);
+    else
+      BOOST_CHECK_LT(0u, atomic_read32(&migrated));
+  }
+  BOOST_CHECK_EQUAL(atomic_read32(&alive), 0u);
+}
+
+// Idle workers steal jobs from busy ones.
+static void
+steal_jobs()
+{
+  steal(false);
+}
+
+// Pinned jobs stay on their worker.
+static void
+pinned_jobs()
+{
+  steal(true);
+}
+
+// Tag operations apply to the jobs of every worker.
+static void
+tags()
+{
+  reset();
+  sched::rTag tag = new sched::Tag;
+  {
+    sched::Workers w(get_time, 4);
+    for (unsigned i = 0; i < 8; ++i)
+    {
+      BusyJob* job = new BusyJob(w.scheduler_get(i % 4), 0);
+      job->tag_set(tag.get());
+      w.start_job(job);
+    }
+    usleep(50000);
+    BOOST_CHECK_LT(0u, atomic_read32(&iterations));
+
+    w.freeze(*tag);
+    boost::uint32_t frozen = atomic_read32(&iterations);
+    usleep(50000);
+    BOOST_CHECK_EQUAL(atomic_read32(&iterations), frozen);
+
+    w.unfreeze(*tag);
+    usleep(50000);
+    BOOST_CHECK_LT(frozen, atomic_read32(&iterations));
+
+    w.stop(*tag, boost::any());
+    for (unsigned i = 0; i < 1000 && atomic_read32(&stopped) < 8; ++i)
+      usleep(10000);
+    BOOST_CHECK_EQUAL(atomic_read32(&stopped), 8u);
+    BOOST_CHECK_EQUAL(atomic_read32(&finished), 0u);
+  }
+  BOOST_CHECK_EQUAL(atomic_read32(&alive), 0u);
+}
+
+test_suite*
+init_test_suite()
+{
+  test_suite* suite = BOOST_TEST_SUITE("sched::Workers");
+  suite->add(BOOST_TEST_CASE(steal_jobs));
+  suite->add(BOOST_TEST_CASE(pinned_jobs));
+  suite->add(BOOST_TEST_CASE(tags));
+  return suite;
+}